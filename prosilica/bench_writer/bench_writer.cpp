@@ -0,0 +1,225 @@
+/* Measures the write stalls a capture would see on a card.
+ *
+ * Writes a synthetic raw recording the way snap_image does: a time block and
+ * an image per frame, paced at the frame rate if one is given. Each frame's
+ * writes are timed, since that is how long a frame callback is held up. The
+ * stdio path is snap_image's default (fwrite per record, everything left
+ * flushed at fclose, plus an fdatasync here so both runs end with the data
+ * on the card); the aligned path is aligned_writer.h as used by
+ * snap_image -w. With both, the stdio run comes first and each file is
+ * deleted after its run, so both see the same card in the same state.
+ */
+
+// includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+#include <algorithm>
+#include <recording.h>
+#include <aligned_writer.h>
+
+// usage
+void ShowUsage()
+{
+  printf("usage: bench_writer -o file [-m stdio|aligned|both] [-n frames] [-s bytes] [-r fps] [-w MB[,MB]] [-k]\n");
+  printf("-m\twriter to measure (default both, stdio first)\n");
+  printf("-n\tframes to write (default 500)\n");
+  printf("-s\timage bytes per frame (default 2097152, a 1024x1024 Mono16 frame)\n");
+  printf("-r\tframe rate to pace the writes at (default: as fast as possible)\n");
+  printf("-w\taligned block size and MB between syncs (default 4,16)\n");
+  printf("-k\tkeep the file of the last run\n");
+}
+
+// one run's results
+typedef struct
+{
+  const char*         name;
+  std::vector<double> frameSeconds;   // time in the writes of each frame
+  double              closeSeconds;
+  double              totalSeconds;
+  unsigned long       late;           // frames whose writes outlasted the frame period
+  bool                ok;
+} tRun;
+
+// the (p*100)th percentile of sorted seconds, in ms
+double Percentile(const std::vector<double>& Sorted,double p)
+{
+  if(Sorted.empty())
+    return 0;
+  size_t i = (size_t)(p*(Sorted.size()-1)+0.5);
+  return Sorted[i]*1000;
+}
+
+// write the recording with stdio or the aligned writer
+void Run(tRun& R,bool Aligned,const char* Path,unsigned long Frames,size_t ImageSize,double Rate,
+         size_t BlockSize,uint64_t SyncBytes)
+{
+  R.name = Aligned ? "aligned" : "stdio";
+  R.frameSeconds.clear();
+  R.frameSeconds.reserve(Frames);
+  R.late = 0;
+  R.ok = true;
+
+  // a frame of noise, changed a little every frame
+  std::vector<uint8_t> image(ImageSize);
+  for(size_t i=0;i<ImageSize;i++)
+    image[i] = (uint8_t)(rand()>>7);
+
+  tRecordingHeader header;
+  memset(&header,0,sizeof(header));
+  header.width = 1024;
+  header.height = ImageSize/2048;
+  header.frameCount = Frames;
+  header.frameRate = Rate;
+  strcpy(header.pixelFormat,"Mono16");
+  uint32_t dropped = 0;
+
+  FILE* f = NULL;
+  tAlignedWriter W;
+  if(Aligned)
+    R.ok = AlignedOpen(W,Path,BlockSize,SyncBytes);
+  else
+    R.ok = (f = fopen(Path,"wb"))!=NULL;
+  if(!R.ok)
+  {
+    printf("%s: failed to create %s\n",R.name,Path);
+    if(Aligned)
+      AlignedClose(W);
+    return;
+  }
+  if(Aligned)
+    AlignedReserve(W,RECORDING_HEADER_SIZE+(uint64_t)Frames*(RECORDING_STAMP_SIZE+ImageSize)+RECORDING_TRAILER_SIZE);
+
+  struct timespec next;
+  clock_gettime(CLOCK_MONOTONIC,&next);
+  double period = Rate>0 ? 1/Rate : 0;
+  double start = AlignedNow();
+  if(Aligned)
+    AlignedWrite(W,&header,RECORDING_HEADER_SIZE);
+  else
+    fwrite(&header,1,RECORDING_HEADER_SIZE,f);
+
+  for(unsigned long i=0;i<Frames && R.ok;i++)
+  {
+    // wait for the frame's time, as the camera would
+    if(Rate>0)
+    {
+      long ns = next.tv_nsec + (long)(1e9/Rate);
+      next.tv_sec += ns/1000000000;
+      next.tv_nsec = ns%1000000000;
+      while(clock_nanosleep(CLOCK_MONOTONIC,TIMER_ABSTIME,&next,NULL)==EINTR)
+        ;
+    }
+
+    uint32_t stamp[4] = {(uint32_t)i,0,(uint32_t)i,0};
+    image[(i*4099)%ImageSize]++;
+    double t = AlignedNow();
+    if(Aligned)
+      R.ok = AlignedWrite(W,stamp,sizeof(stamp)) && AlignedWrite(W,&image[0],ImageSize);
+    else
+      R.ok = fwrite(stamp,1,sizeof(stamp),f)==sizeof(stamp) && fwrite(&image[0],1,ImageSize,f)==ImageSize;
+    t = AlignedNow()-t;
+    R.frameSeconds.push_back(t);
+    if(period>0 && t>period)
+      R.late++;
+  }
+
+  // the close is where stdio's one big flush lands
+  double t = AlignedNow();
+  if(Aligned)
+    R.ok = AlignedWrite(W,&dropped,RECORDING_TRAILER_SIZE) && AlignedClose(W) && R.ok;
+  else
+  {
+    R.ok = fwrite(&dropped,1,RECORDING_TRAILER_SIZE,f)==RECORDING_TRAILER_SIZE && R.ok;
+    R.ok = fflush(f)==0 && fdatasync(fileno(f))==0 && R.ok;
+    R.ok = fclose(f)==0 && R.ok;
+  }
+  R.closeSeconds = AlignedNow()-t;
+  R.totalSeconds = AlignedNow()-start;
+  if(!R.ok)
+    printf("%s: writing %s failed: %s\n",R.name,Path,Aligned ? W.error : strerror(errno));
+  else if(Aligned && !W.direct)
+    printf("aligned: %s does not take O_DIRECT, writes went through the page cache\n",Path);
+}
+
+// main
+int main(int argc, char* argv[])
+{
+  int c;
+  const char* path = NULL;
+  const char* mode = "both";
+  unsigned long frames = 500;
+  size_t imageSize = 2097152;
+  double rate = 0;
+  unsigned int blockMB = 4, syncMB = 16;
+  bool keep = false;
+
+  while ((c = getopt (argc, argv, "o:m:n:s:r:w:k")) != -1)
+  {
+    switch(c)
+    {
+      case 'o':
+        path = optarg;
+        break;
+      case 'm':
+        mode = optarg;
+        break;
+      case 'n':
+        frames = strtoul(optarg,NULL,10);
+        break;
+      case 's':
+        imageSize = strtoul(optarg,NULL,10);
+        break;
+      case 'r':
+        rate = atof(optarg);
+        break;
+      case 'w':
+        sscanf(optarg,"%u,%u",&blockMB,&syncMB);
+        break;
+      case 'k':
+        keep = true;
+        break;
+    }
+  }
+
+  bool both = strcmp(mode,"both")==0;
+  if(!path || frames==0 || imageSize==0 || blockMB==0 ||
+     (!both && strcmp(mode,"stdio")!=0 && strcmp(mode,"aligned")!=0))
+  {
+    ShowUsage();
+    return 1;
+  }
+
+  std::vector<tRun> runs(both ? 2 : 1);
+  for(size_t r=0;r<runs.size();r++)
+  {
+    bool aligned = both ? r==1 : strcmp(mode,"aligned")==0;
+    Run(runs[r],aligned,path,frames,imageSize,rate,(size_t)blockMB<<20,(uint64_t)syncMB<<20);
+    if(!keep || r+1<runs.size())
+      unlink(path);
+  }
+
+  // per-frame stall distribution
+  double mb = (RECORDING_HEADER_SIZE+frames*(RECORDING_STAMP_SIZE+(double)imageSize))/1e6;
+  printf("%lu frames of %lu bytes (%.1f MB)",frames,(unsigned long)imageSize,mb);
+  if(rate>0)
+    printf(" at %.1f fps (%.1f ms per frame)",rate,1000/rate);
+  printf("\n");
+  printf("writer      p50 ms    p99 ms  p99.9 ms    max ms  close ms   late    MB/s\n");
+  bool ok = true;
+  for(size_t r=0;r<runs.size();r++)
+  {
+    tRun& R = runs[r];
+    std::vector<double> sorted(R.frameSeconds);
+    std::sort(sorted.begin(),sorted.end());
+    printf("%-8s %9.2f %9.2f %9.2f %9.2f %9.1f %6lu %7.1f\n",R.name,Percentile(sorted,0.5),
+           Percentile(sorted,0.99),Percentile(sorted,0.999),sorted.empty() ? 0 : sorted.back()*1000,
+           R.closeSeconds*1000,R.late,R.totalSeconds>0 ? mb/R.totalSeconds : 0);
+    ok = ok && R.ok;
+  }
+  return ok ? 0 : 1;
+}
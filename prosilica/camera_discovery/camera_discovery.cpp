@@ -0,0 +1,588 @@
+/* Keeps a registry of the cameras on the network and serves it as JSON.
+ *
+ * PvAPI reports cameras through link callbacks as they appear and vanish;
+ * each event updates one registry entry (camera info, IP settings, access
+ * state) instead of relisting everything on a timer. The JSON answer is
+ * rebuilt only when the registry changes, so a request never waits on the
+ * cameras; a refresh queries its camera on a thread of its own. Requests and
+ * the reply format are described in discovery.h.
+ *
+ * The service answers on a UNIX socket from one poll loop. Link callbacks
+ * run on a PvAPI thread; they update the registry under a lock and wake the
+ * loop through a pipe, which also answers "wait" requests that were held
+ * until enough cameras had been seen. Results of the initial sweep are
+ * dropped for cameras a link event reported while the sweep ran.
+ */
+
+// includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <limits.h>
+#include <map>
+#include <string>
+#include <vector>
+#include <PvApi.h>
+#include <discovery.h>
+#include <camera_sweep.h>
+
+#define MAX_CLIENTS 64
+
+// what the registry knows about a camera
+typedef struct
+{
+  tPvCameraInfoEx info;
+  tPvIpSettings   ip;
+  bool            ipKnown;
+  bool            reachable;
+  time_t          changed;
+} tCameraEntry;
+
+// a client whose request is being read or is waiting for cameras
+typedef struct
+{
+  int         fd;
+  std::string request;
+  unsigned    waitCount;   // answer once this many cameras are known (wait)
+  double      deadline;    // or at this time (or give up reading the request)
+  bool        waiting;
+} tClient;
+
+// registry shared with the link callback
+typedef struct
+{
+  pthread_mutex_t                       lock;
+  std::map<unsigned long,tCameraEntry>  cameras;
+  std::string                           json;   // the list, rebuilt on change
+  unsigned long                         changes;
+  unsigned long                         events; // link events so far
+  std::map<unsigned long,unsigned long> lastEvent; // each camera's latest link event
+  int                                   refreshing; // refresh threads running
+  int                                   wake[2]; // pipe to the poll loop
+  bool                                  verbose; // print cameras as they come and go
+} tRegistry;
+
+tRegistry GRegistry;
+volatile sig_atomic_t stopRequested = 0;
+
+// usage
+void ShowUsage()
+{
+  printf("usage: camera_discovery [-s socket] [-v]\n");
+  printf("-s\tUNIX socket to serve on (default %s)\n",DISCOVERY_SOCKET);
+  printf("-v\tprint cameras as they come and go\n");
+}
+
+// stop on ctrl-c
+void StopHandler(int Signal)
+{
+  stopRequested = 1;
+}
+
+// seconds on the monotonic clock
+double Now()
+{
+  struct timespec tp;
+  clock_gettime(CLOCK_MONOTONIC,&tp);
+  return tp.tv_sec + tp.tv_nsec/1e9;
+}
+
+// a JSON string (camera strings are short ASCII; quotes and control characters are escaped)
+void JsonString(std::string& Out,const char* Value)
+{
+  Out += '"';
+  for(const char* p=Value;*p;p++)
+  {
+    if(*p=='"' || *p=='\\')
+    {
+      Out += '\\';
+      Out += *p;
+    }
+    else if((unsigned char)*p<0x20)
+    {
+      char escaped[8];
+      snprintf(escaped,sizeof(escaped),"\\u%04x",(unsigned char)*p);
+      Out += escaped;
+    }
+    else
+      Out += *p;
+  }
+  Out += '"';
+}
+
+// dotted address of a network-order IPv4 address
+void JsonAddress(std::string& Out,unsigned long Address)
+{
+  struct in_addr a;
+  a.s_addr = Address;
+  JsonString(Out,inet_ntoa(a));
+}
+
+// one camera object
+void JsonCamera(std::string& Out,const tCameraEntry& E)
+{
+  char number[32];
+  snprintf(number,sizeof(number),"%lu",E.info.UniqueId);
+  Out += "{\"uid\":";
+  Out += number;
+  Out += ",\"serial\":";
+  JsonString(Out,E.info.SerialNumber);
+  Out += ",\"name\":";
+  JsonString(Out,E.info.CameraName);
+  Out += ",\"model\":";
+  JsonString(Out,E.info.ModelName);
+  Out += ",\"firmware\":";
+  JsonString(Out,E.info.FirmwareVersion);
+  Out += ",\"ip\":";
+  JsonAddress(Out,E.ipKnown ? E.ip.CurrentIpAddress : 0);
+  Out += ",\"subnet\":";
+  JsonAddress(Out,E.ipKnown ? E.ip.CurrentIpSubnet : 0);
+  Out += ",\"gateway\":";
+  JsonAddress(Out,E.ipKnown ? E.ip.CurrentIpGateway : 0);
+  Out += ",\"config\":";
+  JsonString(Out,!E.ipKnown ? "unknown" : E.ip.ConfigMode==ePvIpConfigPersistent ? "persistent" :
+                 E.ip.ConfigMode==ePvIpConfigDhcp ? "dhcp" : "autoip");
+  Out += ",\"access\":";
+  JsonString(Out,!E.reachable ? "unreachable" : E.info.PermittedAccess & ePvAccessMaster ? "available" : "in use");
+  snprintf(number,sizeof(number),"%lld",(long long)E.changed);
+  Out += ",\"changed\":";
+  Out += number;
+  Out += "}";
+}
+
+// rebuild the list and wake the loop (registry lock held)
+void RegistryChanged(tRegistry& R)
+{
+  R.json = "[";
+  for(std::map<unsigned long,tCameraEntry>::iterator i=R.cameras.begin();i!=R.cameras.end();++i)
+  {
+    if(i!=R.cameras.begin())
+      R.json += ",\n ";
+    JsonCamera(R.json,i->second);
+  }
+  R.json += "]\n";
+  R.changes++;
+  char c = 0;
+  if(write(R.wake[1],&c,1)<0)
+  {
+    // the loop is already awake
+  }
+}
+
+// store one camera, unless a link event after event Since reported it
+void StoreCamera(tRegistry& R,const tCameraEntry& E,unsigned long Since=ULONG_MAX)
+{
+  unsigned long Uid = E.info.UniqueId;
+  pthread_mutex_lock(&R.lock);
+  if(R.lastEvent.count(Uid) && R.lastEvent[Uid]>Since)
+  {
+    pthread_mutex_unlock(&R.lock);
+    return;
+  }
+  bool known = R.cameras.count(Uid)>0;
+  R.cameras[Uid] = E;
+  RegistryChanged(R);
+  pthread_mutex_unlock(&R.lock);
+  if(R.verbose && !known)
+  {
+    struct in_addr a;
+    a.s_addr = E.ipKnown ? E.ip.CurrentIpAddress : 0;
+    printf("added %lu %s (%s)\n",Uid,E.info.CameraName,inet_ntoa(a));
+    fflush(stdout);
+  }
+}
+
+// query one camera and store it; false if PvAPI no longer knows it
+bool QueryCamera(tRegistry& R,unsigned long Uid,bool Reachable)
+{
+  tCameraEntry E;
+  memset(&E,0,sizeof(E));
+  if(PvCameraInfoEx(Uid,&E.info,sizeof(tPvCameraInfoEx))!=ePvErrSuccess)
+    return false;
+  E.reachable = Reachable;
+  E.ipKnown = Reachable && PvCameraIpSettingsGet(Uid,&E.ip)==ePvErrSuccess;
+  E.changed = time(NULL);
+  StoreCamera(R,E);
+  return true;
+}
+
+// the initial sweep, and the last link event before it began
+typedef struct
+{
+  tRegistry*    R;
+  unsigned long since;
+} tSweepContext;
+
+// sweep callback: store a camera of the initial sweep
+void SweptCamera(void* Context,const tSweepResult& Result)
+{
+  tSweepContext& S = *(tSweepContext*)Context;
+  tCameraEntry E;
+  memset(&E,0,sizeof(E));
+  E.info = Result.info;
+  E.ip = Result.ip;
+  E.reachable = Result.reachable;
+  E.ipKnown = Result.reachable && Result.err==ePvErrSuccess;
+  E.changed = time(NULL);
+  StoreCamera(*S.R,E,S.since);
+}
+
+// count a link event for a camera (registry lock held)
+void LinkEvent(tRegistry& R,unsigned long UniqueId)
+{
+  R.events++;
+  R.lastEvent[UniqueId] = R.events;
+}
+
+// link callback: one camera came or went (PvAPI calls these one at a time)
+void LinkCB(void* Context,tPvInterface Interface,tPvLinkEvent Event,unsigned long UniqueId)
+{
+  tRegistry& R = *(tRegistry*)Context;
+  if(Event==ePvLinkAdd)
+  {
+    pthread_mutex_lock(&R.lock);
+    LinkEvent(R,UniqueId);
+    pthread_mutex_unlock(&R.lock);
+    QueryCamera(R,UniqueId,true);
+    return;
+  }
+
+  pthread_mutex_lock(&R.lock);
+  LinkEvent(R,UniqueId);
+  bool known = R.cameras.erase(UniqueId)>0;
+  if(known)
+    RegistryChanged(R);
+  pthread_mutex_unlock(&R.lock);
+  if(R.verbose && known)
+  {
+    printf("removed %lu\n",UniqueId);
+    fflush(stdout);
+  }
+}
+
+// seed the registry with cameras PvAPI found before the callbacks were in place
+// (queried in parallel, so a large installation is known after one round trip)
+void InitialSweep(tRegistry& R)
+{
+  tSweepContext context;
+  context.R = &R;
+  pthread_mutex_lock(&R.lock);
+  context.since = R.events;
+  pthread_mutex_unlock(&R.lock);
+
+  std::vector<tPvCameraInfoEx> list;
+  unsigned long reachable = SweepList(list);
+  SweepQuery(list,reachable,SWEEP_WORKERS,SWEEP_TIMEOUT_MS,SweptCamera,&context);
+}
+
+// the answer to a camera request: match on unique ID, serial, IP or name
+std::string FindCamera(tRegistry& R,const char* Key)
+{
+  std::string out = "null\n";
+  char* end;
+  unsigned long uid = strtoul(Key,&end,10);
+  bool numeric = *Key && *end==0;
+
+  pthread_mutex_lock(&R.lock);
+  for(std::map<unsigned long,tCameraEntry>::iterator i=R.cameras.begin();i!=R.cameras.end();++i)
+  {
+    const tCameraEntry& E = i->second;
+    struct in_addr a;
+    a.s_addr = E.ip.CurrentIpAddress;
+    if((numeric && E.info.UniqueId==uid) || strcmp(E.info.SerialNumber,Key)==0 ||
+       strcmp(E.info.CameraName,Key)==0 || (E.ipKnown && strcmp(inet_ntoa(a),Key)==0))
+    {
+      out.clear();
+      JsonCamera(out,E);
+      out += "\n";
+      break;
+    }
+  }
+  pthread_mutex_unlock(&R.lock);
+  return out;
+}
+
+// answer and close a client
+void Answer(tClient& C,const std::string& Reply)
+{
+  size_t done = 0;
+  while(done<Reply.size())
+  {
+    ssize_t n = write(C.fd,Reply.data()+done,Reply.size()-done);
+    if(n<=0)
+      break;
+    done += n;
+  }
+  close(C.fd);
+  C.fd = -1;
+}
+
+// a refresh, answered from its own thread
+typedef struct
+{
+  tRegistry*  R;
+  int         fd;
+  std::string key;
+} tRefresh;
+
+// query the camera again, then answer as a camera request
+void* RefreshThread(void* Arg)
+{
+  tRefresh* F = (tRefresh*)Arg;
+  tRegistry& R = *F->R;
+  unsigned long uid = strtoul(F->key.c_str(),NULL,10);
+  pthread_mutex_lock(&R.lock);
+  bool reachable = R.cameras.count(uid) && R.cameras[uid].reachable;
+  pthread_mutex_unlock(&R.lock);
+  QueryCamera(R,uid,reachable);
+
+  tClient C;
+  C.fd = F->fd;
+  Answer(C,FindCamera(R,F->key.c_str()));
+  pthread_mutex_lock(&R.lock);
+  R.refreshing--;
+  pthread_mutex_unlock(&R.lock);
+  delete F;
+  return 0;
+}
+
+// hand a refresh to a thread, so the loop never waits on a camera
+void StartRefresh(tClient& C,const char* Key)
+{
+  tRefresh* F = new tRefresh;
+  F->R = &GRegistry;
+  F->fd = C.fd;
+  F->key = Key;
+
+  pthread_attr_t attr;
+  pthread_t thread;
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr,PTHREAD_CREATE_DETACHED);
+  pthread_mutex_lock(&GRegistry.lock);
+  GRegistry.refreshing++;
+  bool ok = pthread_create(&thread,&attr,RefreshThread,F)==0;
+  if(!ok)
+    GRegistry.refreshing--;
+  pthread_mutex_unlock(&GRegistry.lock);
+  pthread_attr_destroy(&attr);
+
+  if(ok)
+    C.fd = -1; // the thread answers and closes
+  else
+  {
+    delete F;
+    Answer(C,"{\"error\":\"no thread for the refresh\"}\n");
+  }
+}
+
+// handle a complete request line; false if the client has to wait
+bool Handle(tClient& C)
+{
+  char request[512];
+  snprintf(request,sizeof(request),"%s",C.request.c_str());
+  char* command = strtok(request," \t\r\n");
+  char* argument = command ? strtok(NULL," \t\r\n") : NULL;
+  char* argument2 = argument ? strtok(NULL," \t\r\n") : NULL;
+
+  if(command && strcmp(command,"list")==0)
+  {
+    pthread_mutex_lock(&GRegistry.lock);
+    std::string json = GRegistry.json;
+    pthread_mutex_unlock(&GRegistry.lock);
+    Answer(C,json);
+  }
+  else if(command && strcmp(command,"camera")==0 && argument)
+    Answer(C,FindCamera(GRegistry,argument));
+  else if(command && strcmp(command,"refresh")==0 && argument)
+    StartRefresh(C,argument);
+  else if(command && strcmp(command,"wait")==0 && argument)
+  {
+    C.waitCount = strtoul(argument,NULL,10);
+    C.deadline = Now() + (argument2 ? atof(argument2)/1000 : DISCOVERY_TIMEOUT_MS/1000.0);
+    C.waiting = true;
+    return false;
+  }
+  else
+    Answer(C,"{\"error\":\"unknown request\"}\n");
+  return true;
+}
+
+// main
+int main(int argc, char* argv[])
+{
+  int c;
+  const char* path = DISCOVERY_SOCKET;
+  while ((c = getopt (argc, argv, "s:v")) != -1)
+  {
+    switch(c)
+    {
+      case 's':
+        path = optarg;
+        break;
+      case 'v':
+        GRegistry.verbose = true;
+        break;
+      default:
+        ShowUsage();
+        return 1;
+    }
+  }
+
+  // registry first, so callbacks have somewhere to go
+  pthread_mutex_init(&GRegistry.lock,NULL);
+  GRegistry.json = "[]\n";
+  if(pipe(GRegistry.wake)!=0)
+    return 1;
+  fcntl(GRegistry.wake[0],F_SETFL,O_NONBLOCK);
+  fcntl(GRegistry.wake[1],F_SETFL,O_NONBLOCK);
+
+  // listen (a stale socket from an earlier run is replaced)
+  struct sockaddr_un address;
+  memset(&address,0,sizeof(address));
+  address.sun_family = AF_UNIX;
+  strncpy(address.sun_path,path,sizeof(address.sun_path)-1);
+  unlink(path);
+  int listener = socket(AF_UNIX,SOCK_STREAM,0);
+  if(listener<0 || bind(listener,(struct sockaddr*)&address,sizeof(address))!=0 || listen(listener,16)!=0)
+  {
+    printf("cannot listen on %s: %s\n",path,strerror(errno));
+    return 1;
+  }
+
+  if(PvInitialize()!=ePvErrSuccess)
+  {
+    printf("failed to initialize the API\n");
+    close(listener);
+    unlink(path);
+    return 1;
+  }
+  PvLinkCallbackRegister(LinkCB,ePvLinkAdd,&GRegistry);
+  PvLinkCallbackRegister(LinkCB,ePvLinkRemove,&GRegistry);
+  InitialSweep(GRegistry);
+
+  struct sigaction action;
+  memset(&action,0,sizeof(action));
+  action.sa_handler = StopHandler;
+  sigaction(SIGINT,&action,NULL);
+  sigaction(SIGTERM,&action,NULL);
+  signal(SIGPIPE,SIG_IGN);
+  printf("serving cameras on %s\n",path);
+  fflush(stdout);
+
+  // one loop: new clients, request lines, registry changes, wait deadlines
+  std::vector<tClient> clients;
+  while(!stopRequested)
+  {
+    std::vector<struct pollfd> fds;
+    struct pollfd p;
+    p.events = POLLIN;
+    p.fd = listener;
+    fds.push_back(p);
+    p.fd = GRegistry.wake[0];
+    fds.push_back(p);
+    double next = Now()+1;
+    for(size_t i=0;i<clients.size();i++)
+    {
+      p.fd = clients[i].waiting ? -1 : clients[i].fd;
+      fds.push_back(p);
+      if(clients[i].deadline<next)
+        next = clients[i].deadline;
+    }
+    double wait = next-Now();
+    if(poll(&fds[0],fds.size(),wait>0 ? (int)(wait*1000)+1 : 0)<0 && errno!=EINTR)
+      break;
+
+    // drain change notices
+    char drain[64];
+    while(read(GRegistry.wake[0],drain,sizeof(drain))>0)
+      ;
+
+    // request lines
+    for(size_t i=0;i<clients.size();i++)
+    {
+      tClient& C = clients[i];
+      if(C.waiting || !(fds[2+i].revents & (POLLIN|POLLHUP|POLLERR)))
+        continue;
+      char buffer[512];
+      ssize_t n = read(C.fd,buffer,sizeof(buffer));
+      if(n<=0 || C.request.size()>4096)
+      {
+        close(C.fd);
+        C.fd = -1;
+        continue;
+      }
+      C.request.append(buffer,n);
+      if(C.request.find('\n')!=std::string::npos)
+        Handle(C);
+    }
+
+    // waiting clients whose count was reached or whose time is up, and
+    // clients that never finished their request
+    pthread_mutex_lock(&GRegistry.lock);
+    unsigned long known = GRegistry.cameras.size();
+    std::string json = GRegistry.json;
+    pthread_mutex_unlock(&GRegistry.lock);
+    double now = Now();
+    for(size_t i=0;i<clients.size();i++)
+    {
+      tClient& C = clients[i];
+      if(C.fd>=0 && C.waiting && (known>=C.waitCount || now>=C.deadline))
+        Answer(C,json);
+      else if(C.fd>=0 && now>=C.deadline)
+      {
+        close(C.fd);
+        C.fd = -1;
+      }
+    }
+
+    // drop finished clients, then take new ones
+    for(size_t i=clients.size();i>0;i--)
+      if(clients[i-1].fd<0)
+        clients.erase(clients.begin()+(i-1));
+    if(fds[0].revents & POLLIN)
+    {
+      int fd = accept(listener,NULL,NULL);
+      if(fd>=0 && clients.size()<MAX_CLIENTS)
+      {
+        tClient C;
+        C.fd = fd;
+        C.waitCount = 0;
+        C.deadline = Now() + DISCOVERY_TIMEOUT_MS/1000.0;
+        C.waiting = false;
+        clients.push_back(C);
+      }
+      else if(fd>=0)
+        close(fd);
+    }
+  }
+
+  for(size_t i=0;i<clients.size();i++)
+    close(clients[i].fd);
+  close(listener);
+  unlink(path);
+
+  // refreshes still querying their camera get a little time to finish
+  for(int waited=0;waited<DISCOVERY_TIMEOUT_MS;waited+=10)
+  {
+    pthread_mutex_lock(&GRegistry.lock);
+    int refreshing = GRegistry.refreshing;
+    pthread_mutex_unlock(&GRegistry.lock);
+    if(refreshing==0)
+      break;
+    usleep(10000);
+  }
+  PvLinkCallbackUnRegister(LinkCB,ePvLinkAdd);
+  PvLinkCallbackUnRegister(LinkCB,ePvLinkRemove);
+  PvUnInitialize();
+  return 0;
+}
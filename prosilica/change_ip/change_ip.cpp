@@ -13,8 +13,7 @@
 #include <signal.h>
 #include <arpa/inet.h>
 #include <PvApi.h>
-
-#define MAX_CAMERA_LIST 20
+#include <camera_sweep.h>
 
 // usage
 void ShowUsage()
@@ -61,8 +60,8 @@ int main(int argc, char* argv[])
       bool            iSet = false;
       bool            sSet = false;
       bool            gSet = false;
-      unsigned long   cameraNum = 0;
-      tPvCameraInfo   cameraList[MAX_CAMERA_LIST];
+      bool            found = false;
+      std::vector<tPvCameraInfoEx> cameraList;
       int             rounds = 0;
       tPvErr          Err;
       unsigned long   Mode = 0;
@@ -112,16 +111,19 @@ int main(int argc, char* argv[])
       if(uSet && iSet && sSet && gSet)
       {
         printf("Looking for camera ... ");
-        while(cameraNum==0 && rounds<10){
-          cameraNum = PvCameraList(cameraList,MAX_CAMERA_LIST,NULL);
-          cameraNum = cameraNum + PvCameraListUnreachable(cameraList,MAX_CAMERA_LIST,NULL);
-          //printf("Attached cameras: %ld\n",cameraNum);
-          Sleep(250);
+        while(!found && rounds<10){
+          // reachable or not, however many cameras there are
+          SweepList(cameraList);
+          for(size_t i=0;i<cameraList.size();i++)
+            found = found || cameraList[i].UniqueId==uid;
+          //printf("Attached cameras: %ld\n",cameraList.size());
+          if(!found)
+            Sleep(250);
           rounds = rounds+1;
           printf("%i\n",rounds);
         }
 
-        if(cameraNum>0){
+        if(found){
           
           printf("done.\n");
           printf("Changing settings ... ");
@@ -161,7 +163,7 @@ int main(int argc, char* argv[])
             printf("done.\n");
         }
         else
-          printf("No cameras found.\n");
+          printf("Camera %lu not found.\n",uid);
       }
       else
       {
@@ -0,0 +1,218 @@
+/* Header-only sequential file writer for SD cards.
+ *
+ * A microSD card erases and programs in blocks of several MB; a stream of
+ * small writes that straddle those blocks makes the card's controller read,
+ * merge and rewrite whole blocks, which is where the long write stalls come
+ * from. This writer gathers output in one aligned buffer of BlockSize bytes
+ * (a multiple of the erase block, e.g. 4 MB) and hands each full buffer to
+ * the kernel as a single O_DIRECT pwrite at a block-aligned offset, so the
+ * card sees whole erase blocks and the page cache is bypassed. The file can
+ * be preallocated once its final size is known, and fdatasync runs every
+ * SyncBytes instead of once at close, so the card never has more than that
+ * outstanding. Every write and sync is timed: the worst case is the stall a
+ * caller saw.
+ *
+ * The last, partial buffer is padded to the O_DIRECT alignment and the file
+ * is cut back to its real length at close. File systems that refuse O_DIRECT
+ * (tmpfs) get the same writes through the page cache.
+ */
+
+#ifndef ALIGNED_WRITER_H_INCLUDE
+#define ALIGNED_WRITER_H_INCLUDE
+
+// includes
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define ALIGNED_IO_ALIGN   4096           // O_DIRECT buffer, offset and length alignment
+#define ALIGNED_BLOCK_SIZE (4u<<20)       // default: a typical SD erase block
+#define ALIGNED_SYNC_BYTES (4u*(4u<<20))  // default: fdatasync every four blocks
+
+// an open file
+typedef struct
+{
+  int      fd;
+  bool     direct;       // opened with O_DIRECT
+  bool     failed;
+  uint8_t* buffer;       // BlockSize bytes, aligned
+  size_t   blockSize;
+  size_t   fill;         // bytes in buffer
+  uint64_t size;         // bytes written by the caller
+  uint64_t flushed;      // bytes handed to the kernel (always block aligned)
+  uint64_t reserved;     // bytes preallocated
+  uint64_t syncBytes;
+  uint64_t sinceSync;
+
+  // accounting
+  uint64_t writes;
+  uint64_t syncs;
+  double   writeSeconds;
+  double   maxWriteSeconds;
+  double   syncSeconds;
+  double   maxSyncSeconds;
+  char     error[128];
+} tAlignedWriter;
+
+// seconds since an arbitrary start
+inline double AlignedNow()
+{
+  struct timespec tp;
+  clock_gettime(CLOCK_MONOTONIC,&tp);
+  return tp.tv_sec + tp.tv_nsec/1e9;
+}
+
+// create Path; BlockSize is rounded up to the alignment, SyncBytes of 0 only syncs at close
+inline bool AlignedOpen(tAlignedWriter& W,const char* Path,size_t BlockSize = ALIGNED_BLOCK_SIZE,
+                        uint64_t SyncBytes = ALIGNED_SYNC_BYTES)
+{
+  memset(&W,0,sizeof(tAlignedWriter));
+  W.blockSize = (BlockSize+ALIGNED_IO_ALIGN-1)/ALIGNED_IO_ALIGN*ALIGNED_IO_ALIGN;
+  W.blockSize = W.blockSize ? W.blockSize : ALIGNED_IO_ALIGN;
+  W.syncBytes = SyncBytes;
+
+  W.direct = true;
+  W.fd = open(Path,O_WRONLY|O_CREAT|O_TRUNC|O_DIRECT,0644);
+  if(W.fd<0 && errno==EINVAL)
+  {
+    W.direct = false;
+    W.fd = open(Path,O_WRONLY|O_CREAT|O_TRUNC,0644);
+  }
+  if(W.fd<0)
+  {
+    snprintf(W.error,sizeof(W.error),"failed to create %.80s: %s",Path,strerror(errno));
+    W.failed = true;
+    return false;
+  }
+  if(posix_memalign((void**)&W.buffer,ALIGNED_IO_ALIGN,W.blockSize)!=0)
+  {
+    snprintf(W.error,sizeof(W.error),"no memory for a %lu byte block",(unsigned long)W.blockSize);
+    W.buffer = NULL;
+    W.failed = true;
+    return false;
+  }
+  return true;
+}
+
+// allocate the file's blocks up front, so the card is not asked for more in mid-capture
+inline bool AlignedReserve(tAlignedWriter& W,uint64_t Bytes)
+{
+  if(W.failed || Bytes<=W.reserved)
+    return !W.failed;
+  int err = posix_fallocate(W.fd,0,(off_t)Bytes);
+  if(err!=0 && err!=EOPNOTSUPP && err!=EINVAL)
+  {
+    snprintf(W.error,sizeof(W.error),"cannot reserve %llu bytes: %s",(unsigned long long)Bytes,strerror(err));
+    return false;
+  }
+  W.reserved = Bytes;
+  return true;
+}
+
+// sync what has been written so far
+inline bool AlignedSync(tAlignedWriter& W)
+{
+  double start = AlignedNow();
+  bool ok = fdatasync(W.fd)==0;
+  double seconds = AlignedNow()-start;
+  W.syncs++;
+  W.syncSeconds += seconds;
+  if(seconds>W.maxSyncSeconds)
+    W.maxSyncSeconds = seconds;
+  W.sinceSync = 0;
+  if(!ok)
+  {
+    snprintf(W.error,sizeof(W.error),"sync failed: %s",strerror(errno));
+    W.failed = true;
+  }
+  return ok;
+}
+
+// write Length bytes of the buffer (a multiple of the alignment) at the flushed offset
+inline bool AlignedFlushBlock(tAlignedWriter& W,size_t Length)
+{
+  double start = AlignedNow();
+  size_t done = 0;
+  while(done<Length)
+  {
+    ssize_t n = pwrite(W.fd,W.buffer+done,Length-done,(off_t)(W.flushed+done));
+    if(n<0 && errno==EINTR)
+      continue;
+    if(n<=0)
+    {
+      snprintf(W.error,sizeof(W.error),"write failed: %s",n<0 ? strerror(errno) : "no space");
+      W.failed = true;
+      return false;
+    }
+    done += n;
+  }
+  double seconds = AlignedNow()-start;
+  W.writes++;
+  W.writeSeconds += seconds;
+  if(seconds>W.maxWriteSeconds)
+    W.maxWriteSeconds = seconds;
+
+  W.flushed += Length;
+  W.sinceSync += Length;
+  if(W.syncBytes && W.sinceSync>=W.syncBytes)
+    return AlignedSync(W);
+  return true;
+}
+
+// append Size bytes
+inline bool AlignedWrite(tAlignedWriter& W,const void* Data,size_t Size)
+{
+  const uint8_t* p = (const uint8_t*)Data;
+  while(Size>0 && !W.failed)
+  {
+    size_t n = W.blockSize-W.fill < Size ? W.blockSize-W.fill : Size;
+    memcpy(W.buffer+W.fill,p,n);
+    W.fill += n;
+    W.size += n;
+    p += n;
+    Size -= n;
+    if(W.fill==W.blockSize)
+    {
+      AlignedFlushBlock(W,W.blockSize);
+      W.fill = 0;
+    }
+  }
+  return !W.failed;
+}
+
+// write the last partial block, cut the file to its length, sync and close
+inline bool AlignedClose(tAlignedWriter& W)
+{
+  bool ok = !W.failed;
+  if(W.fd>=0)
+  {
+    if(ok && W.fill)
+    {
+      size_t padded = (W.fill+ALIGNED_IO_ALIGN-1)/ALIGNED_IO_ALIGN*ALIGNED_IO_ALIGN;
+      memset(W.buffer+W.fill,0,padded-W.fill);
+      ok = AlignedFlushBlock(W,padded);
+      W.fill = 0;
+    }
+
+    // drops the padding and any reservation that was not used
+    if(ok && ftruncate(W.fd,(off_t)W.size)!=0)
+    {
+      snprintf(W.error,sizeof(W.error),"truncate failed: %s",strerror(errno));
+      ok = false;
+    }
+    ok = ok && AlignedSync(W);
+    ok = (close(W.fd)==0) && ok;
+    W.fd = -1;
+  }
+  free(W.buffer);
+  W.buffer = NULL;
+  W.failed = !ok;
+  return ok;
+}
+
+#endif
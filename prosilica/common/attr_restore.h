@@ -0,0 +1,232 @@
+/* Header-only restore of attribute snapshots onto a camera.
+ *
+ * AttrPlan reads the current value of every writable attribute of the
+ * target in one pass and keeps only those that differ; AttrApply writes
+ * them in dependency order. Attributes that bound others go first:
+ *
+ *   0  PixelFormat, Binning*, Decimation*   (bound Width and Height)
+ *   1  Width, Height                        (bound RegionX and RegionY)
+ *   2  RegionX, RegionY
+ *   3  other *Mode and *Selector enums      (decide what values mean)
+ *   4  everything else
+ *   5  FrameRate                            (bound by size, exposure, trigger)
+ *
+ * Bounds also run the other way (a smaller RegionX lets Width grow), so a
+ * write refused as out of range or forbidden is tried again after the rest
+ * of the plan, until a pass makes no progress. A write can also move an
+ * attribute that already matched when planned (PixelFormat or Binning
+ * clamping Width, Width clamping RegionX), so AttrSettle reads the target
+ * again afterwards, writes what moved, and reports what still differs.
+ * Unchanged attributes cost one read and no write (two reads once anything
+ * was written), where a fixed setup writes all of them every time.
+ */
+
+#ifndef ATTR_RESTORE_H_INCLUDE
+#define ATTR_RESTORE_H_INCLUDE
+
+// includes
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <PvApi.h>
+#include <attr_snapshot.h>
+
+#define ATTR_RANKS 6
+
+// one write of a plan
+typedef struct
+{
+  tAttr       target;   // attribute and the value it should have
+  std::string current;  // value before the restore
+  int         rank;     // dependency order
+  tPvErr      err;      // of the last write
+  bool        done;
+} tAttrChange;
+
+// what a restore cost
+typedef struct
+{
+  unsigned long reads;
+  unsigned long writes;     // calls made, retries included
+  unsigned long changed;    // attributes written successfully
+  unsigned long failed;
+  unsigned long unsettled;  // differ from the target after the restore
+  double        readSeconds;
+  double        writeSeconds;
+} tAttrRestoreStats;
+
+// seconds on the monotonic clock
+inline double AttrNow()
+{
+  struct timespec tp;
+  clock_gettime(CLOCK_MONOTONIC,&tp);
+  return tp.tv_sec + tp.tv_nsec/1e9;
+}
+
+// where an attribute goes in the write order
+inline int AttrRank(const std::string& Name,tPvDatatype Type)
+{
+  const char* name = Name.c_str();
+  if(Name=="PixelFormat" || strncmp(name,"Binning",7)==0 || strncmp(name,"Decimation",10)==0)
+    return 0;
+  if(Name=="Width" || Name=="Height")
+    return 1;
+  if(Name=="RegionX" || Name=="RegionY")
+    return 2;
+  size_t n = Name.size();
+  if(Type==ePvDatatypeEnum && ((n>4 && Name.compare(n-4,4,"Mode")==0) || (n>8 && Name.compare(n-8,8,"Selector")==0)))
+    return 3;
+  if(Name=="FrameRate")
+    return 5;
+  return 4;
+}
+
+// write one value given as canonical text
+inline tPvErr AttrSet(tPvHandle Handle,const tAttr& A,const std::string& Value)
+{
+  const char* name = A.name.c_str();
+  switch(A.type)
+  {
+    case ePvDatatypeString:
+      return PvAttrStringSet(Handle,name,Value.c_str());
+    case ePvDatatypeEnum:
+      return PvAttrEnumSet(Handle,name,Value.c_str());
+    case ePvDatatypeUint32:
+      return PvAttrUint32Set(Handle,name,(tPvUint32)strtoul(Value.c_str(),NULL,10));
+    case ePvDatatypeFloat32:
+      return PvAttrFloat32Set(Handle,name,(tPvFloat32)strtod(Value.c_str(),NULL));
+    case ePvDatatypeInt64:
+      return PvAttrInt64Set(Handle,name,(tPvInt64)strtoll(Value.c_str(),NULL,10));
+    case ePvDatatypeBoolean:
+      return PvAttrBooleanSet(Handle,name,Value=="true");
+    default:
+      return ePvErrWrongType;
+  }
+}
+
+// an attribute of a target built in code (no snapshot file)
+inline void AttrTarget(tAttrSnapshot& S,const char* Name,tPvDatatype Type,const std::string& Value)
+{
+  tAttr A;
+  A.name = Name;
+  A.type = Type;
+  A.flags = ePvFlagRead | ePvFlagWrite;
+  A.value = Value;
+  A.err = ePvErrSuccess;
+  S.attrs.push_back(A);
+}
+
+// orders a plan by rank, keeping the target's order within a rank
+inline bool AttrChangeOrder(const tAttrChange& a,const tAttrChange& b)
+{
+  return a.rank<b.rank;
+}
+
+// the writes that bring the camera to Target: writable, settable values that differ (All: every one)
+inline void AttrPlan(tPvHandle Handle,const tAttrSnapshot& Target,std::vector<tAttrChange>& Plan,
+                     tAttrRestoreStats& Stats,bool All = false)
+{
+  double start = AttrNow();
+  Plan.clear();
+  for(size_t i=0;i<Target.attrs.size();i++)
+  {
+    const tAttr& A = Target.attrs[i];
+    if(!(A.flags & ePvFlagWrite) || (A.flags & (ePvFlagVolatile|ePvFlagConst)) || A.err!=ePvErrSuccess)
+      continue;
+    tAttrChange C;
+    C.target = A;
+    C.rank = AttrRank(A.name,A.type);
+    C.err = ePvErrSuccess;
+    C.done = false;
+    if(!All)
+    {
+      tPvErr err = AttrGet(Handle,A,C.current);
+      Stats.reads++;
+      if(err==ePvErrSuccess && C.current==A.value)
+        continue;
+    }
+    Plan.push_back(C);
+  }
+  std::stable_sort(Plan.begin(),Plan.end(),AttrChangeOrder);
+  Stats.readSeconds += AttrNow()-start;
+}
+
+// write a plan in order; refused writes are retried while passes make progress
+inline bool AttrApply(tPvHandle Handle,std::vector<tAttrChange>& Plan,tAttrRestoreStats& Stats)
+{
+  double start = AttrNow();
+  bool progress = true;
+  unsigned long left = Plan.size();
+  while(left>0 && progress)
+  {
+    progress = false;
+    for(size_t i=0;i<Plan.size();i++)
+    {
+      tAttrChange& C = Plan[i];
+      if(C.done)
+        continue;
+      C.err = AttrSet(Handle,C.target,C.target.value);
+      Stats.writes++;
+      if(C.err==ePvErrSuccess)
+      {
+        C.done = true;
+        Stats.changed++;
+        left--;
+        progress = true;
+      }
+      else if(C.err!=ePvErrOutOfRange && C.err!=ePvErrForbidden && C.err!=ePvErrUnavailable)
+      {
+        // not a matter of order; trying again will not help
+        C.done = true;
+        Stats.failed++;
+        left--;
+      }
+    }
+  }
+  Stats.failed += left;
+  Stats.writeSeconds += AttrNow()-start;
+  return Stats.failed==0;
+}
+
+// after a plan is applied: read the target again, write once more what
+// differs (attributes moved by a later write), and leave in Missed what
+// still differs after that, with the value read back in current
+inline bool AttrSettle(tPvHandle Handle,const tAttrSnapshot& Target,std::vector<tAttrChange>& Missed,
+                       tAttrRestoreStats& Stats)
+{
+  std::vector<tAttrChange> moved;
+  AttrPlan(Handle,Target,moved,Stats);
+  Missed.clear();
+  if(!moved.empty())
+  {
+    // failures were counted by the first apply
+    tAttrRestoreStats again;
+    memset(&again,0,sizeof(tAttrRestoreStats));
+    AttrApply(Handle,moved,again);
+    Stats.writes += again.writes;
+    Stats.changed += again.changed;
+    Stats.writeSeconds += again.writeSeconds;
+    AttrPlan(Handle,Target,Missed,Stats);
+  }
+  Stats.unsettled = Missed.size();
+  return Missed.empty();
+}
+
+// plan, apply and settle in one call; false if any write failed or did not take
+inline bool AttrRestore(tPvHandle Handle,const tAttrSnapshot& Target,tAttrRestoreStats& Stats,
+                        std::vector<tAttrChange>& Missed,bool All = false)
+{
+  std::vector<tAttrChange> plan;
+  memset(&Stats,0,sizeof(tAttrRestoreStats));
+  AttrPlan(Handle,Target,plan,Stats,All);
+  bool ok = AttrApply(Handle,plan,Stats);
+  Missed.clear();
+  if(Stats.changed)
+    ok = AttrSettle(Handle,Target,Missed,Stats) && ok;
+  return ok;
+}
+
+#endif
@@ -0,0 +1,687 @@
+/* Header-only attribute snapshots of a camera.
+ *
+ * A snapshot holds every attribute of a camera (except commands and the
+ * /Stats counters) with its type, flags, category, range and value. Values
+ * and ranges are kept as text in one canonical form per type, so snapshots
+ * compare and diff without knowing types; floats are written with 9
+ * significant digits, enough to read back the same float. Strings of any
+ * length are read whole.
+ *
+ * Snapshots are saved as JSON (one attribute per line) or in a compact
+ * binary form, and AttrLoad reads either. The attribute list, types, flags,
+ * categories and ranges depend on the model and its firmware, not on the
+ * camera, so they are cached per model: a repeat dump of any camera of that
+ * model only reads values. PvAPI treats some ranges as dynamic (enum sets,
+ * sizes that follow binning); cached ranges are those seen when the cache
+ * was built, and a refresh reads them again.
+ */
+
+#ifndef ATTR_SNAPSHOT_H_INCLUDE
+#define ATTR_SNAPSHOT_H_INCLUDE
+
+// includes
+#include <stdio.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <map>
+#include <string>
+#include <vector>
+#include <PvApi.h>
+
+#define ATTR_MAGIC     "SEDATTR1"
+#define ATTR_CACHE_DIR "/var/tmp/sedcam-attrs"
+
+// one attribute
+typedef struct
+{
+  std::string   name;
+  tPvDatatype   type;
+  unsigned long flags;    // ePvFlag bits
+  std::string   category;
+  std::string   impact;
+  std::string   min;      // numeric range (empty if none)
+  std::string   max;
+  std::string   choices;  // enum set, comma separated
+  std::string   value;    // canonical text (empty with an error)
+  tPvErr        err;      // of reading the value
+} tAttr;
+
+// one camera's attributes
+typedef struct
+{
+  unsigned long      uid;
+  std::string        serial;
+  std::string        model;
+  std::string        firmware;
+  std::string        name;
+  std::string        ip;
+  int64_t            taken;   // UNIX time of the dump
+  std::vector<tAttr> attrs;
+} tAttrSnapshot;
+
+// type names used in the files
+inline const char* AttrTypeName(tPvDatatype Type)
+{
+  switch(Type)
+  {
+    case ePvDatatypeCommand: return "command";
+    case ePvDatatypeRaw:     return "raw";
+    case ePvDatatypeString:  return "string";
+    case ePvDatatypeEnum:    return "enum";
+    case ePvDatatypeUint32:  return "uint32";
+    case ePvDatatypeFloat32: return "float32";
+    case ePvDatatypeInt64:   return "int64";
+    case ePvDatatypeBoolean: return "boolean";
+    default:                 return "unknown";
+  }
+}
+
+inline tPvDatatype AttrTypeFromName(const std::string& Name)
+{
+  for(unsigned int t=ePvDatatypeCommand;t<=(unsigned int)ePvDatatypeBoolean;t++)
+    if(Name==AttrTypeName((tPvDatatype)t))
+      return (tPvDatatype)t;
+  return ePvDatatypeUnknown;
+}
+
+// numbers in their canonical text
+inline std::string AttrText(unsigned long Value)
+{
+  char text[32];
+  snprintf(text,sizeof(text),"%lu",Value);
+  return text;
+}
+
+inline std::string AttrText(double Value,bool Float)
+{
+  char text[32];
+  snprintf(text,sizeof(text),Float ? "%.9g" : "%.0f",Value);
+  return text;
+}
+
+inline std::string AttrText(long long Value)
+{
+  char text[32];
+  snprintf(text,sizeof(text),"%lld",Value);
+  return text;
+}
+
+// read a string-valued call whole, growing the buffer to the size PvAPI reports
+template<typename tCall>
+inline tPvErr AttrLongString(tCall Call,std::string& Value)
+{
+  std::vector<char> buffer(256);
+  unsigned long size = 0;
+  tPvErr err;
+  while(true)
+  {
+    size = 0;
+    err = Call(&buffer[0],buffer.size(),&size);
+    if(err!=ePvErrSuccess || size<buffer.size())
+      break;
+    buffer.resize(size+64);
+  }
+  buffer.back() = 0;
+  Value = err==ePvErrSuccess ? &buffer[0] : "";
+  return err;
+}
+
+// adapters for AttrLongString
+struct tAttrStringCall
+{
+  tPvHandle handle; const char* name;
+  tPvErr operator()(char* B,unsigned long S,unsigned long* P) const { return PvAttrStringGet(handle,name,B,S,P); }
+};
+struct tAttrEnumCall
+{
+  tPvHandle handle; const char* name;
+  tPvErr operator()(char* B,unsigned long S,unsigned long* P) const { return PvAttrEnumGet(handle,name,B,S,P); }
+};
+struct tAttrRangeEnumCall
+{
+  tPvHandle handle; const char* name;
+  tPvErr operator()(char* B,unsigned long S,unsigned long* P) const { return PvAttrRangeEnum(handle,name,B,S,P); }
+};
+
+// read one value as canonical text
+inline tPvErr AttrGet(tPvHandle Handle,const tAttr& A,std::string& Value)
+{
+  const char* name = A.name.c_str();
+  tPvErr err;
+  Value.clear();
+  switch(A.type)
+  {
+    case ePvDatatypeString:
+    {
+      tAttrStringCall call = {Handle,name};
+      return AttrLongString(call,Value);
+    }
+    case ePvDatatypeEnum:
+    {
+      tAttrEnumCall call = {Handle,name};
+      return AttrLongString(call,Value);
+    }
+    case ePvDatatypeUint32:
+    {
+      tPvUint32 v;
+      if((err = PvAttrUint32Get(Handle,name,&v))==ePvErrSuccess)
+        Value = AttrText((unsigned long)v);
+      return err;
+    }
+    case ePvDatatypeFloat32:
+    {
+      tPvFloat32 v;
+      if((err = PvAttrFloat32Get(Handle,name,&v))==ePvErrSuccess)
+        Value = AttrText((double)v,true);
+      return err;
+    }
+    case ePvDatatypeInt64:
+    {
+      tPvInt64 v;
+      if((err = PvAttrInt64Get(Handle,name,&v))==ePvErrSuccess)
+        Value = AttrText((long long)v);
+      return err;
+    }
+    case ePvDatatypeBoolean:
+    {
+      tPvBoolean v;
+      if((err = PvAttrBooleanGet(Handle,name,&v))==ePvErrSuccess)
+        Value = v ? "true" : "false";
+      return err;
+    }
+    default:
+      return ePvErrWrongType;
+  }
+}
+
+// read one attribute's range
+inline void AttrGetRange(tPvHandle Handle,tAttr& A)
+{
+  const char* name = A.name.c_str();
+  A.min.clear();
+  A.max.clear();
+  A.choices.clear();
+  switch(A.type)
+  {
+    case ePvDatatypeEnum:
+    {
+      tAttrRangeEnumCall call = {Handle,name};
+      AttrLongString(call,A.choices);
+      break;
+    }
+    case ePvDatatypeUint32:
+    {
+      tPvUint32 lo, hi;
+      if(PvAttrRangeUint32(Handle,name,&lo,&hi)==ePvErrSuccess)
+      {
+        A.min = AttrText((unsigned long)lo);
+        A.max = AttrText((unsigned long)hi);
+      }
+      break;
+    }
+    case ePvDatatypeFloat32:
+    {
+      tPvFloat32 lo, hi;
+      if(PvAttrRangeFloat32(Handle,name,&lo,&hi)==ePvErrSuccess)
+      {
+        A.min = AttrText((double)lo,true);
+        A.max = AttrText((double)hi,true);
+      }
+      break;
+    }
+    case ePvDatatypeInt64:
+    {
+      tPvInt64 lo, hi;
+      if(PvAttrRangeInt64(Handle,name,&lo,&hi)==ePvErrSuccess)
+      {
+        A.min = AttrText((long long)lo);
+        A.max = AttrText((long long)hi);
+      }
+      break;
+    }
+    default:
+      break;
+  }
+}
+
+// list the attributes with their types, flags and ranges (no values)
+inline bool AttrDescribe(tPvHandle Handle,std::vector<tAttr>& Attrs)
+{
+  tPvAttrListPtr list;
+  tPvUint32 count;
+  Attrs.clear();
+  if(PvAttrList(Handle,&list,&count)!=ePvErrSuccess)
+    return false;
+  for(tPvUint32 i=0;i<count;i++)
+  {
+    tPvAttributeInfo info;
+    if(PvAttrInfo(Handle,list[i],&info)!=ePvErrSuccess)
+      continue;
+    if(info.Datatype==ePvDatatypeCommand || info.Datatype==ePvDatatypeRaw ||
+       (info.Category && strncmp(info.Category,"/Stats",6)==0))
+      continue;
+    tAttr A;
+    A.name = list[i];
+    A.type = info.Datatype;
+    A.flags = info.Flags;
+    A.category = info.Category ? info.Category : "";
+    A.impact = info.Impact ? info.Impact : "";
+    A.err = ePvErrSuccess;
+    AttrGetRange(Handle,A);
+    Attrs.push_back(A);
+  }
+  return true;
+}
+
+// binary form: little-endian integers, strings as a 32-bit length and bytes
+inline void AttrPut(std::string& Out,uint64_t Value,int Bytes)
+{
+  for(int i=0;i<Bytes;i++)
+    Out += (char)((Value>>(8*i))&0xff);
+}
+
+inline void AttrPut(std::string& Out,const std::string& Value)
+{
+  AttrPut(Out,Value.size(),4);
+  Out += Value;
+}
+
+inline bool AttrTake(const std::string& In,size_t& At,uint64_t& Value,int Bytes)
+{
+  if(At+Bytes>In.size())
+    return false;
+  Value = 0;
+  for(int i=0;i<Bytes;i++)
+    Value |= (uint64_t)(uint8_t)In[At+i]<<(8*i);
+  At += Bytes;
+  return true;
+}
+
+inline bool AttrTake(const std::string& In,size_t& At,std::string& Value)
+{
+  uint64_t size;
+  if(!AttrTake(In,At,size,4) || At+size>In.size())
+    return false;
+  Value.assign(In,At,size);
+  At += size;
+  return true;
+}
+
+inline std::string AttrEncode(const tAttrSnapshot& S)
+{
+  std::string out = ATTR_MAGIC;
+  AttrPut(out,S.uid,8);
+  AttrPut(out,(uint64_t)S.taken,8);
+  AttrPut(out,S.serial);
+  AttrPut(out,S.model);
+  AttrPut(out,S.firmware);
+  AttrPut(out,S.name);
+  AttrPut(out,S.ip);
+  AttrPut(out,S.attrs.size(),4);
+  for(size_t i=0;i<S.attrs.size();i++)
+  {
+    const tAttr& A = S.attrs[i];
+    AttrPut(out,A.name);
+    AttrPut(out,A.type,1);
+    AttrPut(out,A.flags,1);
+    AttrPut(out,A.err,1);
+    AttrPut(out,A.category);
+    AttrPut(out,A.impact);
+    AttrPut(out,A.min);
+    AttrPut(out,A.max);
+    AttrPut(out,A.choices);
+    AttrPut(out,A.value);
+  }
+  return out;
+}
+
+inline bool AttrDecode(const std::string& In,tAttrSnapshot& S)
+{
+  size_t at = strlen(ATTR_MAGIC);
+  uint64_t uid, taken, count;
+  if(In.compare(0,at,ATTR_MAGIC)!=0 || !AttrTake(In,at,uid,8) || !AttrTake(In,at,taken,8) ||
+     !AttrTake(In,at,S.serial) || !AttrTake(In,at,S.model) || !AttrTake(In,at,S.firmware) ||
+     !AttrTake(In,at,S.name) || !AttrTake(In,at,S.ip) || !AttrTake(In,at,count,4))
+    return false;
+  S.uid = uid;
+  S.taken = (int64_t)taken;
+  S.attrs.resize(count<In.size() ? count : 0);
+  for(size_t i=0;i<S.attrs.size();i++)
+  {
+    tAttr& A = S.attrs[i];
+    uint64_t type, flags, err;
+    if(!AttrTake(In,at,A.name) || !AttrTake(In,at,type,1) || !AttrTake(In,at,flags,1) ||
+       !AttrTake(In,at,err,1) || !AttrTake(In,at,A.category) || !AttrTake(In,at,A.impact) ||
+       !AttrTake(In,at,A.min) || !AttrTake(In,at,A.max) || !AttrTake(In,at,A.choices) ||
+       !AttrTake(In,at,A.value))
+      return false;
+    A.type = (tPvDatatype)type;
+    A.flags = flags;
+    A.err = (tPvErr)err;
+  }
+  return S.attrs.size()==count;
+}
+
+// JSON form: camera fields on the first line, then one flat object per attribute
+inline void AttrJsonString(std::string& Out,const std::string& Value)
+{
+  Out += '"';
+  for(size_t i=0;i<Value.size();i++)
+  {
+    unsigned char c = Value[i];
+    if(c=='"' || c=='\\')
+    {
+      Out += '\\';
+      Out += c;
+    }
+    else if(c<0x20)
+    {
+      char escaped[8];
+      snprintf(escaped,sizeof(escaped),"\\u%04x",c);
+      Out += escaped;
+    }
+    else
+      Out += c;
+  }
+  Out += '"';
+}
+
+// a value as JSON: numbers and booleans bare, the rest as strings
+inline void AttrJsonValue(std::string& Out,tPvDatatype Type,const std::string& Value)
+{
+  bool bare = !Value.empty() && (Type==ePvDatatypeUint32 || Type==ePvDatatypeInt64 ||
+              Type==ePvDatatypeBoolean || (Type==ePvDatatypeFloat32 && Value.find_first_of("ni")==std::string::npos));
+  if(bare)
+    Out += Value;
+  else
+    AttrJsonString(Out,Value);
+}
+
+inline std::string AttrFlagText(unsigned long Flags)
+{
+  std::string text;
+  text += Flags & ePvFlagRead ? "r" : "";
+  text += Flags & ePvFlagWrite ? "w" : "";
+  text += Flags & ePvFlagVolatile ? "v" : "";
+  text += Flags & ePvFlagConst ? "c" : "";
+  return text;
+}
+
+inline std::string AttrToJson(const tAttrSnapshot& S)
+{
+  std::string out = "{\"uid\":" + AttrText(S.uid) + ",\"serial\":";
+  AttrJsonString(out,S.serial);
+  out += ",\"model\":";
+  AttrJsonString(out,S.model);
+  out += ",\"firmware\":";
+  AttrJsonString(out,S.firmware);
+  out += ",\"name\":";
+  AttrJsonString(out,S.name);
+  out += ",\"ip\":";
+  AttrJsonString(out,S.ip);
+  out += ",\"taken\":" + AttrText((long long)S.taken) + ",\"attributes\":[\n";
+  for(size_t i=0;i<S.attrs.size();i++)
+  {
+    const tAttr& A = S.attrs[i];
+    out += " {\"name\":";
+    AttrJsonString(out,A.name);
+    out += ",\"type\":\"";
+    out += AttrTypeName(A.type);
+    out += "\",\"flags\":\"" + AttrFlagText(A.flags) + "\",\"category\":";
+    AttrJsonString(out,A.category);
+    out += ",\"impact\":";
+    AttrJsonString(out,A.impact);
+    if(!A.min.empty())
+    {
+      out += ",\"min\":";
+      AttrJsonValue(out,A.type,A.min);
+      out += ",\"max\":";
+      AttrJsonValue(out,A.type,A.max);
+    }
+    if(!A.choices.empty())
+    {
+      out += ",\"choices\":";
+      AttrJsonString(out,A.choices);
+    }
+    if(A.err==ePvErrSuccess)
+    {
+      out += ",\"value\":";
+      AttrJsonValue(out,A.type,A.value);
+    }
+    else
+      out += ",\"error\":" + AttrText((unsigned long)A.err);
+    out += i+1<S.attrs.size() ? "},\n" : "}\n";
+  }
+  out += "]}\n";
+  return out;
+}
+
+// fields of one flat JSON object, as text; stops at a nested array or object
+inline void AttrJsonFields(const std::string& Line,std::map<std::string,std::string>& Fields)
+{
+  size_t at = Line.find('{');
+  while(at!=std::string::npos && at<Line.size())
+  {
+    // key
+    size_t open = Line.find('"',at);
+    if(open==std::string::npos)
+      return;
+    size_t close = Line.find('"',open+1);
+    size_t colon = close==std::string::npos ? close : Line.find(':',close);
+    if(colon==std::string::npos)
+      return;
+    std::string key(Line,open+1,close-open-1);
+    at = Line.find_first_not_of(" \t",colon+1);
+    if(at==std::string::npos || Line[at]=='[' || Line[at]=='{')
+      return;
+
+    // value: a string with escapes, or a bare word up to the next , or }
+    std::string value;
+    if(Line[at]=='"')
+    {
+      for(at++;at<Line.size() && Line[at]!='"';at++)
+      {
+        if(Line[at]!='\\' || at+1>=Line.size())
+        {
+          value += Line[at];
+          continue;
+        }
+        char c = Line[++at];
+        if(c=='u' && at+4<Line.size())
+        {
+          value += (char)strtol(Line.substr(at+1,4).c_str(),NULL,16);
+          at += 4;
+        }
+        else
+          value += c=='n' ? '\n' : c=='t' ? '\t' : c=='r' ? '\r' : c;
+      }
+      at++;
+    }
+    else
+    {
+      size_t end = Line.find_first_of(",}",at);
+      value.assign(Line,at,end==std::string::npos ? std::string::npos : end-at);
+      at = end;
+    }
+    Fields[key] = value;
+    at = at==std::string::npos ? at : Line.find_first_of(",}",at);
+    if(at==std::string::npos || Line[at]=='}')
+      return;
+    at++;
+  }
+}
+
+inline bool AttrFromJson(const std::string& In,tAttrSnapshot& S)
+{
+  size_t start = 0, end;
+  bool header = false;
+  while(start<In.size())
+  {
+    end = In.find('\n',start);
+    end = end==std::string::npos ? In.size() : end;
+    std::string line(In,start,end-start);
+    start = end+1;
+    std::map<std::string,std::string> f;
+    AttrJsonFields(line,f);
+    if(!header)
+    {
+      if(!f.count("serial"))
+        return false;
+      S.uid = strtoul(f["uid"].c_str(),NULL,10);
+      S.serial = f["serial"];
+      S.model = f["model"];
+      S.firmware = f["firmware"];
+      S.name = f["name"];
+      S.ip = f["ip"];
+      S.taken = strtoll(f["taken"].c_str(),NULL,10);
+      header = true;
+      continue;
+    }
+    if(!f.count("name"))
+      continue;
+    tAttr A;
+    A.name = f["name"];
+    A.type = AttrTypeFromName(f["type"]);
+    std::string flags = f["flags"];
+    A.flags = (flags.find('r')!=std::string::npos ? ePvFlagRead : 0) |
+              (flags.find('w')!=std::string::npos ? ePvFlagWrite : 0) |
+              (flags.find('v')!=std::string::npos ? ePvFlagVolatile : 0) |
+              (flags.find('c')!=std::string::npos ? ePvFlagConst : 0);
+    A.category = f["category"];
+    A.impact = f["impact"];
+    A.min = f["min"];
+    A.max = f["max"];
+    A.choices = f["choices"];
+    A.value = f["value"];
+    A.err = f.count("error") ? (tPvErr)atoi(f["error"].c_str()) : ePvErrSuccess;
+    S.attrs.push_back(A);
+  }
+  return header;
+}
+
+// whole file to and from a string
+inline bool AttrReadFile(const char* Path,std::string& Data)
+{
+  FILE* file = fopen(Path,"rb");
+  if(!file)
+    return false;
+  char buffer[65536];
+  size_t n;
+  Data.clear();
+  while((n=fread(buffer,1,sizeof(buffer),file))>0)
+    Data.append(buffer,n);
+  bool ok = !ferror(file);
+  fclose(file);
+  return ok;
+}
+
+// write through a temporary file and rename, so readers never see half a file
+inline bool AttrWriteFile(const char* Path,const std::string& Data)
+{
+  // a unique name, since threads (dump_camera -j) may write the same path
+  std::string temporary = std::string(Path) + ".XXXXXX";
+  int fd = mkstemp(&temporary[0]);
+  if(fd<0)
+    return false;
+  fchmod(fd,0644);
+  FILE* file = fdopen(fd,"wb");
+  if(!file)
+  {
+    close(fd);
+    unlink(temporary.c_str());
+    return false;
+  }
+  bool ok = fwrite(Data.data(),1,Data.size(),file)==Data.size();
+  ok = fclose(file)==0 && ok;
+  ok = ok && rename(temporary.c_str(),Path)==0;
+  if(!ok)
+    unlink(temporary.c_str());
+  return ok;
+}
+
+// save as JSON or binary
+inline bool AttrSave(const char* Path,const tAttrSnapshot& S,bool Binary)
+{
+  return AttrWriteFile(Path,Binary ? AttrEncode(S) : AttrToJson(S));
+}
+
+// load a snapshot in either form
+inline bool AttrLoad(const char* Path,tAttrSnapshot& S)
+{
+  std::string data;
+  S = tAttrSnapshot();
+  if(!AttrReadFile(Path,data))
+    return false;
+  return data.compare(0,strlen(ATTR_MAGIC),ATTR_MAGIC)==0 ? AttrDecode(data,S) : AttrFromJson(data,S);
+}
+
+// an attribute by name (NULL if the snapshot has none)
+inline const tAttr* AttrFind(const tAttrSnapshot& S,const std::string& Name)
+{
+  for(size_t i=0;i<S.attrs.size();i++)
+    if(S.attrs[i].name==Name)
+      return &S.attrs[i];
+  return NULL;
+}
+
+// cache file of a model and firmware
+inline std::string AttrCachePath(const char* Dir,const std::string& Model,const std::string& Firmware)
+{
+  std::string key = Model + "_" + Firmware;
+  for(size_t i=0;i<key.size();i++)
+    if(!isalnum((unsigned char)key[i]) && key[i]!='.' && key[i]!='-')
+      key[i] = '_';
+  return std::string(Dir) + "/" + key + ".attrs";
+}
+
+// everything about a camera: descriptions from the model cache (or the
+// camera, when Refresh is set or nothing is cached), then the values;
+// Cached tells which it was. CacheDir NULL means no cache.
+inline bool AttrSnapshot(tPvHandle Handle,const tPvCameraInfoEx& Info,const char* Ip,
+                         const char* CacheDir,bool Refresh,tAttrSnapshot& S,bool* Cached = NULL)
+{
+  S = tAttrSnapshot();
+  S.uid = Info.UniqueId;
+  S.serial = Info.SerialNumber;
+  S.model = Info.ModelName;
+  S.firmware = Info.FirmwareVersion;
+  S.name = Info.CameraName;
+  S.ip = Ip ? Ip : "";
+  S.taken = time(NULL);
+
+  std::string path = CacheDir ? AttrCachePath(CacheDir,S.model,S.firmware) : "";
+  tAttrSnapshot cache;
+  bool cached = CacheDir && !Refresh && AttrLoad(path.c_str(),cache) && !cache.attrs.empty();
+  if(Cached)
+    *Cached = cached;
+  if(cached)
+    S.attrs = cache.attrs;
+  else
+  {
+    if(!AttrDescribe(Handle,S.attrs))
+      return false;
+    if(CacheDir)
+    {
+      // the cache is a snapshot of the model with no camera and no values
+      cache = tAttrSnapshot();
+      cache.uid = 0;
+      cache.taken = S.taken;
+      cache.model = S.model;
+      cache.firmware = S.firmware;
+      cache.attrs = S.attrs;
+      mkdir(CacheDir,0777);
+      AttrSave(path.c_str(),cache,true);
+    }
+  }
+
+  for(size_t i=0;i<S.attrs.size();i++)
+    S.attrs[i].err = AttrGet(Handle,S.attrs[i],S.attrs[i].value);
+  return true;
+}
+
+#endif
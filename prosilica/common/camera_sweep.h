@@ -0,0 +1,290 @@
+/* Header-only parallel sweep of the cameras PvAPI knows.
+ *
+ * SweepList sizes its lists from PvCameraCount and grows them until every
+ * camera fits, so there is no fixed limit. SweepQuery then asks each
+ * reachable camera for its info and IP settings from a pool of worker
+ * threads; a sweep takes about as long as the slowest query, not the sum.
+ *
+ * Results reach the callback in unique ID order, each as soon as it and all
+ * cameras before it are done. A query that runs past the timeout is reported
+ * with ePvErrTimeout and its worker is replaced, so a silent camera costs the
+ * timeout once instead of holding up the cameras queued behind it. The late
+ * worker finishes its call in the background and its answer is dropped; if
+ * no replacement can be started and every worker is late, the cameras still
+ * queued are reported with ePvErrResources. Before returning, SweepQuery
+ * waits up to SWEEP_DRAIN_MS for late workers to leave PvAPI, so the caller
+ * can uninitialize it; a call hung longer than that is abandoned.
+ */
+
+#ifndef CAMERA_SWEEP_H_INCLUDE
+#define CAMERA_SWEEP_H_INCLUDE
+
+// includes
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <algorithm>
+#include <vector>
+#include <PvApi.h>
+
+#define SWEEP_WORKERS    256  // default queries in flight
+#define SWEEP_STACK      (256*1024) // workers only wait on PvAPI calls
+#define SWEEP_TIMEOUT_MS 1000 // default time one query may take
+#define SWEEP_DRAIN_MS   5000 // most time spent waiting for late workers
+
+// one camera of a sweep
+typedef struct
+{
+  tPvCameraInfoEx info;
+  tPvIpSettings   ip;
+  tPvErr          err;       // of the IP query (ePvErrTimeout if it took too long)
+  bool            reachable; // unreachable cameras are listed but not queried
+} tSweepResult;
+
+// called for each camera, in unique ID order, from the caller's thread
+typedef void (*tSweepCallback)(void* Context,const tSweepResult& Result);
+
+// state shared by the caller and the workers (freed by whoever leaves last)
+typedef struct
+{
+  pthread_mutex_t           lock;
+  pthread_cond_t            changed;
+  std::vector<tSweepResult> results;
+  std::vector<double>       started;  // when each query began (0 = not yet)
+  std::vector<char>         done;
+  std::vector<char>         late;     // timed out while its worker is still in PvAPI
+  size_t                    next;     // next camera to hand out
+  int                       live;     // workers running
+  int                       stalled;  // of them, in a late query
+  int                       refs;
+} tSweepState;
+
+// orders list positions by unique ID
+struct tSweepOrder
+{
+  const std::vector<tPvCameraInfoEx>& list;
+  tSweepOrder(const std::vector<tPvCameraInfoEx>& List) : list(List) {}
+  bool operator()(size_t a,size_t b) const { return list[a].UniqueId<list[b].UniqueId; }
+};
+
+// seconds on the monotonic clock
+inline double SweepNow()
+{
+  struct timespec tp;
+  clock_gettime(CLOCK_MONOTONIC,&tp);
+  return tp.tv_sec + tp.tv_nsec/1e9;
+}
+
+// reachable cameras first, then unreachable ones; returns how many are reachable
+inline unsigned long SweepList(std::vector<tPvCameraInfoEx>& List)
+{
+  List.clear();
+  unsigned long reachable = 0;
+  for(int unreachable=0;unreachable<2;unreachable++)
+  {
+    // the list may grow between the count and the call; ask again until it fits
+    std::vector<tPvCameraInfoEx> part(PvCameraCount()+8);
+    unsigned long found = 0, filled;
+    while(true)
+    {
+      filled = unreachable ? PvCameraListUnreachableEx(&part[0],part.size(),&found,sizeof(tPvCameraInfoEx))
+                           : PvCameraListEx(&part[0],part.size(),&found,sizeof(tPvCameraInfoEx));
+      if(found<=part.size())
+        break;
+      part.resize(found+8);
+    }
+    List.insert(List.end(),part.begin(),part.begin()+filled);
+    if(!unreachable)
+      reachable = filled;
+  }
+  return reachable;
+}
+
+// drop one reference to the shared state
+inline void SweepRelease(tSweepState* S)
+{
+  pthread_mutex_lock(&S->lock);
+  bool last = --S->refs==0;
+  pthread_mutex_unlock(&S->lock);
+  if(last)
+  {
+    pthread_mutex_destroy(&S->lock);
+    pthread_cond_destroy(&S->changed);
+    delete S;
+  }
+}
+
+// worker: query cameras until none are left
+inline void* SweepWorker(void* pContext)
+{
+  tSweepState* S = (tSweepState*)pContext;
+  pthread_mutex_lock(&S->lock);
+  while(true)
+  {
+    while(S->next<S->results.size() && S->done[S->next])
+      S->next++;
+    if(S->next>=S->results.size())
+      break;
+    size_t i = S->next++;
+    S->started[i] = SweepNow();
+    tSweepResult R = S->results[i];
+    pthread_mutex_unlock(&S->lock);
+
+    tPvCameraInfoEx info;
+    if(PvCameraInfoEx(R.info.UniqueId,&info,sizeof(tPvCameraInfoEx))==ePvErrSuccess)
+      R.info = info;
+    R.err = PvCameraIpSettingsGet(R.info.UniqueId,&R.ip);
+
+    pthread_mutex_lock(&S->lock);
+    if(S->late[i])
+    {
+      S->late[i] = 0;
+      S->stalled--;
+    }
+    if(!S->done[i])
+    {
+      S->results[i] = R;
+      S->done[i] = 1;
+      pthread_cond_broadcast(&S->changed);
+    }
+  }
+  S->live--;
+  pthread_cond_broadcast(&S->changed);
+  pthread_mutex_unlock(&S->lock);
+  SweepRelease(S);
+  return 0;
+}
+
+// start one more worker (lock held); false if no thread could be made
+inline bool SweepSpawn(tSweepState* S)
+{
+  pthread_attr_t attr;
+  pthread_t thread;
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr,PTHREAD_CREATE_DETACHED);
+  pthread_attr_setstacksize(&attr,SWEEP_STACK);
+  S->refs++;
+  S->live++;
+  bool ok = pthread_create(&thread,&attr,SweepWorker,S)==0;
+  if(!ok)
+  {
+    S->refs--;
+    S->live--;
+  }
+  pthread_attr_destroy(&attr);
+  return ok;
+}
+
+// query the first Reachable cameras of List; returns how many answered in time
+inline unsigned long SweepQuery(const std::vector<tPvCameraInfoEx>& List,unsigned long Reachable,
+                                unsigned int Workers,unsigned int TimeoutMs,
+                                tSweepCallback Callback,void* Context)
+{
+  tSweepState* S = new tSweepState;
+  size_t n = List.size();
+  S->results.resize(n);
+  S->started.assign(n,0);
+  S->done.assign(n,0);
+  S->late.assign(n,0);
+  S->next = 0;
+  S->live = 0;
+  S->stalled = 0;
+  S->refs = 1;
+  for(size_t i=0;i<n;i++)
+  {
+    memset(&S->results[i],0,sizeof(tSweepResult));
+    S->results[i].info = List[i];
+    S->results[i].reachable = i<Reachable;
+    S->done[i] = i>=Reachable;
+  }
+
+  // answers are released in unique ID order
+  std::vector<size_t> order(n);
+  for(size_t i=0;i<n;i++)
+    order[i] = i;
+  std::stable_sort(order.begin(),order.end(),tSweepOrder(List));
+
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr,CLOCK_MONOTONIC);
+  pthread_mutex_init(&S->lock,NULL);
+  pthread_cond_init(&S->changed,&attr);
+  pthread_condattr_destroy(&attr);
+
+  pthread_mutex_lock(&S->lock);
+  unsigned int workers = Workers<Reachable ? Workers : (unsigned int)Reachable;
+  for(unsigned int i=0;i<workers;i++)
+    SweepSpawn(S);
+
+  unsigned long answered = 0;
+  size_t emitted = 0;
+  while(emitted<n)
+  {
+    // hand over everything that is ready, in order, outside the lock
+    while(emitted<n && S->done[order[emitted]])
+    {
+      tSweepResult R = S->results[order[emitted++]];
+      answered += R.reachable && R.err==ePvErrSuccess;
+      pthread_mutex_unlock(&S->lock);
+      Callback(Context,R);
+      pthread_mutex_lock(&S->lock);
+    }
+    if(emitted>=n)
+      break;
+
+    // give up on queries past their time, and replace their workers
+    double now = SweepNow();
+    double wake = now+1;
+    for(size_t i=0;i<n;i++)
+    {
+      if(S->done[i] || S->started[i]==0)
+        continue;
+      double deadline = S->started[i]+TimeoutMs/1000.0;
+      if(now>=deadline)
+      {
+        S->results[i].err = ePvErrTimeout;
+        S->done[i] = 1;
+        S->late[i] = 1;
+        S->stalled++;
+        if(S->next<n)
+          SweepSpawn(S);
+      }
+      else if(deadline<wake)
+        wake = deadline;
+    }
+
+    // no threads, or every worker late and none replaced: nobody would take
+    // the rest of the queue, so mark it failed rather than wait forever
+    if(S->live==S->stalled)
+    {
+      for(size_t i=S->next;i<n;i++)
+      {
+        if(!S->done[i])
+        {
+          S->results[i].err = ePvErrResources;
+          S->done[i] = 1;
+        }
+      }
+    }
+    if(S->done[order[emitted]])
+      continue;
+
+    struct timespec until;
+    until.tv_sec = (time_t)wake;
+    until.tv_nsec = (long)((wake-until.tv_sec)*1e9);
+    pthread_cond_timedwait(&S->changed,&S->lock,&until);
+  }
+
+  // let late workers leave PvAPI before the caller uninitializes it
+  double drain = SweepNow()+SWEEP_DRAIN_MS/1000.0;
+  struct timespec until;
+  until.tv_sec = (time_t)drain;
+  until.tv_nsec = (long)((drain-until.tv_sec)*1e9);
+  while(S->live>0 && SweepNow()<drain)
+    pthread_cond_timedwait(&S->changed,&S->lock,&until);
+  pthread_mutex_unlock(&S->lock);
+  SweepRelease(S);
+  return answered;
+}
+
+#endif
@@ -0,0 +1,132 @@
+/* Header-only CRC32C (Castagnoli polynomial, as used by iSCSI and ext4).
+ *
+ * Crc32c uses the ARMv8 CRC32 instructions or SSE4.2 crc32 when the compiler
+ * targets them and falls back to slicing-by-8 tables otherwise (eight bytes
+ * per step through eight 256-entry tables). All paths give the same value.
+ * The running value is passed in and returned, so a CRC can be built up
+ * piece by piece; start from 0. Crc32c(0,"123456789",9) is 0xe3069283.
+ */
+
+#ifndef CRC32C_H_INCLUDE
+#define CRC32C_H_INCLUDE
+
+// includes
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#if defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define CRC32C_ARM
+#elif defined(__SSE4_2__)
+#include <nmmintrin.h>
+#define CRC32C_SSE42
+#endif
+
+#define CRC32C_POLY 0x82f63b78u // reflected
+
+// slicing-by-8 tables, built on first use
+typedef struct tCrc32cTables
+{
+  uint32_t t[8][256];
+
+  tCrc32cTables()
+  {
+    for(uint32_t n=0;n<256;n++)
+    {
+      uint32_t c = n;
+      for(int k=0;k<8;k++)
+        c = (c>>1) ^ (CRC32C_POLY & (0u-(c&1)));
+      t[0][n] = c;
+    }
+    for(uint32_t n=0;n<256;n++)
+      for(int k=1;k<8;k++)
+        t[k][n] = (t[k-1][n]>>8) ^ t[0][t[k-1][n]&0xff];
+  }
+} tCrc32cTables;
+
+inline const tCrc32cTables& Crc32cTables()
+{
+  static const tCrc32cTables tables;
+  return tables;
+}
+
+// portable CRC on the inverted running value
+inline uint32_t Crc32cSoftware(uint32_t c,const uint8_t* p,size_t n)
+{
+  const tCrc32cTables& T = Crc32cTables();
+
+  while(n && ((uintptr_t)p&7))
+  {
+    c = (c>>8) ^ T.t[0][(c^*p++)&0xff];
+    n--;
+  }
+  while(n>=8)
+  {
+    // little-endian loads, as the recordings themselves
+    uint32_t lo = p[0] | (p[1]<<8) | (p[2]<<16) | ((uint32_t)p[3]<<24);
+    uint32_t hi = p[4] | (p[5]<<8) | (p[6]<<16) | ((uint32_t)p[7]<<24);
+    lo ^= c;
+    c = T.t[7][lo&0xff] ^ T.t[6][(lo>>8)&0xff] ^ T.t[5][(lo>>16)&0xff] ^ T.t[4][lo>>24] ^
+        T.t[3][hi&0xff] ^ T.t[2][(hi>>8)&0xff] ^ T.t[1][(hi>>16)&0xff] ^ T.t[0][hi>>24];
+    p += 8;
+    n -= 8;
+  }
+  while(n--)
+    c = (c>>8) ^ T.t[0][(c^*p++)&0xff];
+  return c;
+}
+
+// CRC32C of Size bytes at Data, continuing from Crc
+inline uint32_t Crc32c(uint32_t Crc,const void* Data,size_t Size)
+{
+  const uint8_t* p = (const uint8_t*)Data;
+  uint32_t c = ~Crc;
+
+#if defined(CRC32C_ARM)
+  while(Size && ((uintptr_t)p&7))
+  {
+    c = __crc32cb(c,*p++);
+    Size--;
+  }
+  for(;Size>=8;p+=8,Size-=8)
+  {
+    uint64_t v;
+    memcpy(&v,p,8);
+    c = __crc32cd(c,v);
+  }
+  while(Size--)
+    c = __crc32cb(c,*p++);
+#elif defined(CRC32C_SSE42)
+  while(Size && ((uintptr_t)p&7))
+  {
+    c = _mm_crc32_u8(c,*p++);
+    Size--;
+  }
+#if defined(__x86_64__)
+  uint64_t c64 = c;
+  for(;Size>=8;p+=8,Size-=8)
+  {
+    uint64_t v;
+    memcpy(&v,p,8);
+    c64 = _mm_crc32_u64(c64,v);
+  }
+  c = (uint32_t)c64;
+#else
+  for(;Size>=4;p+=4,Size-=4)
+  {
+    uint32_t v;
+    memcpy(&v,p,4);
+    c = _mm_crc32_u32(c,v);
+  }
+#endif
+  while(Size--)
+    c = _mm_crc32_u8(c,*p++);
+#else
+  c = Crc32cSoftware(c,p,Size);
+#endif
+
+  return ~c;
+}
+
+#endif
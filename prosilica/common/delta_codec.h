@@ -0,0 +1,734 @@
+/* Header-only lossless inter-frame codec for snap_image recordings.
+ *
+ * Every keyInterval-th frame is a keyframe, predicted from the sample one
+ * stride to its left (stride 2 keeps Bayer colours apart, 3 or 4 the
+ * channels of packed colour formats). All other frames are predicted from
+ * the previous frame. Residuals are wrapped to the sample width, zigzag
+ * mapped to unsigned values and Rice coded in blocks of DELTA_BLOCK samples,
+ * each with its own parameter; a block of zeros costs five bits, so a static
+ * scene compresses to little more than its noise. A frame that would grow
+ * is stored as is. Differencing and its inverse have NEON and SSE2 paths.
+ *
+ * File layout: a 96-byte tDeltaHeader, then per frame a tDeltaFrame (time
+ * block, payload size, flags), the frame's footer entry if the source had a
+ * footer, and the payload. Closing the file appends a table of frame offsets
+ * and fills in frameCount and indexOffset, so a finished file seeks to any
+ * frame by decoding from the keyframe before it, while a file still being
+ * written can be read front to back.
+ */
+
+#ifndef DELTA_CODEC_H_INCLUDE
+#define DELTA_CODEC_H_INCLUDE
+
+// includes
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include <recording.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define DC_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define DC_SSE2
+#endif
+
+#define DELTA_MAGIC       "SEDDLT1"
+#define DELTA_HEADER_SIZE 96
+#define DELTA_FRAME_SIZE  24
+#define DELTA_BLOCK       32 // samples per Rice parameter
+#define DELTA_ZERO_BLOCK  31 // block header for a block of zeros
+#define DELTA_ESCAPE      24 // unary length that introduces a raw value
+
+// payload modes (first payload byte)
+typedef enum
+{
+  eDeltaKey    = 0, // spatial prediction
+  eDeltaInter  = 1, // previous frame prediction
+  eDeltaStored = 2  // raw image
+} tDeltaMode;
+
+// file header (little-endian, padded to DELTA_HEADER_SIZE)
+typedef struct
+{
+  char             magic[8];
+  uint64_t         frameCount;    // frames written (0 until closed)
+  uint64_t         indexOffset;   // frame offset table (0 until closed)
+  tRecordingHeader recording;     // header of the source recording
+  uint32_t         keyInterval;
+  uint32_t         sampleSize;    // 1 or 2 bytes
+  uint32_t         stride;        // keyframe prediction distance in samples
+  uint32_t         framesDropped; // source trailer
+  uint32_t         infoSize;      // footer entry bytes per frame (0 = none)
+  uint32_t         complete;      // source had its trailer
+  uint8_t          reserved[DELTA_HEADER_SIZE-84];
+} tDeltaHeader;
+
+// frame record header
+typedef struct
+{
+  tFrameStamp stamp;
+  uint32_t    size;   // payload bytes
+  uint32_t    flags;  // bit 0: keyframe
+} tDeltaFrame;
+
+// sample layout of an image
+typedef struct
+{
+  uint32_t sampleSize;
+  uint32_t sampleBits;
+  uint32_t stride;
+  uint32_t imageSize;
+  uint64_t samples;
+} tDeltaLayout;
+
+// layout for a recording header
+inline tDeltaLayout DeltaLayoutFor(const tRecordingHeader& H)
+{
+  static const struct { const char* name; uint32_t sampleSize; uint32_t stride; } formats[] =
+  {
+    {"Mono16",2,1}, {"Bayer16",2,2}, {"Rgb48",2,3}, {"Bayer8",1,2},
+    {"Rgb24",1,3}, {"Bgr24",1,3}, {"Rgba32",1,4}, {"Bgra32",1,4},
+    {"Yuv411",1,3}, {"Yuv422",1,2}, {"Yuv444",1,3},
+    {"Mono12Packed",1,3}, {"Bayer12Packed",1,3}
+  };
+
+  tDeltaLayout L;
+  L.sampleSize = 1;
+  L.stride = 1;
+  for(unsigned int i=0;i<sizeof(formats)/sizeof(formats[0]);i++)
+    if(strcmp(H.pixelFormat,formats[i].name)==0)
+    {
+      L.sampleSize = formats[i].sampleSize;
+      L.stride = formats[i].stride;
+    }
+  L.imageSize = (uint32_t)RecordingImageSize(H.width,H.height,H.pixelFormat);
+  if(L.imageSize % L.sampleSize)
+    L.sampleSize = 1;
+  L.sampleBits = 8*L.sampleSize;
+  L.samples = L.imageSize/L.sampleSize;
+  return L;
+}
+
+// largest payload for a layout (mode byte plus a stored image)
+inline uint32_t DeltaMaxPayload(const tDeltaLayout& L)
+{
+  return 1 + L.imageSize;
+}
+
+// room the encoder needs: a stored image plus one worst-case block past it
+inline uint32_t DeltaEncodeRoom(const tDeltaLayout& L)
+{
+  return DeltaMaxPayload(L) + (5 + DELTA_BLOCK*(DELTA_ESCAPE+16))/8 + 16;
+}
+
+// ---- kernels ----
+
+// zigzag-mapped wrapped differences A-B
+inline void DiffRow8(const uint8_t* a,const uint8_t* b,uint16_t* z,size_t n)
+{
+  size_t i = 0;
+#if defined(DC_NEON)
+  for(;i+16<=n;i+=16)
+  {
+    int8x16_t d = vreinterpretq_s8_u8(vsubq_u8(vld1q_u8(a+i),vld1q_u8(b+i)));
+    uint8x16_t m = vreinterpretq_u8_s8(veorq_s8(vshlq_n_s8(d,1),vshrq_n_s8(d,7)));
+    vst1q_u16(z+i,vmovl_u8(vget_low_u8(m)));
+    vst1q_u16(z+i+8,vmovl_u8(vget_high_u8(m)));
+  }
+#elif defined(DC_SSE2)
+  __m128i zero = _mm_setzero_si128();
+  for(;i+16<=n;i+=16)
+  {
+    __m128i d = _mm_sub_epi8(_mm_loadu_si128((const __m128i*)(a+i)),_mm_loadu_si128((const __m128i*)(b+i)));
+    __m128i m = _mm_xor_si128(_mm_add_epi8(d,d),_mm_cmpgt_epi8(zero,d));
+    _mm_storeu_si128((__m128i*)(z+i),_mm_unpacklo_epi8(m,zero));
+    _mm_storeu_si128((__m128i*)(z+i+8),_mm_unpackhi_epi8(m,zero));
+  }
+#endif
+  for(;i<n;i++)
+  {
+    int8_t d = (int8_t)(uint8_t)(a[i]-b[i]);
+    z[i] = (uint8_t)((d<<1) ^ (d>>7));
+  }
+}
+
+inline void DiffRow16(const uint16_t* a,const uint16_t* b,uint16_t* z,size_t n)
+{
+  size_t i = 0;
+#if defined(DC_NEON)
+  for(;i+8<=n;i+=8)
+  {
+    int16x8_t d = vreinterpretq_s16_u16(vsubq_u16(vld1q_u16(a+i),vld1q_u16(b+i)));
+    vst1q_u16(z+i,vreinterpretq_u16_s16(veorq_s16(vshlq_n_s16(d,1),vshrq_n_s16(d,15))));
+  }
+#elif defined(DC_SSE2)
+  for(;i+8<=n;i+=8)
+  {
+    __m128i d = _mm_sub_epi16(_mm_loadu_si128((const __m128i*)(a+i)),_mm_loadu_si128((const __m128i*)(b+i)));
+    _mm_storeu_si128((__m128i*)(z+i),_mm_xor_si128(_mm_slli_epi16(d,1),_mm_srai_epi16(d,15)));
+  }
+#endif
+  for(;i<n;i++)
+  {
+    int16_t d = (int16_t)(uint16_t)(a[i]-b[i]);
+    z[i] = (uint16_t)((d<<1) ^ (d>>15));
+  }
+}
+
+// inverse of DiffRow: A = B + unzigzag(z)
+inline void UndiffRow8(const uint16_t* z,const uint8_t* b,uint8_t* a,size_t n)
+{
+  size_t i = 0;
+#if defined(DC_NEON)
+  for(;i+16<=n;i+=16)
+  {
+    uint8x16_t m = vcombine_u8(vmovn_u16(vld1q_u16(z+i)),vmovn_u16(vld1q_u16(z+i+8)));
+    uint8x16_t d = veorq_u8(vshrq_n_u8(m,1),vreinterpretq_u8_s8(vnegq_s8(vreinterpretq_s8_u8(vandq_u8(m,vdupq_n_u8(1))))));
+    vst1q_u8(a+i,vaddq_u8(vld1q_u8(b+i),d));
+  }
+#elif defined(DC_SSE2)
+  __m128i one = _mm_set1_epi16(1), low = _mm_set1_epi16(0xff), zero = _mm_setzero_si128();
+  for(;i+16<=n;i+=16)
+  {
+    __m128i m0 = _mm_loadu_si128((const __m128i*)(z+i)), m1 = _mm_loadu_si128((const __m128i*)(z+i+8));
+    __m128i d0 = _mm_xor_si128(_mm_srli_epi16(m0,1),_mm_sub_epi16(zero,_mm_and_si128(m0,one)));
+    __m128i d1 = _mm_xor_si128(_mm_srli_epi16(m1,1),_mm_sub_epi16(zero,_mm_and_si128(m1,one)));
+    __m128i d = _mm_packus_epi16(_mm_and_si128(d0,low),_mm_and_si128(d1,low));
+    _mm_storeu_si128((__m128i*)(a+i),_mm_add_epi8(_mm_loadu_si128((const __m128i*)(b+i)),d));
+  }
+#endif
+  for(;i<n;i++)
+    a[i] = (uint8_t)(b[i] + ((z[i]>>1) ^ (0u-(z[i]&1))));
+}
+
+inline void UndiffRow16(const uint16_t* z,const uint16_t* b,uint16_t* a,size_t n)
+{
+  size_t i = 0;
+#if defined(DC_NEON)
+  for(;i+8<=n;i+=8)
+  {
+    uint16x8_t m = vld1q_u16(z+i);
+    uint16x8_t d = veorq_u16(vshrq_n_u16(m,1),vreinterpretq_u16_s16(vnegq_s16(vreinterpretq_s16_u16(vandq_u16(m,vdupq_n_u16(1))))));
+    vst1q_u16(a+i,vaddq_u16(vld1q_u16(b+i),d));
+  }
+#elif defined(DC_SSE2)
+  __m128i one = _mm_set1_epi16(1), zero = _mm_setzero_si128();
+  for(;i+8<=n;i+=8)
+  {
+    __m128i m = _mm_loadu_si128((const __m128i*)(z+i));
+    __m128i d = _mm_xor_si128(_mm_srli_epi16(m,1),_mm_sub_epi16(zero,_mm_and_si128(m,one)));
+    _mm_storeu_si128((__m128i*)(a+i),_mm_add_epi16(_mm_loadu_si128((const __m128i*)(b+i)),d));
+  }
+#endif
+  for(;i<n;i++)
+    a[i] = (uint16_t)(b[i] + ((z[i]>>1) ^ (0u-(z[i]&1))));
+}
+
+// ---- bit streams (least significant bit first) ----
+
+typedef struct
+{
+  uint8_t* p;
+  uint64_t acc;
+  unsigned int n;
+} tBitWriter;
+
+inline void BitPut(tBitWriter& W,uint32_t Value,unsigned int Bits)
+{
+  W.acc |= (uint64_t)Value << W.n;
+  W.n += Bits;
+  if(W.n>=32)
+  {
+    uint32_t word = (uint32_t)W.acc;
+    W.p[0] = word; W.p[1] = word>>8; W.p[2] = word>>16; W.p[3] = word>>24;
+    W.p += 4;
+    W.acc >>= 32;
+    W.n -= 32;
+  }
+}
+
+inline void BitFlush(tBitWriter& W)
+{
+  for(;W.n>0;W.n=W.n>8 ? W.n-8 : 0,W.acc>>=8)
+    *W.p++ = (uint8_t)W.acc;
+}
+
+typedef struct
+{
+  const uint8_t* p;
+  const uint8_t* end;
+  uint64_t acc;
+  unsigned int n;
+  bool overrun;
+} tBitReader;
+
+// top up to at least 56 bits (zeros past the end, flagged once used)
+inline void BitRefill(tBitReader& R)
+{
+  if(R.n<=56 && R.end-R.p>=8)
+  {
+    // whole bytes that fit, from one unaligned little-endian load
+    uint64_t v;
+    memcpy(&v,R.p,8);
+    R.acc |= v << R.n;
+    R.p += (63-R.n)>>3;
+    R.n |= 56;
+  }
+  while(R.n<=56)
+  {
+    R.acc |= (uint64_t)(R.p<R.end ? *R.p : 0) << R.n;
+    R.p++;
+    R.n += 8;
+  }
+}
+
+inline uint32_t BitGet(tBitReader& R,unsigned int Bits)
+{
+  uint32_t v = (uint32_t)(R.acc & ((1ull<<Bits)-1));
+  R.acc >>= Bits;
+  R.n -= Bits;
+  return v;
+}
+
+// bits past the end of the data were consumed
+inline bool BitOverrun(const tBitReader& R)
+{
+  return R.p>R.end && (uint64_t)(R.p-R.end)*8>R.n;
+}
+
+// ---- Rice coding ----
+
+// bits to code n values with parameter k
+inline uint64_t RiceCost(const uint16_t* z,size_t n,unsigned int k,unsigned int Bits)
+{
+  uint64_t bits = 0;
+  for(size_t i=0;i<n;i++)
+  {
+    uint32_t q = z[i]>>k;
+    bits += q<DELTA_ESCAPE ? q+1+k : DELTA_ESCAPE+Bits;
+  }
+  return bits;
+}
+
+// code residuals in blocks, each with the cheapest nearby parameter; gives
+// up (false) once the output passes Limit
+inline bool RiceEncode(tBitWriter& W,const uint16_t* z,uint64_t n,unsigned int Bits,const uint8_t* Limit)
+{
+  for(uint64_t b=0;b<n;b+=DELTA_BLOCK)
+  {
+    if(W.p>Limit)
+      return false;
+    size_t m = n-b<DELTA_BLOCK ? (size_t)(n-b) : DELTA_BLOCK;
+    const uint16_t* v = z+b;
+    uint32_t sum = 0;
+    for(size_t i=0;i<m;i++)
+      sum += v[i];
+    if(sum==0)
+    {
+      BitPut(W,DELTA_ZERO_BLOCK,5);
+      continue;
+    }
+
+    // start near log2 of the mean and try one either side
+    unsigned int k0 = 0;
+    while(k0<Bits && ((uint64_t)m<<(k0+1))<=sum)
+      k0++;
+    unsigned int k = k0;
+    uint64_t best = RiceCost(v,m,k0,Bits);
+    for(unsigned int c=(k0>0 ? k0-1 : 0);c<=k0+1 && c<=Bits;c++)
+    {
+      uint64_t cost = c==k0 ? best : RiceCost(v,m,c,Bits);
+      if(cost<best)
+      {
+        best = cost;
+        k = c;
+      }
+    }
+
+    BitPut(W,k,5);
+    for(size_t i=0;i<m;i++)
+    {
+      uint32_t q = v[i]>>k;
+      if(q<DELTA_ESCAPE)
+      {
+        BitPut(W,1u<<q,q+1);
+        if(k)
+          BitPut(W,v[i]&((1u<<k)-1),k);
+      }
+      else
+      {
+        BitPut(W,0,DELTA_ESCAPE);
+        BitPut(W,v[i],Bits);
+      }
+    }
+  }
+  return true;
+}
+
+inline bool RiceDecode(tBitReader& R,uint16_t* z,uint64_t n,unsigned int Bits)
+{
+  for(uint64_t b=0;b<n;b+=DELTA_BLOCK)
+  {
+    size_t m = n-b<DELTA_BLOCK ? (size_t)(n-b) : DELTA_BLOCK;
+    uint16_t* v = z+b;
+    BitRefill(R);
+    unsigned int k = BitGet(R,5);
+    if(k==DELTA_ZERO_BLOCK)
+    {
+      memset(v,0,m*sizeof(uint16_t));
+      continue;
+    }
+    if(k>Bits)
+      return false;
+
+    for(size_t i=0;i<m;i++)
+    {
+      BitRefill(R);
+      unsigned int q = __builtin_ctzll(R.acc | (1ull<<DELTA_ESCAPE));
+      if(q<DELTA_ESCAPE)
+      {
+        BitGet(R,q+1);
+        v[i] = (uint16_t)((q<<k) | (k ? BitGet(R,k) : 0));
+      }
+      else
+      {
+        BitGet(R,DELTA_ESCAPE);
+        v[i] = (uint16_t)BitGet(R,Bits);
+      }
+    }
+    if(BitOverrun(R))
+      return false;
+  }
+  return true;
+}
+
+// ---- frames ----
+
+// residuals of an image against Prev, or against itself one stride back if Prev is NULL
+inline void DeltaResiduals(const tDeltaLayout& L,const uint8_t* Image,const uint8_t* Prev,uint16_t* z)
+{
+  uint64_t n = L.samples, s = L.stride<n ? L.stride : n;
+  static const uint8_t zeros[32] = {0};
+
+  if(L.sampleSize==1)
+  {
+    if(Prev)
+      DiffRow8(Image,Prev,z,n);
+    else
+    {
+      DiffRow8(Image,zeros,z,s);
+      DiffRow8(Image+s,Image,z+s,n-s);
+    }
+  }
+  else
+  {
+    const uint16_t* image = (const uint16_t*)Image;
+    if(Prev)
+      DiffRow16(image,(const uint16_t*)Prev,z,n);
+    else
+    {
+      DiffRow16(image,(const uint16_t*)zeros,z,s);
+      DiffRow16(image+s,image,z+s,n-s);
+    }
+  }
+}
+
+// encode an image into Out (grown as needed) and return the payload size;
+// Prev is the previous image, or NULL for a keyframe
+inline uint32_t DeltaEncodeFrame(const tDeltaLayout& L,const uint8_t* Image,const uint8_t* Prev,
+                                 std::vector<uint16_t>& Residual,std::vector<uint8_t>& Out)
+{
+  // stop coding once the stream is longer than a stored frame would be
+  Residual.resize(L.samples);
+  if(Out.size()<DeltaEncodeRoom(L))
+    Out.resize(DeltaEncodeRoom(L));
+
+  DeltaResiduals(L,Image,Prev,&Residual[0]);
+  tBitWriter W;
+  W.p = &Out[1];
+  W.acc = 0;
+  W.n = 0;
+  bool coded = RiceEncode(W,&Residual[0],L.samples,L.sampleBits,&Out[0]+DeltaMaxPayload(L));
+  BitFlush(W);
+
+  uint64_t size = W.p - &Out[0];
+  if(!coded || size>=DeltaMaxPayload(L))
+  {
+    Out[0] = eDeltaStored;
+    memcpy(&Out[1],Image,L.imageSize);
+    return DeltaMaxPayload(L);
+  }
+  Out[0] = Prev ? eDeltaInter : eDeltaKey;
+  return (uint32_t)size;
+}
+
+// decode a payload into Image; Prev is the previous image (may be NULL for keyframes)
+inline bool DeltaDecodeFrame(const tDeltaLayout& L,const uint8_t* Payload,uint32_t Size,const uint8_t* Prev,
+                             std::vector<uint16_t>& Residual,uint8_t* Image)
+{
+  if(Size<1)
+    return false;
+  if(Payload[0]==eDeltaStored)
+  {
+    if(Size!=DeltaMaxPayload(L))
+      return false;
+    memcpy(Image,Payload+1,L.imageSize);
+    return true;
+  }
+  if(Payload[0]>eDeltaInter || (Payload[0]==eDeltaInter && !Prev))
+    return false;
+
+  Residual.resize(L.samples);
+  uint16_t* z = &Residual[0];
+  tBitReader R;
+  R.p = Payload+1;
+  R.end = Payload+Size;
+  R.acc = 0;
+  R.n = 0;
+  if(!RiceDecode(R,z,L.samples,L.sampleBits))
+    return false;
+
+  uint64_t n = L.samples, s = L.stride<n ? L.stride : n;
+  if(Payload[0]==eDeltaInter)
+  {
+    if(L.sampleSize==1)
+      UndiffRow8(z,Prev,Image,n);
+    else
+      UndiffRow16(z,(const uint16_t*)Prev,(uint16_t*)Image,n);
+    return true;
+  }
+
+  // keyframes depend on the sample just restored, so run serially
+  if(L.sampleSize==1)
+  {
+    for(uint64_t i=0;i<n;i++)
+      Image[i] = (uint8_t)((i<s ? 0 : Image[i-s]) + ((z[i]>>1) ^ (0u-(z[i]&1))));
+  }
+  else
+  {
+    uint16_t* image = (uint16_t*)Image;
+    for(uint64_t i=0;i<n;i++)
+      image[i] = (uint16_t)((i<s ? 0 : image[i-s]) + ((z[i]>>1) ^ (0u-(z[i]&1))));
+  }
+  return true;
+}
+
+// ---- files ----
+
+// compressed file being written
+typedef struct
+{
+  FILE*                  f;
+  tDeltaHeader           header;
+  uint64_t               offset;  // of the next frame record
+  std::vector<uint64_t>* index;
+} tDeltaWriter;
+
+// create a file for frames of the given recording
+inline bool DeltaWriterOpen(tDeltaWriter& W,const char* Path,const tRecording& Rec,uint32_t KeyInterval,uint32_t InfoSize)
+{
+  tDeltaLayout L = DeltaLayoutFor(Rec.header);
+
+  memset(&W,0,sizeof(tDeltaWriter));
+  memcpy(W.header.magic,DELTA_MAGIC,sizeof(DELTA_MAGIC));
+  W.header.recording = Rec.header;
+  W.header.keyInterval = KeyInterval ? KeyInterval : 1;
+  W.header.sampleSize = L.sampleSize;
+  W.header.stride = L.stride;
+  W.header.framesDropped = Rec.framesDropped;
+  W.header.infoSize = InfoSize;
+  W.header.complete = Rec.complete;
+
+  W.f = fopen(Path,"wb");
+  if(!W.f || fwrite(&W.header,1,DELTA_HEADER_SIZE,W.f)!=DELTA_HEADER_SIZE)
+  {
+    if(W.f)
+      fclose(W.f);
+    W.f = NULL;
+    return false;
+  }
+  W.offset = DELTA_HEADER_SIZE;
+  W.index = new std::vector<uint64_t>;
+  return true;
+}
+
+// append a frame record
+inline bool DeltaWriterAppend(tDeltaWriter& W,const tFrameStamp& Stamp,const uint8_t* Info,
+                              const uint8_t* Payload,uint32_t Size)
+{
+  tDeltaFrame frame;
+  frame.stamp = Stamp;
+  frame.size = Size;
+  frame.flags = Payload[0]==eDeltaInter ? 0 : 1;
+
+  W.index->push_back(W.offset);
+  W.offset += DELTA_FRAME_SIZE + W.header.infoSize + Size;
+  return fwrite(&frame,1,DELTA_FRAME_SIZE,W.f)==DELTA_FRAME_SIZE &&
+         (W.header.infoSize==0 || fwrite(Info,1,W.header.infoSize,W.f)==W.header.infoSize) &&
+         fwrite(Payload,1,Size,W.f)==Size;
+}
+
+// write the index and the final header, and close
+inline bool DeltaWriterClose(tDeltaWriter& W)
+{
+  bool ok = W.f!=NULL;
+  if(ok)
+  {
+    W.header.frameCount = W.index->size();
+    W.header.indexOffset = W.offset;
+    ok = (W.index->empty() || fwrite(&(*W.index)[0],sizeof(uint64_t),W.index->size(),W.f)==W.index->size()) &&
+         fseeko(W.f,0,SEEK_SET)==0 && fwrite(&W.header,1,DELTA_HEADER_SIZE,W.f)==DELTA_HEADER_SIZE;
+    ok = (fclose(W.f)==0) && ok;
+  }
+  delete W.index;
+  W.index = NULL;
+  W.f = NULL;
+  return ok;
+}
+
+// compressed file being read, front to back or from a keyframe
+typedef struct
+{
+  FILE*                  f;
+  tDeltaHeader           header;
+  tDeltaLayout           layout;
+  uint64_t               next;     // index of the next frame
+  bool                   havePrev; // image holds frame next-1
+  tFrameStamp            stamp;
+  std::vector<uint8_t>*  image;
+  std::vector<uint8_t>*  prev;
+  std::vector<uint8_t>*  info;
+  std::vector<uint8_t>*  payload;
+  std::vector<uint16_t>* residual;
+  std::vector<uint64_t>* index;
+  char                   error[128];
+} tDeltaReader;
+
+// close a reader
+inline void DeltaReaderClose(tDeltaReader& R)
+{
+  if(R.f && R.f!=stdin)
+    fclose(R.f);
+  R.f = NULL;
+  delete R.image;
+  delete R.prev;
+  delete R.info;
+  delete R.payload;
+  delete R.residual;
+  delete R.index;
+  R.image = R.prev = R.info = R.payload = NULL;
+  R.residual = NULL;
+  R.index = NULL;
+}
+
+// open a compressed file ("-" reads standard input, front to back only)
+inline bool DeltaReaderOpen(tDeltaReader& R,const char* Path)
+{
+  memset(&R,0,sizeof(tDeltaReader));
+  R.f = strcmp(Path,"-")==0 ? stdin : fopen(Path,"rb");
+  if(!R.f || fread(&R.header,1,DELTA_HEADER_SIZE,R.f)!=DELTA_HEADER_SIZE ||
+     memcmp(R.header.magic,DELTA_MAGIC,8)!=0)
+  {
+    snprintf(R.error,sizeof(R.error),"%s is not a compressed recording",Path);
+    DeltaReaderClose(R);
+    return false;
+  }
+
+  // the stored layout wins over the derived one, which only guards its size
+  tRecording rec;
+  memset(&rec,0,sizeof(rec));
+  rec.header = R.header.recording;
+  rec.fileSize = RECORDING_HEADER_SIZE;
+  R.layout = DeltaLayoutFor(R.header.recording);
+  if(!RecordingCheckHeader(rec) || (R.header.sampleSize!=1 && R.header.sampleSize!=2) ||
+     R.layout.imageSize % R.header.sampleSize || R.header.stride==0 || R.header.keyInterval==0)
+  {
+    snprintf(R.error,sizeof(R.error),"%s has a bad header",Path);
+    DeltaReaderClose(R);
+    return false;
+  }
+  R.layout.sampleSize = R.header.sampleSize;
+  R.layout.sampleBits = 8*R.header.sampleSize;
+  R.layout.stride = R.header.stride;
+  R.layout.samples = R.layout.imageSize/R.header.sampleSize;
+
+  R.image = new std::vector<uint8_t>(R.layout.imageSize);
+  R.prev = new std::vector<uint8_t>(R.layout.imageSize);
+  R.info = new std::vector<uint8_t>(R.header.infoSize);
+  R.payload = new std::vector<uint8_t>(DeltaMaxPayload(R.layout));
+  R.residual = new std::vector<uint16_t>(R.layout.samples);
+  R.index = new std::vector<uint64_t>;
+  return true;
+}
+
+// decode the next frame into R.stamp, *R.image and *R.info; false at the
+// end of the frames (R.error empty) or on a damaged record
+inline bool DeltaReaderNext(tDeltaReader& R)
+{
+  tDeltaFrame frame;
+
+  R.error[0] = 0;
+  if(R.header.indexOffset && R.next>=R.header.frameCount)
+    return false;
+  size_t got = fread(&frame,1,DELTA_FRAME_SIZE,R.f);
+  if(got==0 && !R.header.indexOffset)
+    return false; // an unfinished file ends at its last whole record
+  if(got!=DELTA_FRAME_SIZE || frame.size>DeltaMaxPayload(R.layout) ||
+     (R.header.infoSize && fread(&(*R.info)[0],1,R.header.infoSize,R.f)!=R.header.infoSize) ||
+     fread(&(*R.payload)[0],1,frame.size,R.f)!=frame.size)
+  {
+    snprintf(R.error,sizeof(R.error),"frame %llu is cut short",(unsigned long long)R.next);
+    return false;
+  }
+
+  // the previous image is the prediction for this one
+  R.image->swap(*R.prev);
+  if(!DeltaDecodeFrame(R.layout,&(*R.payload)[0],frame.size,R.havePrev ? &(*R.prev)[0] : NULL,
+                       *R.residual,&(*R.image)[0]))
+  {
+    snprintf(R.error,sizeof(R.error),"frame %llu cannot be decoded",(unsigned long long)R.next);
+    R.havePrev = false;
+    return false;
+  }
+  R.stamp = frame.stamp;
+  R.havePrev = true;
+  R.next++;
+  return true;
+}
+
+// position the reader so DeltaReaderNext returns frame i (finished files only)
+inline bool DeltaReaderSeek(tDeltaReader& R,uint64_t i)
+{
+  if(!R.header.indexOffset || i>=R.header.frameCount)
+  {
+    snprintf(R.error,sizeof(R.error),"frame %llu cannot be reached",(unsigned long long)i);
+    return false;
+  }
+  if(R.index->empty())
+  {
+    R.index->resize(R.header.frameCount);
+    if(fseeko(R.f,R.header.indexOffset,SEEK_SET)!=0 ||
+       fread(&(*R.index)[0],sizeof(uint64_t),R.index->size(),R.f)!=R.index->size())
+    {
+      R.index->clear();
+      snprintf(R.error,sizeof(R.error),"frame index cannot be read");
+      return false;
+    }
+  }
+
+  // decode forward from the keyframe at or before i
+  uint64_t key = i - i%R.header.keyInterval;
+  if(fseeko(R.f,(*R.index)[key],SEEK_SET)!=0)
+    return false;
+  R.next = key;
+  R.havePrev = false;
+  while(R.next<i)
+    if(!DeltaReaderNext(R))
+      return false;
+  return true;
+}
+
+#endif
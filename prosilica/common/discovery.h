@@ -0,0 +1,116 @@
+/* Header-only client for the camera_discovery service.
+ *
+ * camera_discovery keeps a registry of the cameras PvAPI has reported,
+ * updated from link add and remove events, and answers one-line requests
+ * on a UNIX socket with JSON:
+ *
+ *   list                      every camera, as an array sorted by unique ID
+ *   camera <uid|serial|ip|name>  one camera object, or null
+ *   wait <count> <ms>         the list, once at least count cameras are known
+ *                             or the time is up
+ *   refresh <uid>             query one camera again (access state changes
+ *                             raise no event), then answer as camera
+ *
+ * A camera object is flat: "uid" (number), "serial", "name", "model",
+ * "firmware", "ip", "subnet", "gateway", "config", "access" ("available",
+ * "in use" or "unreachable") and "changed" (UNIX time of the last update).
+ * DiscoveryLookup gives C++ tools a camera's address without waiting for
+ * PvAPI's own discovery; PvCameraOpenByAddr then opens it directly.
+ */
+
+#ifndef DISCOVERY_H_INCLUDE
+#define DISCOVERY_H_INCLUDE
+
+// includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <string>
+
+#define DISCOVERY_SOCKET "/tmp/sedcam-cameras.sock"
+#define DISCOVERY_TIMEOUT_MS 2000 // default wait for a reply
+
+// a camera as the service describes it
+typedef struct
+{
+  unsigned long uid;
+  char          serial[32];
+  char          name[32];
+  char          ip[16];
+  char          access[16];
+} tDiscoveredCamera;
+
+// send one request and read the whole reply; false if the service is not there
+inline bool DiscoveryRequest(const char* Path,const char* Request,std::string& Reply,
+                             int TimeoutMs = DISCOVERY_TIMEOUT_MS)
+{
+  struct sockaddr_un address;
+  memset(&address,0,sizeof(address));
+  address.sun_family = AF_UNIX;
+  strncpy(address.sun_path,Path ? Path : DISCOVERY_SOCKET,sizeof(address.sun_path)-1);
+
+  int fd = socket(AF_UNIX,SOCK_STREAM,0);
+  if(fd<0)
+    return false;
+  struct timeval timeout = {TimeoutMs/1000,(TimeoutMs%1000)*1000};
+  setsockopt(fd,SOL_SOCKET,SO_RCVTIMEO,&timeout,sizeof(timeout));
+  if(connect(fd,(struct sockaddr*)&address,sizeof(address))!=0)
+  {
+    close(fd);
+    return false;
+  }
+
+  std::string line = std::string(Request) + "\n";
+  bool ok = write(fd,line.data(),line.size())==(ssize_t)line.size();
+  Reply.clear();
+  char buffer[4096];
+  ssize_t n;
+  while(ok && (n=read(fd,buffer,sizeof(buffer)))>0)
+    Reply.append(buffer,n);
+  close(fd);
+  return ok && !Reply.empty();
+}
+
+// value of a field of a flat JSON object (strings unquoted, no escapes expected); false if missing
+inline bool DiscoveryField(const std::string& Object,const char* Name,char* Value,size_t Size)
+{
+  std::string key = std::string("\"") + Name + "\":";
+  size_t at = Object.find(key);
+  if(at==std::string::npos || Size==0)
+    return false;
+  at += key.size();
+  bool quoted = at<Object.size() && Object[at]=='"';
+  at += quoted;
+  size_t end = quoted ? Object.find('"',at) : Object.find_first_of(",}",at);
+  if(end==std::string::npos)
+    return false;
+  size_t length = end-at<Size-1 ? end-at : Size-1;
+  memcpy(Value,Object.data()+at,length);
+  Value[length] = 0;
+  return true;
+}
+
+// look a camera up by unique ID, serial, IP or name; false if unknown or no service
+inline bool DiscoveryLookup(const char* Path,const char* Key,tDiscoveredCamera& Camera)
+{
+  std::string reply;
+  std::string request = std::string("camera ") + Key;
+  memset(&Camera,0,sizeof(Camera));
+  if(!DiscoveryRequest(Path,request.c_str(),reply) || reply.compare(0,4,"null")==0)
+    return false;
+
+  char uid[32];
+  if(!DiscoveryField(reply,"uid",uid,sizeof(uid)) || !DiscoveryField(reply,"ip",Camera.ip,sizeof(Camera.ip)))
+    return false;
+  Camera.uid = strtoul(uid,NULL,10);
+  DiscoveryField(reply,"serial",Camera.serial,sizeof(Camera.serial));
+  DiscoveryField(reply,"name",Camera.name,sizeof(Camera.name));
+  DiscoveryField(reply,"access",Camera.access,sizeof(Camera.access));
+  return true;
+}
+
+#endif
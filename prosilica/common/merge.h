@@ -0,0 +1,126 @@
+/* Header-only time-aligned merge of recordings from several cameras.
+ *
+ * The cameras of a session are started together through PtpTriggerTimeHi
+ * and share the PTP clock, so frames taken at the same moment carry camera
+ * timestamps within a fraction of a frame period of each other. The merge
+ * keeps a cursor per recording and a min-heap of the cursors' next frame
+ * times. When every cursor's next frame lies within the tolerance of the
+ * earliest, those frames form a tuple and all cursors advance; otherwise the
+ * earliest frame has no partner left in at least one recording (that
+ * recording's next frame is already too late), so it is reported unmatched
+ * and only its cursor advances.
+ *
+ * Only the cursors are kept, so memory does not grow with recording length.
+ * Times must not decrease within a recording, which holds for the camera
+ * clock and for the host clock unless it was stepped during the capture.
+ */
+
+#ifndef MERGE_H_INCLUDE
+#define MERGE_H_INCLUDE
+
+// includes
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <recording.h>
+
+// next frame of one recording, ordered by time
+typedef std::pair<uint64_t,unsigned int> tMergeHead;
+
+// merge state
+typedef struct
+{
+  unsigned int              count;     // recordings
+  const tRecording*         recs;
+  tTimeBase                 base;
+  uint64_t                  tolerance; // ns
+  std::vector<uint64_t>*    next;      // next frame per recording
+  std::vector<tMergeHead>*  heap;      // min-heap of heads that are left
+  uint64_t                  latest;    // latest head time seen
+} tMerge;
+
+// time of frame i in ns on the merge clock (camera ticks are scaled by
+// each recording's own TimeStampFrequency)
+inline uint64_t MergeTime(const tRecording& Rec,tTimeBase Base,uint64_t i)
+{
+  tFrameStamp stamp = RecordingStamp(Rec,i);
+  if(Base==eTimeHost || Rec.header.timeStampFrequency==0)
+    return FrameTime(stamp,Base);
+
+  // split to keep ticks * 1e9 from overflowing
+  uint64_t ticks = FrameTicks(stamp), f = Rec.header.timeStampFrequency;
+  return ticks/f*1000000000ull + ticks%f*1000000000ull/f;
+}
+
+// move recording r's cursor on and put its next frame in the heap
+inline void MergeAdvance(tMerge& M,unsigned int r)
+{
+  uint64_t i = ++(*M.next)[r];
+  if(i<M.recs[r].count)
+  {
+    uint64_t t = MergeTime(M.recs[r],M.base,i);
+    M.heap->push_back(tMergeHead(t,r));
+    std::push_heap(M.heap->begin(),M.heap->end(),std::greater<tMergeHead>());
+    if(t>M.latest)
+      M.latest = t;
+  }
+}
+
+// start a merge of Count recordings
+inline void MergeOpen(tMerge& M,const tRecording* Recs,unsigned int Count,tTimeBase Base,uint64_t Tolerance)
+{
+  M.count = Count;
+  M.recs = Recs;
+  M.base = Base;
+  M.tolerance = Tolerance;
+  M.next = new std::vector<uint64_t>(Count,(uint64_t)-1);
+  M.heap = new std::vector<tMergeHead>;
+  M.latest = 0;
+  for(unsigned int r=0;r<Count;r++)
+    MergeAdvance(M,r);
+}
+
+inline void MergeClose(tMerge& M)
+{
+  delete M.next;
+  delete M.heap;
+  M.next = NULL;
+  M.heap = NULL;
+}
+
+// next tuple or unmatched frame: Frames[r] is the frame of recording r, or
+// -1 if it has none in this step; Time is the earliest frame's time.
+// Returns false when every recording is used up.
+inline bool MergeNext(tMerge& M,int64_t* Frames,uint64_t& Time,bool& Matched)
+{
+  std::vector<tMergeHead>& heap = *M.heap;
+  if(heap.empty())
+    return false;
+
+  Time = heap.front().first;
+  Matched = heap.size()==M.count && M.latest-Time<=M.tolerance;
+  if(Matched)
+  {
+    // every head is within the window: take them all
+    heap.clear();
+    for(unsigned int r=0;r<M.count;r++)
+    {
+      Frames[r] = (int64_t)(*M.next)[r];
+      MergeAdvance(M,r);
+    }
+    return true;
+  }
+
+  // the earliest frame cannot be matched any more
+  unsigned int r = heap.front().second;
+  std::pop_heap(heap.begin(),heap.end(),std::greater<tMergeHead>());
+  heap.pop_back();
+  for(unsigned int c=0;c<M.count;c++)
+    Frames[c] = -1;
+  Frames[r] = (int64_t)(*M.next)[r];
+  MergeAdvance(M,r);
+  return true;
+}
+
+#endif
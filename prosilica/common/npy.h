@@ -0,0 +1,122 @@
+/* Header-only writer for NumPy .npy files.
+ *
+ * The file is created with its full expected shape and preallocated, data is
+ * appended along the first axis, and on close the header is rewritten in
+ * place with the number of items actually written. The header is padded to
+ * a fixed, 64-byte aligned size chosen for the largest possible shape, so
+ * the fix-up never moves the data, and the result can be opened with
+ * np.load(mmap_mode='r').
+ */
+
+#ifndef NPY_H_INCLUDE
+#define NPY_H_INCLUDE
+
+// includes
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define NPY_MAX_DIMS 4
+
+// an .npy file being written
+typedef struct
+{
+  FILE*    fhandle;
+  char     descr[160];           // numpy dtype description, e.g. '<u2'
+  int      ndims;
+  uint64_t shape[NPY_MAX_DIMS];  // shape[0] is the expected item count
+  uint64_t itemSize;             // bytes per item along the first axis
+  size_t   headerSize;           // bytes reserved for the header
+  uint64_t written;              // items appended so far
+} tNpyFile;
+
+// format the header for a given item count into Out (exactly Size bytes)
+inline bool NpyFormatHeader(const tNpyFile& Npy,uint64_t Items,char* Out,size_t Size)
+{
+  char dict[512];
+  int n = snprintf(dict,sizeof(dict),"{'descr': %s, 'fortran_order': False, 'shape': (%llu,",
+                   Npy.descr,(unsigned long long)Items);
+  for(int i=1;i<Npy.ndims;i++)
+    n += snprintf(dict+n,sizeof(dict)-n,"%s%llu",i>1 ? ", " : " ",(unsigned long long)Npy.shape[i]);
+  n += snprintf(dict+n,sizeof(dict)-n,"), }");
+
+  // magic, version 1.0, little-endian header length, dict padded with spaces
+  if(n<0 || (size_t)n+11>Size || Size-10>0xffff)
+    return false;
+  memcpy(Out,"\x93NUMPY\x01\x00",8);
+  Out[8] = (char)((Size-10) & 0xff);
+  Out[9] = (char)((Size-10) >> 8);
+  memcpy(Out+10,dict,n);
+  memset(Out+10+n,' ',Size-10-n-1);
+  Out[Size-1] = '\n';
+  return true;
+}
+
+// create the file, write a header for Shape and preallocate the data
+inline bool NpyOpen(tNpyFile& Npy,const char* Path,const char* Descr,
+                    const uint64_t* Shape,int Ndims,uint64_t ElementSize)
+{
+  memset(&Npy,0,sizeof(tNpyFile));
+  if(Ndims<1 || Ndims>NPY_MAX_DIMS || strlen(Descr)>=sizeof(Npy.descr))
+    return false;
+
+  strcpy(Npy.descr,Descr);
+  Npy.ndims = Ndims;
+  Npy.itemSize = ElementSize;
+  for(int i=0;i<Ndims;i++)
+  {
+    Npy.shape[i] = Shape[i];
+    if(i>0)
+      Npy.itemSize *= Shape[i];
+  }
+
+  // reserve room for a 20-digit item count so the fix-up always fits
+  char header[1024];
+  Npy.headerSize = 64;
+  while(Npy.headerSize<=sizeof(header) && !NpyFormatHeader(Npy,0xffffffffffffffffull,header,Npy.headerSize))
+    Npy.headerSize += 64;
+  if(Npy.headerSize>sizeof(header) || !NpyFormatHeader(Npy,Shape[0],header,Npy.headerSize))
+    return false;
+
+  if(!(Npy.fhandle = fopen(Path,"wb")))
+    return false;
+  posix_fallocate(fileno(Npy.fhandle),0,Npy.headerSize + Shape[0]*Npy.itemSize);
+  if(fwrite(header,1,Npy.headerSize,Npy.fhandle)!=Npy.headerSize)
+  {
+    fclose(Npy.fhandle);
+    Npy.fhandle = NULL;
+    return false;
+  }
+  return true;
+}
+
+// append Count items
+inline bool NpyAppend(tNpyFile& Npy,const void* Data,uint64_t Count)
+{
+  if(fwrite(Data,Npy.itemSize,Count,Npy.fhandle)!=Count)
+    return false;
+  Npy.written += Count;
+  return true;
+}
+
+// rewrite the header with the items written, drop unused preallocation and close
+inline bool NpyClose(tNpyFile& Npy)
+{
+  char header[1024];
+  bool ok = (Npy.fhandle!=NULL);
+
+  if(ok)
+  {
+    ok = NpyFormatHeader(Npy,Npy.written,header,Npy.headerSize);
+    ok = ok && fflush(Npy.fhandle)==0;
+    ok = ok && pwrite(fileno(Npy.fhandle),header,Npy.headerSize,0)==(ssize_t)Npy.headerSize;
+    ok = ok && ftruncate(fileno(Npy.fhandle),Npy.headerSize + Npy.written*Npy.itemSize)==0;
+    ok = (fclose(Npy.fhandle)==0) && ok;
+    Npy.fhandle = NULL;
+  }
+  return ok;
+}
+
+#endif
@@ -0,0 +1,680 @@
+/* Header-only conversion of every tPvImageFormat to Mono16, Rgb48 or Rgb24.
+ *
+ * Sources are brought row by row into 16-bit working rows (one grey plane or
+ * R, G and B planes), then written out in the target layout. 16-bit targets
+ * keep the source's significant bits LSB aligned, as PvAPI delivers them;
+ * Rgb24 shifts them down to 8 bits. Colour to Mono16 uses BT.601 luma.
+ *
+ * Bayer data is demosaiced bilinearly, or edge-aware (Hamilton-Adams: green
+ * is interpolated along the direction with the smaller gradient, red and
+ * blue from colour differences to green). YUV is full-range BT.601 in the
+ * U Y V ordering of the Prosilica cameras (411: U Y Y V Y Y, 422: U Y V Y,
+ * 444: U Y V). 12-bit packed formats hold two pixels in three bytes.
+ *
+ * Averaging, narrowing and YUV kernels have NEON, AVX2/SSE2 and scalar
+ * paths with identical results. Rows are split into bands that run on
+ * separate threads.
+ */
+
+#ifndef PIXEL_FORMAT_H_INCLUDE
+#define PIXEL_FORMAT_H_INCLUDE
+
+// includes
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <PvApi.h>
+#include <workers.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define PF_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define PF_SSE2
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define PF_AVX2
+#endif
+#endif
+
+#define PF_PAD 2 // border of the padded planes used for demosaicing
+
+// output layouts
+typedef enum
+{
+  ePixelMono16 = 0,
+  ePixelRgb48  = 1,
+  ePixelRgb24  = 2
+} tPixelTarget;
+
+// Bayer interpolation
+typedef enum
+{
+  eDemosaicBilinear  = 0,
+  eDemosaicEdgeAware = 1
+} tDemosaic;
+
+// conversion settings
+typedef struct
+{
+  tPixelTarget    target;
+  tDemosaic       demosaic;
+  tPvBayerPattern bayer;     // pattern of Bayer sources
+  unsigned int    bitDepth;  // significant bits of 16-bit sources (0 = 16)
+  unsigned int    threads;   // row bands converted in parallel
+} tConvertOptions;
+
+// state of one conversion
+typedef struct
+{
+  const uint8_t*        src;
+  tPvImageFormat        format;
+  uint32_t              width;
+  uint32_t              height;
+  tConvertOptions       Options;
+  unsigned int          bits;     // significant bits of the working rows
+  uint8_t*              dst;
+  unsigned int          bands;
+  size_t                stride;   // row length of the padded planes
+  std::vector<uint16_t> raw;      // padded Bayer plane
+  std::vector<uint16_t> green;    // padded green plane (edge-aware)
+} tConvertJob;
+
+// default settings for a target
+inline void ConvertDefaults(tConvertOptions& Options,tPixelTarget Target)
+{
+  Options.target = Target;
+  Options.demosaic = eDemosaicBilinear;
+  Options.bayer = ePvBayerRGGB;
+  Options.bitDepth = 0;
+  Options.threads = 2;
+}
+
+// tPvImageFormat for a PixelFormat name
+inline bool PixelFormatByName(const char* Name,tPvImageFormat& Format)
+{
+  static const char* names[] =
+  {
+    "Mono8", "Mono16", "Bayer8", "Bayer16", "Rgb24", "Rgb48", "Yuv411",
+    "Yuv422", "Yuv444", "Bgr24", "Rgba32", "Bgra32", "Mono12Packed", "Bayer12Packed"
+  };
+
+  for(unsigned int i=0;i<sizeof(names)/sizeof(names[0]);i++)
+    if(strcmp(Name,names[i])==0)
+    {
+      Format = (tPvImageFormat)i;
+      return true;
+    }
+  return false;
+}
+
+// bytes per pixel of a target
+inline unsigned int PixelTargetBytes(tPixelTarget Target)
+{
+  return Target==ePixelMono16 ? 2 : Target==ePixelRgb48 ? 6 : 3;
+}
+
+// significant bits delivered by a format
+inline unsigned int PixelFormatDepth(tPvImageFormat Format,const tConvertOptions& Options)
+{
+  switch(Format)
+  {
+    case ePvFmtMono12Packed:
+    case ePvFmtBayer12Packed:
+      return 12;
+    case ePvFmtMono16:
+    case ePvFmtBayer16:
+    case ePvFmtRgb48:
+      return Options.bitDepth && Options.bitDepth<16 ? Options.bitDepth : 16;
+    default:
+      return 8;
+  }
+}
+
+// colour (0 = R, 1 = G, 2 = B) of Bayer pixel x,y
+inline int BayerColour(tPvBayerPattern Pattern,uint32_t x,uint32_t y)
+{
+  static const uint8_t colours[4][4] = {{0,1,1,2},{1,2,0,1},{1,0,2,1},{2,1,1,0}};
+  return colours[Pattern & 3][(y&1)*2 + (x&1)];
+}
+
+// mirror an index into [0,n) keeping its parity
+inline uint32_t ReflectIndex(int64_t i,uint32_t n)
+{
+  if(n<2)
+    return 0;
+  while(i<0 || i>=n)
+    i = i<0 ? -i : 2*(int64_t)n-2-i;
+  return (uint32_t)i;
+}
+
+// ---- kernels ----
+
+// rounding average of two rows
+inline void AvgRow(const uint16_t* a,const uint16_t* b,uint16_t* Out,size_t n)
+{
+  size_t i = 0;
+#if defined(PF_NEON)
+  for(;i+8<=n;i+=8)
+    vst1q_u16(Out+i,vrhaddq_u16(vld1q_u16(a+i),vld1q_u16(b+i)));
+#elif defined(PF_SSE2)
+#if defined(PF_AVX2)
+  for(;i+16<=n;i+=16)
+    _mm256_storeu_si256((__m256i*)(Out+i),_mm256_avg_epu16(_mm256_loadu_si256((const __m256i*)(a+i)),
+                                                             _mm256_loadu_si256((const __m256i*)(b+i))));
+#endif
+  for(;i+8<=n;i+=8)
+    _mm_storeu_si128((__m128i*)(Out+i),_mm_avg_epu16(_mm_loadu_si128((const __m128i*)(a+i)),
+                                                     _mm_loadu_si128((const __m128i*)(b+i))));
+#endif
+  for(;i<n;i++)
+    Out[i] = (a[i]+b[i]+1)>>1;
+}
+
+// shift a row down by Shift bits and saturate to 8 bits
+inline void NarrowRow(const uint16_t* In,uint8_t* Out,size_t n,unsigned int Shift)
+{
+  size_t i = 0;
+#if defined(PF_NEON)
+  int16x8_t shift = vdupq_n_s16(-(int)Shift);
+  for(;i+8<=n;i+=8)
+    vst1_u8(Out+i,vqmovn_u16(vshlq_u16(vld1q_u16(In+i),shift)));
+#elif defined(PF_SSE2)
+  __m128i count = _mm_cvtsi32_si128(Shift);
+  __m128i max = _mm_set1_epi16(255);
+  for(;i+16<=n;i+=16)
+  {
+    __m128i a = _mm_srl_epi16(_mm_loadu_si128((const __m128i*)(In+i)),count);
+    __m128i b = _mm_srl_epi16(_mm_loadu_si128((const __m128i*)(In+i+8)),count);
+    a = _mm_sub_epi16(a,_mm_subs_epu16(a,max));
+    b = _mm_sub_epi16(b,_mm_subs_epu16(b,max));
+    _mm_storeu_si128((__m128i*)(Out+i),_mm_packus_epi16(a,b));
+  }
+#endif
+  for(;i<n;i++)
+  {
+    unsigned int v = In[i]>>Shift;
+    Out[i] = v>255 ? 255 : v;
+  }
+}
+
+// full-range BT.601 YUV to RGB with coefficients in 1/128 (exact in 16 bits)
+inline void YuvToRgbRow(const int16_t* Y,const int16_t* U,const int16_t* V,
+                        uint16_t* R,uint16_t* G,uint16_t* B,size_t n)
+{
+  size_t i = 0;
+#if defined(PF_NEON)
+  int16x8_t c128 = vdupq_n_s16(128), zero = vdupq_n_s16(0), max = vdupq_n_s16(255);
+  for(;i+8<=n;i+=8)
+  {
+    int16x8_t y = vld1q_s16(Y+i);
+    int16x8_t u = vsubq_s16(vld1q_s16(U+i),c128), v = vsubq_s16(vld1q_s16(V+i),c128);
+    int16x8_t r = vaddq_s16(y,vrshrq_n_s16(vmulq_n_s16(v,179),7));
+    int16x8_t g = vsubq_s16(y,vrshrq_n_s16(vaddq_s16(vmulq_n_s16(u,44),vmulq_n_s16(v,91)),7));
+    int16x8_t b = vaddq_s16(y,vrshrq_n_s16(vmulq_n_s16(u,227),7));
+    vst1q_u16(R+i,vreinterpretq_u16_s16(vminq_s16(vmaxq_s16(r,zero),max)));
+    vst1q_u16(G+i,vreinterpretq_u16_s16(vminq_s16(vmaxq_s16(g,zero),max)));
+    vst1q_u16(B+i,vreinterpretq_u16_s16(vminq_s16(vmaxq_s16(b,zero),max)));
+  }
+#elif defined(PF_SSE2)
+  __m128i c128 = _mm_set1_epi16(128), c64 = _mm_set1_epi16(64), zero = _mm_setzero_si128(), max = _mm_set1_epi16(255);
+  __m128i kr = _mm_set1_epi16(179), kgu = _mm_set1_epi16(44), kgv = _mm_set1_epi16(91), kb = _mm_set1_epi16(227);
+  for(;i+8<=n;i+=8)
+  {
+    __m128i y = _mm_loadu_si128((const __m128i*)(Y+i));
+    __m128i u = _mm_sub_epi16(_mm_loadu_si128((const __m128i*)(U+i)),c128);
+    __m128i v = _mm_sub_epi16(_mm_loadu_si128((const __m128i*)(V+i)),c128);
+    __m128i r = _mm_add_epi16(y,_mm_srai_epi16(_mm_add_epi16(_mm_mullo_epi16(v,kr),c64),7));
+    __m128i g = _mm_sub_epi16(y,_mm_srai_epi16(_mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(u,kgu),
+                                                                           _mm_mullo_epi16(v,kgv)),c64),7));
+    __m128i b = _mm_add_epi16(y,_mm_srai_epi16(_mm_add_epi16(_mm_mullo_epi16(u,kb),c64),7));
+    _mm_storeu_si128((__m128i*)(R+i),_mm_min_epi16(_mm_max_epi16(r,zero),max));
+    _mm_storeu_si128((__m128i*)(G+i),_mm_min_epi16(_mm_max_epi16(g,zero),max));
+    _mm_storeu_si128((__m128i*)(B+i),_mm_min_epi16(_mm_max_epi16(b,zero),max));
+  }
+#endif
+  for(;i<n;i++)
+  {
+    int u = U[i]-128, v = V[i]-128;
+    int r = Y[i] + ((179*v+64)>>7);
+    int g = Y[i] - ((44*u+91*v+64)>>7);
+    int b = Y[i] + ((227*u+64)>>7);
+    R[i] = r<0 ? 0 : r>255 ? 255 : r;
+    G[i] = g<0 ? 0 : g>255 ? 255 : g;
+    B[i] = b<0 ? 0 : b>255 ? 255 : b;
+  }
+}
+
+// unpack n 12-bit pixels starting at pixel First of a packed image
+inline void Unpack12Row(const uint8_t* Src,uint64_t First,uint32_t n,uint16_t* Out)
+{
+  uint32_t i = 0;
+  if(n && (First & 1))
+  {
+    const uint8_t* p = Src + 3*(First/2);
+    Out[i++] = (p[2]<<4) | (p[1]>>4);
+  }
+#if defined(PF_NEON)
+  for(;i+16<=n;i+=16)
+  {
+    uint8x8x3_t t = vld3_u8(Src + 3*((First+i)/2));
+    uint16x8x2_t z;
+    z.val[0] = vorrq_u16(vshll_n_u8(t.val[0],4),vmovl_u8(vand_u8(t.val[1],vdup_n_u8(0x0f))));
+    z.val[1] = vorrq_u16(vshll_n_u8(t.val[2],4),vmovl_u8(vshr_n_u8(t.val[1],4)));
+    vst2q_u16(Out+i,z);
+  }
+#endif
+  for(;i<n;i++)
+  {
+    const uint8_t* p = Src + 3*((First+i)/2);
+    Out[i] = ((First+i) & 1) ? (p[2]<<4) | (p[1]>>4) : (p[0]<<4) | (p[1] & 0x0f);
+  }
+}
+
+// ---- rows ----
+
+// row y of a grey or Bayer source as 16-bit values
+inline void RawRow(const tConvertJob& J,uint32_t y,uint16_t* Out)
+{
+  uint64_t first = (uint64_t)y*J.width;
+  switch(J.format)
+  {
+    case ePvFmtMono8:
+    case ePvFmtBayer8:
+      for(uint32_t x=0;x<J.width;x++)
+        Out[x] = J.src[first+x];
+      break;
+    case ePvFmtMono16:
+    case ePvFmtBayer16:
+      memcpy(Out,J.src+2*first,2*(size_t)J.width);
+      break;
+    default:
+      Unpack12Row(J.src,first,J.width,Out);
+      break;
+  }
+}
+
+// row y of an RGB, BGR, RGBA or BGRA source as planes
+inline void ColourRow(const tConvertJob& J,uint32_t y,uint16_t* R,uint16_t* G,uint16_t* B)
+{
+  unsigned int channels = (J.format==ePvFmtRgba32 || J.format==ePvFmtBgra32) ? 4 : 3;
+  bool bgr = (J.format==ePvFmtBgr24 || J.format==ePvFmtBgra32);
+  uint16_t* first = bgr ? B : R;
+  uint16_t* last = bgr ? R : B;
+
+  if(J.format==ePvFmtRgb48)
+  {
+    const uint8_t* row = J.src + (size_t)y*J.width*6;
+    for(uint32_t x=0;x<J.width;x++)
+    {
+      memcpy(R+x,row+6*x,2);
+      memcpy(G+x,row+6*x+2,2);
+      memcpy(B+x,row+6*x+4,2);
+    }
+    return;
+  }
+
+  const uint8_t* row = J.src + (size_t)y*J.width*channels;
+  for(uint32_t x=0;x<J.width;x++,row+=channels)
+  {
+    first[x] = row[0];
+    G[x] = row[1];
+    last[x] = row[2];
+  }
+}
+
+// row y of a YUV source as RGB planes
+inline void YuvRow(const tConvertJob& J,uint32_t y,int16_t* Y,int16_t* U,int16_t* V,
+                   uint16_t* R,uint16_t* G,uint16_t* B)
+{
+  uint64_t first = (uint64_t)y*J.width;
+  for(uint32_t x=0;x<J.width;x++)
+  {
+    uint64_t i = first+x;
+    const uint8_t* p;
+    switch(J.format)
+    {
+      case ePvFmtYuv411: // U Y Y V Y Y per 4 pixels
+        p = J.src + 6*(i/4);
+        Y[x] = p[(i&3)<2 ? 1+(i&1) : 4+(i&1)];
+        U[x] = p[0];
+        V[x] = p[3];
+        break;
+      case ePvFmtYuv422: // U Y V Y per 2 pixels
+        p = J.src + 4*(i/2);
+        Y[x] = p[1+2*(i&1)];
+        U[x] = p[0];
+        V[x] = p[2];
+        break;
+      default:           // U Y V per pixel
+        p = J.src + 3*i;
+        Y[x] = p[1];
+        U[x] = p[0];
+        V[x] = p[2];
+        break;
+    }
+  }
+  YuvToRgbRow(Y,U,V,R,G,B,J.width);
+}
+
+// write grey (G only) or colour planes as row y of the target
+inline void EmitRow(const tConvertJob& J,uint32_t y,const uint16_t* R,const uint16_t* G,const uint16_t* B,
+                    uint8_t* Scratch)
+{
+  size_t n = J.width;
+  bool grey = (R==NULL);
+
+  switch(J.Options.target)
+  {
+    case ePixelMono16:
+    {
+      uint16_t* out = (uint16_t*)(J.dst + (size_t)y*n*2);
+      if(grey)
+        memcpy(out,G,2*n);
+      else
+        for(size_t x=0;x<n;x++)
+          out[x] = (77*(uint32_t)R[x] + 150*(uint32_t)G[x] + 29*(uint32_t)B[x] + 128)>>8;
+      break;
+    }
+    case ePixelRgb48:
+    {
+      uint16_t* out = (uint16_t*)(J.dst + (size_t)y*n*6);
+      for(size_t x=0;x<n;x++)
+      {
+        out[3*x] = grey ? G[x] : R[x];
+        out[3*x+1] = G[x];
+        out[3*x+2] = grey ? G[x] : B[x];
+      }
+      break;
+    }
+    default:
+    {
+      uint8_t* out = J.dst + (size_t)y*n*3;
+      unsigned int shift = J.bits>8 ? J.bits-8 : 0;
+      uint8_t* r = Scratch;
+      uint8_t* g = Scratch+n;
+      uint8_t* b = Scratch+2*n;
+      NarrowRow(G,g,n,shift);
+      if(!grey)
+      {
+        NarrowRow(R,r,n,shift);
+        NarrowRow(B,b,n,shift);
+      }
+      for(size_t x=0;x<n;x++)
+      {
+        out[3*x] = grey ? g[x] : r[x];
+        out[3*x+1] = g[x];
+        out[3*x+2] = grey ? g[x] : b[x];
+      }
+      break;
+    }
+  }
+}
+
+// ---- bands ----
+
+// rows of band i
+inline void ConvertBandRows(const tConvertJob& J,unsigned int i,uint32_t& First,uint32_t& Last)
+{
+  First = (uint32_t)((uint64_t)J.height*i/J.bands);
+  Last = (uint32_t)((uint64_t)J.height*(i+1)/J.bands);
+}
+
+// padded plane pixel (x and y may reach PF_PAD outside the image)
+inline uint16_t* PlaneAt(const tConvertJob& J,std::vector<uint16_t>& Plane,int64_t x,int64_t y)
+{
+  return &Plane[(size_t)(y+PF_PAD)*J.stride + (size_t)(x+PF_PAD)];
+}
+
+// fill the left and right border of a padded plane row by reflection
+inline void PadRow(const tConvertJob& J,std::vector<uint16_t>& Plane,uint32_t y)
+{
+  uint16_t* row = PlaneAt(J,Plane,0,y);
+  for(int k=1;k<=PF_PAD;k++)
+  {
+    row[-k] = row[ReflectIndex(-k,J.width)];
+    row[J.width-1+k] = row[ReflectIndex(J.width-1+k,J.width)];
+  }
+}
+
+// fill the top and bottom border of a padded plane by reflection
+inline void PadRows(const tConvertJob& J,std::vector<uint16_t>& Plane)
+{
+  for(int k=1;k<=PF_PAD;k++)
+  {
+    memcpy(PlaneAt(J,Plane,-PF_PAD,-k),PlaneAt(J,Plane,-PF_PAD,ReflectIndex(-k,J.height)),2*J.stride);
+    memcpy(PlaneAt(J,Plane,-PF_PAD,J.height-1+k),
+           PlaneAt(J,Plane,-PF_PAD,ReflectIndex(J.height-1+k,J.height)),2*J.stride);
+  }
+}
+
+// grey, RGB and YUV sources, one row at a time
+inline void ConvertDirectBand(void* Arg,unsigned int Index)
+{
+  tConvertJob& J = *(tConvertJob*)Arg;
+  uint32_t first, last;
+  ConvertBandRows(J,Index,first,last);
+
+  size_t n = J.width;
+  std::vector<uint16_t> planes(3*n);
+  std::vector<int16_t> yuv(3*n);
+  std::vector<uint8_t> scratch(3*n);
+  uint16_t* R = &planes[0];
+  uint16_t* G = &planes[n];
+  uint16_t* B = &planes[2*n];
+
+  for(uint32_t y=first;y<last;y++)
+    switch(J.format)
+    {
+      case ePvFmtMono8:
+      case ePvFmtMono16:
+      case ePvFmtMono12Packed:
+        RawRow(J,y,G);
+        EmitRow(J,y,NULL,G,NULL,&scratch[0]);
+        break;
+      case ePvFmtYuv411:
+      case ePvFmtYuv422:
+      case ePvFmtYuv444:
+        YuvRow(J,y,&yuv[0],&yuv[n],&yuv[2*n],R,G,B);
+        EmitRow(J,y,R,G,B,&scratch[0]);
+        break;
+      default:
+        ColourRow(J,y,R,G,B);
+        EmitRow(J,y,R,G,B,&scratch[0]);
+        break;
+    }
+}
+
+// Bayer, pass 1: unpack into the padded plane
+inline void ConvertUnpackBand(void* Arg,unsigned int Index)
+{
+  tConvertJob& J = *(tConvertJob*)Arg;
+  uint32_t first, last;
+  ConvertBandRows(J,Index,first,last);
+  for(uint32_t y=first;y<last;y++)
+  {
+    RawRow(J,y,PlaneAt(J,J.raw,0,y));
+    PadRow(J,J.raw,y);
+  }
+}
+
+// Bayer bilinear: rounding averages of the neighbours, picked by site colour
+inline void ConvertBilinearBand(void* Arg,unsigned int Index)
+{
+  tConvertJob& J = *(tConvertJob*)Arg;
+  uint32_t first, last;
+  ConvertBandRows(J,Index,first,last);
+
+  size_t n = J.width;
+  std::vector<uint16_t> planes(3*n), avg(6*n);
+  std::vector<uint8_t> scratch(3*n);
+  uint16_t* out[3] = {&planes[0],&planes[n],&planes[2*n]};
+  uint16_t* vert = &avg[0];
+  uint16_t* horz = &avg[n];
+  uint16_t* cross = &avg[2*n];
+  uint16_t* diagUp = &avg[3*n];
+  uint16_t* diagDown = &avg[4*n];
+  uint16_t* diag = &avg[5*n];
+
+  for(uint32_t y=first;y<last;y++)
+  {
+    const uint16_t* up = PlaneAt(J,J.raw,0,(int64_t)y-1);
+    const uint16_t* mid = PlaneAt(J,J.raw,0,y);
+    const uint16_t* down = PlaneAt(J,J.raw,0,y+1);
+
+    AvgRow(up,down,vert,n);
+    AvgRow(mid-1,mid+1,horz,n);
+    AvgRow(vert,horz,cross,n);
+    AvgRow(up-1,up+1,diagUp,n);
+    AvgRow(down-1,down+1,diagDown,n);
+    AvgRow(diagUp,diagDown,diag,n);
+
+    for(uint32_t x=0;x<n;x++)
+    {
+      int c = BayerColour(J.Options.bayer,x,y);
+      if(c==1)
+      {
+        out[1][x] = mid[x];
+        out[BayerColour(J.Options.bayer,x^1,y)][x] = horz[x];
+        out[BayerColour(J.Options.bayer,x,y^1)][x] = vert[x];
+      }
+      else
+      {
+        out[c][x] = mid[x];
+        out[1][x] = cross[x];
+        out[2-c][x] = diag[x];
+      }
+    }
+    EmitRow(J,y,out[0],out[1],out[2],&scratch[0]);
+  }
+}
+
+// Bayer edge-aware, pass 2: green along the smoother direction
+inline void ConvertGreenBand(void* Arg,unsigned int Index)
+{
+  tConvertJob& J = *(tConvertJob*)Arg;
+  uint32_t first, last;
+  ConvertBandRows(J,Index,first,last);
+  int32_t max = (1<<J.bits)-1;
+
+  for(uint32_t y=first;y<last;y++)
+  {
+    const uint16_t* m2 = PlaneAt(J,J.raw,0,(int64_t)y-2);
+    const uint16_t* m1 = PlaneAt(J,J.raw,0,(int64_t)y-1);
+    const uint16_t* m0 = PlaneAt(J,J.raw,0,y);
+    const uint16_t* p1 = PlaneAt(J,J.raw,0,y+1);
+    const uint16_t* p2 = PlaneAt(J,J.raw,0,y+2);
+    uint16_t* g = PlaneAt(J,J.green,0,y);
+
+    for(int64_t x=0;x<J.width;x++)
+    {
+      if(BayerColour(J.Options.bayer,x,y)==1)
+      {
+        g[x] = m0[x];
+        continue;
+      }
+      int32_t c = 2*m0[x];
+      int32_t lapH = c - m0[x-2] - m0[x+2], lapV = c - m2[x] - p2[x];
+      int32_t gradH = abs(m0[x-1]-m0[x+1]) + abs(lapH);
+      int32_t gradV = abs(m1[x]-p1[x]) + abs(lapV);
+      int32_t gh = 2*(m0[x-1]+m0[x+1]) + lapH;   // 4x estimates
+      int32_t gv = 2*(m1[x]+p1[x]) + lapV;
+      int32_t v = gradH<gradV ? gh : gradV<gradH ? gv : (gh+gv)/2;
+      v = (v+2)>>2;
+      g[x] = v<0 ? 0 : v>max ? max : v;
+    }
+    PadRow(J,J.green,y);
+  }
+}
+
+// Bayer edge-aware, pass 3: red and blue from colour differences to green
+inline void ConvertChromaBand(void* Arg,unsigned int Index)
+{
+  tConvertJob& J = *(tConvertJob*)Arg;
+  uint32_t first, last;
+  ConvertBandRows(J,Index,first,last);
+
+  size_t n = J.width;
+  int32_t max = (1<<J.bits)-1;
+  std::vector<uint16_t> planes(2*n);
+  std::vector<uint8_t> scratch(3*n);
+
+  for(uint32_t y=first;y<last;y++)
+  {
+    const uint16_t* r1 = PlaneAt(J,J.raw,0,(int64_t)y-1);
+    const uint16_t* r0 = PlaneAt(J,J.raw,0,y);
+    const uint16_t* r2 = PlaneAt(J,J.raw,0,y+1);
+    const uint16_t* g1 = PlaneAt(J,J.green,0,(int64_t)y-1);
+    const uint16_t* g0 = PlaneAt(J,J.green,0,y);
+    const uint16_t* g2 = PlaneAt(J,J.green,0,y+1);
+    uint16_t* out[3] = {&planes[0],(uint16_t*)g0,&planes[n]};
+
+    for(int64_t x=0;x<(int64_t)n;x++)
+    {
+      int c = BayerColour(J.Options.bayer,x,y);
+      int32_t h, v, d;
+      if(c==1)
+      {
+        h = g0[x] + ((r0[x-1]-g0[x-1] + r0[x+1]-g0[x+1])>>1);
+        v = g0[x] + ((r1[x]-g1[x] + r2[x]-g2[x])>>1);
+        out[BayerColour(J.Options.bayer,x^1,y)][x] = h<0 ? 0 : h>max ? max : h;
+        out[BayerColour(J.Options.bayer,x,y^1)][x] = v<0 ? 0 : v>max ? max : v;
+      }
+      else
+      {
+        d = g0[x] + ((r1[x-1]-g1[x-1] + r1[x+1]-g1[x+1] + r2[x-1]-g2[x-1] + r2[x+1]-g2[x+1])>>2);
+        out[c][x] = r0[x];
+        out[2-c][x] = d<0 ? 0 : d>max ? max : d;
+      }
+    }
+    EmitRow(J,y,out[0],out[1],out[2],&scratch[0]);
+  }
+}
+
+// convert a Width x Height image of Format into Dst (Width*Height*PixelTargetBytes bytes)
+inline bool ConvertImage(const void* Src,tPvImageFormat Format,uint32_t Width,uint32_t Height,
+                         const tConvertOptions& Options,void* Dst)
+{
+  if(!Width || !Height || (unsigned int)Format>ePvFmtBayer12Packed)
+    return false;
+
+  tConvertJob J;
+  J.src = (const uint8_t*)Src;
+  J.format = Format;
+  J.width = Width;
+  J.height = Height;
+  J.Options = Options;
+  J.bits = PixelFormatDepth(Format,Options);
+  J.dst = (uint8_t*)Dst;
+  J.bands = Options.threads ? Options.threads : 1;
+  if(J.bands>Height)
+    J.bands = Height;
+
+  bool bayer = (Format==ePvFmtBayer8 || Format==ePvFmtBayer16 || Format==ePvFmtBayer12Packed);
+  if(!bayer)
+  {
+    RunParallel(J.bands,ConvertDirectBand,&J);
+    return true;
+  }
+
+  // Bayer: unpack into a plane with reflected borders, then interpolate
+  J.stride = Width + 2*PF_PAD;
+  J.raw.resize(J.stride*(Height + 2*PF_PAD));
+  RunParallel(J.bands,ConvertUnpackBand,&J);
+  PadRows(J,J.raw);
+
+  if(Options.demosaic==eDemosaicBilinear)
+    RunParallel(J.bands,ConvertBilinearBand,&J);
+  else
+  {
+    J.green.resize(J.raw.size());
+    RunParallel(J.bands,ConvertGreenBand,&J);
+    PadRows(J,J.green);
+    RunParallel(J.bands,ConvertChromaBand,&J);
+  }
+  return true;
+}
+
+#endif
@@ -0,0 +1,302 @@
+/* Header-only parallel PNG encoder for 8- and 16-bit grey and RGB frames.
+ *
+ * Each row is filtered with all five PNG filters and the one with the
+ * smallest sum of absolute signed bytes is kept (the libpng heuristic), with
+ * the scoring done in NEON or SSE2 where available. The filtered image is
+ * then cut into slices that are deflated on separate threads: every slice
+ * but the last ends in a sync flush, so the raw deflate streams can simply
+ * be concatenated, and each slice is primed with the 32 KB of filtered data
+ * before it so splitting costs almost no compression. The zlib checksum is
+ * stitched together with adler32_combine.
+ */
+
+#ifndef PNG_H_INCLUDE
+#define PNG_H_INCLUDE
+
+// includes
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <zlib.h>
+#include <vector>
+#include <workers.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define PNG_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define PNG_SSE2
+#endif
+
+#define PNG_WINDOW 32768
+
+// encoder settings
+typedef struct
+{
+  int          level;     // zlib level 0-9
+  int          strategy;  // Z_FILTERED, Z_RLE, Z_DEFAULT_STRATEGY ...
+  unsigned int threads;   // deflate slices encoded in parallel
+} tPngOptions;
+
+// shared state while encoding one image
+typedef struct
+{
+  const uint8_t*              samples;    // host order samples
+  uint32_t                    width;
+  uint32_t                    height;
+  uint32_t                    channels;
+  uint32_t                    sampleSize; // 1 or 2 bytes
+  size_t                      rowBytes;   // bytes per row without filter byte
+  std::vector<uint8_t>        filtered;   // height rows of 1 + rowBytes
+  tPngOptions                 Options;
+  unsigned int                slices;
+  std::vector<std::vector<uint8_t> > streams;
+  std::vector<uLong>          adlers;
+  std::vector<uint8_t>        failed;
+} tPngJob;
+
+// sum of absolute values of the row taken as signed bytes
+inline uint64_t PngRowScore(const uint8_t* Row,size_t n)
+{
+  uint64_t sum = 0;
+  size_t i = 0;
+#if defined(PNG_NEON)
+  uint32x4_t acc = vdupq_n_u32(0);
+  for(;i+16<=n;i+=16)
+  {
+    uint8x16_t v = vld1q_u8(Row+i);
+    uint8x16_t a = vminq_u8(v,vreinterpretq_u8_s8(vnegq_s8(vreinterpretq_s8_u8(v))));
+    acc = vpadalq_u16(acc,vpaddlq_u8(a));
+  }
+  uint64x2_t acc2 = vpaddlq_u32(acc);
+  sum = vgetq_lane_u64(acc2,0) + vgetq_lane_u64(acc2,1);
+#elif defined(PNG_SSE2)
+  __m128i zero = _mm_setzero_si128();
+  __m128i acc = zero;
+  for(;i+16<=n;i+=16)
+  {
+    __m128i v = _mm_loadu_si128((const __m128i*)(Row+i));
+    __m128i a = _mm_min_epu8(v,_mm_sub_epi8(zero,v));
+    acc = _mm_add_epi64(acc,_mm_sad_epu8(a,zero));
+  }
+  sum = (uint64_t)_mm_cvtsi128_si32(acc) + (uint64_t)_mm_cvtsi128_si32(_mm_srli_si128(acc,8));
+#endif
+  for(;i<n;i++)
+    sum += Row[i]<128 ? Row[i] : 256-Row[i];
+  return sum;
+}
+
+// paeth predictor
+inline uint8_t PngPaeth(int a,int b,int c)
+{
+  int p = a+b-c;
+  int pa = abs(p-a), pb = abs(p-b), pc = abs(p-c);
+  if(pa<=pb && pa<=pc)
+    return a;
+  return pb<=pc ? b : c;
+}
+
+// big-endian bytes of row y
+inline void PngRowBytes(const tPngJob& Job,uint32_t y,uint8_t* Out)
+{
+  const uint8_t* in = Job.samples + (size_t)y*Job.rowBytes;
+  if(Job.sampleSize==1)
+    memcpy(Out,in,Job.rowBytes);
+  else
+    for(size_t i=0;i<Job.rowBytes;i+=2)
+    {
+      uint16_t v;
+      memcpy(&v,in+i,2);
+      Out[i] = v>>8;
+      Out[i+1] = v & 0xff;
+    }
+}
+
+// filter rows [first,last) into Job.filtered
+inline void PngFilterRows(tPngJob& Job,uint32_t First,uint32_t Last)
+{
+  size_t n = Job.rowBytes;
+  size_t bpp = Job.channels*Job.sampleSize;
+  std::vector<uint8_t> prev(n,0), cur(n), trial(5*n);
+
+  if(First>0)
+    PngRowBytes(Job,First-1,&prev[0]);
+
+  for(uint32_t y=First;y<Last;y++)
+  {
+    PngRowBytes(Job,y,&cur[0]);
+    const uint8_t* c = &cur[0];
+    const uint8_t* p = &prev[0];
+    uint8_t* none = &trial[0];
+    uint8_t* sub = &trial[n];
+    uint8_t* up = &trial[2*n];
+    uint8_t* avg = &trial[3*n];
+    uint8_t* paeth = &trial[4*n];
+
+    memcpy(none,c,n);
+    for(size_t i=0;i<bpp;i++)
+    {
+      sub[i] = c[i];
+      up[i] = c[i]-p[i];
+      avg[i] = c[i]-(p[i]>>1);
+      paeth[i] = c[i]-p[i];
+    }
+    for(size_t i=bpp;i<n;i++)
+    {
+      sub[i] = c[i]-c[i-bpp];
+      up[i] = c[i]-p[i];
+      avg[i] = c[i]-((c[i-bpp]+p[i])>>1);
+      paeth[i] = c[i]-PngPaeth(c[i-bpp],p[i],p[i-bpp]);
+    }
+
+    // keep the filter with the lowest score
+    int best = 0;
+    uint64_t bestScore = PngRowScore(none,n);
+    for(int f=1;f<5;f++)
+    {
+      uint64_t score = PngRowScore(&trial[f*n],n);
+      if(score<bestScore)
+      {
+        best = f;
+        bestScore = score;
+      }
+    }
+
+    uint8_t* out = &Job.filtered[(size_t)y*(n+1)];
+    out[0] = best;
+    memcpy(out+1,&trial[best*n],n);
+    prev.swap(cur);
+  }
+}
+
+// rows of slice i
+inline void PngSliceRows(const tPngJob& Job,unsigned int i,uint32_t& First,uint32_t& Last)
+{
+  First = (uint32_t)((uint64_t)Job.height*i/Job.slices);
+  Last = (uint32_t)((uint64_t)Job.height*(i+1)/Job.slices);
+}
+
+// filter and deflate one slice (runs on its own thread)
+inline void PngSliceFilter(void* Arg,unsigned int i)
+{
+  tPngJob& Job = *(tPngJob*)Arg;
+  uint32_t first, last;
+  PngSliceRows(Job,i,first,last);
+  PngFilterRows(Job,first,last);
+}
+
+inline void PngSliceDeflate(void* Arg,unsigned int i)
+{
+  tPngJob& Job = *(tPngJob*)Arg;
+  uint32_t first, last;
+  PngSliceRows(Job,i,first,last);
+
+  size_t stride = Job.rowBytes+1;
+  const uint8_t* in = &Job.filtered[(size_t)first*stride];
+  size_t size = (size_t)(last-first)*stride;
+  bool final = (i==Job.slices-1);
+
+  z_stream zs;
+  memset(&zs,0,sizeof(zs));
+  if(deflateInit2(&zs,Job.Options.level,Z_DEFLATED,-15,8,Job.Options.strategy)!=Z_OK)
+  {
+    Job.failed[i] = 1;
+    return;
+  }
+
+  // prime with the data before the slice so matches can reach back into it
+  size_t dict = (size_t)first*stride < PNG_WINDOW ? (size_t)first*stride : PNG_WINDOW;
+  if(dict)
+    deflateSetDictionary(&zs,in-dict,dict);
+
+  std::vector<uint8_t>& out = Job.streams[i];
+  out.resize(deflateBound(&zs,size)+16);
+  zs.next_in = (Bytef*)in;
+  zs.avail_in = size;
+  zs.next_out = &out[0];
+  zs.avail_out = out.size();
+  int err = deflate(&zs,final ? Z_FINISH : Z_SYNC_FLUSH);
+  Job.failed[i] = final ? err!=Z_STREAM_END : (err!=Z_OK || zs.avail_in!=0);
+  out.resize(zs.total_out);
+  deflateEnd(&zs);
+
+  Job.adlers[i] = adler32(adler32(0,NULL,0),in,size);
+}
+
+// append a PNG chunk
+inline void PngChunk(std::vector<uint8_t>& Out,const char* Type,const uint8_t* Data,size_t Size)
+{
+  uint8_t be[4] = {(uint8_t)(Size>>24),(uint8_t)(Size>>16),(uint8_t)(Size>>8),(uint8_t)Size};
+  Out.insert(Out.end(),be,be+4);
+  size_t start = Out.size();
+  Out.insert(Out.end(),Type,Type+4);
+  if(Size)
+    Out.insert(Out.end(),Data,Data+Size);
+
+  uLong crc = crc32(crc32(0,NULL,0),&Out[start],Out.size()-start);
+  uint8_t c[4] = {(uint8_t)(crc>>24),(uint8_t)(crc>>16),(uint8_t)(crc>>8),(uint8_t)crc};
+  Out.insert(Out.end(),c,c+4);
+}
+
+// encode Samples (host byte order, rows packed) as a PNG into Out
+inline bool PngEncode(const void* Samples,uint32_t Width,uint32_t Height,uint32_t Channels,
+                      uint32_t BitDepth,const tPngOptions& Options,std::vector<uint8_t>& Out)
+{
+  if((BitDepth!=8 && BitDepth!=16) || (Channels!=1 && Channels!=3) || !Width || !Height)
+    return false;
+
+  tPngJob Job;
+  Job.samples = (const uint8_t*)Samples;
+  Job.width = Width;
+  Job.height = Height;
+  Job.channels = Channels;
+  Job.sampleSize = BitDepth/8;
+  Job.rowBytes = (size_t)Width*Channels*Job.sampleSize;
+  Job.filtered.resize((size_t)Height*(Job.rowBytes+1));
+  Job.Options = Options;
+  Job.slices = Options.threads ? Options.threads : 1;
+  if(Job.slices>Height)
+    Job.slices = Height;
+  Job.streams.resize(Job.slices);
+  Job.adlers.resize(Job.slices);
+  Job.failed.assign(Job.slices,0);
+
+  // filter everything first so every slice can be primed from its predecessor
+  RunParallel(Job.slices,PngSliceFilter,&Job);
+  RunParallel(Job.slices,PngSliceDeflate,&Job);
+
+  // zlib header, concatenated slices, combined adler32
+  std::vector<uint8_t> idat;
+  int flevel = Options.level<2 ? 0 : Options.level<6 ? 1 : Options.level==6 ? 2 : 3;
+  uint8_t cmf = 0x78, flg = flevel<<6;
+  flg += 31 - ((cmf<<8) + flg)%31;
+  idat.push_back(cmf);
+  idat.push_back(flg);
+  uLong adler = adler32(0,NULL,0);
+  size_t stride = Job.rowBytes+1;
+  for(unsigned int i=0;i<Job.slices;i++)
+  {
+    if(Job.failed[i])
+      return false;
+    uint32_t first, last;
+    PngSliceRows(Job,i,first,last);
+    adler = adler32_combine(adler,Job.adlers[i],(z_off_t)((size_t)(last-first)*stride));
+    idat.insert(idat.end(),Job.streams[i].begin(),Job.streams[i].end());
+  }
+  uint8_t a[4] = {(uint8_t)(adler>>24),(uint8_t)(adler>>16),(uint8_t)(adler>>8),(uint8_t)adler};
+  idat.insert(idat.end(),a,a+4);
+
+  // signature, IHDR, IDAT, IEND
+  static const uint8_t signature[8] = {0x89,'P','N','G','\r','\n',0x1a,'\n'};
+  uint8_t ihdr[13] = {(uint8_t)(Width>>24),(uint8_t)(Width>>16),(uint8_t)(Width>>8),(uint8_t)Width,
+                      (uint8_t)(Height>>24),(uint8_t)(Height>>16),(uint8_t)(Height>>8),(uint8_t)Height,
+                      (uint8_t)BitDepth,(uint8_t)(Channels==3 ? 2 : 0),0,0,0};
+  Out.assign(signature,signature+8);
+  PngChunk(Out,"IHDR",ihdr,13);
+  PngChunk(Out,"IDAT",&idat[0],idat.size());
+  PngChunk(Out,"IEND",NULL,0);
+  return true;
+}
+
+#endif
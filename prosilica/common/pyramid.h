@@ -0,0 +1,162 @@
+/* Header-only format and reader for pyramid sidecars written by make_pyramid.
+ *
+ * A sidecar holds, for every frame of a recording, its time block and the
+ * frame at 1/2, 1/4 and 1/8 scale as 8-bit tone-mapped images. Every frame
+ * record has the same size, so the record of frame i is found by arithmetic
+ * alone and a thumbnail is a pointer into the mapping: no index to search,
+ * nothing to decode.
+ *
+ * Layout: a 128-byte tPyramidHeader, then frameCount records of
+ * tFrameStamp + level 1 + level 2 + level 3 (rows packed, one byte per pixel).
+ * frameCount is written last, so an interrupted build reads as empty.
+ */
+
+#ifndef PYRAMID_H_INCLUDE
+#define PYRAMID_H_INCLUDE
+
+// includes
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <recording.h>
+
+#define PYRAMID_MAGIC       "SEDPYR1"
+#define PYRAMID_HEADER_SIZE 128
+#define PYRAMID_LEVELS      3 // 1/2, 1/4 and 1/8 scale
+
+// sidecar header (little-endian, padded to PYRAMID_HEADER_SIZE)
+typedef struct
+{
+  char     magic[8];
+  uint32_t width;                       // source frame size
+  uint32_t height;
+  uint32_t levels;
+  uint32_t levelWidth[PYRAMID_LEVELS];
+  uint32_t levelHeight[PYRAMID_LEVELS];
+  uint32_t recordSize;                  // time block + all levels
+  uint64_t frameCount;                  // frames written
+  uint32_t toneLow;                     // source values mapped to 0 and 255
+  uint32_t toneHigh;
+  char     pixelFormat[16];
+  uint8_t  reserved[PYRAMID_HEADER_SIZE-80];
+} tPyramidHeader;
+
+// one thumbnail
+typedef struct
+{
+  const uint8_t* pixels;
+  uint32_t       width;
+  uint32_t       height;
+} tThumbnail;
+
+// an open sidecar
+typedef struct
+{
+  int            fd;
+  const uint8_t* base;
+  uint64_t       fileSize;
+  tPyramidHeader header;
+  uint32_t       levelOffset[PYRAMID_LEVELS]; // within a record
+  char           error[128];
+} tPyramid;
+
+// fill in level sizes and offsets for a source frame size
+inline void PyramidLayout(tPyramidHeader& Header,uint32_t LevelOffset[PYRAMID_LEVELS])
+{
+  uint32_t offset = RECORDING_STAMP_SIZE;
+  uint32_t w = Header.width, h = Header.height;
+
+  Header.levels = PYRAMID_LEVELS;
+  for(int l=0;l<PYRAMID_LEVELS;l++)
+  {
+    w = w>1 ? w/2 : 1;
+    h = h>1 ? h/2 : 1;
+    Header.levelWidth[l] = w;
+    Header.levelHeight[l] = h;
+    LevelOffset[l] = offset;
+    offset += w*h;
+  }
+  Header.recordSize = offset;
+}
+
+// close a sidecar
+inline void PyramidClose(tPyramid& P)
+{
+  if(P.base)
+    munmap((void*)P.base,P.fileSize);
+  if(P.fd>=0)
+    close(P.fd);
+  P.base = NULL;
+  P.fd = -1;
+}
+
+// open and map a sidecar
+inline bool PyramidOpen(tPyramid& P,const char* Path)
+{
+  struct stat st;
+
+  memset(&P,0,sizeof(tPyramid));
+  P.fd = open(Path,O_RDONLY);
+  if(P.fd<0 || fstat(P.fd,&st)!=0 || (uint64_t)st.st_size<PYRAMID_HEADER_SIZE)
+  {
+    snprintf(P.error,sizeof(P.error),"cannot read %s",Path);
+    PyramidClose(P);
+    return false;
+  }
+  P.fileSize = st.st_size;
+
+  // mapped whole, like a recording; on 32-bit hosts it has to fit size_t
+  if(P.fileSize>(uint64_t)SIZE_MAX)
+  {
+    snprintf(P.error,sizeof(P.error),"%s is too large to map on this host",Path);
+    P.fileSize = 0;
+    PyramidClose(P);
+    return false;
+  }
+
+  void* base = mmap(NULL,(size_t)P.fileSize,PROT_READ,MAP_SHARED,P.fd,0);
+  if(base==MAP_FAILED)
+  {
+    snprintf(P.error,sizeof(P.error),"cannot map %s",Path);
+    PyramidClose(P);
+    return false;
+  }
+  P.base = (const uint8_t*)base;
+  memcpy(&P.header,P.base,PYRAMID_HEADER_SIZE);
+
+  // check the stored layout against the one derived from the frame size
+  tPyramidHeader expected = P.header;
+  PyramidLayout(expected,P.levelOffset);
+  if(memcmp(P.header.magic,PYRAMID_MAGIC,8)!=0 || memcmp(&expected,&P.header,sizeof(tPyramidHeader))!=0 ||
+     PYRAMID_HEADER_SIZE + P.header.frameCount*P.header.recordSize > P.fileSize)
+  {
+    snprintf(P.error,sizeof(P.error),"%s is not a complete pyramid sidecar",Path);
+    PyramidClose(P);
+    return false;
+  }
+  return true;
+}
+
+// time block of frame i
+inline tFrameStamp PyramidStamp(const tPyramid& P,uint64_t i)
+{
+  tFrameStamp stamp;
+  memcpy(&stamp,P.base + PYRAMID_HEADER_SIZE + i*P.header.recordSize,RECORDING_STAMP_SIZE);
+  return stamp;
+}
+
+// thumbnail of frame i at level l (0 = 1/2 scale .. 2 = 1/8 scale)
+inline tThumbnail PyramidThumbnail(const tPyramid& P,uint64_t i,int l)
+{
+  tThumbnail t;
+  t.pixels = P.base + PYRAMID_HEADER_SIZE + i*P.header.recordSize + P.levelOffset[l];
+  t.width = P.header.levelWidth[l];
+  t.height = P.header.levelHeight[l];
+  return t;
+}
+
+#endif
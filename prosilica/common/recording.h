@@ -0,0 +1,508 @@
+/* Header-only reader for snap_image recordings.
+ *
+ * A recording is the 36-byte header written by WriteHeader, one record per
+ * frame (16-byte time block followed by the image) and, once the capture has
+ * completed, the 4-byte dropped-frame count. The 40 bytes checkFile adds to
+ * the expected size are this header plus the trailer. Newer recordings
+ * follow the trailer with a footer: a tFrameInfo per frame (the CRC32C of
+ * the frame record and, from cameras in chunk mode, the exposure, gain and
+ * sync levels the frame was taken with) and a tRecordingFooter tail ending
+ * in a magic string, so it is found from the end of the file. Readers that
+ * predate the footer still find every frame but take the file for a
+ * truncated one; entries of older footers are shorter, and what they lack
+ * reads as zero.
+ *
+ * The file is memory-mapped and frames are handed out as views into the
+ * mapping, so pixel data is never copied. The whole file is mapped at once,
+ * so on 32-bit hosts a recording must fit in the process address space:
+ * about 2 GB on the BeagleBone, which RecordingOpen reports by name.
+ * Frames are fixed size, so RecordingFindRange locates a time range with a
+ * binary search that reads only O(log n) time blocks.
+ */
+
+#ifndef RECORDING_H_INCLUDE
+#define RECORDING_H_INCLUDE
+
+// includes
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <iterator>
+
+#define RECORDING_HEADER_SIZE  36 // bytes written by WriteHeader
+#define RECORDING_STAMP_SIZE   16 // time block in front of every image
+#define RECORDING_TRAILER_SIZE 4  // dropped-frame count at end of file
+#define RECORDING_FOOTER_SIZE  24 // tail of the per-frame footer
+#define RECORDING_FOOTER_MAGIC "SEDFOOT"
+#define RECORDING_FOOTER_VERSION 2 // 1: crc only
+
+// for the tools' usage text
+#define RECORDING_MAP_LIMIT "recordings are mapped whole, so a 32-bit host (BeagleBone) opens at most about 2 GB\n"
+#define RECORDING_CHUNK_ID     1000 // ancillary chunk of Prosilica GigE cameras
+#define RECORDING_CHUNK_DATA   20   // chunk bytes tFrameInfo takes fields from
+#define FRAME_INFO_ANCILLARY   1    // tFrameInfo flag: the fields after it came from chunk data
+
+// recording header (little-endian, field order as in WriteHeader)
+typedef struct
+{
+  uint32_t width;
+  uint32_t height;
+  uint32_t timeStampFrequency;
+  float    frameRate;
+  uint32_t frameCount;
+  char     pixelFormat[16];
+} tRecordingHeader;
+
+// time block written by FrameDoneCB
+typedef struct
+{
+  uint32_t hostSecond;
+  uint32_t hostnSecond;
+  uint32_t timestampLo;
+  uint32_t timestampHi;
+} tFrameStamp;
+
+// per-frame footer entry (entries may grow; entrySize in the tail says by how much)
+typedef struct
+{
+  uint32_t crc;              // CRC32C of the time block and image
+  uint32_t flags;            // FRAME_INFO_ANCILLARY if the fields below are set
+  uint32_t exposure;         // exposure the frame was taken with, us
+  uint32_t gain;             // gain, dB
+  uint16_t syncIn;           // sync input levels, one bit per input
+  uint16_t syncOut;          // sync output levels
+  uint32_t acquisitionCount; // camera's acquisition counter
+} tFrameInfo;
+
+// footer tail, the last bytes of the file
+typedef struct
+{
+  uint32_t entrySize;   // bytes per tFrameInfo as written
+  uint32_t version;
+  uint64_t count;       // entries, one per frame record
+  char     magic[8];
+} tRecordingFooter;
+
+// clocks frames can be searched by
+typedef enum
+{
+  eTimeHost   = 0, // host time in ns since the epoch
+  eTimeCamera = 1  // camera ticks
+} tTimeBase;
+
+// access pattern hints passed on to madvise
+typedef enum
+{
+  eAccessNormal     = 0,
+  eAccessSequential = 1,
+  eAccessRandom     = 2
+} tAccessHint;
+
+// view of one frame inside the mapping (the stamp is a copy, the image is not)
+typedef struct
+{
+  uint64_t       index;
+  tFrameStamp    stamp;
+  const void*    image;
+  uint32_t       width;
+  uint32_t       height;
+  uint32_t       imageSize;
+} tFrameView;
+
+// an open recording
+typedef struct
+{
+  int              fd;
+  const uint8_t*   base;
+  uint64_t         fileSize;
+  tRecordingHeader header;
+  uint32_t         imageSize;     // bytes per image
+  uint64_t         recordSize;    // time block + image
+  uint64_t         count;         // complete frame records in the file
+  bool             complete;      // dropped-frame trailer is present
+  bool             truncated;     // file ends inside a frame record
+  uint32_t         framesDropped; // valid if complete
+  const uint8_t*   info;          // footer entries (NULL if there is no footer)
+  uint32_t         infoSize;      // bytes per footer entry
+  uint64_t         infoCount;     // footer entries
+  uint64_t         readahead;     // frames prefetched ahead of iteration (0 = off)
+  char             error[128];
+} tRecording;
+
+// bits per pixel for a PixelFormat name (0 if unknown)
+inline unsigned int PixelFormatBits(const char* pixelFormat)
+{
+  static const struct { const char* name; unsigned int bits; } formats[] =
+  {
+    {"Mono8",8}, {"Mono16",16}, {"Bayer8",8}, {"Bayer16",16},
+    {"Rgb24",24}, {"Rgb48",48}, {"Yuv411",12}, {"Yuv422",16},
+    {"Yuv444",24}, {"Bgr24",24}, {"Rgba32",32}, {"Bgra32",32},
+    {"Mono12Packed",12}, {"Bayer12Packed",12}
+  };
+
+  for(unsigned int i=0;i<sizeof(formats)/sizeof(formats[0]);i++)
+    if(strcmp(pixelFormat,formats[i].name)==0)
+      return formats[i].bits;
+  return 0;
+}
+
+// image size in bytes for a frame of the given geometry and format
+inline uint64_t RecordingImageSize(uint32_t width,uint32_t height,const char* pixelFormat)
+{
+  return ((uint64_t)width * height * PixelFormatBits(pixelFormat) + 7) / 8;
+}
+
+// 64-bit camera timestamp of a frame
+inline uint64_t FrameTicks(const tFrameStamp& Stamp)
+{
+  return ((uint64_t)Stamp.timestampHi << 32) | Stamp.timestampLo;
+}
+
+// host time of a frame in nanoseconds since the epoch
+inline uint64_t FrameHostTime(const tFrameStamp& Stamp)
+{
+  return (uint64_t)Stamp.hostSecond * 1000000000ull + Stamp.hostnSecond;
+}
+
+// time of a frame on the given clock
+inline uint64_t FrameTime(const tFrameStamp& Stamp,tTimeBase Base)
+{
+  return Base==eTimeCamera ? FrameTicks(Stamp) : FrameHostTime(Stamp);
+}
+
+// close a recording
+inline void RecordingClose(tRecording& Rec)
+{
+  if(Rec.base)
+    munmap((void*)Rec.base,Rec.fileSize);
+  if(Rec.fd>=0)
+    close(Rec.fd);
+  Rec.base = NULL;
+  Rec.fd = -1;
+  Rec.count = 0;
+}
+
+// set the madvise hint for the whole mapping
+inline void RecordingAdvise(const tRecording& Rec,tAccessHint Hint)
+{
+  int advice = MADV_NORMAL;
+  if(Hint==eAccessSequential)
+    advice = MADV_SEQUENTIAL;
+  if(Hint==eAccessRandom)
+    advice = MADV_RANDOM;
+  if(Rec.base)
+    madvise((void*)Rec.base,Rec.fileSize,advice);
+}
+
+// ask the kernel to start reading frames [first,first+n) without waiting for them
+inline void RecordingPrefetch(const tRecording& Rec,uint64_t first,uint64_t n)
+{
+  if(!Rec.base || first>=Rec.count)
+    return;
+  if(n>Rec.count-first)
+    n = Rec.count-first;
+
+  // madvise needs a page aligned start
+  uint64_t pageSize = (uint64_t)sysconf(_SC_PAGESIZE);
+  uint64_t start = RECORDING_HEADER_SIZE + first*Rec.recordSize;
+  uint64_t end = start + n*Rec.recordSize;
+  start -= start % pageSize;
+  madvise((void*)(Rec.base+start),end-start,MADV_WILLNEED);
+}
+
+// check the header against the layout written by WriteHeader and size the records
+inline bool RecordingCheckHeader(tRecording& Rec)
+{
+  const tRecordingHeader& h = Rec.header;
+
+  if(memchr(h.pixelFormat,0,sizeof(h.pixelFormat))==NULL)
+  {
+    snprintf(Rec.error,sizeof(Rec.error),"pixel format is not terminated");
+    return false;
+  }
+  if(PixelFormatBits(h.pixelFormat)==0)
+  {
+    snprintf(Rec.error,sizeof(Rec.error),"unknown pixel format %s",h.pixelFormat);
+    return false;
+  }
+  if(h.width==0 || h.height==0)
+  {
+    snprintf(Rec.error,sizeof(Rec.error),"bad frame size %ux%u",h.width,h.height);
+    return false;
+  }
+  if(!(h.frameRate>=0.0f && h.frameRate<1e6f))
+  {
+    snprintf(Rec.error,sizeof(Rec.error),"bad frame rate");
+    return false;
+  }
+
+  Rec.imageSize = (uint32_t)RecordingImageSize(h.width,h.height,h.pixelFormat);
+  Rec.recordSize = RECORDING_STAMP_SIZE + (uint64_t)Rec.imageSize;
+
+  // a footer follows the trailer, so take it off the end first
+  uint64_t end = Rec.fileSize;
+  Rec.info = NULL;
+  Rec.infoSize = 0;
+  Rec.infoCount = 0;
+  if(end>=RECORDING_HEADER_SIZE+RECORDING_TRAILER_SIZE+RECORDING_FOOTER_SIZE)
+  {
+    tRecordingFooter tail;
+    memcpy(&tail,Rec.base+end-RECORDING_FOOTER_SIZE,RECORDING_FOOTER_SIZE);
+    uint64_t room = end - RECORDING_HEADER_SIZE - RECORDING_TRAILER_SIZE - RECORDING_FOOTER_SIZE;
+    if(memcmp(tail.magic,RECORDING_FOOTER_MAGIC,sizeof(tail.magic))==0 && tail.entrySize>=sizeof(uint32_t) &&
+       tail.count<=room/tail.entrySize)
+    {
+      uint64_t size = tail.count*tail.entrySize + RECORDING_FOOTER_SIZE;
+      if((end-size-RECORDING_HEADER_SIZE) % Rec.recordSize==RECORDING_TRAILER_SIZE)
+      {
+        end -= size;
+        Rec.info = Rec.base + end;
+        Rec.infoSize = tail.entrySize;
+        Rec.infoCount = tail.count;
+      }
+    }
+  }
+
+  // work out how many records are present and whether the trailer was written
+  uint64_t body = end - RECORDING_HEADER_SIZE;
+  uint64_t rest = body % Rec.recordSize;
+  Rec.count = body / Rec.recordSize;
+  Rec.complete = (rest==RECORDING_TRAILER_SIZE);
+  Rec.truncated = (rest!=0 && !Rec.complete);
+  Rec.framesDropped = 0;
+  if(Rec.complete)
+    memcpy(&Rec.framesDropped,Rec.base+end-RECORDING_TRAILER_SIZE,RECORDING_TRAILER_SIZE);
+
+  if(Rec.count>h.frameCount)
+  {
+    snprintf(Rec.error,sizeof(Rec.error),"%llu frames found but header specifies %u",
+      (unsigned long long)Rec.count,h.frameCount);
+    return false;
+  }
+  return true;
+}
+
+// open and map a recording
+inline bool RecordingOpen(tRecording& Rec,const char* Path,tAccessHint Hint = eAccessNormal)
+{
+  struct stat st;
+
+  memset(&Rec,0,sizeof(tRecording));
+  Rec.fd = open(Path,O_RDONLY);
+  if(Rec.fd<0)
+  {
+    snprintf(Rec.error,sizeof(Rec.error),"cannot open %s",Path);
+    return false;
+  }
+  if(fstat(Rec.fd,&st)!=0 || (uint64_t)st.st_size<RECORDING_HEADER_SIZE)
+  {
+    snprintf(Rec.error,sizeof(Rec.error),"%s is too short to be a recording",Path);
+    RecordingClose(Rec);
+    return false;
+  }
+  Rec.fileSize = st.st_size;
+
+  // the whole file is mapped at once; on 32-bit hosts it has to fit size_t,
+  // and in practice the 2-3 GB of free address space
+  if(Rec.fileSize>(uint64_t)SIZE_MAX)
+  {
+    snprintf(Rec.error,sizeof(Rec.error),"cannot map %.1f GB on a 32-bit host (about 2 GB at most): %s",
+             Rec.fileSize/1073741824.0,Path);
+    Rec.fileSize = 0;
+    RecordingClose(Rec);
+    return false;
+  }
+
+  void* base = mmap(NULL,(size_t)Rec.fileSize,PROT_READ,MAP_SHARED,Rec.fd,0);
+  if(base==MAP_FAILED)
+  {
+    if(sizeof(void*)<8 && errno==ENOMEM)
+      snprintf(Rec.error,sizeof(Rec.error),"cannot map %.1f GB on a 32-bit host (about 2 GB at most): %s",
+               Rec.fileSize/1073741824.0,Path);
+    else
+      snprintf(Rec.error,sizeof(Rec.error),"cannot map %s: %s",Path,strerror(errno));
+    Rec.base = NULL;
+    RecordingClose(Rec);
+    return false;
+  }
+  Rec.base = (const uint8_t*)base;
+  memcpy(&Rec.header,Rec.base,RECORDING_HEADER_SIZE);
+
+  if(!RecordingCheckHeader(Rec))
+  {
+    RecordingClose(Rec);
+    return false;
+  }
+
+  RecordingAdvise(Rec,Hint);
+  return true;
+}
+
+// view of frame i (i must be below Rec.count)
+inline tFrameView RecordingFrame(const tRecording& Rec,uint64_t i)
+{
+  tFrameView view;
+  const uint8_t* record = Rec.base + RECORDING_HEADER_SIZE + i*Rec.recordSize;
+
+  view.index = i;
+  memcpy(&view.stamp,record,RECORDING_STAMP_SIZE);
+  view.image = record + RECORDING_STAMP_SIZE;
+  view.width = Rec.header.width;
+  view.height = Rec.header.height;
+  view.imageSize = Rec.imageSize;
+  return view;
+}
+
+// time block of frame i (touches only the page holding it)
+inline tFrameStamp RecordingStamp(const tRecording& Rec,uint64_t i)
+{
+  tFrameStamp stamp;
+  memcpy(&stamp,Rec.base + RECORDING_HEADER_SIZE + i*Rec.recordSize,RECORDING_STAMP_SIZE);
+  return stamp;
+}
+
+// first frame whose time is at or after Time (Rec.count if none), by binary
+// search; times must not decrease, which holds for the camera clock and for
+// the host clock unless it was stepped during the capture
+inline uint64_t RecordingLowerBound(const tRecording& Rec,tTimeBase Base,uint64_t Time)
+{
+  uint64_t lo = 0, hi = Rec.count;
+  while(lo<hi)
+  {
+    uint64_t mid = lo + (hi-lo)/2;
+    if(FrameTime(RecordingStamp(Rec,mid),Base)<Time)
+      lo = mid+1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+// frames with Start <= time < Stop as First and Count
+inline void RecordingFindRange(const tRecording& Rec,tTimeBase Base,uint64_t Start,uint64_t Stop,
+                               uint64_t& First,uint64_t& Count)
+{
+  First = RecordingLowerBound(Rec,Base,Start);
+  uint64_t last = Stop>Start ? RecordingLowerBound(Rec,Base,Stop) : First;
+  Count = last>First ? last-First : 0;
+}
+
+// footer entry of frame i; false if the recording has none for it (fields
+// missing from an older, shorter entry are zeroed)
+inline bool RecordingFrameInfo(const tRecording& Rec,uint64_t i,tFrameInfo& Info)
+{
+  memset(&Info,0,sizeof(tFrameInfo));
+  if(!Rec.info || i>=Rec.infoCount)
+    return false;
+  memcpy(&Info,Rec.info + i*Rec.infoSize,Rec.infoSize<sizeof(tFrameInfo) ? Rec.infoSize : sizeof(tFrameInfo));
+  return true;
+}
+
+// 32 or 16 bits of chunk data, in the byte order it came in
+inline uint32_t ChunkWord(const uint8_t* P,bool BigEndian,int Bytes = 4)
+{
+  uint32_t value = 0;
+  for(int i=0;i<Bytes;i++)
+    value |= (uint32_t)P[BigEndian ? i : Bytes-1-i] << (8*(Bytes-1-i));
+  return value;
+}
+
+// take exposure, gain and sync levels from a frame's ancillary buffer
+// (ChunkModeActive): the chunk data, then its ID and length. GigE Vision
+// sends chunks big-endian; the ID tells if they arrive swapped. False if
+// the buffer holds no chunk this understands.
+inline bool FrameInfoAncillary(tFrameInfo& Info,const void* Data,unsigned long Size)
+{
+  const uint8_t* p = (const uint8_t*)Data;
+  if(!p || Size<RECORDING_CHUNK_DATA+8)
+    return false;
+  const uint8_t* tail = p + Size - 8;
+  bool big = ChunkWord(tail,true)==RECORDING_CHUNK_ID;
+  if(!big && ChunkWord(tail,false)!=RECORDING_CHUNK_ID)
+    return false;
+  uint32_t length = ChunkWord(tail+4,big);
+  if(length<RECORDING_CHUNK_DATA || length>Size-8)
+    return false;
+
+  // acquisition count, lens settings, exposure, gain, sync in, sync out
+  const uint8_t* chunk = tail - length;
+  Info.acquisitionCount = ChunkWord(chunk,big);
+  Info.exposure = ChunkWord(chunk+8,big);
+  Info.gain = ChunkWord(chunk+12,big);
+  Info.syncIn = (uint16_t)ChunkWord(chunk+16,big,2);
+  Info.syncOut = (uint16_t)ChunkWord(chunk+18,big,2);
+  Info.flags |= FRAME_INFO_ANCILLARY;
+  return true;
+}
+
+// footer tail for Count entries of the current layout
+inline tRecordingFooter RecordingFooterTail(uint64_t Count)
+{
+  tRecordingFooter tail;
+  memset(&tail,0,sizeof(tail));
+  tail.entrySize = sizeof(tFrameInfo);
+  tail.version = RECORDING_FOOTER_VERSION;
+  tail.count = Count;
+  memcpy(tail.magic,RECORDING_FOOTER_MAGIC,sizeof(RECORDING_FOOTER_MAGIC));
+  return tail;
+}
+
+// random-access iterator over the frames of a recording
+class tFrameIterator
+{
+public:
+  typedef std::random_access_iterator_tag iterator_category;
+  typedef tFrameView                      value_type;
+  typedef int64_t                         difference_type;
+  typedef const tFrameView*               pointer;
+  typedef tFrameView                      reference;
+
+  tFrameIterator() : Rec(NULL), i(0) {}
+  tFrameIterator(const tRecording* R,uint64_t I) : Rec(R), i(I)
+  {
+    if(Rec && Rec->readahead)
+      RecordingPrefetch(*Rec,i,2*Rec->readahead);
+  }
+
+  tFrameView operator*() const { return RecordingFrame(*Rec,i); }
+  tFrameView operator[](difference_type n) const { return RecordingFrame(*Rec,i+n); }
+
+  tFrameIterator& operator++() { i++; Prefetch(); return *this; }
+  tFrameIterator operator++(int) { tFrameIterator t(*this); ++*this; return t; }
+  tFrameIterator& operator--() { i--; return *this; }
+  tFrameIterator operator--(int) { tFrameIterator t(*this); i--; return t; }
+  tFrameIterator& operator+=(difference_type n) { i += n; Prefetch(); return *this; }
+  tFrameIterator& operator-=(difference_type n) { i -= n; return *this; }
+  tFrameIterator operator+(difference_type n) const { tFrameIterator t(*this); t.i += n; return t; }
+  tFrameIterator operator-(difference_type n) const { tFrameIterator t(*this); t.i -= n; return t; }
+  difference_type operator-(const tFrameIterator& o) const { return (difference_type)i - (difference_type)o.i; }
+
+  bool operator==(const tFrameIterator& o) const { return i==o.i; }
+  bool operator!=(const tFrameIterator& o) const { return i!=o.i; }
+  bool operator<(const tFrameIterator& o) const { return i<o.i; }
+  bool operator>(const tFrameIterator& o) const { return i>o.i; }
+  bool operator<=(const tFrameIterator& o) const { return i<=o.i; }
+  bool operator>=(const tFrameIterator& o) const { return i>=o.i; }
+
+private:
+  // when readahead is on, request the next window each time one is entered
+  void Prefetch()
+  {
+    if(Rec && Rec->readahead && i%Rec->readahead==0)
+      RecordingPrefetch(*Rec,i+Rec->readahead,Rec->readahead);
+  }
+
+  const tRecording* Rec;
+  uint64_t          i;
+};
+
+// range of frames usable with range-for and the standard algorithms
+inline tFrameIterator begin(const tRecording& Rec) { return tFrameIterator(&Rec,0); }
+inline tFrameIterator end(const tRecording& Rec) { return tFrameIterator(NULL,Rec.count); }
+
+#endif
@@ -0,0 +1,472 @@
+/* Header-only session files for snap_image.
+ *
+ * A session file is INI text: [session] holds the capture settings,
+ * [camera] attribute values for every camera, and [camera <uid>] one
+ * camera's output file and attribute values (these win over [camera]).
+ * Keys that start with a capital letter are camera attributes, written the
+ * way dump_camera shows them; the others are settings. ; and # start
+ * comments.
+ *
+ *   [session]
+ *   frames = 100
+ *   rate = 30                 ; frames per second
+ *   link_mbit = 1000          ; network link the cameras share
+ *   disk_mb = 40              ; sustained write rate of the output, MB/s
+ *
+ *   [camera]
+ *   PixelFormat = Mono8
+ *   Width = 1360
+ *
+ *   [camera 102345]
+ *   outfile = /data/left.bin
+ *   ExposureValue = 20000
+ *
+ * Everything is checked before a camera is opened. ConfigValidate checks
+ * each value against the model's cached description (see attr_snapshot.h):
+ * the attribute must exist and be writable, and the value must parse as its
+ * type within its range or enum set. The cached limits of Width, Height,
+ * RegionX and RegionY follow the binning at the time of the dump, so they
+ * are only checked when the settings leave binning and decimation alone.
+ * ConfigRate works out what a camera's frames need on the link and on
+ * disk, and ConfigFits adds the cameras up against the declared limits.
+ */
+
+#ifndef SESSION_CONFIG_H_INCLUDE
+#define SESSION_CONFIG_H_INCLUDE
+
+// includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <PvApi.h>
+#include <recording.h>
+#include <attr_snapshot.h>
+
+#define CONFIG_LINK_MBIT     1000 // link assumed when the file declares none
+#define CONFIG_PACKET_SIZE   1500 // PacketSize assumed when none is set
+#define CONFIG_PACKET_HEADER 36   // IP, UDP and GVSP headers inside PacketSize
+#define CONFIG_GVSP_HEADER   8    // of them, the GVSP header
+#define CONFIG_ETHERNET      38   // Ethernet header, FCS, preamble and gap per packet
+
+// one key = value line
+typedef struct
+{
+  std::string section;  // "session", "camera" or "camera <uid>"
+  std::string key;
+  std::string value;
+  int         line;
+} tConfigEntry;
+
+// a parsed session file
+typedef struct
+{
+  std::string               path;
+  std::vector<tConfigEntry> entries;
+} tConfig;
+
+// what one camera's frames need
+typedef struct
+{
+  unsigned long uid;
+  uint64_t      imageBytes;  // per frame
+  double        rate;        // frames per second
+  double        wireBytes;   // per second on the link, all headers and Ethernet framing included
+  double        streamBytes; // per second as StreamBytesPerSecond counts it (payload and GVSP headers)
+  double        diskBytes;   // per second to the output, time blocks included
+  double        streamLimit; // StreamBytesPerSecond (0 if not set)
+} tConfigRate;
+
+// settings known in [session] and [camera] sections
+static const char* const ConfigSessionKeys[] =
+  {"frames","rate","exposure","exposure_auto_max","gain_auto_max","link_mbit","disk_mb"};
+static const char* const ConfigCameraKeys[] = {"outfile"};
+
+// text without surrounding blanks
+inline std::string ConfigTrim(const std::string& S)
+{
+  size_t first = 0, last = S.size();
+  while(first<last && isspace((unsigned char)S[first]))
+    first++;
+  while(last>first && isspace((unsigned char)S[last-1]))
+    last--;
+  return S.substr(first,last-first);
+}
+
+// section of one camera
+inline std::string ConfigSection(unsigned long Uid)
+{
+  char section[32];
+  snprintf(section,sizeof(section),"camera %lu",Uid);
+  return section;
+}
+
+// camera attributes start with a capital letter, settings do not
+inline bool ConfigIsAttr(const std::string& Key)
+{
+  return !Key.empty() && isupper((unsigned char)Key[0]);
+}
+
+// is Key one of Keys
+inline bool ConfigKnown(const char* const* Keys,size_t Count,const std::string& Key)
+{
+  for(size_t i=0;i<Count;i++)
+    if(Key==Keys[i])
+      return true;
+  return false;
+}
+
+// parse session file text; Error gets "path:line: reason"
+inline bool ConfigParse(const std::string& Text,const char* Path,tConfig& C,std::string& Error)
+{
+  char where[512];
+  std::string section;
+  size_t start = 0;
+  C.path = Path;
+  C.entries.clear();
+  for(int line=1;start<Text.size();line++)
+  {
+    size_t end = Text.find('\n',start);
+    end = end==std::string::npos ? Text.size() : end;
+    std::string text(Text,start,end-start);
+    start = end+1;
+    size_t comment = text.find_first_of(";#");
+    text = ConfigTrim(comment==std::string::npos ? text : text.substr(0,comment));
+    if(text.empty())
+      continue;
+
+    snprintf(where,sizeof(where),"%s:%d: ",Path,line);
+    if(text[0]=='[')
+    {
+      if(text[text.size()-1]!=']')
+      {
+        Error = std::string(where) + "unterminated section";
+        return false;
+      }
+      section = ConfigTrim(text.substr(1,text.size()-2));
+      char* rest = NULL;
+      bool camera = section.compare(0,7,"camera ")==0 && strtoul(section.c_str()+7,&rest,10)>0 && *rest==0;
+      if(section!="session" && section!="camera" && !camera)
+      {
+        Error = std::string(where) + "unknown section [" + section + "]";
+        return false;
+      }
+      if(camera)
+        section = ConfigSection(strtoul(section.c_str()+7,NULL,10));
+      continue;
+    }
+
+    size_t equals = text.find('=');
+    if(equals==std::string::npos)
+    {
+      Error = std::string(where) + "expected key = value";
+      return false;
+    }
+    tConfigEntry E;
+    E.section = section;
+    E.key = ConfigTrim(text.substr(0,equals));
+    E.value = ConfigTrim(text.substr(equals+1));
+    E.line = line;
+    if(section.empty())
+    {
+      Error = std::string(where) + E.key + " is outside any section";
+      return false;
+    }
+    if(E.key.empty() || E.value.empty())
+    {
+      Error = std::string(where) + "expected key = value";
+      return false;
+    }
+    if(section=="session")
+    {
+      char* rest = NULL;
+      if(ConfigIsAttr(E.key))
+      {
+        Error = std::string(where) + "camera attribute " + E.key + " belongs in a [camera] section";
+        return false;
+      }
+      if(!ConfigKnown(ConfigSessionKeys,sizeof(ConfigSessionKeys)/sizeof(ConfigSessionKeys[0]),E.key))
+      {
+        Error = std::string(where) + "unknown setting " + E.key;
+        return false;
+      }
+      if(strtod(E.value.c_str(),&rest)<0 || *rest!=0)
+      {
+        Error = std::string(where) + E.key + " must be a number, not " + E.value;
+        return false;
+      }
+    }
+    else if(!ConfigIsAttr(E.key) &&
+            (section=="camera" || !ConfigKnown(ConfigCameraKeys,sizeof(ConfigCameraKeys)/sizeof(ConfigCameraKeys[0]),E.key)))
+    {
+      Error = std::string(where) + "unknown setting " + E.key + " in [" + section + "]";
+      return false;
+    }
+    C.entries.push_back(E);
+  }
+  return true;
+}
+
+// read and parse a session file
+inline bool ConfigLoad(const char* Path,tConfig& C,std::string& Error)
+{
+  std::string text;
+  if(!AttrReadFile(Path,text))
+  {
+    Error = std::string("cannot read ") + Path;
+    return false;
+  }
+  return ConfigParse(text,Path,C,Error);
+}
+
+// a value (the last one given), NULL if unset
+inline const char* ConfigValue(const tConfig& C,const std::string& Section,const char* Key)
+{
+  const char* value = NULL;
+  for(size_t i=0;i<C.entries.size();i++)
+    if(C.entries[i].section==Section && C.entries[i].key==Key)
+      value = C.entries[i].value.c_str();
+  return value;
+}
+
+// cameras with a section of their own, in file order
+inline void ConfigCameras(const tConfig& C,std::vector<unsigned long>& Uids)
+{
+  Uids.clear();
+  for(size_t i=0;i<C.entries.size();i++)
+  {
+    if(C.entries[i].section.compare(0,7,"camera ")!=0)
+      continue;
+    unsigned long uid = strtoul(C.entries[i].section.c_str()+7,NULL,10);
+    if(std::find(Uids.begin(),Uids.end(),uid)==Uids.end())
+      Uids.push_back(uid);
+  }
+}
+
+// set an attribute of a target, replacing a value it already has
+inline void ConfigPut(tAttrSnapshot& Target,const std::string& Name,tPvDatatype Type,const std::string& Value)
+{
+  for(size_t i=0;i<Target.attrs.size();i++)
+    if(Target.attrs[i].name==Name)
+    {
+      Target.attrs[i].value = Value;
+      if(Type!=ePvDatatypeUnknown)
+        Target.attrs[i].type = Type;
+      return;
+    }
+  tAttr A;
+  A.name = Name;
+  A.type = Type;
+  A.flags = ePvFlagRead | ePvFlagWrite;
+  A.value = Value;
+  A.err = ePvErrSuccess;
+  Target.attrs.push_back(A);
+}
+
+// the file's attributes for one camera ([camera], then [camera <uid>]) over Target;
+// types come from Model, or from Target, and are unknown otherwise
+inline void ConfigAttrs(const tConfig& C,unsigned long Uid,const tAttrSnapshot* Model,tAttrSnapshot& Target)
+{
+  std::string own = ConfigSection(Uid);
+  for(int pass=0;pass<2;pass++)
+    for(size_t i=0;i<C.entries.size();i++)
+    {
+      const tConfigEntry& E = C.entries[i];
+      if(E.section!=(pass ? own : "camera") || !ConfigIsAttr(E.key))
+        continue;
+      const tAttr* known = Model ? AttrFind(*Model,E.key) : NULL;
+      known = known ? known : AttrFind(Target,E.key);
+      ConfigPut(Target,E.key,known ? known->type : ePvDatatypeUnknown,E.value);
+    }
+}
+
+// check a value against a description and put it in canonical form; false with the reason
+inline bool ConfigCheck(const tAttr& Description,std::string& Value,bool Bounded,std::string& Error)
+{
+  const char* text = Value.c_str();
+  char* rest = NULL;
+  std::string range = Description.min + ".." + Description.max;
+  bool ranged = Bounded && !Description.min.empty() && !Description.max.empty();
+  if(!(Description.flags & ePvFlagWrite) || (Description.flags & ePvFlagConst))
+  {
+    Error = "is read-only";
+    return false;
+  }
+  switch(Description.type)
+  {
+    case ePvDatatypeString:
+      return true;
+    case ePvDatatypeEnum:
+      if(!Description.choices.empty() && ("," + Description.choices + ",").find("," + Value + ",")==std::string::npos)
+      {
+        Error = "must be one of " + Description.choices;
+        return false;
+      }
+      return true;
+    case ePvDatatypeBoolean:
+      if(Value!="true" && Value!="false")
+      {
+        Error = "must be true or false";
+        return false;
+      }
+      return true;
+    case ePvDatatypeUint32:
+      {
+        unsigned long v = strtoul(text,&rest,10);
+        if(rest==text || *rest || strchr(text,'-') || v>0xffffffffUL)
+          Error = "must be a whole number";
+        else if(ranged && (v<strtoul(Description.min.c_str(),NULL,10) || v>strtoul(Description.max.c_str(),NULL,10)))
+          Error = "is outside " + range;
+        else
+        {
+          Value = AttrText(v);
+          return true;
+        }
+        return false;
+      }
+    case ePvDatatypeFloat32:
+      {
+        double v = strtod(text,&rest);
+        if(rest==text || *rest || !isfinite(v))
+          Error = "must be a number";
+        else if(ranged && (v<strtod(Description.min.c_str(),NULL) || v>strtod(Description.max.c_str(),NULL)))
+          Error = "is outside " + range;
+        else
+        {
+          Value = AttrText(v,true);
+          return true;
+        }
+        return false;
+      }
+    case ePvDatatypeInt64:
+      {
+        long long v = strtoll(text,&rest,10);
+        if(rest==text || *rest)
+          Error = "must be a whole number";
+        else if(ranged && (v<strtoll(Description.min.c_str(),NULL,10) || v>strtoll(Description.max.c_str(),NULL,10)))
+          Error = "is outside " + range;
+        else
+        {
+          Value = AttrText(v);
+          return true;
+        }
+        return false;
+      }
+    case ePvDatatypeUnknown:
+      Error = "has no known type (no cached description of this model; run dump_camera once)";
+      return false;
+    default:
+      Error = std::string("cannot be set (") + AttrTypeName(Description.type) + ")";
+      return false;
+  }
+}
+
+// check every attribute of a target against the model (NULL: only the
+// types the target already has); values are left in canonical form
+inline bool ConfigValidate(const tAttrSnapshot* Model,tAttrSnapshot& Target,std::vector<std::string>& Errors)
+{
+  // the cached frame limits are those of the binning at the time of the dump
+  bool rebinned = false;
+  for(size_t i=0;i<Target.attrs.size();i++)
+  {
+    const char* name = Target.attrs[i].name.c_str();
+    rebinned = rebinned || strncmp(name,"Binning",7)==0 || strncmp(name,"Decimation",10)==0;
+  }
+
+  bool ok = true;
+  for(size_t i=0;i<Target.attrs.size();i++)
+  {
+    tAttr& A = Target.attrs[i];
+    const tAttr* description = Model ? AttrFind(*Model,A.name) : &A;
+    std::string error;
+    if(!description)
+      error = "is not an attribute of " + Model->model + " (firmware " + Model->firmware + ")";
+    else
+    {
+      bool framed = A.name=="Width" || A.name=="Height" || A.name=="RegionX" || A.name=="RegionY";
+      A.type = description->type;
+      if(ConfigCheck(*description,A.value,!(framed && rebinned),error))
+        continue;
+    }
+    Errors.push_back(A.name + " = " + A.value + " " + error);
+    ok = false;
+  }
+  return ok;
+}
+
+// what a target's frames need; false if it lacks the size or the rate
+inline bool ConfigRate(const tAttrSnapshot& Target,tConfigRate& R,std::string& Error)
+{
+  const tAttr* width = AttrFind(Target,"Width");
+  const tAttr* height = AttrFind(Target,"Height");
+  const tAttr* format = AttrFind(Target,"PixelFormat");
+  const tAttr* rate = AttrFind(Target,"FrameRate");
+  const tAttr* packet = AttrFind(Target,"PacketSize");
+  const tAttr* limit = AttrFind(Target,"StreamBytesPerSecond");
+  if(!width || !height || !format || !rate)
+  {
+    Error = "Width, Height, PixelFormat and FrameRate are needed to work out the data rate";
+    return false;
+  }
+  if(PixelFormatBits(format->value.c_str())==0)
+  {
+    Error = "no data rate for pixel format " + format->value;
+    return false;
+  }
+
+  R.uid = Target.uid;
+  R.imageBytes = RecordingImageSize(strtoul(width->value.c_str(),NULL,10),strtoul(height->value.c_str(),NULL,10),
+                                    format->value.c_str());
+  R.rate = strtod(rate->value.c_str(),NULL);
+  R.streamLimit = limit ? strtod(limit->value.c_str(),NULL) : 0;
+
+  // every packet carries its headers; a leader and a trailer packet frame each image
+  unsigned long packetSize = packet ? strtoul(packet->value.c_str(),NULL,10) : CONFIG_PACKET_SIZE;
+  unsigned long payload = packetSize>CONFIG_PACKET_HEADER ? packetSize-CONFIG_PACKET_HEADER : 1;
+  double packets = ceil((double)R.imageBytes/payload) + 2;
+  R.wireBytes = R.rate * (R.imageBytes + packets*(CONFIG_PACKET_HEADER+CONFIG_ETHERNET));
+  R.streamBytes = R.rate * (R.imageBytes + packets*CONFIG_GVSP_HEADER);
+  R.diskBytes = R.rate * (R.imageBytes + RECORDING_STAMP_SIZE);
+  return true;
+}
+
+// do the cameras fit their stream limits, the shared link and the disk? (DiskMB 0: not checked)
+inline bool ConfigFits(const std::vector<tConfigRate>& Rates,double LinkMbit,double DiskMB,
+                       std::vector<std::string>& Errors)
+{
+  char text[256];
+  double wire = 0, disk = 0;
+  bool ok = true;
+  for(size_t i=0;i<Rates.size();i++)
+  {
+    const tConfigRate& R = Rates[i];
+    wire += R.wireBytes;
+    disk += R.diskBytes;
+    if(R.streamLimit>0 && R.streamBytes>R.streamLimit)
+    {
+      snprintf(text,sizeof(text),"camera %lu needs %.1f MB/s at %.1f frames/s, its StreamBytesPerSecond allows %.1f MB/s",
+               R.uid,R.streamBytes/1e6,R.rate,R.streamLimit/1e6);
+      Errors.push_back(text);
+      ok = false;
+    }
+  }
+  if(wire*8>LinkMbit*1e6)
+  {
+    snprintf(text,sizeof(text),"the cameras need %.0f Mbit/s, the link carries %.0f Mbit/s",wire*8/1e6,LinkMbit);
+    Errors.push_back(text);
+    ok = false;
+  }
+  if(DiskMB>0 && disk>DiskMB*1048576.0)
+  {
+    snprintf(text,sizeof(text),"the recordings need %.1f MB/s, the disk takes %.1f MB/s",disk/1048576.0,DiskMB);
+    Errors.push_back(text);
+    ok = false;
+  }
+  return ok;
+}
+
+#endif
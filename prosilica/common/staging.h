@@ -0,0 +1,238 @@
+/* Header-only RAM staging tier between a capture and its output file.
+ *
+ * Writes are copied into a ring buffer of a fixed budget and return at once;
+ * a flusher thread drains the ring into the real output through a sink
+ * function. The flusher runs at the lowest best-effort I/O priority and
+ * a raised nice value, and can be held to a byte rate, so a burst lands in
+ * RAM and reaches the card at a pace the card sustains. The rate limit is
+ * lifted while the ring is more than half full, so throttling never causes
+ * a stall on its own. Only when the budget is used up does a write block
+ * until the flusher makes room; frames that arrive meanwhile wait in the
+ * capture's own buffer pool.
+ *
+ * Every write is stamped when staged, and the flusher records how long each
+ * one stayed in RAM before it reached the sink, so the exposure to a power
+ * cut (data not yet on the card) is measured, not guessed.
+ *
+ * One thread writes at a time (the ring keeps a single writer position);
+ * the sink is called from the flusher thread only.
+ */
+
+#ifndef STAGING_H_INCLUDE
+#define STAGING_H_INCLUDE
+
+// includes
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <deque>
+
+#define STAGE_CHUNK       (1u<<20) // most handed to the sink at once
+#define STAGE_IOPRIO      ((2<<13)|7) // best-effort class, lowest level
+#define STAGE_NICE        10
+
+// writes data to the persistent output; false on error
+typedef bool (*tStageSink)(void* Context,const void* Data,size_t Size);
+
+// staging ring and its flusher
+typedef struct
+{
+  uint8_t*          ring;
+  uint64_t          budget;       // ring size in bytes
+  uint64_t          head;         // bytes handed to the sink (total)
+  uint64_t          tail;         // bytes staged (total)
+  double            rate;         // bytes per second to the sink (0 = no limit)
+  tStageSink        Sink;
+  void*             context;
+  pthread_t         thread;
+  pthread_mutex_t   lock;
+  pthread_cond_t    changed;
+  bool              closing;
+  bool              failed;       // the sink failed; later data is dropped
+  std::deque<std::pair<uint64_t,double> >* stamps; // end of each write and when it was staged
+
+  // accounting
+  uint64_t          maxUsed;      // most bytes staged at once
+  uint64_t          waits;        // writes that found the budget used up
+  double            waitSeconds;
+  double            maxWaitSeconds;
+  double            maxAge;       // longest a write stayed unflushed
+  double            ageSum;
+  uint64_t          aged;
+  double            sinkSeconds;
+} tStager;
+
+// seconds since an arbitrary start
+inline double StageNow()
+{
+  struct timespec tp;
+  clock_gettime(CLOCK_MONOTONIC,&tp);
+  return tp.tv_sec + tp.tv_nsec/1e9;
+}
+
+// flusher thread: drain the ring into the sink
+inline void* StageFlusher(void* pContext)
+{
+  tStager& S = *(tStager*)pContext;
+
+  // stay out of the capture's way: low I/O priority (honoured by CFQ and
+  // BFQ) and low CPU priority, for this thread only
+  syscall(SYS_ioprio_set,1,0,STAGE_IOPRIO);
+  setpriority(PRIO_PROCESS,syscall(SYS_gettid),STAGE_NICE);
+
+  double next = StageNow(); // when the rate allows the next chunk
+  pthread_mutex_lock(&S.lock);
+  while(true)
+  {
+    while(S.head==S.tail && !S.closing)
+      pthread_cond_wait(&S.changed,&S.lock);
+    if(S.head==S.tail)
+      break;
+
+    // the contiguous part up to the end of the ring
+    uint64_t offset = S.head%S.budget;
+    uint64_t n = S.tail-S.head;
+    n = n<S.budget-offset ? n : S.budget-offset;
+    n = n<STAGE_CHUNK ? n : STAGE_CHUNK;
+    bool throttle = S.rate>0 && !S.closing && (S.tail-S.head)*2<S.budget;
+    pthread_mutex_unlock(&S.lock);
+
+    // hold to the rate (an idle flusher saves up at most a second of it)
+    double t = StageNow();
+    if(throttle)
+    {
+      next = next>t-1 ? next : t-1;
+      if(next>t)
+      {
+        struct timespec wait;
+        wait.tv_sec = (time_t)(next-t);
+        wait.tv_nsec = (long)((next-t-wait.tv_sec)*1e9);
+        nanosleep(&wait,NULL);
+      }
+      next += n/S.rate;
+      t = StageNow();
+    }
+
+    bool ok = S.failed || S.Sink(S.context,S.ring+offset,n);
+    double now = StageNow();
+    if(!throttle)
+      next = now;
+
+    pthread_mutex_lock(&S.lock);
+    S.sinkSeconds += now-t;
+    S.failed = S.failed || !ok;
+    S.head += n;
+    while(!S.stamps->empty() && S.stamps->front().first<=S.head)
+    {
+      double age = now-S.stamps->front().second;
+      S.maxAge = age>S.maxAge ? age : S.maxAge;
+      S.ageSum += age;
+      S.aged++;
+      S.stamps->pop_front();
+    }
+    pthread_cond_broadcast(&S.changed);
+  }
+  pthread_mutex_unlock(&S.lock);
+  return 0;
+}
+
+// allocate Budget bytes of RAM and start the flusher (Rate in bytes/s, 0 = no limit)
+inline bool StageOpen(tStager& S,uint64_t Budget,double Rate,tStageSink Sink,void* Context)
+{
+  memset(&S,0,sizeof(tStager));
+  S.budget = Budget;
+  S.rate = Rate;
+  S.Sink = Sink;
+  S.context = Context;
+
+  // touch every page now, not in the first frame callbacks
+  if(Budget==0)
+    return false;
+  void* ring = mmap(NULL,(size_t)Budget,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS|MAP_POPULATE,-1,0);
+  if(ring==MAP_FAILED)
+    return false;
+  S.ring = (uint8_t*)ring;
+
+  S.stamps = new std::deque<std::pair<uint64_t,double> >;
+  pthread_mutex_init(&S.lock,NULL);
+  pthread_cond_init(&S.changed,NULL);
+  if(pthread_create(&S.thread,NULL,StageFlusher,&S)!=0)
+  {
+    munmap(S.ring,S.budget);
+    S.ring = NULL;
+    delete S.stamps;
+    S.stamps = NULL;
+    return false;
+  }
+  return true;
+}
+
+// stage Size bytes, waiting for room only if the budget is used up
+inline void StageWrite(tStager& S,const void* Data,size_t Size)
+{
+  const uint8_t* p = (const uint8_t*)Data;
+  while(Size>0)
+  {
+    // a write larger than the ring goes in pieces
+    uint64_t n = Size<S.budget/2 ? Size : S.budget/2;
+    n = n ? n : Size;
+
+    pthread_mutex_lock(&S.lock);
+    if(S.budget-(S.tail-S.head)<n)
+    {
+      double start = StageNow();
+      S.waits++;
+      while(S.budget-(S.tail-S.head)<n)
+        pthread_cond_wait(&S.changed,&S.lock);
+      double seconds = StageNow()-start;
+      S.waitSeconds += seconds;
+      S.maxWaitSeconds = seconds>S.maxWaitSeconds ? seconds : S.maxWaitSeconds;
+    }
+    uint64_t tail = S.tail;
+    pthread_mutex_unlock(&S.lock);
+
+    // copy outside the lock; the flusher never reads past tail
+    uint64_t offset = tail%S.budget;
+    uint64_t first = n<S.budget-offset ? n : S.budget-offset;
+    memcpy(S.ring+offset,p,first);
+    memcpy(S.ring,p+first,n-first);
+
+    pthread_mutex_lock(&S.lock);
+    S.tail += n;
+    S.stamps->push_back(std::make_pair(S.tail,StageNow()));
+    S.maxUsed = S.tail-S.head>S.maxUsed ? S.tail-S.head : S.maxUsed;
+    pthread_cond_broadcast(&S.changed);
+    pthread_mutex_unlock(&S.lock);
+
+    p += n;
+    Size -= n;
+  }
+}
+
+// flush everything at full speed, stop the flusher and free the ring; false if the sink failed
+inline bool StageClose(tStager& S)
+{
+  if(!S.ring)
+    return false;
+  pthread_mutex_lock(&S.lock);
+  S.closing = true;
+  pthread_cond_broadcast(&S.changed);
+  pthread_mutex_unlock(&S.lock);
+  pthread_join(S.thread,NULL);
+
+  munmap(S.ring,S.budget);
+  S.ring = NULL;
+  delete S.stamps;
+  S.stamps = NULL;
+  pthread_mutex_destroy(&S.lock);
+  pthread_cond_destroy(&S.changed);
+  return !S.failed;
+}
+
+#endif
@@ -0,0 +1,355 @@
+/* Header-only sender for streaming a recording to stream_collector over TCP.
+ *
+ * A stream is a tStreamHello naming the file to write, followed by exactly
+ * the bytes of a raw recording. Frames go out with sendmsg straight from
+ * the frame buffers. Where the kernel supports MSG_ZEROCOPY the buffer is
+ * only lent to the socket: it stays pending until the completion arrives on
+ * the socket's error queue, and is then handed back through the Release
+ * function (snap_image requeues it with PvAPI). At most maxInFlight frames
+ * are pending; a sender that reaches the limit waits for completions, and
+ * those waits, the time spent blocked in sendmsg and the pending high-water
+ * mark are counted so a slow link shows up in the numbers rather than as
+ * missing frames. Without MSG_ZEROCOPY the data is copied into the socket
+ * and the buffer is released as soon as sendmsg returns. Frames still
+ * pending when the stream closes are never released.
+ */
+
+#ifndef STREAM_H_INCLUDE
+#define STREAM_H_INCLUDE
+
+// includes
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <linux/errqueue.h>
+#include <deque>
+
+// older headers lack the zerocopy names
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+#ifndef SO_EE_CODE_ZEROCOPY_COPIED
+#define SO_EE_CODE_ZEROCOPY_COPIED 1
+#endif
+
+#define STREAM_MAGIC      "SEDSTRM"
+#define STREAM_HELLO_SIZE 12  // magic and name length, then the name
+#define STREAM_NAME_MAX   255
+#define STREAM_DRAIN_MS   5000 // longest wait for completions when closing
+
+// start of every stream
+typedef struct
+{
+  char     magic[8];
+  uint32_t nameLength; // bytes of file name that follow
+} tStreamHello;
+
+// hands a frame buffer back once the socket is done with it
+typedef void (*tStreamRelease)(void* Context);
+
+// an open stream
+typedef struct
+{
+  int                  fd;
+  bool                 zerocopy;     // MSG_ZEROCOPY accepted by the socket
+  bool                 failed;
+  uint32_t             maxInFlight;
+  tStreamRelease       Release;
+  pthread_mutex_t      lock;
+  uint32_t             nextId;       // zerocopy send counter, as the kernel keeps it
+  std::deque<std::pair<uint32_t,void*> >* pending; // last send id and context per frame
+
+  // accounting
+  uint64_t             frames;
+  uint64_t             bytes;
+  uint64_t             copied;       // zerocopy sends the kernel copied after all
+  uint64_t             waits;        // times maxInFlight was reached
+  double               waitSeconds;
+  double               sendSeconds;  // blocked in sendmsg
+  uint32_t             maxPending;
+  uint32_t             stranded;     // frames never completed, so never released
+  char                 error[128];
+} tStreamSender;
+
+// seconds since an arbitrary start
+inline double StreamNow()
+{
+  struct timespec tp;
+  clock_gettime(CLOCK_MONOTONIC,&tp);
+  return tp.tv_sec + tp.tv_nsec/1e9;
+}
+
+// send all of an iovec list (Flags may hold MSG_ZEROCOPY); false on error
+inline bool StreamSendAll(tStreamSender& S,struct iovec* Iov,int Count,int Flags)
+{
+  double start = StreamNow();
+  while(Count>0)
+  {
+    struct msghdr msg;
+    memset(&msg,0,sizeof(msg));
+    msg.msg_iov = Iov;
+    msg.msg_iovlen = Count;
+    ssize_t n = sendmsg(S.fd,&msg,Flags|MSG_NOSIGNAL);
+    if(n<0 && errno==EINTR)
+      continue;
+    if(n<0 && errno==ENOBUFS && (Flags & MSG_ZEROCOPY))
+    {
+      // out of notification memory: copy this part instead
+      Flags &= ~MSG_ZEROCOPY;
+      continue;
+    }
+    if(n<0)
+    {
+      snprintf(S.error,sizeof(S.error),"send failed: %s",strerror(errno));
+      S.failed = true;
+      S.sendSeconds += StreamNow()-start;
+      return false;
+    }
+    if(Flags & MSG_ZEROCOPY)
+      S.nextId++;
+    S.bytes += n;
+
+    // skip what went out
+    while(Count>0 && (size_t)n>=Iov->iov_len)
+    {
+      n -= Iov->iov_len;
+      Iov++;
+      Count--;
+    }
+    if(Count>0)
+    {
+      Iov->iov_base = (uint8_t*)Iov->iov_base + n;
+      Iov->iov_len -= n;
+    }
+  }
+  S.sendSeconds += StreamNow()-start;
+  return true;
+}
+
+// release frames whose sends have completed, waiting until at most Until are pending
+inline void StreamReap(tStreamSender& S,uint32_t Until,int TimeoutMs = -1)
+{
+  double start = StreamNow();
+  while(!S.pending->empty())
+  {
+    char control[256];
+    struct msghdr msg;
+    memset(&msg,0,sizeof(msg));
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    if(recvmsg(S.fd,&msg,MSG_ERRQUEUE|MSG_DONTWAIT)<0)
+    {
+      if(errno!=EAGAIN && errno!=EWOULDBLOCK && errno!=EINTR)
+        break;
+      if(S.pending->size()<=Until)
+        break;
+
+      // completions are flagged as POLLERR
+      struct pollfd p;
+      p.fd = S.fd;
+      p.events = 0;
+      if(poll(&p,1,100)<0 && errno!=EINTR)
+        break;
+      if(TimeoutMs>=0 && (StreamNow()-start)*1000>TimeoutMs)
+        break;
+      continue;
+    }
+
+    for(struct cmsghdr* c=CMSG_FIRSTHDR(&msg);c;c=CMSG_NXTHDR(&msg,c))
+    {
+      struct sock_extended_err* e = (struct sock_extended_err*)CMSG_DATA(c);
+      if(e->ee_origin!=SO_EE_ORIGIN_ZEROCOPY)
+        continue;
+
+      // sends ee_info..ee_data are done (ids wrap, so compare by difference)
+      uint32_t done = e->ee_data;
+      if(e->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+        S.copied += e->ee_data - e->ee_info + 1;
+      while(!S.pending->empty() && (int32_t)(S.pending->front().first-done)<=0)
+      {
+        S.Release(S.pending->front().second);
+        S.pending->pop_front();
+      }
+    }
+  }
+}
+
+// connect to host:port and announce the file name
+inline bool StreamConnect(tStreamSender& S,const char* Address,const char* Name,uint32_t MaxInFlight,
+                          tStreamRelease Release)
+{
+  memset(&S,0,sizeof(tStreamSender));
+  S.fd = -1;
+  S.maxInFlight = MaxInFlight ? MaxInFlight : 1;
+  S.Release = Release;
+  S.pending = new std::deque<std::pair<uint32_t,void*> >;
+  pthread_mutex_init(&S.lock,NULL);
+
+  // host:port
+  char host[256];
+  const char* colon = strrchr(Address,':');
+  if(!colon || colon==Address || (size_t)(colon-Address)>=sizeof(host))
+  {
+    snprintf(S.error,sizeof(S.error),"stream address %s is not host:port",Address);
+    S.failed = true;
+    return false;
+  }
+  memcpy(host,Address,colon-Address);
+  host[colon-Address] = 0;
+
+  struct addrinfo hints, *list = NULL;
+  memset(&hints,0,sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  if(getaddrinfo(host,colon+1,&hints,&list)!=0)
+  {
+    snprintf(S.error,sizeof(S.error),"cannot resolve %.100s",host);
+    S.failed = true;
+    return false;
+  }
+  for(struct addrinfo* a=list;a && S.fd<0;a=a->ai_next)
+  {
+    S.fd = socket(a->ai_family,a->ai_socktype,a->ai_protocol);
+    if(S.fd>=0 && connect(S.fd,a->ai_addr,a->ai_addrlen)!=0)
+    {
+      close(S.fd);
+      S.fd = -1;
+    }
+  }
+  freeaddrinfo(list);
+  if(S.fd<0)
+  {
+    snprintf(S.error,sizeof(S.error),"cannot connect to %s",Address);
+    S.failed = true;
+    return false;
+  }
+
+  // zerocopy if the kernel has it (4.14 and later)
+  int one = 1;
+  S.zerocopy = setsockopt(S.fd,SOL_SOCKET,SO_ZEROCOPY,&one,sizeof(one))==0;
+  setsockopt(S.fd,IPPROTO_TCP,TCP_NODELAY,&one,sizeof(one));
+
+  // the collector only ever sees the base name
+  const char* base = strrchr(Name,'/');
+  base = base ? base+1 : Name;
+  tStreamHello hello;
+  memset(&hello,0,sizeof(hello));
+  memcpy(hello.magic,STREAM_MAGIC,sizeof(STREAM_MAGIC));
+  hello.nameLength = strlen(base)<STREAM_NAME_MAX ? strlen(base) : STREAM_NAME_MAX;
+  struct iovec iov[2];
+  iov[0].iov_base = &hello;
+  iov[0].iov_len = STREAM_HELLO_SIZE;
+  iov[1].iov_base = (void*)base;
+  iov[1].iov_len = hello.nameLength;
+  uint64_t bytes = S.bytes;
+  bool ok = StreamSendAll(S,iov,2,0);
+  S.bytes = bytes;
+  return ok;
+}
+
+// send bytes that are copied (header, trailer, footer)
+inline bool StreamSend(tStreamSender& S,const void* Data,size_t Size)
+{
+  pthread_mutex_lock(&S.lock);
+  struct iovec iov;
+  iov.iov_base = (void*)Data;
+  iov.iov_len = Size;
+  bool ok = !S.failed && StreamSendAll(S,&iov,1,0);
+  pthread_mutex_unlock(&S.lock);
+  return ok;
+}
+
+// send a frame record from its buffers; Stamp and Image must stay untouched
+// until Context is released. Returns true if the stream holds the buffers
+// (they come back through Release), false if the caller has them back.
+inline bool StreamSendFrame(tStreamSender& S,const void* Stamp,size_t StampSize,const void* Image,size_t ImageSize,
+                            void* Context)
+{
+  pthread_mutex_lock(&S.lock);
+  if(S.failed)
+  {
+    pthread_mutex_unlock(&S.lock);
+    return false;
+  }
+
+  // backpressure: wait for the oldest sends before lending out another buffer
+  StreamReap(S,S.maxInFlight);
+  if(S.zerocopy && S.pending->size()>=S.maxInFlight)
+  {
+    double start = StreamNow();
+    S.waits++;
+    StreamReap(S,S.maxInFlight-1);
+    S.waitSeconds += StreamNow()-start;
+  }
+
+  struct iovec iov[2];
+  iov[0].iov_base = (void*)Stamp;
+  iov[0].iov_len = StampSize;
+  iov[1].iov_base = (void*)Image;
+  iov[1].iov_len = ImageSize;
+  uint32_t id = S.nextId;
+  bool ok = StreamSendAll(S,iov,2,S.zerocopy ? MSG_ZEROCOPY : 0);
+  S.frames++;
+
+  // held only if some part of it went out by zerocopy
+  bool held = ok && S.nextId!=id;
+  if(held)
+  {
+    S.pending->push_back(std::make_pair(S.nextId-1,Context));
+    if(S.pending->size()>S.maxPending)
+      S.maxPending = S.pending->size();
+  }
+  pthread_mutex_unlock(&S.lock);
+  return held;
+}
+
+// wait for outstanding frames and close. A frame whose completion never
+// came may still be read by the kernel, so it is not released: the stream
+// fails and the buffer stays out of the camera's queue.
+inline bool StreamClose(tStreamSender& S)
+{
+  if(S.pending)
+  {
+    if(S.fd>=0)
+      StreamReap(S,0,STREAM_DRAIN_MS);
+    if(!S.pending->empty())
+    {
+      S.stranded = S.pending->size();
+      if(!S.failed)
+        snprintf(S.error,sizeof(S.error),"%u frames not completed after %d ms and left unqueued",S.stranded,
+                 STREAM_DRAIN_MS);
+      S.failed = true;
+    }
+    delete S.pending;
+    S.pending = NULL;
+    pthread_mutex_destroy(&S.lock);
+  }
+  bool ok = !S.failed;
+  if(S.fd>=0)
+  {
+    shutdown(S.fd,SHUT_WR);
+    ok = (close(S.fd)==0) && ok;
+  }
+  S.fd = -1;
+  return ok;
+}
+
+#endif
@@ -0,0 +1,163 @@
+/* Header-only pthread helpers.
+ *
+ * tWorkQueue: a fixed set of threads runs jobs submitted to a bounded
+ * queue. Submitting to a full queue blocks, which gives producers (e.g.
+ * frame callbacks) natural backpressure instead of unbounded memory growth.
+ *
+ * RunParallel: run Count copies of a function, one per thread, and wait for
+ * all of them (the calling thread runs copy 0).
+ */
+
+#ifndef WORKERS_H_INCLUDE
+#define WORKERS_H_INCLUDE
+
+// includes
+#include <pthread.h>
+#include <string.h>
+#include <deque>
+#include <vector>
+
+// job function
+typedef void (*tJobFunc)(void* Arg);
+
+// work queue
+typedef struct
+{
+  pthread_mutex_t        lock;
+  pthread_cond_t         changed;
+  std::deque<std::pair<tJobFunc,void*> >* jobs;
+  std::vector<pthread_t>* threads;
+  unsigned int           maxPending;
+  unsigned int           running;  // jobs currently executing
+  bool                   stopping;
+} tWorkQueue;
+
+// worker thread
+inline void* WorkQueueThread(void* pContext)
+{
+  tWorkQueue* Queue = (tWorkQueue*)pContext;
+
+  pthread_mutex_lock(&Queue->lock);
+  while(true)
+  {
+    while(Queue->jobs->empty() && !Queue->stopping)
+      pthread_cond_wait(&Queue->changed,&Queue->lock);
+    if(Queue->jobs->empty())
+      break;
+
+    std::pair<tJobFunc,void*> job = Queue->jobs->front();
+    Queue->jobs->pop_front();
+    Queue->running++;
+    pthread_cond_broadcast(&Queue->changed);
+    pthread_mutex_unlock(&Queue->lock);
+
+    job.first(job.second);
+
+    pthread_mutex_lock(&Queue->lock);
+    Queue->running--;
+    pthread_cond_broadcast(&Queue->changed);
+  }
+  pthread_mutex_unlock(&Queue->lock);
+  return 0;
+}
+
+// start Threads workers with at most MaxPending queued jobs
+inline bool WorkQueueStart(tWorkQueue& Queue,unsigned int Threads,unsigned int MaxPending)
+{
+  pthread_mutex_init(&Queue.lock,NULL);
+  pthread_cond_init(&Queue.changed,NULL);
+  Queue.jobs = new std::deque<std::pair<tJobFunc,void*> >();
+  Queue.threads = new std::vector<pthread_t>();
+  Queue.maxPending = MaxPending ? MaxPending : 1;
+  Queue.running = 0;
+  Queue.stopping = false;
+
+  for(unsigned int i=0;i<(Threads ? Threads : 1);i++)
+  {
+    pthread_t thread;
+    if(pthread_create(&thread,NULL,WorkQueueThread,&Queue)!=0)
+      break;
+    Queue.threads->push_back(thread);
+  }
+  return !Queue.threads->empty();
+}
+
+// queue a job, waiting while the queue is full
+inline void WorkQueueSubmit(tWorkQueue& Queue,tJobFunc Func,void* Arg)
+{
+  pthread_mutex_lock(&Queue.lock);
+  while(Queue.jobs->size()>=Queue.maxPending)
+    pthread_cond_wait(&Queue.changed,&Queue.lock);
+  Queue.jobs->push_back(std::make_pair(Func,Arg));
+  pthread_cond_broadcast(&Queue.changed);
+  pthread_mutex_unlock(&Queue.lock);
+}
+
+// wait until every submitted job has run
+inline void WorkQueueWait(tWorkQueue& Queue)
+{
+  pthread_mutex_lock(&Queue.lock);
+  while(!Queue.jobs->empty() || Queue.running)
+    pthread_cond_wait(&Queue.changed,&Queue.lock);
+  pthread_mutex_unlock(&Queue.lock);
+}
+
+// finish outstanding jobs and stop the workers
+inline void WorkQueueStop(tWorkQueue& Queue)
+{
+  pthread_mutex_lock(&Queue.lock);
+  Queue.stopping = true;
+  pthread_cond_broadcast(&Queue.changed);
+  pthread_mutex_unlock(&Queue.lock);
+
+  for(unsigned int i=0;i<Queue.threads->size();i++)
+    pthread_join((*Queue.threads)[i],NULL);
+
+  delete Queue.jobs;
+  delete Queue.threads;
+  pthread_mutex_destroy(&Queue.lock);
+  pthread_cond_destroy(&Queue.changed);
+}
+
+// function run by RunParallel
+typedef void (*tParallelFunc)(void* Arg,unsigned int Index);
+
+// one RunParallel thread
+typedef struct
+{
+  tParallelFunc Func;
+  void*         Arg;
+  unsigned int  Index;
+} tParallelTask;
+
+inline void* ParallelThread(void* pContext)
+{
+  tParallelTask* Task = (tParallelTask*)pContext;
+  Task->Func(Task->Arg,Task->Index);
+  return 0;
+}
+
+// run Func(Arg,0..Count-1) on Count threads and wait for all of them
+inline void RunParallel(unsigned int Count,tParallelFunc Func,void* Arg)
+{
+  std::vector<tParallelTask> tasks(Count);
+  std::vector<pthread_t> threads(Count);
+  std::vector<bool> started(Count,false);
+
+  for(unsigned int i=1;i<Count;i++)
+  {
+    tasks[i].Func = Func;
+    tasks[i].Arg = Arg;
+    tasks[i].Index = i;
+    started[i] = pthread_create(&threads[i],NULL,ParallelThread,&tasks[i])==0;
+    if(!started[i])
+      Func(Arg,i);
+  }
+  if(Count)
+    Func(Arg,0);
+  for(unsigned int i=1;i<Count;i++)
+    if(started[i])
+      pthread_join(threads[i],NULL);
+}
+
+#endif
@@ -0,0 +1,434 @@
+/* Header-only Zarr v2 directory store writer and chunk reader.
+ *
+ * The store is a group holding three arrays:
+ *   pixels  (frames, height, width), chunked in time and space
+ *   stamps  (frames, 4) uint32, the raw format's per-frame time block
+ *   info    (frames, 6) uint32, the footer's per-frame camera values: flags,
+ *           exposure, gain, sync in, sync out and acquisition count (all 0
+ *           unless the camera sent chunk data, flag 1)
+ *
+ * Frames are collected into a block of chunkT frames; when a block is full
+ * its tiles are cut out, zlib compressed and written by a pool of worker
+ * threads while capture carries on with the next block. A small pool of
+ * blocks bounds memory; if every block is still being compressed, appending
+ * waits. On close the partial last block is flushed (padded with the fill
+ * value as zarr requires), the array metadata is written with the final
+ * frame count and everything is consolidated into .zmetadata.
+ */
+
+#ifndef ZARR_H_INCLUDE
+#define ZARR_H_INCLUDE
+
+// includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include <vector>
+#include <workers.h>
+
+#define ZARR_BLOCKS      3 // time blocks in flight per writer
+#define ZARR_INFO_FIELDS 6 // columns of the info array
+
+struct tZarrWriter;
+
+// one time-chunk of frames
+typedef struct
+{
+  tZarrWriter* Writer;
+  uint8_t*     pixels;  // chunkT frames
+  uint32_t*    stamps;  // chunkT rows of 4
+  uint32_t*    info;    // chunkT rows of ZARR_INFO_FIELDS
+  uint64_t     index;   // time chunk index
+  uint32_t     frames;  // frames filled
+  unsigned int pending; // tile jobs still running
+} tZarrBlock;
+
+// compression job for one tile of a block
+typedef struct
+{
+  tZarrBlock*  Block;
+  uint32_t     ty;
+  uint32_t     tx;
+} tZarrJob;
+
+// a store being written
+typedef struct tZarrWriter
+{
+  char            path[1024];
+  char            dtype[8];
+  char            pixelFormat[16];
+  uint32_t        width;
+  uint32_t        height;
+  uint32_t        sampleSize;
+  uint32_t        chunkT;
+  uint32_t        chunkY;
+  uint32_t        chunkX;
+  uint32_t        tilesY;
+  uint32_t        tilesX;
+  int             level;   // zlib level, 0 stores chunks uncompressed
+  float           frameRate;
+  uint32_t        timeStampFrequency;
+  tWorkQueue      Queue;
+  pthread_mutex_t lock;
+  pthread_cond_t  freed;
+  tZarrBlock      blocks[ZARR_BLOCKS];
+  tZarrJob*       jobs;    // tilesY*tilesX jobs per block
+  tZarrBlock*     current;
+  uint64_t        frames;
+  uint64_t        bytesIn;
+  uint64_t        bytesOut;
+  bool            failed;
+} tZarrWriter;
+
+// metadata for one array (no trailing newline)
+inline int ZarrArrayMeta(char* Out,size_t Size,const char* Dtype,int Ndims,
+                         const uint64_t* Shape,const uint32_t* Chunks,int Level)
+{
+  char shape[128], chunks[128], compressor[64];
+  int ns = 0, nc = 0;
+  for(int i=0;i<Ndims;i++)
+  {
+    ns += snprintf(shape+ns,sizeof(shape)-ns,"%s%llu",i ? ", " : "",(unsigned long long)Shape[i]);
+    nc += snprintf(chunks+nc,sizeof(chunks)-nc,"%s%u",i ? ", " : "",Chunks[i]);
+  }
+  if(Level>0)
+    snprintf(compressor,sizeof(compressor),"{\"id\": \"zlib\", \"level\": %d}",Level);
+  else
+    snprintf(compressor,sizeof(compressor),"null");
+
+  return snprintf(Out,Size,
+    "{\"chunks\": [%s], \"compressor\": %s, \"dtype\": \"%s\", \"fill_value\": 0, "
+    "\"filters\": null, \"order\": \"C\", \"shape\": [%s], \"zarr_format\": 2}",
+    chunks,compressor,Dtype,shape);
+}
+
+// write a small file under the store
+inline bool ZarrWriteFile(const tZarrWriter& Z,const char* Name,const void* Data,size_t Size)
+{
+  char name[1200];
+  snprintf(name,sizeof(name),"%s/%s",Z.path,Name);
+  FILE* file = fopen(name,"wb");
+  if(!file)
+    return false;
+  bool ok = fwrite(Data,1,Size,file)==Size;
+  return (fclose(file)==0) && ok;
+}
+
+// compress and write one tile of a block (runs on a worker)
+inline void ZarrTileJob(void* Arg)
+{
+  tZarrJob* Job = (tZarrJob*)Arg;
+  tZarrBlock* Block = Job->Block;
+  tZarrWriter* Z = Block->Writer;
+  uint32_t s = Z->sampleSize;
+
+  // cut the tile out of the block, padding edges and missing frames with zeros
+  size_t tileSize = (size_t)Z->chunkT*Z->chunkY*Z->chunkX*s;
+  uint8_t* tile = (uint8_t*)calloc(1,tileSize);
+  uint32_t y0 = Job->ty*Z->chunkY, x0 = Job->tx*Z->chunkX;
+  uint32_t rows = Z->height-y0 < Z->chunkY ? Z->height-y0 : Z->chunkY;
+  uint32_t cols = Z->width-x0 < Z->chunkX ? Z->width-x0 : Z->chunkX;
+  for(uint32_t t=0;t<Block->frames;t++)
+  {
+    const uint8_t* frame = Block->pixels + (size_t)t*Z->width*Z->height*s;
+    for(uint32_t y=0;y<rows;y++)
+      memcpy(tile + (((size_t)t*Z->chunkY + y)*Z->chunkX)*s,
+             frame + ((size_t)(y0+y)*Z->width + x0)*s,(size_t)cols*s);
+  }
+
+  // compress
+  uLongf outSize = compressBound(tileSize);
+  uint8_t* out = tile;
+  bool ok = true;
+  if(Z->level>0)
+  {
+    out = (uint8_t*)malloc(outSize);
+    ok = out && compress2(out,&outSize,tile,tileSize,Z->level)==Z_OK;
+  }
+  else
+    outSize = tileSize;
+
+  char name[64];
+  snprintf(name,sizeof(name),"pixels/%llu.%u.%u",(unsigned long long)Block->index,Job->ty,Job->tx);
+  ok = ok && ZarrWriteFile(*Z,name,out,outSize);
+
+  if(out!=tile)
+    free(out);
+  free(tile);
+
+  // hand the block back once its last tile is done
+  pthread_mutex_lock(&Z->lock);
+  Z->bytesIn += tileSize;
+  Z->bytesOut += outSize;
+  Z->failed = Z->failed || !ok;
+  if(--Block->pending==0)
+    pthread_cond_broadcast(&Z->freed);
+  pthread_mutex_unlock(&Z->lock);
+}
+
+// queue the current block for compression and pick a free one
+inline void ZarrSubmit(tZarrWriter& Z)
+{
+  tZarrBlock* Block = Z.current;
+  uint64_t n = Z.tilesY*Z.tilesX;
+
+  // stamps and info are tiny, so they are written here uncompressed
+  char name[64];
+  std::vector<uint32_t> stamps((size_t)Z.chunkT*4,0);
+  memcpy(&stamps[0],Block->stamps,(size_t)Block->frames*16);
+  snprintf(name,sizeof(name),"stamps/%llu.0",(unsigned long long)Block->index);
+  bool ok = ZarrWriteFile(Z,name,&stamps[0],stamps.size()*4);
+  std::vector<uint32_t> info((size_t)Z.chunkT*ZARR_INFO_FIELDS,0);
+  memcpy(&info[0],Block->info,(size_t)Block->frames*ZARR_INFO_FIELDS*4);
+  snprintf(name,sizeof(name),"info/%llu.0",(unsigned long long)Block->index);
+  ok = ZarrWriteFile(Z,name,&info[0],info.size()*4) && ok;
+
+  pthread_mutex_lock(&Z.lock);
+  Z.failed = Z.failed || !ok;
+  Block->pending = n;
+  pthread_mutex_unlock(&Z.lock);
+
+  tZarrJob* jobs = Z.jobs + (Block-Z.blocks)*n;
+  for(uint32_t ty=0;ty<Z.tilesY;ty++)
+    for(uint32_t tx=0;tx<Z.tilesX;tx++)
+    {
+      tZarrJob* Job = &jobs[ty*Z.tilesX+tx];
+      Job->Block = Block;
+      Job->ty = ty;
+      Job->tx = tx;
+      WorkQueueSubmit(Z.Queue,ZarrTileJob,Job);
+    }
+
+  // wait for a block that is not being compressed
+  pthread_mutex_lock(&Z.lock);
+  Z.current = NULL;
+  while(!Z.current)
+  {
+    for(int i=0;i<ZARR_BLOCKS && !Z.current;i++)
+      if(Z.blocks[i].pending==0)
+        Z.current = &Z.blocks[i];
+    if(!Z.current)
+      pthread_cond_wait(&Z.freed,&Z.lock);
+  }
+  pthread_mutex_unlock(&Z.lock);
+  Z.current->index = Block->index+1;
+  Z.current->frames = 0;
+}
+
+// free the blocks, jobs and lock of a writer whose workers are stopped
+inline void ZarrRelease(tZarrWriter& Z)
+{
+  for(int i=0;i<ZARR_BLOCKS;i++)
+  {
+    free(Z.blocks[i].pixels);
+    free(Z.blocks[i].stamps);
+    free(Z.blocks[i].info);
+    Z.blocks[i].pixels = NULL;
+    Z.blocks[i].stamps = NULL;
+    Z.blocks[i].info = NULL;
+  }
+  delete [] Z.jobs;
+  Z.jobs = NULL;
+  pthread_mutex_destroy(&Z.lock);
+  pthread_cond_destroy(&Z.freed);
+}
+
+// create the store
+inline bool ZarrOpen(tZarrWriter& Z,const char* Path,uint32_t Width,uint32_t Height,
+                     const char* PixelFormat,uint32_t ChunkT,uint32_t ChunkY,uint32_t ChunkX,
+                     int Level,unsigned int Workers)
+{
+  memset(&Z,0,sizeof(tZarrWriter));
+  if(strcmp(PixelFormat,"Mono16")==0)
+  {
+    strcpy(Z.dtype,"<u2");
+    Z.sampleSize = 2;
+  }
+  else if(strcmp(PixelFormat,"Mono8")==0)
+  {
+    strcpy(Z.dtype,"|u1");
+    Z.sampleSize = 1;
+  }
+  else
+    return false;
+
+  snprintf(Z.path,sizeof(Z.path),"%s",Path);
+  snprintf(Z.pixelFormat,sizeof(Z.pixelFormat),"%s",PixelFormat);
+  Z.width = Width;
+  Z.height = Height;
+  Z.chunkT = ChunkT ? ChunkT : 1;
+  Z.chunkY = ChunkY && ChunkY<Height ? ChunkY : Height;
+  Z.chunkX = ChunkX && ChunkX<Width ? ChunkX : Width;
+  Z.tilesY = (Height+Z.chunkY-1)/Z.chunkY;
+  Z.tilesX = (Width+Z.chunkX-1)/Z.chunkX;
+  Z.level = Level;
+
+  char name[1200];
+  bool ok = (mkdir(Path,0755)==0 || errno==EEXIST);
+  snprintf(name,sizeof(name),"%s/pixels",Path);
+  ok = ok && (mkdir(name,0755)==0 || errno==EEXIST);
+  snprintf(name,sizeof(name),"%s/stamps",Path);
+  ok = ok && (mkdir(name,0755)==0 || errno==EEXIST);
+  snprintf(name,sizeof(name),"%s/info",Path);
+  ok = ok && (mkdir(name,0755)==0 || errno==EEXIST);
+  if(!ok)
+    return false;
+
+  size_t blockSize = (size_t)Z.chunkT*Width*Height*Z.sampleSize;
+  for(int i=0;i<ZARR_BLOCKS;i++)
+  {
+    Z.blocks[i].Writer = &Z;
+    Z.blocks[i].pixels = (uint8_t*)malloc(blockSize);
+    Z.blocks[i].stamps = (uint32_t*)malloc((size_t)Z.chunkT*16);
+    Z.blocks[i].info = (uint32_t*)malloc((size_t)Z.chunkT*ZARR_INFO_FIELDS*4);
+    if(!Z.blocks[i].pixels || !Z.blocks[i].stamps || !Z.blocks[i].info)
+      ok = false;
+  }
+  Z.jobs = new tZarrJob[ZARR_BLOCKS*Z.tilesY*Z.tilesX];
+  Z.current = &Z.blocks[0];
+
+  pthread_mutex_init(&Z.lock,NULL);
+  pthread_cond_init(&Z.freed,NULL);
+  if(ok && WorkQueueStart(Z.Queue,Workers,Z.tilesY*Z.tilesX*2))
+    return true;
+
+  // a queue that started no thread still has its lock and lists to free
+  if(ok)
+    WorkQueueStop(Z.Queue);
+  ZarrRelease(Z);
+  return false;
+}
+
+// append a frame, its time block and its ZARR_INFO_FIELDS info values
+inline void ZarrAppend(tZarrWriter& Z,const void* Pixels,const uint32_t* Stamp,const uint32_t* Info)
+{
+  tZarrBlock* Block = Z.current;
+  memcpy(Block->pixels + (size_t)Block->frames*Z.width*Z.height*Z.sampleSize,Pixels,
+         (size_t)Z.width*Z.height*Z.sampleSize);
+  memcpy(Block->stamps + (size_t)Block->frames*4,Stamp,16);
+  memcpy(Block->info + (size_t)Block->frames*ZARR_INFO_FIELDS,Info,ZARR_INFO_FIELDS*4);
+  Block->frames++;
+  Z.frames++;
+  if(Block->frames==Z.chunkT)
+    ZarrSubmit(Z);
+}
+
+// flush, write the metadata and release the writer
+inline bool ZarrClose(tZarrWriter& Z)
+{
+  if(Z.current && Z.current->frames)
+    ZarrSubmit(Z);
+  WorkQueueStop(Z.Queue);
+
+  // array metadata with the final frame count
+  char pixels[512], stamps[512], info[512], attrs[512], all[3072];
+  uint64_t pixelShape[3] = {Z.frames,Z.height,Z.width};
+  uint32_t pixelChunks[3] = {Z.chunkT,Z.chunkY,Z.chunkX};
+  uint64_t stampShape[2] = {Z.frames,4};
+  uint32_t stampChunks[2] = {Z.chunkT,4};
+  uint64_t infoShape[2] = {Z.frames,ZARR_INFO_FIELDS};
+  uint32_t infoChunks[2] = {Z.chunkT,ZARR_INFO_FIELDS};
+  const char* group = "{\"zarr_format\": 2}";
+  ZarrArrayMeta(pixels,sizeof(pixels),Z.dtype,3,pixelShape,pixelChunks,Z.level);
+  ZarrArrayMeta(stamps,sizeof(stamps),"<u4",2,stampShape,stampChunks,0);
+  ZarrArrayMeta(info,sizeof(info),"<u4",2,infoShape,infoChunks,0);
+  snprintf(attrs,sizeof(attrs),
+    "{\"frame_rate\": %g, \"pixel_format\": \"%s\", \"time_stamp_frequency\": %u, "
+    "\"stamp_fields\": [\"host_sec\", \"host_nsec\", \"ticks_lo\", \"ticks_hi\"], "
+    "\"info_fields\": [\"flags\", \"exposure\", \"gain\", \"sync_in\", \"sync_out\", \"acquisition_count\"]}",
+    Z.frameRate,Z.pixelFormat,Z.timeStampFrequency);
+  snprintf(all,sizeof(all),
+    "{\"metadata\": {\".zgroup\": %s, \"pixels/.zarray\": %s, \"pixels/.zattrs\": %s, "
+    "\"stamps/.zarray\": %s, \"info/.zarray\": %s}, \"zarr_consolidated_format\": 1}\n",
+    group,pixels,attrs,stamps,info);
+
+  bool ok = !Z.failed;
+  ok = ZarrWriteFile(Z,".zgroup",group,strlen(group)) && ok;
+  ok = ZarrWriteFile(Z,"pixels/.zarray",pixels,strlen(pixels)) && ok;
+  ok = ZarrWriteFile(Z,"pixels/.zattrs",attrs,strlen(attrs)) && ok;
+  ok = ZarrWriteFile(Z,"stamps/.zarray",stamps,strlen(stamps)) && ok;
+  ok = ZarrWriteFile(Z,"info/.zarray",info,strlen(info)) && ok;
+  ok = ZarrWriteFile(Z,".zmetadata",all,strlen(all)) && ok;
+
+  ZarrRelease(Z);
+  return ok;
+}
+
+// reader for the pixels array of a store
+typedef struct
+{
+  char     path[1024];
+  uint64_t shape[3];
+  uint32_t chunks[3];
+  uint32_t sampleSize;
+  bool     compressed;
+} tZarrReader;
+
+// read pixels/.zarray
+inline bool ZarrReaderOpen(tZarrReader& R,const char* Path)
+{
+  char name[1200], meta[1024];
+  memset(&R,0,sizeof(tZarrReader));
+  snprintf(R.path,sizeof(R.path),"%s",Path);
+  snprintf(name,sizeof(name),"%s/pixels/.zarray",Path);
+
+  FILE* file = fopen(name,"rb");
+  if(!file)
+    return false;
+  size_t n = fread(meta,1,sizeof(meta)-1,file);
+  fclose(file);
+  meta[n] = 0;
+
+  unsigned long long shape[3];
+  const char* shapeAt = strstr(meta,"\"shape\"");
+  const char* chunksAt = strstr(meta,"\"chunks\"");
+  const char* dtypeAt = strstr(meta,"\"dtype\"");
+  if(!shapeAt || !chunksAt || !dtypeAt ||
+     sscanf(shapeAt,"\"shape\": [%llu, %llu, %llu]",&shape[0],&shape[1],&shape[2])!=3 ||
+     sscanf(chunksAt,"\"chunks\": [%u, %u, %u]",&R.chunks[0],&R.chunks[1],&R.chunks[2])!=3)
+    return false;
+  for(int i=0;i<3;i++)
+    R.shape[i] = shape[i];
+  R.sampleSize = strncmp(dtypeAt,"\"dtype\": \"<u2\"",14)==0 ? 2 : 1;
+  R.compressed = strstr(meta,"\"compressor\": null")==NULL;
+  return R.chunks[0] && R.chunks[1] && R.chunks[2];
+}
+
+// bytes in one decoded chunk
+inline size_t ZarrChunkSize(const tZarrReader& R)
+{
+  return (size_t)R.chunks[0]*R.chunks[1]*R.chunks[2]*R.sampleSize;
+}
+
+// read and decode chunk (t,y,x) into Out (ZarrChunkSize bytes)
+inline bool ZarrReadChunk(const tZarrReader& R,uint64_t t,uint32_t y,uint32_t x,void* Out)
+{
+  char name[1200];
+  snprintf(name,sizeof(name),"%s/pixels/%llu.%u.%u",R.path,(unsigned long long)t,y,x);
+
+  FILE* file = fopen(name,"rb");
+  if(!file)
+    return false;
+  fseek(file,0,SEEK_END);
+  long size = ftell(file);
+  fseek(file,0,SEEK_SET);
+
+  uLongf outSize = ZarrChunkSize(R);
+  bool ok;
+  if(R.compressed)
+  {
+    std::vector<uint8_t> in(size>0 ? size : 1);
+    ok = fread(&in[0],1,size,file)==(size_t)size &&
+         uncompress((Bytef*)Out,&outSize,&in[0],size)==Z_OK && outSize==ZarrChunkSize(R);
+  }
+  else
+    ok = (uLongf)size==outSize && fread(Out,1,size,file)==(size_t)size;
+  fclose(file);
+  return ok;
+}
+
+#endif
@@ -0,0 +1,401 @@
+/* Lossless compression of snap_image recordings with the inter-frame codec
+ * in delta_codec.h, the matching streaming decoder, and a benchmark against
+ * per-frame codecs.
+ *
+ * Frames only depend on source frames, so they are encoded in parallel in
+ * batches and written in order. Decoding runs front to back through
+ * tDeltaReader, from a file or a pipe, and rebuilds the recording byte for
+ * byte, including its trailer and footer; footer checksums are checked as
+ * frames come out. -s seeks to a frame through the keyframe before it.
+ */
+
+// includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <vector>
+#include <algorithm>
+#include <zlib.h>
+#include <recording.h>
+#include <delta_codec.h>
+#include <crc32c.h>
+#include <workers.h>
+
+#define BATCH_FRAMES 8 // frames per thread per batch
+
+// encoder state
+typedef struct
+{
+  tRecording   Rec;
+  tDeltaLayout layout;
+  uint32_t     keyInterval;
+  unsigned int threads;
+  uint64_t     first;     // first frame of the batch
+  uint64_t     count;     // frames in the batch
+  std::vector<std::vector<uint8_t> >  payload;  // per batch slot
+  std::vector<uint32_t>               size;
+  std::vector<std::vector<uint16_t> > residual; // per thread
+} tEncoder;
+
+// usage
+void ShowUsage()
+{
+  printf("usage: compress_recording -i recording -o output [-k interval] [-j threads]\n");
+  printf("       compress_recording -d -i compressed -o recording [-s first] [-n frames]\n");
+  printf("       compress_recording -b -i recording [-k interval] [-n frames]\n");
+  printf("-k\tframes from one keyframe to the next (default 64)\n");
+  printf("-j\tencoding threads (default 2)\n");
+  printf("-d\tdecode; - reads standard input or writes standard output\n");
+  printf("-s\tfirst frame to decode (needs a finished file)\n");
+  printf("-n\tframes to decode (default all) or benchmark (default 300)\n");
+  printf("-b\tcompare ratio and speed with per-frame codecs on one thread\n");
+  printf(RECORDING_MAP_LIMIT);
+}
+
+// seconds since an arbitrary start
+double Now()
+{
+  struct timespec tp;
+  clock_gettime(CLOCK_MONOTONIC,&tp);
+  return tp.tv_sec + tp.tv_nsec/1e9;
+}
+
+// image of frame i in the mapping
+inline const uint8_t* Image(const tRecording& Rec,uint64_t i)
+{
+  return Rec.base + RECORDING_HEADER_SIZE + i*Rec.recordSize + RECORDING_STAMP_SIZE;
+}
+
+// previous image as prediction, or NULL at keyframes
+inline const uint8_t* Prediction(const tRecording& Rec,uint32_t KeyInterval,uint64_t i)
+{
+  return i%KeyInterval ? Image(Rec,i-1) : NULL;
+}
+
+// encode every threads-th frame of the batch, starting at Index
+void EncodeBatch(void* Arg,unsigned int Index)
+{
+  tEncoder& E = *(tEncoder*)Arg;
+  for(uint64_t j=Index;j<E.count;j+=E.threads)
+  {
+    uint64_t i = E.first+j;
+    E.size[j] = DeltaEncodeFrame(E.layout,Image(E.Rec,i),Prediction(E.Rec,E.keyInterval,i),
+                                 E.residual[Index],E.payload[j]);
+  }
+}
+
+// compress a recording
+int Encode(const char* Input,const char* Output,uint32_t KeyInterval,unsigned int Threads)
+{
+  tEncoder E;
+  if(!RecordingOpen(E.Rec,Input,eAccessSequential))
+  {
+    printf("%s\n",E.Rec.error);
+    return 1;
+  }
+  // compressed frames are whole frames, so a cut-off last record is left out
+  if(E.Rec.truncated)
+    printf("\n*** Warning ***\n%s ends inside frame %llu; its %llu bytes are not compressed.\n\n",Input,
+           (unsigned long long)E.Rec.count,
+           (unsigned long long)((E.Rec.fileSize-RECORDING_HEADER_SIZE)%E.Rec.recordSize));
+  E.layout = DeltaLayoutFor(E.Rec.header);
+  E.keyInterval = KeyInterval;
+  E.threads = Threads;
+  E.payload.resize(Threads*BATCH_FRAMES);
+  E.size.resize(Threads*BATCH_FRAMES);
+  E.residual.resize(Threads);
+
+  // footer entries travel with their frames when every frame has one
+  uint32_t infoSize = E.Rec.info && E.Rec.infoCount==E.Rec.count ? E.Rec.infoSize : 0;
+  tDeltaWriter W;
+  if(!DeltaWriterOpen(W,Output,E.Rec,KeyInterval,infoSize))
+  {
+    printf("failed to create %s\n",Output);
+    RecordingClose(E.Rec);
+    return 1;
+  }
+
+  bool ok = true;
+  uint64_t bytesOut = 0;
+  double start = Now();
+  for(E.first=0;E.first<E.Rec.count && ok;E.first+=E.count)
+  {
+    E.count = std::min<uint64_t>(E.payload.size(),E.Rec.count-E.first);
+    RecordingPrefetch(E.Rec,E.first+E.count,E.count);
+    RunParallel(Threads,EncodeBatch,&E);
+    for(uint64_t j=0;j<E.count && ok;j++)
+    {
+      uint64_t i = E.first+j;
+      ok = DeltaWriterAppend(W,RecordingStamp(E.Rec,i),infoSize ? E.Rec.info+i*infoSize : NULL,
+                             &E.payload[j][0],E.size[j]);
+      bytesOut += DELTA_FRAME_SIZE + infoSize + E.size[j];
+    }
+  }
+  ok = DeltaWriterClose(W) && ok;
+  double seconds = Now()-start;
+
+  uint64_t bytesIn = E.Rec.count*E.Rec.recordSize;
+  if(ok)
+    printf("%llu frames in %.2f s (%.1f MB/s), %.1f MB to %.1f MB (ratio %.2f) written to %s\n",
+           (unsigned long long)E.Rec.count,seconds,seconds>0 ? bytesIn/1e6/seconds : 0.0,
+           bytesIn/1e6,bytesOut/1e6,bytesOut ? (double)bytesIn/bytesOut : 0.0,Output);
+  else
+    printf("failed to write %s\n",Output);
+  RecordingClose(E.Rec);
+  return ok ? 0 : 1;
+}
+
+// decompress frames [First,First+Count) back into a recording
+int Decode(const char* Input,const char* Output,uint64_t First,uint64_t Count)
+{
+  tDeltaReader R;
+  if(!DeltaReaderOpen(R,Input))
+  {
+    printf("%s\n",R.error);
+    return 1;
+  }
+
+  // a part of the recording gets its own frame count, as with extract_frames
+  bool partial = First>0 || Count!=(uint64_t)-1;
+  if(First>0 && !DeltaReaderSeek(R,First))
+  {
+    printf("%s\n",R.error);
+    DeltaReaderClose(R);
+    return 1;
+  }
+  tRecordingHeader header = R.header.recording;
+  if(partial)
+  {
+    uint64_t available = R.header.frameCount>First ? R.header.frameCount-First : 0;
+    header.frameCount = (uint32_t)(Count<available ? Count : available);
+  }
+
+  FILE* out = strcmp(Output,"-")==0 ? stdout : fopen(Output,"wb");
+  FILE* log = out==stdout ? stderr : stdout;
+  if(!out || fwrite(&header,1,RECORDING_HEADER_SIZE,out)!=RECORDING_HEADER_SIZE)
+  {
+    fprintf(log,"failed to create %s\n",Output);
+    DeltaReaderClose(R);
+    return 1;
+  }
+
+  // frames, keeping footer entries for the end and checking their checksums
+  std::vector<uint8_t> info;
+  uint64_t frames = 0, mismatched = 0;
+  bool ok = true;
+  double start = Now();
+  while(ok && frames<Count && DeltaReaderNext(R))
+  {
+    const std::vector<uint8_t>& image = *R.image;
+    ok = fwrite(&R.stamp,1,RECORDING_STAMP_SIZE,out)==RECORDING_STAMP_SIZE &&
+         fwrite(&image[0],1,image.size(),out)==image.size();
+    if(R.header.infoSize)
+    {
+      info.insert(info.end(),R.info->begin(),R.info->end());
+      tFrameInfo entry;
+      memcpy(&entry.crc,&(*R.info)[0],sizeof(entry.crc));
+      if(Crc32c(Crc32c(0,&R.stamp,RECORDING_STAMP_SIZE),&image[0],image.size())!=entry.crc)
+        mismatched++;
+    }
+    frames++;
+  }
+  if(R.error[0])
+  {
+    fprintf(log,"%s\n",R.error);
+    ok = false;
+  }
+  double seconds = Now()-start;
+
+  // trailer and footer as in the source
+  if(R.header.complete)
+    ok = ok && fwrite(&R.header.framesDropped,1,RECORDING_TRAILER_SIZE,out)==RECORDING_TRAILER_SIZE;
+  if(R.header.infoSize && R.header.complete)
+  {
+    tRecordingFooter tail = RecordingFooterTail(frames);
+    tail.entrySize = R.header.infoSize;
+    ok = ok && (info.empty() || fwrite(&info[0],1,info.size(),out)==info.size()) &&
+         fwrite(&tail,1,RECORDING_FOOTER_SIZE,out)==RECORDING_FOOTER_SIZE;
+  }
+  ok = (out==stdout ? fflush(out)==0 : fclose(out)==0) && ok;
+
+  if(ok)
+    fprintf(log,"%llu frames decoded in %.2f s (%.1f frames/s) to %s\n",(unsigned long long)frames,
+            seconds,seconds>0 ? frames/seconds : 0.0,Output);
+  else
+    fprintf(log,"failed to decode %s\n",Input);
+  if(mismatched)
+    fprintf(log,"\n*** Warning ***\n%llu frames do not match their checksums.\n\n",(unsigned long long)mismatched);
+  DeltaReaderClose(R);
+  return ok && !mismatched ? 0 : 1;
+}
+
+// compare the codec with itself as intra-only and with zlib per frame
+int Benchmark(const char* Input,uint32_t KeyInterval,uint64_t Count)
+{
+  tRecording Rec;
+  if(!RecordingOpen(Rec,Input,eAccessSequential))
+  {
+    printf("%s\n",Rec.error);
+    return 1;
+  }
+  uint64_t n = Count<Rec.count ? Count : Rec.count;
+  tDeltaLayout L = DeltaLayoutFor(Rec.header);
+  uint64_t bytesIn = n*L.imageSize;
+  std::vector<uint16_t> residual;
+  std::vector<uint8_t> payload, image(L.imageSize), prev(L.imageSize);
+  bool lossless = true;
+
+  // touch the frames once so every method reads them from memory
+  uint32_t check = 0;
+  for(uint64_t i=0;i<n;i++)
+    check = Crc32c(check,Image(Rec,i),L.imageSize);
+  (void)check;
+
+  printf("%llu frames of %ux%u %s, %.1f MB\n",(unsigned long long)n,Rec.header.width,Rec.header.height,
+         Rec.header.pixelFormat,bytesIn/1e6);
+  printf("%-22s %8s %12s %12s\n","method","ratio","encode MB/s","decode MB/s");
+
+  // the inter-frame codec, then the same with every frame a keyframe
+  uint32_t intervals[2] = {KeyInterval,1};
+  for(int m=0;m<2;m++)
+  {
+    // payloads are kept so decoding can be timed on its own
+    std::vector<uint8_t> stream;
+    std::vector<uint32_t> sizes(n);
+    double start = Now();
+    for(uint64_t i=0;i<n;i++)
+    {
+      sizes[i] = DeltaEncodeFrame(L,Image(Rec,i),Prediction(Rec,intervals[m],i),residual,payload);
+      stream.insert(stream.end(),payload.begin(),payload.begin()+sizes[i]);
+    }
+    double encode = Now()-start;
+
+    uint64_t offset = 0;
+    start = Now();
+    for(uint64_t i=0;i<n && lossless;i++)
+    {
+      image.swap(prev);
+      lossless = DeltaDecodeFrame(L,&stream[offset],sizes[i],i%intervals[m] ? &prev[0] : NULL,residual,&image[0]);
+      offset += sizes[i];
+    }
+    double decode = Now()-start;
+
+    // compared afterwards, outside the timing
+    offset = 0;
+    for(uint64_t i=0;i<n && lossless;i++)
+    {
+      image.swap(prev);
+      lossless = DeltaDecodeFrame(L,&stream[offset],sizes[i],i%intervals[m] ? &prev[0] : NULL,residual,&image[0]) &&
+                 memcmp(&image[0],Image(Rec,i),L.imageSize)==0;
+      offset += sizes[i];
+    }
+
+    char name[64];
+    if(intervals[m]>1)
+      snprintf(name,sizeof(name),"delta, key every %u",intervals[m]);
+    else
+      snprintf(name,sizeof(name),"delta, intra only");
+    printf("%-22s %8.2f %12.1f %12.1f\n",name,stream.size() ? (double)bytesIn/stream.size() : 0.0,
+           encode>0 ? bytesIn/1e6/encode : 0.0,decode>0 ? bytesIn/1e6/decode : 0.0);
+  }
+
+  // zlib on each frame on its own
+  int levels[2] = {1,6};
+  for(int m=0;m<2;m++)
+  {
+    std::vector<uint8_t> stream(n*compressBound(L.imageSize));
+    std::vector<uLongf> sizes(n);
+    uint64_t offset = 0;
+    double start = Now();
+    for(uint64_t i=0;i<n;i++)
+    {
+      sizes[i] = compressBound(L.imageSize);
+      compress2(&stream[offset],&sizes[i],Image(Rec,i),L.imageSize,levels[m]);
+      offset += sizes[i];
+    }
+    double encode = Now()-start;
+
+    uint64_t bytesOut = offset;
+    offset = 0;
+    start = Now();
+    for(uint64_t i=0;i<n;i++)
+    {
+      uLongf size = L.imageSize;
+      uncompress(&image[0],&size,&stream[offset],sizes[i]);
+      offset += sizes[i];
+    }
+    double decode = Now()-start;
+
+    char name[64];
+    snprintf(name,sizeof(name),"zlib level %d",levels[m]);
+    printf("%-22s %8.2f %12.1f %12.1f\n",name,bytesOut ? (double)bytesIn/bytesOut : 0.0,
+           encode>0 ? bytesIn/1e6/encode : 0.0,decode>0 ? bytesIn/1e6/decode : 0.0);
+  }
+
+  if(!lossless)
+    printf("\n*** Warning ***\nDecoded frames differ from the source.\n\n");
+  RecordingClose(Rec);
+  return lossless ? 0 : 1;
+}
+
+// main
+int main(int argc, char* argv[])
+{
+  int c;
+  const char* input = NULL;
+  const char* output = NULL;
+  bool decode = false, benchmark = false;
+  uint32_t keyInterval = 64;
+  unsigned int threads = 2;
+  uint64_t first = 0, count = (uint64_t)-1;
+
+  while ((c = getopt (argc, argv, "i:o:k:j:ds:n:b")) != -1)
+  {
+    switch(c)
+    {
+      case 'i':
+        input = optarg;
+        break;
+      case 'o':
+        output = optarg;
+        break;
+      case 'k':
+        keyInterval = atoi(optarg);
+        break;
+      case 'j':
+        threads = atoi(optarg);
+        break;
+      case 'd':
+        decode = true;
+        break;
+      case 's':
+        first = strtoull(optarg,NULL,10);
+        break;
+      case 'n':
+        count = strtoull(optarg,NULL,10);
+        break;
+      case 'b':
+        benchmark = true;
+        break;
+    }
+  }
+
+  if(!input || (!output && !benchmark))
+  {
+    ShowUsage();
+    return 1;
+  }
+  if(keyInterval==0)
+    keyInterval = 1;
+  if(threads==0)
+    threads = 1;
+
+  // the benchmark holds every compressed frame, so it defaults to a sample
+  if(benchmark)
+    return Benchmark(input,keyInterval,count!=(uint64_t)-1 ? count : 300);
+  if(decode)
+    return Decode(input,output,first,count);
+  return Encode(input,output,keyInterval,threads);
+}
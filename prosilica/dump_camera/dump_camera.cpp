@@ -7,8 +7,12 @@
 |
 |==============================================================================
 |
-| This sample code dumps, to a text file, all the attributes of a camera specified
-| by its IP address, or of the first camera visible on the host computer.
+| This sample code dumps all the attributes of cameras specified by their IP
+| addresses, of every camera found (-a), or of the first camera visible on the
+| host computer: as JSON with types, flags and ranges (default), in a compact
+| binary form, or as text. Attribute descriptions are cached per model and
+| firmware, so a repeat dump only reads values, and cameras are dumped in
+| parallel. With -d it compares two dumps instead.
 |
 |==============================================================================
 |
@@ -42,20 +46,44 @@
 #if defined(_LINUX) || defined(_QNX) || defined(_OSX)
 #include <unistd.h>
 #include <time.h>
+#include <pthread.h>
 #include <arpa/inet.h>
 #endif
 
 #include <PvApi.h>
+#include <attr_snapshot.h>
+#include <camera_sweep.h>
+
+// output formats
+typedef enum
+{
+    eFormatJson = 0,
+    eFormatBinary = 1,
+    eFormatText = 2
+} tFormat;
 
 // camera data
 typedef struct 
 {
     tPvHandle       Handle;
-    tPvCameraInfo   Info;
+    tPvCameraInfoEx Info;
+    unsigned long   IP;       // open by this address (0 = by unique ID)
+    pthread_t       Thread;
+    bool            Dumped;
 } tCamera;
 
-// global camera data
-tCamera GCamera;
+// options shared by the dump threads
+typedef struct
+{
+    tFormat         Format;
+    const char*     OutDir;
+    const char*     CacheDir; // NULL = no cache
+    bool            Refresh;  // describe attributes from the camera again
+} tOptions;
+
+// global options
+tOptions GOptions;
+pthread_mutex_t GPrintLock = PTHREAD_MUTEX_INITIALIZER;
 
 #if defined(_LINUX) || defined(_QNX) || defined(_OSX)
 void Sleep(unsigned int time)
@@ -70,6 +98,20 @@ void Sleep(unsigned int time)
 }
 #endif
 
+// usage
+void ShowUsage()
+{
+    printf("usage: dump_camera [-a] [-f json|bin|text] [-o dir] [-c dir|none] [-R] [camera IP ...]\n");
+    printf("       dump_camera -d [-V] old new\n");
+    printf("-a\tdump every camera found\n");
+    printf("-f\toutput format (default json), written to <serial>.json, .snap or .txt\n");
+    printf("-o\toutput directory (default .)\n");
+    printf("-c\tattribute description cache (default %s)\n",ATTR_CACHE_DIR);
+    printf("-R\tread descriptions and ranges from the camera again\n");
+    printf("-d\tcompare two dumps (json or bin); exit status 1 if they differ\n");
+    printf("-V\twith -d, include volatile attributes\n");
+}
+
 // wait for a camera to be plugged
 void WaitForCamera()
 {
@@ -82,181 +124,253 @@ void WaitForCamera()
     printf("\n");
 }
 
-// get the first camera found
-bool CameraGrab()
+// open the camera
+bool CameraOpen(tCamera& Camera)
 {
-    return PvCameraList(&(GCamera.Info),1,NULL) >= 1;
+    if(Camera.IP)
+    {
+        if(PvCameraInfoByAddrEx(Camera.IP,&Camera.Info,NULL,sizeof(tPvCameraInfoEx)))
+            return false;
+        return !PvCameraOpenByAddr(Camera.IP,ePvAccessMonitor,&Camera.Handle);
+    }
+    return !PvCameraOpen(Camera.Info.UniqueId,ePvAccessMonitor,&Camera.Handle);
 }
 
-// open the camera
-bool CameraOpen()
+// close the camera
+void CameraClose(tCamera& Camera)
 {
-    if(!PvCameraOpen(GCamera.Info.UniqueId,ePvAccessMonitor,&(GCamera.Handle)))
-        return true;
-    else
-        return false;
+    PvCameraClose(Camera.Handle); 
 }
 
-// open the camera
-bool CameraOpen(unsigned long IP)
+// the text format: one attribute per line
+std::string TextDump(const tAttrSnapshot& Snapshot)
+{
+    std::string out = Snapshot.serial + "\n\n";
+    char label[64];
+
+    for(size_t i=0;i<Snapshot.attrs.size();i++)
+    {
+        const tAttr& A = Snapshot.attrs[i];
+        snprintf(label,sizeof(label),"%-30s",A.name.c_str());
+        out += label;
+        out += A.err==ePvErrSuccess ? " = " + A.value + "\n" : " = ERROR!\n";
+    }
+    return out;
+}
+
+// dump one camera (thread function)
+void* DumpCamera(void* pContext)
 {
-    if(!PvCameraInfoByAddr(IP,&GCamera.Info,NULL))
-        return CameraOpen();
+    tCamera& Camera = *(tCamera*)pContext;
+    double start = SweepNow();
+    tAttrSnapshot snapshot;
+    bool cached = false;
+    char ip[32] = "";
+
+    if(!CameraOpen(Camera))
+    {
+        pthread_mutex_lock(&GPrintLock);
+        printf("failed to open camera %lu (maybe not found?)\n",Camera.Info.UniqueId);
+        pthread_mutex_unlock(&GPrintLock);
+        return 0;
+    }
+
+    tPvIpSettings settings;
+    struct in_addr addr;
+    addr.s_addr = Camera.IP;
+    if(!Camera.IP && !PvCameraIpSettingsGet(Camera.Info.UniqueId,&settings))
+        addr.s_addr = settings.CurrentIpAddress;
+    if(addr.s_addr)
+        snprintf(ip,sizeof(ip),"%s",inet_ntoa(addr));
+
+    if(AttrSnapshot(Camera.Handle,Camera.Info,ip,GOptions.CacheDir,GOptions.Refresh,snapshot,&cached))
+    {
+        const char* extension[] = {"json","snap","txt"};
+        std::string name = std::string(GOptions.OutDir) + "/" + snapshot.serial + "." + extension[GOptions.Format];
+        bool ok = GOptions.Format==eFormatText ? AttrWriteFile(name.c_str(),TextDump(snapshot))
+                                               : AttrSave(name.c_str(),snapshot,GOptions.Format==eFormatBinary);
+
+        pthread_mutex_lock(&GPrintLock);
+        if(ok)
+            printf("%s (%s): %lu attributes, descriptions from %s, %.0f ms -> %s\n",snapshot.serial.c_str(),ip,
+                   (unsigned long)snapshot.attrs.size(),cached ? "cache" : "camera",(SweepNow()-start)*1000,name.c_str());
+        else
+            printf("sorry, failed to create the output file %s\n",name.c_str());
+        pthread_mutex_unlock(&GPrintLock);
+        Camera.Dumped = ok;
+    }
     else
-        return false;
+    {
+        pthread_mutex_lock(&GPrintLock);
+        printf("failed to list the attributes of camera %lu\n",Camera.Info.UniqueId);
+        pthread_mutex_unlock(&GPrintLock);
+    }
+
+    CameraClose(Camera);
+    return 0;
 }
 
-// close the camera
-void CameraClose()
+// a value for the diff listing
+std::string DiffValue(const tAttr& A)
 {
-    PvCameraClose(GCamera.Handle); 
+    if(A.err!=ePvErrSuccess)
+        return "(error " + AttrText((unsigned long)A.err) + ")";
+    return A.type==ePvDatatypeString || A.type==ePvDatatypeEnum ? "\"" + A.value + "\"" : A.value;
 }
 
-// display info on a given attribute of the camera
-void QueryAttribute(FILE* File,const char* Label)
+// compare two dumps: 0 if the same, 1 if they differ, 2 if one cannot be read
+int DiffSnapshots(const char* OldPath,const char* NewPath,bool Volatile)
 {
-    tPvAttributeInfo lInfo;
+    tAttrSnapshot a, b;
+    if(!AttrLoad(OldPath,a) || !AttrLoad(NewPath,b))
+    {
+        printf("cannot read %s\n",AttrLoad(OldPath,a) ? NewPath : OldPath);
+        return 2;
+    }
 
-    if(!PvAttrInfo(GCamera.Handle,Label,&lInfo))
+    printf("--- %s (%s %s, firmware %s)\n",OldPath,a.model.c_str(),a.serial.c_str(),a.firmware.c_str());
+    printf("+++ %s (%s %s, firmware %s)\n",NewPath,b.model.c_str(),b.serial.c_str(),b.firmware.c_str());
+
+    unsigned long differences = 0;
+    for(size_t i=0;i<a.attrs.size();i++)
+    {
+        const tAttr& A = a.attrs[i];
+        const tAttr* B = AttrFind(b,A.name);
+        if(!Volatile && ((A.flags & ePvFlagVolatile) || (B && (B->flags & ePvFlagVolatile))))
+            continue;
+        if(!B)
+            printf("- %s = %s\n",A.name.c_str(),DiffValue(A).c_str());
+        else if(A.err!=B->err || A.value!=B->value)
+            printf("  %s: %s -> %s\n",A.name.c_str(),DiffValue(A).c_str(),DiffValue(*B).c_str());
+        else
+            continue;
+        differences++;
+    }
+    for(size_t i=0;i<b.attrs.size();i++)
     {
-        if(lInfo.Datatype != ePvDatatypeCommand && strcmp(lInfo.Category,"/Stats"))
+        const tAttr& B = b.attrs[i];
+        if(AttrFind(a,B.name) || (!Volatile && (B.flags & ePvFlagVolatile)))
+            continue;
+        printf("+ %s = %s\n",B.name.c_str(),DiffValue(B).c_str());
+        differences++;
+    }
+
+    printf("%lu difference(s)\n",differences);
+    return differences ? 1 : 0;
+}
+
+int main(int argc, char* argv[])
+{
+    bool all = false;
+    bool diff = false;
+    bool includeVolatile = false;
+    int c;
+
+    memset(&GOptions,0,sizeof(tOptions));
+    GOptions.Format = eFormatJson;
+    GOptions.OutDir = ".";
+    GOptions.CacheDir = ATTR_CACHE_DIR;
+
+    while((c = getopt(argc, argv, "af:o:c:RdV")) != -1)
+    {
+        switch(c)
         {
-            fprintf(File,"%-30s",Label); 
-            
-            switch(lInfo.Datatype)
-            {           
-                case ePvDatatypeString:
+            case 'a':
+                all = true;
+                break;
+            case 'f':
+                if(strcmp(optarg,"bin")==0)
+                    GOptions.Format = eFormatBinary;
+                else if(strcmp(optarg,"text")==0)
+                    GOptions.Format = eFormatText;
+                else if(strcmp(optarg,"json")!=0)
                 {
-                    char lValue[128];
-    
-                    // we assume here that any string value will be less than 128 characters
-                    // long, wich we may not be the case
-                    
-                    if(!PvAttrStringGet(GCamera.Handle,Label,lValue,128,NULL))
-                        fprintf(File," = %s\n",lValue);
-                    else
-                        fprintf(File," = ERROR!\n");
-    
-                    break;                
-                }
-                case ePvDatatypeEnum:
-                {
-                    char lValue[128];
-    
-                    // we assume here that any string value will be less than 128 characters
-                    // long, wich we may not be the case
-                    
-                    if(!PvAttrEnumGet(GCamera.Handle,Label,lValue,128,NULL))
-                        fprintf(File," = %s\n",lValue);
-                    else
-                        fprintf(File," = ERROR!\n");
-                    break;
+                    ShowUsage();
+                    return 1;
                 }
-                case ePvDatatypeUint32:
-                {
-                    tPvUint32 lValue;
-                    
-                    if(!PvAttrUint32Get(GCamera.Handle,Label,&lValue))
-                        fprintf(File," = %lu\n",lValue);
-                    else
-                        fprintf(File," = ERROR!\n");
-                    break;
-                }
-                case ePvDatatypeFloat32:
-                {
-                    tPvFloat32 lValue;
-                    
-                    if(!PvAttrFloat32Get(GCamera.Handle,Label,&lValue))
-                        fprintf(File," = %f\n",lValue);
-                    else
-                        fprintf(File," = ERROR!\n");
-                    break;
-                }
-                default:
-                    printf("\n");
-            }
+                break;
+            case 'o':
+                GOptions.OutDir = optarg;
+                break;
+            case 'c':
+                GOptions.CacheDir = strcmp(optarg,"none") ? optarg : NULL;
+                break;
+            case 'R':
+                GOptions.Refresh = true;
+                break;
+            case 'd':
+                diff = true;
+                break;
+            case 'V':
+                includeVolatile = true;
+                break;
+            default:
+                ShowUsage();
+                return 1;
         }
     }
-}
 
-// list all the attributes
-void ListAttributes()
-{
-    tPvUint32 lCount;
-    tPvAttrListPtr lAttrs;
-    FILE* file;
-    char name[18];
-    
-    sprintf(name,"%s.txt",GCamera.Info.SerialString);
-    
-    if((file = fopen(name,"w")))
+    // comparing dumps needs no camera
+    if(diff)
     {
-        printf("writing camera attribute to %s\n",name);        
-        
-        fprintf(file,"%s\n\n",GCamera.Info.SerialString);
-    
-        if(!PvAttrList(GCamera.Handle,&lAttrs,&lCount))
+        if(argc-optind != 2)
         {
-            for(tPvUint32 i=0;i<lCount;i++)
-                QueryAttribute(file,lAttrs[i]);
+            ShowUsage();
+            return 2;
         }
-        
-        fclose(file);
+        return DiffSnapshots(argv[optind],argv[optind+1],includeVolatile);
     }
-    else
-        printf("sorry, failed to create the output file\n");
-}
 
-int main(int argc, char* argv[])
-{
     // initialise the Prosilica API
     if(!PvInitialize())
     { 
-        memset(&GCamera,0,sizeof(tCamera));
+        std::vector<tCamera> cameras;
+        tCamera camera;
+        memset(&camera,0,sizeof(tCamera));
 
-        // the only command line argument accepted is the IP@ of the camera to be open
-        if(argc>1)
+        // the cameras given by IP@, every camera found, or the first one
+        for(int i=optind;i<argc;i++)
         {
-            unsigned long IP = inet_addr(argv[1]);
-             
-            if(IP)
-            {           
-                // open the camera
-                if(CameraOpen(IP))
-                {
-                    ListAttributes();
-    
-                    // unsetup the camera
-                    CameraClose();
-                }
-                else
-                    printf("Failed to open the camera (maybe not found?)\n");
-            }
+            camera.IP = inet_addr(argv[i]);
+            if(camera.IP==INADDR_NONE || !camera.IP)
+                printf("a valid IP address must be entered (%s)\n",argv[i]);
             else
-                printf("a valid IP address must be entered\n");
+                cameras.push_back(camera);
         }
-        else
+        if(optind==argc)
         {
             // wait for a camera to be plugged
             WaitForCamera();
-    
-            if(CameraGrab())
+
+            std::vector<tPvCameraInfoEx> list;
+            unsigned long reachable = SweepList(list);
+            for(unsigned long i=0;i<reachable && (all || i<1);i++)
             {
-                // open the camera
-                if(CameraOpen())
-                {
-                    ListAttributes();
-    
-                    // unsetup the camera
-                    CameraClose();
-                }
-                else
-                    printf("failed to open the camera\n");
+                camera.Info = list[i];
+                cameras.push_back(camera);
             }
-            else
+            if(cameras.empty())
                 printf("failed to grab a camera!\n");
         }
 
+        // every camera at once; each waits only on its own calls
+        double start = SweepNow();
+        for(size_t i=0;i<cameras.size();i++)
+            if(pthread_create(&cameras[i].Thread,NULL,DumpCamera,&cameras[i]))
+            {
+                cameras[i].Thread = 0;
+                DumpCamera(&cameras[i]);
+            }
+        unsigned long dumped = 0;
+        for(size_t i=0;i<cameras.size();i++)
+        {
+            if(cameras[i].Thread)
+                pthread_join(cameras[i].Thread,NULL);
+            dumped += cameras[i].Dumped;
+        }
+        if(cameras.size()>1)
+            printf("%lu of %lu camera(s) dumped in %.0f ms\n",dumped,(unsigned long)cameras.size(),(SweepNow()-start)*1000);
+
         // uninitialise the API
         PvUnInitialize();
     }
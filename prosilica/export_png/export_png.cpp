@@ -0,0 +1,235 @@
+/* Exports frames of a snap_image recording as 8- or 16-bit PNGs using the
+ * parallel encoder in common/png.h, and reports the encode time per frame.
+ * Bayer, YUV, BGR(A) and packed recordings go through common/pixel_format.h
+ * first (included in the timing).
+ */
+
+// includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <vector>
+#include <recording.h>
+#include <png.h>
+#include <pixel_format.h>
+
+// usage
+void ShowUsage()
+{
+  printf("usage: export_png -i recording [-o output] [-f first] [-n count] [-l level] [-s strategy] [-j threads]\n");
+  printf("                  [-p pattern] [-d demosaic] [-b bits]\n");
+  printf("-i\tsnap_image recording\n");
+  printf("-o\toutput file; with several frames a printf pattern such as frame%%06d.png\n");
+  printf("\t(default: recording name with .png, or _NNNNNN.png per frame)\n");
+  printf("-f\tfirst frame (default 0)\n");
+  printf("-n\tnumber of frames, 0 for all (default 1)\n");
+  printf("-l\tzlib level 0-9 (default 6)\n");
+  printf("-s\tzlib strategy: filtered, rle, huffman or default (default filtered)\n");
+  printf("-j\tdeflate and conversion threads per frame (default 2)\n");
+  printf("-p\tBayer pattern of Bayer recordings: rggb, gbrg, grbg or bggr (default rggb)\n");
+  printf("-d\tdemosaicing: bilinear or edge (default bilinear)\n");
+  printf("-b\tsignificant bits of 16-bit formats (default 16)\n");
+  printf("formats other than Mono8/16 and Rgb24/48 are converted to grey or RGB first\n");
+  printf(RECORDING_MAP_LIMIT);
+}
+
+// seconds since an arbitrary start
+double Now()
+{
+  struct timespec tp;
+  clock_gettime(CLOCK_MONOTONIC,&tp);
+  return tp.tv_sec + tp.tv_nsec/1e9;
+}
+
+// name of the png for frame i
+void OutputName(char* Name,size_t Size,const char* Input,const char* Output,uint64_t i,bool Several)
+{
+  char stem[1024];
+
+  if(Output && strchr(Output,'%'))
+  {
+    snprintf(Name,Size,Output,(unsigned long long)i);
+    return;
+  }
+
+  // strip the extension of the given output or of the input
+  snprintf(stem,sizeof(stem),"%s",Output ? Output : Input);
+  char* ext = strrchr(stem,'.');
+  if(ext && !strchr(ext,'/'))
+    *ext = 0;
+
+  if(Several)
+    snprintf(Name,Size,"%s_%06llu.png",stem,(unsigned long long)i);
+  else
+    snprintf(Name,Size,"%s.png",stem);
+}
+
+// main
+int main(int argc, char* argv[])
+{
+  int c;
+  const char* input = NULL;
+  const char* output = NULL;
+  uint64_t first = 0;
+  uint64_t count = 1;
+  tPngOptions Options;
+  Options.level = 6;
+  Options.strategy = Z_FILTERED;
+  Options.threads = 2;
+  tConvertOptions Convert;
+  ConvertDefaults(Convert,ePixelRgb24);
+
+  while ((c = getopt (argc, argv, "i:o:f:n:l:s:j:p:d:b:")) != -1)
+  {
+    switch(c)
+    {
+      case 'i':
+        input = optarg;
+        break;
+      case 'o':
+        output = optarg;
+        break;
+      case 'f':
+        first = strtoull(optarg,NULL,10);
+        break;
+      case 'n':
+        count = strtoull(optarg,NULL,10);
+        break;
+      case 'l':
+        Options.level = atoi(optarg);
+        break;
+      case 's':
+        if(strcmp(optarg,"rle")==0)
+          Options.strategy = Z_RLE;
+        else if(strcmp(optarg,"huffman")==0)
+          Options.strategy = Z_HUFFMAN_ONLY;
+        else if(strcmp(optarg,"default")==0)
+          Options.strategy = Z_DEFAULT_STRATEGY;
+        else
+          Options.strategy = Z_FILTERED;
+        break;
+      case 'j':
+        Options.threads = atoi(optarg);
+        Convert.threads = Options.threads;
+        break;
+      case 'p':
+        if(strcmp(optarg,"gbrg")==0)
+          Convert.bayer = ePvBayerGBRG;
+        else if(strcmp(optarg,"grbg")==0)
+          Convert.bayer = ePvBayerGRBG;
+        else if(strcmp(optarg,"bggr")==0)
+          Convert.bayer = ePvBayerBGGR;
+        else
+          Convert.bayer = ePvBayerRGGB;
+        break;
+      case 'd':
+        Convert.demosaic = strcmp(optarg,"edge")==0 ? eDemosaicEdgeAware : eDemosaicBilinear;
+        break;
+      case 'b':
+        Convert.bitDepth = atoi(optarg);
+        break;
+    }
+  }
+
+  if(!input)
+  {
+    ShowUsage();
+    return 1;
+  }
+
+  tRecording Rec;
+  if(!RecordingOpen(Rec,input,eAccessSequential))
+  {
+    printf("%s\n",Rec.error);
+    return 1;
+  }
+
+  // map the pixel format onto png channels and depth, converting the others
+  const char* format = Rec.header.pixelFormat;
+  uint32_t channels = 1, depth = 16;
+  bool convert = false;
+  tPvImageFormat pvFormat = ePvFmtMono16;
+  if(strcmp(format,"Mono8")==0)
+    depth = 8;
+  else if(strcmp(format,"Rgb24")==0)
+  {
+    channels = 3;
+    depth = 8;
+  }
+  else if(strcmp(format,"Rgb48")==0)
+    channels = 3;
+  else if(strcmp(format,"Mono16")!=0)
+  {
+    if(!PixelFormatByName(format,pvFormat))
+    {
+      printf("pixel format %s is not supported\n",format);
+      RecordingClose(Rec);
+      return 1;
+    }
+
+    // packed grey to Mono16, 8-bit colour to Rgb24, deeper colour to Rgb48
+    convert = true;
+    if(pvFormat==ePvFmtMono12Packed)
+      Convert.target = ePixelMono16;
+    else
+    {
+      channels = 3;
+      depth = PixelFormatDepth(pvFormat,Convert)>8 ? 16 : 8;
+      Convert.target = depth==8 ? ePixelRgb24 : ePixelRgb48;
+    }
+  }
+
+  if(first>=Rec.count)
+  {
+    printf("recording has only %llu frames\n",(unsigned long long)Rec.count);
+    RecordingClose(Rec);
+    return 1;
+  }
+  if(count==0 || count>Rec.count-first)
+    count = Rec.count-first;
+  Rec.readahead = 4;
+
+  std::vector<uint8_t> png;
+  std::vector<uint8_t> converted(convert ? (size_t)Rec.header.width*Rec.header.height*PixelTargetBytes(Convert.target) : 0);
+  double encodeTime = 0;
+  uint64_t pngBytes = 0;
+  int status = 0;
+  tFrameIterator it = begin(Rec)+first;
+
+  for(uint64_t i=0;i<count;i++,++it)
+  {
+    tFrameView Frame = *it;
+    char name[1100];
+    OutputName(name,sizeof(name),input,output,Frame.index,count>1);
+
+    double start = Now();
+    const void* samples = Frame.image;
+    if(convert)
+    {
+      ConvertImage(Frame.image,pvFormat,Frame.width,Frame.height,Convert,&converted[0]);
+      samples = &converted[0];
+    }
+    bool ok = PngEncode(samples,Frame.width,Frame.height,channels,depth,Options,png);
+    encodeTime += Now()-start;
+
+    FILE* file = ok ? fopen(name,"wb") : NULL;
+    if(!file || fwrite(&png[0],1,png.size(),file)!=png.size())
+    {
+      printf("failed to write %s\n",name);
+      status = 1;
+    }
+    if(file)
+      fclose(file);
+    pngBytes += png.size();
+  }
+
+  double raw = (double)count*Rec.imageSize;
+  printf("%llu frames: %.1f ms per frame, %.1f MB/s, %.1f%% of raw size (level %d, %u threads)\n",
+         (unsigned long long)count,1000*encodeTime/count,raw/1e6/encodeTime,100*pngBytes/raw,
+         Options.level,Options.threads);
+
+  RecordingClose(Rec);
+  return status;
+}
@@ -0,0 +1,413 @@
+/* Streams a snap_image recording into a single multi-page BigTIFF.
+ *
+ * Pages are compressed on worker threads (Deflate or LZW, both with
+ * horizontal differencing) and written in order by the main thread with
+ * TIFFWriteRawStrip, so only a fixed window of pages is ever held in
+ * memory regardless of recording length. Each page carries its frame's host
+ * time in DateTime and the full time block in ImageDescription.
+ */
+
+// includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <zlib.h>
+#include <tiffio.h>
+#include <vector>
+#include <recording.h>
+#include <workers.h>
+
+#define ROWS_PER_STRIP 64
+#define LZW_HASH_SIZE  9001 // prime larger than the 4096 codes
+
+// compression choices
+typedef enum
+{
+  eCompressNone    = 0,
+  eCompressDeflate = 1,
+  eCompressLzw     = 2
+} tCompress;
+
+// one page in flight
+typedef struct
+{
+  tFrameView                         Frame;
+  std::vector<std::vector<uint8_t> > strips;
+  bool                               done;
+  bool                               failed;
+} tPage;
+
+// export session
+typedef struct
+{
+  tRecording          Rec;
+  tCompress           compress;
+  int                 level;
+  uint32_t            sampleSize;
+  std::vector<tPage>  pages;     // ring of pages in flight
+  pthread_mutex_t     lock;
+  pthread_cond_t      pageDone;
+} tExport;
+
+// global export session
+tExport GExport;
+
+// usage
+void ShowUsage()
+{
+  printf("usage: export_tiff -i recording -o output.tif [-c none|deflate|lzw] [-l level] [-j threads] [-f first] [-n count]\n");
+  printf("-c\tpage compression (default deflate)\n");
+  printf("-l\tdeflate level 1-9 (default 6)\n");
+  printf("-j\tcompression threads (default 2)\n");
+  printf("-f\tfirst frame (default 0)\n");
+  printf("-n\tnumber of frames (default all)\n");
+  printf(RECORDING_MAP_LIMIT);
+}
+
+// TIFF LZW encoder state (codes written MSB first, 9 to 12 bits)
+typedef struct
+{
+  std::vector<uint8_t>* out;
+  uint32_t              bits;
+  int                   nbits;
+  int                   bitCount;
+  int                   freeEnt;
+  int                   maxCode;
+  int32_t               keys[LZW_HASH_SIZE];
+  uint16_t              codes[LZW_HASH_SIZE];
+} tLzw;
+
+// write one code
+void LzwPut(tLzw& L,int Code)
+{
+  L.bits = (L.bits << L.nbits) | Code;
+  L.bitCount += L.nbits;
+  while(L.bitCount>=8)
+  {
+    L.out->push_back((uint8_t)(L.bits >> (L.bitCount-8)));
+    L.bitCount -= 8;
+  }
+}
+
+// forget all strings
+void LzwClear(tLzw& L)
+{
+  memset(L.keys,0xff,sizeof(L.keys));
+  L.nbits = 9;
+  L.maxCode = 511;
+  L.freeEnt = 258;
+}
+
+// account for a new table entry, mirroring libtiff's encoder
+void LzwGrow(tLzw& L)
+{
+  if(++L.freeEnt==4094)
+  {
+    LzwPut(L,256);
+    LzwClear(L);
+  }
+  else if(L.freeEnt>L.maxCode)
+  {
+    L.nbits++;
+    L.maxCode = (1<<L.nbits)-1;
+  }
+}
+
+// LZW compress In into Out the way libtiff does (clear code first, EOI last)
+void LzwEncode(const uint8_t* In,size_t Size,std::vector<uint8_t>& Out)
+{
+  tLzw* L = new tLzw;
+  L->out = &Out;
+  L->bits = 0;
+  L->bitCount = 0;
+  LzwClear(*L);
+  Out.clear();
+
+  LzwPut(*L,256);
+  if(Size)
+  {
+    int ent = In[0];
+    for(size_t i=1;i<Size;i++)
+    {
+      int32_t key = (ent << 8) | In[i];
+      uint32_t h = (uint32_t)key % LZW_HASH_SIZE;
+      while(L->keys[h]!=-1 && L->keys[h]!=key)
+        h = (h+1) % LZW_HASH_SIZE;
+
+      if(L->keys[h]==key)
+      {
+        ent = L->codes[h];
+        continue;
+      }
+
+      // new string: emit the known prefix and remember prefix + byte
+      LzwPut(*L,ent);
+      L->keys[h] = key;
+      L->codes[h] = L->freeEnt;
+      LzwGrow(*L);
+      ent = In[i];
+    }
+    LzwPut(*L,ent);
+    LzwGrow(*L);
+  }
+  LzwPut(*L,257);
+  if(L->bitCount)
+    Out.push_back((uint8_t)(L->bits << (8-L->bitCount)));
+  delete L;
+}
+
+// horizontal differencing (TIFF predictor 2) on a strip of rows
+void Predict(uint8_t* Data,uint32_t Rows,uint32_t Width,uint32_t SampleSize)
+{
+  for(uint32_t y=0;y<Rows;y++)
+  {
+    if(SampleSize==2)
+    {
+      uint16_t* row = (uint16_t*)(Data + (size_t)y*Width*2);
+      for(uint32_t x=Width-1;x>0;x--)
+        row[x] -= row[x-1];
+    }
+    else
+    {
+      uint8_t* row = Data + (size_t)y*Width;
+      for(uint32_t x=Width-1;x>0;x--)
+        row[x] -= row[x-1];
+    }
+  }
+}
+
+// compress all strips of a page (runs on a worker)
+void CompressPage(void* Arg)
+{
+  tPage* Page = (tPage*)Arg;
+  const tFrameView& Frame = Page->Frame;
+  uint32_t strips = (Frame.height+ROWS_PER_STRIP-1)/ROWS_PER_STRIP;
+  size_t rowBytes = (size_t)Frame.width*GExport.sampleSize;
+  std::vector<uint8_t> rows;
+  bool failed = false;
+
+  Page->strips.resize(strips);
+  for(uint32_t s=0;s<strips;s++)
+  {
+    uint32_t first = s*ROWS_PER_STRIP;
+    uint32_t n = Frame.height-first < ROWS_PER_STRIP ? Frame.height-first : ROWS_PER_STRIP;
+    const uint8_t* src = (const uint8_t*)Frame.image + first*rowBytes;
+    std::vector<uint8_t>& out = Page->strips[s];
+
+    if(GExport.compress==eCompressNone)
+    {
+      out.assign(src,src+n*rowBytes);
+      continue;
+    }
+
+    rows.assign(src,src+n*rowBytes);
+    Predict(&rows[0],n,Frame.width,GExport.sampleSize);
+    if(GExport.compress==eCompressLzw)
+      LzwEncode(&rows[0],rows.size(),out);
+    else
+    {
+      uLongf size = compressBound(rows.size());
+      out.resize(size);
+      failed = failed || compress2(&out[0],&size,&rows[0],rows.size(),GExport.level)!=Z_OK;
+      out.resize(size);
+    }
+  }
+
+  pthread_mutex_lock(&GExport.lock);
+  Page->failed = failed;
+  Page->done = true;
+  pthread_cond_broadcast(&GExport.pageDone);
+  pthread_mutex_unlock(&GExport.lock);
+}
+
+// write a finished page as the next directory
+bool WritePage(TIFF* Tif,tPage& Page,uint64_t PageNumber,uint64_t Pages)
+{
+  // wait for the workers
+  pthread_mutex_lock(&GExport.lock);
+  while(!Page.done)
+    pthread_cond_wait(&GExport.pageDone,&GExport.lock);
+  pthread_mutex_unlock(&GExport.lock);
+  if(Page.failed)
+    return false;
+
+  const tFrameView& Frame = Page.Frame;
+  const tRecordingHeader& h = GExport.Rec.header;
+  uint16_t compression = COMPRESSION_NONE;
+  if(GExport.compress==eCompressDeflate)
+    compression = COMPRESSION_ADOBE_DEFLATE;
+  if(GExport.compress==eCompressLzw)
+    compression = COMPRESSION_LZW;
+
+  // host time to the second in DateTime, everything in ImageDescription
+  char dateTime[32], description[512];
+  time_t seconds = Frame.stamp.hostSecond;
+  struct tm utc;
+  gmtime_r(&seconds,&utc);
+  strftime(dateTime,sizeof(dateTime),"%Y:%m:%d %H:%M:%S",&utc);
+  snprintf(description,sizeof(description),
+    "{\"frame\": %llu, \"host_sec\": %u, \"host_nsec\": %u, \"ticks\": %llu, "
+    "\"time_stamp_frequency\": %u, \"frame_rate\": %g, \"pixel_format\": \"%s\"}",
+    (unsigned long long)Frame.index,Frame.stamp.hostSecond,Frame.stamp.hostnSecond,
+    (unsigned long long)FrameTicks(Frame.stamp),h.timeStampFrequency,h.frameRate,h.pixelFormat);
+
+  TIFFSetField(Tif,TIFFTAG_SUBFILETYPE,FILETYPE_PAGE);
+  TIFFSetField(Tif,TIFFTAG_IMAGEWIDTH,Frame.width);
+  TIFFSetField(Tif,TIFFTAG_IMAGELENGTH,Frame.height);
+  TIFFSetField(Tif,TIFFTAG_BITSPERSAMPLE,GExport.sampleSize*8);
+  TIFFSetField(Tif,TIFFTAG_SAMPLESPERPIXEL,1);
+  TIFFSetField(Tif,TIFFTAG_PHOTOMETRIC,PHOTOMETRIC_MINISBLACK);
+  TIFFSetField(Tif,TIFFTAG_PLANARCONFIG,PLANARCONFIG_CONTIG);
+  TIFFSetField(Tif,TIFFTAG_ROWSPERSTRIP,ROWS_PER_STRIP);
+  TIFFSetField(Tif,TIFFTAG_COMPRESSION,compression);
+  if(compression!=COMPRESSION_NONE)
+    TIFFSetField(Tif,TIFFTAG_PREDICTOR,PREDICTOR_HORIZONTAL);
+  // PageNumber is 16-bit and optional; long recordings go without it
+  if(Pages<=65535)
+    TIFFSetField(Tif,TIFFTAG_PAGENUMBER,(uint16_t)PageNumber,(uint16_t)Pages);
+  TIFFSetField(Tif,TIFFTAG_SOFTWARE,"export_tiff");
+  TIFFSetField(Tif,TIFFTAG_DATETIME,dateTime);
+  TIFFSetField(Tif,TIFFTAG_IMAGEDESCRIPTION,description);
+
+  bool ok = true;
+  for(size_t s=0;s<Page.strips.size() && ok;s++)
+    ok = TIFFWriteRawStrip(Tif,s,&Page.strips[s][0],Page.strips[s].size())>=0;
+  ok = ok && TIFFWriteDirectory(Tif);
+
+  // release the page's memory before the slot is reused
+  std::vector<std::vector<uint8_t> >().swap(Page.strips);
+  return ok;
+}
+
+// main
+int main(int argc, char* argv[])
+{
+  int c;
+  const char* input = NULL;
+  const char* output = NULL;
+  unsigned int threads = 2;
+  uint64_t first = 0, count = 0;
+
+  GExport.compress = eCompressDeflate;
+  GExport.level = 6;
+
+  while ((c = getopt (argc, argv, "i:o:c:l:j:f:n:")) != -1)
+  {
+    switch(c)
+    {
+      case 'i':
+        input = optarg;
+        break;
+      case 'o':
+        output = optarg;
+        break;
+      case 'c':
+        if(strcmp(optarg,"none")==0)
+          GExport.compress = eCompressNone;
+        else if(strcmp(optarg,"lzw")==0)
+          GExport.compress = eCompressLzw;
+        else
+          GExport.compress = eCompressDeflate;
+        break;
+      case 'l':
+        GExport.level = atoi(optarg);
+        break;
+      case 'j':
+        threads = atoi(optarg);
+        break;
+      case 'f':
+        first = strtoull(optarg,NULL,10);
+        break;
+      case 'n':
+        count = strtoull(optarg,NULL,10);
+        break;
+    }
+  }
+
+  if(!input || !output)
+  {
+    ShowUsage();
+    return 1;
+  }
+
+  if(!RecordingOpen(GExport.Rec,input,eAccessSequential))
+  {
+    printf("%s\n",GExport.Rec.error);
+    return 1;
+  }
+
+  const char* format = GExport.Rec.header.pixelFormat;
+  if(strcmp(format,"Mono16")==0)
+    GExport.sampleSize = 2;
+  else if(strcmp(format,"Mono8")==0)
+    GExport.sampleSize = 1;
+  else
+  {
+    printf("pixel format %s is not supported\n",format);
+    RecordingClose(GExport.Rec);
+    return 1;
+  }
+
+  // a TIFF needs at least one page
+  if(first>=GExport.Rec.count)
+  {
+    printf("frame %llu is past the end of %s (%llu frames)\n",(unsigned long long)first,input,
+           (unsigned long long)GExport.Rec.count);
+    RecordingClose(GExport.Rec);
+    return 1;
+  }
+  if(count==0 || count>GExport.Rec.count-first)
+    count = GExport.Rec.count-first;
+
+  // BigTIFF ("8"), so the output may pass 4 GB
+  TIFF* Tif = TIFFOpen(output,"w8");
+  if(!Tif)
+  {
+    printf("failed to create %s\n",output);
+    RecordingClose(GExport.Rec);
+    return 1;
+  }
+
+  // two pages per worker in flight bounds memory
+  pthread_mutex_init(&GExport.lock,NULL);
+  pthread_cond_init(&GExport.pageDone,NULL);
+  GExport.pages.resize(2*(threads ? threads : 1));
+  GExport.Rec.readahead = GExport.pages.size();
+  tWorkQueue Queue;
+  WorkQueueStart(Queue,threads,GExport.pages.size());
+
+  bool ok = true;
+  size_t window = GExport.pages.size();
+  uint64_t written = 0;
+  uint64_t i;
+  for(i=0;i<count;i++)
+  {
+    tPage& Page = GExport.pages[i%window];
+    if(i>=window && !(ok = WritePage(Tif,Page,written++,count)))
+      break;
+
+    Page.Frame = RecordingFrame(GExport.Rec,first+i);
+    Page.done = false;
+    Page.failed = false;
+    WorkQueueSubmit(Queue,CompressPage,&Page);
+    if(i%window==0)
+      RecordingPrefetch(GExport.Rec,first+i+window,window);
+  }
+
+  // write the pages still in flight, unless a write already failed
+  for(;ok && written<i;written++)
+    ok = WritePage(Tif,GExport.pages[written%window],written,count);
+
+  WorkQueueStop(Queue);
+  TIFFClose(Tif);
+  RecordingClose(GExport.Rec);
+
+  if(ok)
+    printf("%llu frames written to %s\n",(unsigned long long)count,output);
+  else
+    printf("failed to write %s\n",output);
+  return ok ? 0 : 1;
+}
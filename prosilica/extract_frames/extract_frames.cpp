@@ -0,0 +1,224 @@
+/* Copies the frames of a snap_image recording that fall in a time range into
+ * a new recording with its own header, trailer and, if the source has one,
+ * checksum footer.
+ *
+ * The range is found by binary search over the time blocks, so only a few
+ * dozen pages of the source are read before the copy starts, and the copy
+ * itself is one sequential run since the selected frames are contiguous.
+ */
+
+// includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <recording.h>
+
+// usage
+void ShowUsage()
+{
+  printf("usage: extract_frames -i recording -o output [-c] [-s start] [-e end | -d seconds]\n");
+  printf("-c\tsearch camera ticks instead of host UTC\n");
+  printf("-s\tfirst time to keep (default: start of recording)\n");
+  printf("-e\ttime to stop before (default: end of recording)\n");
+  printf("-d\tseconds to keep after start, instead of -e\n");
+  printf("times are UTC as 2024-05-01T12:00:00.5 or seconds since the epoch, camera ticks\n");
+  printf("with -c, or +seconds relative to the first frame in either case\n");
+  printf(RECORDING_MAP_LIMIT);
+}
+
+// parse a time into the search clock (ns for host time, ticks for the camera)
+bool ParseTime(const char* Text,const tRecording& Rec,tTimeBase Base,uint64_t& Time)
+{
+  char* end;
+  uint64_t perSecond = Base==eTimeCamera ? Rec.header.timeStampFrequency : 1000000000ull;
+
+  // relative to the first frame
+  if(Text[0]=='+')
+  {
+    double seconds = strtod(Text+1,&end);
+    if(*end || seconds<0 || Rec.count==0)
+      return false;
+    Time = FrameTime(RecordingStamp(Rec,0),Base) + (uint64_t)(seconds*perSecond);
+    return true;
+  }
+
+  if(Base==eTimeCamera)
+  {
+    Time = strtoull(Text,&end,10);
+    return *end==0;
+  }
+
+  // ISO 8601 date in UTC with optional fraction, else plain epoch seconds
+  struct tm utc;
+  memset(&utc,0,sizeof(utc));
+  const char* rest = strptime(Text,"%Y-%m-%dT%H:%M:%S",&utc);
+  if(rest)
+  {
+    double fraction = 0;
+    if(*rest=='.')
+    {
+      fraction = strtod(rest,&end);
+      rest = end;
+    }
+    if(*rest=='Z')
+      rest++;
+    if(*rest)
+      return false;
+    Time = (uint64_t)timegm(&utc)*1000000000ull + (uint64_t)(fraction*1e9);
+    return true;
+  }
+
+  double seconds = strtod(Text,&end);
+  if(*end || seconds<0)
+    return false;
+  Time = (uint64_t)(seconds*1e9);
+  return true;
+}
+
+// write all of Data or fail
+bool WriteAll(int fd,const uint8_t* Data,uint64_t Size)
+{
+  while(Size)
+  {
+    ssize_t n = write(fd,Data,Size<(4<<20) ? Size : (4<<20));
+    if(n<=0)
+      return false;
+    Data += n;
+    Size -= n;
+  }
+  return true;
+}
+
+// main
+int main(int argc, char* argv[])
+{
+  int c;
+  const char* input = NULL;
+  const char* output = NULL;
+  const char* startText = NULL;
+  const char* endText = NULL;
+  double duration = -1;
+  tTimeBase Base = eTimeHost;
+
+  while ((c = getopt (argc, argv, "i:o:cs:e:d:")) != -1)
+  {
+    switch(c)
+    {
+      case 'i':
+        input = optarg;
+        break;
+      case 'o':
+        output = optarg;
+        break;
+      case 'c':
+        Base = eTimeCamera;
+        break;
+      case 's':
+        startText = optarg;
+        break;
+      case 'e':
+        endText = optarg;
+        break;
+      case 'd':
+        duration = atof(optarg);
+        break;
+    }
+  }
+
+  if(!input || !output)
+  {
+    ShowUsage();
+    return 1;
+  }
+
+  tRecording Rec;
+  if(!RecordingOpen(Rec,input,eAccessRandom))
+  {
+    printf("%s\n",Rec.error);
+    return 1;
+  }
+  if(Rec.count==0)
+  {
+    printf("%s holds no frames\n",input);
+    RecordingClose(Rec);
+    return 1;
+  }
+
+  // time range [start,stop)
+  uint64_t start = 0, stop = UINT64_MAX;
+  if(startText && !ParseTime(startText,Rec,Base,start))
+  {
+    printf("cannot parse start time %s\n",startText);
+    RecordingClose(Rec);
+    return 1;
+  }
+  if(endText && !ParseTime(endText,Rec,Base,stop))
+  {
+    printf("cannot parse end time %s\n",endText);
+    RecordingClose(Rec);
+    return 1;
+  }
+  if(duration>=0)
+  {
+    if(!startText)
+      start = FrameTime(RecordingStamp(Rec,0),Base);
+    double perSecond = Base==eTimeCamera ? Rec.header.timeStampFrequency : 1e9;
+    stop = start + (uint64_t)(duration*perSecond);
+  }
+
+  uint64_t first, count;
+  RecordingFindRange(Rec,Base,start,stop,first,count);
+  if(count==0)
+  {
+    printf("no frames in the requested range\n");
+    RecordingClose(Rec);
+    return 1;
+  }
+
+  int fd = open(output,O_WRONLY|O_CREAT|O_TRUNC,0644);
+  if(fd<0)
+  {
+    printf("failed to create %s\n",output);
+    RecordingClose(Rec);
+    return 1;
+  }
+
+  // new header with the extracted frame count, then the records in one run
+  tRecordingHeader header = Rec.header;
+  header.frameCount = (uint32_t)count;
+  const uint8_t* records = Rec.base + RECORDING_HEADER_SIZE + first*Rec.recordSize;
+  uint64_t size = count*Rec.recordSize;
+  uint64_t skip = (records-Rec.base) % sysconf(_SC_PAGESIZE);
+  madvise((void*)(records-skip),size+skip,MADV_SEQUENTIAL);
+
+  // the trailer keeps the source's dropped-frame count (0 if it was never written)
+  uint32_t dropped = Rec.framesDropped;
+  bool ok = WriteAll(fd,(const uint8_t*)&header,RECORDING_HEADER_SIZE) &&
+            WriteAll(fd,records,size) &&
+            WriteAll(fd,(const uint8_t*)&dropped,RECORDING_TRAILER_SIZE);
+
+  // the checksums of the copied frames still hold, so carry their footer entries over
+  if(ok && Rec.info && first+count<=Rec.infoCount)
+  {
+    tRecordingFooter tail;
+    memcpy(&tail,Rec.base+Rec.fileSize-RECORDING_FOOTER_SIZE,RECORDING_FOOTER_SIZE);
+    tail.count = count;
+    ok = WriteAll(fd,Rec.info+first*Rec.infoSize,count*Rec.infoSize) &&
+         WriteAll(fd,(const uint8_t*)&tail,RECORDING_FOOTER_SIZE);
+  }
+  ok = (close(fd)==0) && ok;
+
+  tFrameStamp a = RecordingStamp(Rec,first), b = RecordingStamp(Rec,first+count-1);
+  if(ok)
+    printf("frames %llu-%llu (%llu) written to %s, host %u.%09u-%u.%09u, ticks %llu-%llu\n",
+           (unsigned long long)first,(unsigned long long)(first+count-1),(unsigned long long)count,output,
+           a.hostSecond,a.hostnSecond,b.hostSecond,b.hostnSecond,
+           (unsigned long long)FrameTicks(a),(unsigned long long)FrameTicks(b));
+  else
+    printf("failed to write %s\n",output);
+
+  RecordingClose(Rec);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,368 @@
+/* Builds a pyramid sidecar (common/pyramid.h) for a snap_image recording in
+ * one streaming pass, and renders contact sheets from it.
+ *
+ * Each thread takes every n-th frame, halves it three times with 2x2 box
+ * averages kept at 16 bits, tone-maps each level to 8 bits through a lookup
+ * table and writes the frame record with pwrite at its fixed offset, so no
+ * ordering between threads is needed and memory stays at one record per
+ * thread. The tone window is taken from percentiles of a sample of frames
+ * unless given with -w, and is the same for the whole recording so
+ * thumbnails can be compared.
+ */
+
+// includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <vector>
+#include <recording.h>
+#include <pyramid.h>
+#include <workers.h>
+#include <png.h>
+
+#define TONE_SAMPLE_FRAMES 16 // frames sampled for the tone window
+#define TONE_SAMPLE_STEP   7  // pixel step within a sampled frame
+
+// build state shared by the threads
+typedef struct
+{
+  tRecording           Rec;
+  tPyramidHeader       Header;
+  uint32_t             levelOffset[PYRAMID_LEVELS];
+  int                  fd;
+  unsigned int         threads;
+  uint32_t             sampleSize;  // bytes per source pixel
+  std::vector<uint8_t> tone;        // source value to 8 bits
+  volatile uint32_t    failed;      // set by any thread, atomically
+} tBuild;
+
+// usage
+void ShowUsage()
+{
+  printf("usage: make_pyramid -i recording [-o sidecar] [-w low,high] [-j threads]\n");
+  printf("       make_pyramid -p sidecar -c sheet.png [-l level] [-n thumbnails] [-k columns]\n");
+  printf("-o\tsidecar to write (default: recording name with .pyr)\n");
+  printf("-w\tsource values mapped to black and white (default: 0.1 and 99.9 percentiles)\n");
+  printf("-j\tthreads (default 2)\n");
+  printf("-c\twrite a contact sheet png from the sidecar (-p, or the one just built)\n");
+  printf("-l\tsheet level: 1 = 1/2, 2 = 1/4, 3 = 1/8 scale (default 3)\n");
+  printf("-n\tthumbnails on the sheet, evenly spaced over the recording (default 64)\n");
+  printf("-k\tthumbnails per row (default 8)\n");
+  printf(RECORDING_MAP_LIMIT);
+}
+
+// seconds since an arbitrary start
+double Now()
+{
+  struct timespec tp;
+  clock_gettime(CLOCK_MONOTONIC,&tp);
+  return tp.tv_sec + tp.tv_nsec/1e9;
+}
+
+// source pixel at x,y
+inline uint32_t Pixel(const tBuild& B,const uint8_t* Image,uint32_t x,uint32_t y)
+{
+  size_t i = (size_t)y*B.Header.width + x;
+  if(B.sampleSize==1)
+    return Image[i];
+  uint16_t v;
+  memcpy(&v,Image+2*i,2);
+  return v;
+}
+
+// pick the tone window from percentiles of a sample of frames
+void ToneWindow(tBuild& B,uint32_t& Low,uint32_t& High)
+{
+  std::vector<uint64_t> histogram(B.sampleSize==1 ? 256 : 65536,0);
+  uint64_t frames = B.Rec.count<TONE_SAMPLE_FRAMES ? B.Rec.count : TONE_SAMPLE_FRAMES;
+  uint64_t pixels = (uint64_t)B.Header.width*B.Header.height;
+  uint64_t total = 0;
+
+  for(uint64_t f=0;f<frames;f++)
+  {
+    const uint8_t* image = (const uint8_t*)RecordingFrame(B.Rec,f*B.Rec.count/frames).image;
+    for(uint64_t i=0;i<pixels;i+=TONE_SAMPLE_STEP,total++)
+      histogram[Pixel(B,image,i%B.Header.width,i/B.Header.width)]++;
+  }
+
+  uint64_t sum = 0;
+  Low = 0;
+  High = histogram.size()-1;
+  for(size_t v=0;v<histogram.size();v++)
+  {
+    sum += histogram[v];
+    if(sum*1000<=total)
+      Low = v;
+    if(sum*1000<total*999)
+      High = v+1;
+  }
+  if(High<=Low)
+    High = Low+1;
+}
+
+// lookup table for the tone window
+void ToneTable(tBuild& B)
+{
+  uint32_t lo = B.Header.toneLow, hi = B.Header.toneHigh;
+  B.tone.resize(B.sampleSize==1 ? 256 : 65536);
+  for(uint32_t v=0;v<B.tone.size();v++)
+    B.tone[v] = v<=lo ? 0 : v>=hi ? 255 : (uint8_t)(((v-lo)*255 + (hi-lo)/2)/(hi-lo));
+}
+
+// halve a source image of type T into 16-bit averages
+template<typename T> void HalveImage(const T* In,uint32_t Width,uint32_t Height,uint16_t* Out,uint32_t OutWidth,uint32_t OutHeight)
+{
+  uint32_t dx = Width>1 ? 1 : 0;
+  for(uint32_t y=0;y<OutHeight;y++)
+  {
+    const T* r0 = In + (size_t)2*y*Width;
+    const T* r1 = Height>1 ? r0+Width : r0;
+    uint16_t* out = Out + (size_t)y*OutWidth;
+    for(uint32_t x=0;x<OutWidth;x++)
+      out[x] = (r0[2*x] + r0[2*x+dx] + r1[2*x] + r1[2*x+dx] + 2)/4;
+  }
+}
+
+// build the records of frames Index, Index+threads, ...
+void BuildThread(void* Arg,unsigned int Index)
+{
+  tBuild& B = *(tBuild*)Arg;
+  const tPyramidHeader& h = B.Header;
+  std::vector<uint8_t> record(h.recordSize);
+  std::vector<uint16_t> cur(h.levelWidth[0]*h.levelHeight[0]), next(cur.size());
+
+  for(uint64_t i=Index;i<B.Rec.count && !__sync_fetch_and_or(&B.failed,0);i+=B.threads)
+  {
+    tFrameView Frame = RecordingFrame(B.Rec,i);
+    const uint8_t* image = (const uint8_t*)Frame.image;
+    memcpy(&record[0],&Frame.stamp,RECORDING_STAMP_SIZE);
+
+    // level 1 from the source (16-bit images are 2-byte aligned in the mapping)
+    if(B.sampleSize==1)
+      HalveImage(image,h.width,h.height,&cur[0],h.levelWidth[0],h.levelHeight[0]);
+    else
+      HalveImage((const uint16_t*)image,h.width,h.height,&cur[0],h.levelWidth[0],h.levelHeight[0]);
+
+    // tone-map each level, then halve it for the next
+    for(int l=0;l<PYRAMID_LEVELS;l++)
+    {
+      uint32_t w = h.levelWidth[l], hh = h.levelHeight[l];
+      uint8_t* out = &record[B.levelOffset[l]];
+      for(uint32_t p=0;p<w*hh;p++)
+        out[p] = B.tone[cur[p]];
+      if(l+1<PYRAMID_LEVELS)
+      {
+        HalveImage(&cur[0],w,hh,&next[0],h.levelWidth[l+1],h.levelHeight[l+1]);
+        cur.swap(next);
+      }
+    }
+
+    off_t offset = PYRAMID_HEADER_SIZE + (off_t)i*h.recordSize;
+    if(pwrite(B.fd,&record[0],record.size(),offset)!=(ssize_t)record.size())
+      __sync_fetch_and_or(&B.failed,1);
+  }
+}
+
+// build the sidecar for a recording
+bool BuildPyramid(const char* Input,const char* Output,bool FixedTone,uint32_t Low,uint32_t High,unsigned int Threads)
+{
+  tBuild B;
+  if(!RecordingOpen(B.Rec,Input,eAccessSequential))
+  {
+    printf("%s\n",B.Rec.error);
+    return false;
+  }
+
+  // grey or raw Bayer (averaging a 2x2 Bayer cell gives its luminance)
+  const char* format = B.Rec.header.pixelFormat;
+  if(strcmp(format,"Mono8")==0 || strcmp(format,"Bayer8")==0)
+    B.sampleSize = 1;
+  else if(strcmp(format,"Mono16")==0 || strcmp(format,"Bayer16")==0)
+    B.sampleSize = 2;
+  else
+  {
+    printf("pixel format %s is not supported\n",format);
+    RecordingClose(B.Rec);
+    return false;
+  }
+  if(B.Rec.count==0)
+  {
+    printf("%s holds no frames\n",Input);
+    RecordingClose(B.Rec);
+    return false;
+  }
+
+  memset(&B.Header,0,sizeof(tPyramidHeader));
+  memcpy(B.Header.magic,PYRAMID_MAGIC,8);
+  B.Header.width = B.Rec.header.width;
+  B.Header.height = B.Rec.header.height;
+  memcpy(B.Header.pixelFormat,B.Rec.header.pixelFormat,sizeof(B.Header.pixelFormat));
+  PyramidLayout(B.Header,B.levelOffset);
+  if(!FixedTone)
+    ToneWindow(B,Low,High);
+  B.Header.toneLow = Low;
+  B.Header.toneHigh = High>Low ? High : Low+1;
+  ToneTable(B);
+
+  // header with no frames until every record is in place
+  B.fd = open(Output,O_WRONLY|O_CREAT|O_TRUNC,0644);
+  uint64_t size = PYRAMID_HEADER_SIZE + B.Rec.count*B.Header.recordSize;
+  if(B.fd<0 || pwrite(B.fd,&B.Header,PYRAMID_HEADER_SIZE,0)!=PYRAMID_HEADER_SIZE ||
+     posix_fallocate(B.fd,0,size)!=0)
+  {
+    printf("failed to create %s\n",Output);
+    if(B.fd>=0)
+      close(B.fd);
+    RecordingClose(B.Rec);
+    return false;
+  }
+
+  B.threads = Threads ? Threads : 1;
+  B.failed = 0;
+  double start = Now();
+  RunParallel(B.threads,BuildThread,&B);
+  double seconds = Now()-start;
+
+  B.Header.frameCount = B.Rec.count;
+  bool ok = !B.failed && pwrite(B.fd,&B.Header,PYRAMID_HEADER_SIZE,0)==PYRAMID_HEADER_SIZE;
+  ok = (close(B.fd)==0) && ok;
+  if(ok)
+    printf("%llu frames in %.2f s (%.1f frames/s), tone window %u-%u, %.1f MB written to %s\n",
+           (unsigned long long)B.Rec.count,seconds,B.Rec.count/seconds,B.Header.toneLow,B.Header.toneHigh,
+           size/1e6,Output);
+  else
+    printf("failed to write %s\n",Output);
+
+  RecordingClose(B.Rec);
+  return ok;
+}
+
+// lay out thumbnails of one level on a grid and save it as a png
+bool ContactSheet(const char* Sidecar,const char* Sheet,int Level,uint64_t Count,uint32_t Columns)
+{
+  tPyramid P;
+  if(!PyramidOpen(P,Sidecar))
+  {
+    printf("%s\n",P.error);
+    return false;
+  }
+  if(Level<1 || Level>PYRAMID_LEVELS || P.header.frameCount==0)
+  {
+    printf("nothing to show at level %d\n",Level);
+    PyramidClose(P);
+    return false;
+  }
+
+  if(Count==0 || Count>P.header.frameCount)
+    Count = P.header.frameCount;
+  if(Columns==0)
+    Columns = 1;
+  if(Columns>Count)
+    Columns = Count;
+
+  // thumbnails separated by a 2 pixel black border
+  uint32_t tw = P.header.levelWidth[Level-1], th = P.header.levelHeight[Level-1];
+  uint32_t rows = (Count+Columns-1)/Columns;
+  uint32_t width = Columns*(tw+2)+2, height = rows*(th+2)+2;
+  std::vector<uint8_t> sheet((size_t)width*height,0);
+
+  double start = Now();
+  for(uint64_t n=0;n<Count;n++)
+  {
+    tThumbnail t = PyramidThumbnail(P,n*P.header.frameCount/Count,Level-1);
+    uint32_t x0 = 2 + (n%Columns)*(tw+2), y0 = 2 + (n/Columns)*(th+2);
+    for(uint32_t y=0;y<th;y++)
+      memcpy(&sheet[(size_t)(y0+y)*width+x0],t.pixels+(size_t)y*tw,tw);
+  }
+  double seconds = Now()-start;
+
+  tPngOptions Options;
+  Options.level = 6;
+  Options.strategy = Z_FILTERED;
+  Options.threads = 2;
+  std::vector<uint8_t> png;
+  FILE* file = NULL;
+  bool ok = PngEncode(&sheet[0],width,height,1,8,Options,png) && (file = fopen(Sheet,"wb"))!=NULL &&
+            fwrite(&png[0],1,png.size(),file)==png.size();
+  if(file)
+    ok = (fclose(file)==0) && ok;
+
+  if(ok)
+    printf("%llu thumbnails of %ux%u fetched in %.1f us each, %ux%u sheet written to %s\n",
+           (unsigned long long)Count,tw,th,1e6*seconds/Count,width,height,Sheet);
+  else
+    printf("failed to write %s\n",Sheet);
+  PyramidClose(P);
+  return ok;
+}
+
+// main
+int main(int argc, char* argv[])
+{
+  int c;
+  const char* input = NULL;
+  const char* sidecar = NULL;
+  const char* sheet = NULL;
+  bool fixedTone = false;
+  uint32_t low = 0, high = 0;
+  unsigned int threads = 2;
+  int level = 3;
+  uint64_t count = 64;
+  uint32_t columns = 8;
+  char name[1024];
+
+  while ((c = getopt (argc, argv, "i:o:p:w:j:c:l:n:k:")) != -1)
+  {
+    switch(c)
+    {
+      case 'i':
+        input = optarg;
+        break;
+      case 'o':
+      case 'p':
+        sidecar = optarg;
+        break;
+      case 'w':
+        fixedTone = sscanf(optarg,"%u,%u",&low,&high)==2;
+        break;
+      case 'j':
+        threads = atoi(optarg);
+        break;
+      case 'c':
+        sheet = optarg;
+        break;
+      case 'l':
+        level = atoi(optarg);
+        break;
+      case 'n':
+        count = strtoull(optarg,NULL,10);
+        break;
+      case 'k':
+        columns = atoi(optarg);
+        break;
+    }
+  }
+
+  if(!input && !(sidecar && sheet))
+  {
+    ShowUsage();
+    return 1;
+  }
+
+  if(input)
+  {
+    if(!sidecar)
+    {
+      snprintf(name,sizeof(name),"%s.pyr",input);
+      sidecar = name;
+    }
+    if(!BuildPyramid(input,sidecar,fixedTone,low,high,threads))
+      return 1;
+  }
+
+  if(sheet && !ContactSheet(sidecar,sheet,level,count,columns))
+    return 1;
+  return 0;
+}
@@ -0,0 +1,246 @@
+/* Lines up the recordings of a multi-camera session by timestamp.
+ *
+ * The merge in merge.h walks all recordings once, front to back, and yields
+ * tuples of frames taken within the tolerance of each other, plus the frames
+ * that have no partner. The result can be written as an index (one line per
+ * tuple or unmatched frame, with the frame number in each recording) and as
+ * a combined recording whose frames are the images of a tuple stacked top
+ * to bottom. Both are written as the merge goes; footer checksums of the
+ * combined recording are spooled to a temporary file, so memory stays the
+ * same however long the recordings are.
+ */
+
+// includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+#include <recording.h>
+#include <merge.h>
+#include <crc32c.h>
+
+#define MAX_RECORDINGS 16
+
+// usage
+void ShowUsage()
+{
+  printf("usage: merge_recordings -i recording -i recording [...] [-o combined] [-x index] [-h] [-t ms]\n");
+  printf("-o\tcombined recording, tuple images stacked in -i order (same width and format)\n");
+  printf("-x\tindex of tuples and unmatched frames (CSV: time_ns, frame per recording or -1)\n");
+  printf("-h\tmatch host time instead of camera time\n");
+  printf("-t\ttolerance in ms (default: half the frame period)\n");
+  printf(RECORDING_MAP_LIMIT);
+}
+
+// combined recording being written
+typedef struct
+{
+  FILE*            f;
+  FILE*            crcs;   // footer entries, copied in at the end
+  tRecordingHeader header;
+  uint64_t         frames;
+} tCombined;
+
+// start the combined recording; frameCount is filled in when it is closed
+bool CombinedOpen(tCombined& C,const char* Path,const tRecording* Recs,unsigned int Count)
+{
+  C.header = Recs[0].header;
+  C.header.height = 0;
+  for(unsigned int r=0;r<Count;r++)
+  {
+    if(Recs[r].header.width!=C.header.width || strcmp(Recs[r].header.pixelFormat,C.header.pixelFormat)!=0)
+    {
+      printf("recordings must share width and pixel format to be combined\n");
+      return false;
+    }
+    C.header.height += Recs[r].header.height;
+  }
+  C.header.frameCount = 0;
+  C.frames = 0;
+  C.crcs = tmpfile();
+  C.f = fopen(Path,"wb");
+  if(!C.f || !C.crcs || fwrite(&C.header,1,RECORDING_HEADER_SIZE,C.f)!=RECORDING_HEADER_SIZE)
+  {
+    printf("failed to create %s\n",Path);
+    if(C.f)
+      fclose(C.f);
+    if(C.crcs)
+      fclose(C.crcs);
+    C.f = C.crcs = NULL;
+    return false;
+  }
+  return true;
+}
+
+// append a tuple: the first recording's time block, then every image
+bool CombinedAppend(tCombined& C,const tRecording* Recs,unsigned int Count,const int64_t* Frames)
+{
+  tFrameView first = RecordingFrame(Recs[0],Frames[0]);
+  uint32_t crc = Crc32c(0,&first.stamp,RECORDING_STAMP_SIZE);
+  bool ok = fwrite(&first.stamp,1,RECORDING_STAMP_SIZE,C.f)==RECORDING_STAMP_SIZE;
+  for(unsigned int r=0;r<Count && ok;r++)
+  {
+    tFrameView view = RecordingFrame(Recs[r],Frames[r]);
+    ok = fwrite(view.image,1,view.imageSize,C.f)==view.imageSize;
+    crc = Crc32c(crc,view.image,view.imageSize);
+  }
+
+  tFrameInfo info;
+  memset(&info,0,sizeof(info));
+  info.crc = crc;
+  C.frames++;
+  return ok && fwrite(&info,1,sizeof(info),C.crcs)==sizeof(info);
+}
+
+// trailer, footer and the final frame count
+bool CombinedClose(tCombined& C,uint32_t FramesDropped)
+{
+  tRecordingFooter tail = RecordingFooterTail(C.frames);
+  bool ok = fwrite(&FramesDropped,1,RECORDING_TRAILER_SIZE,C.f)==RECORDING_TRAILER_SIZE;
+
+  // copy the spooled checksums across
+  char buffer[65536];
+  size_t n;
+  rewind(C.crcs);
+  while(ok && (n=fread(buffer,1,sizeof(buffer),C.crcs))>0)
+    ok = fwrite(buffer,1,n,C.f)==n;
+  ok = ok && fwrite(&tail,1,RECORDING_FOOTER_SIZE,C.f)==RECORDING_FOOTER_SIZE;
+
+  C.header.frameCount = (uint32_t)C.frames;
+  ok = ok && fseeko(C.f,0,SEEK_SET)==0 && fwrite(&C.header,1,RECORDING_HEADER_SIZE,C.f)==RECORDING_HEADER_SIZE;
+  ok = (fclose(C.f)==0) && ok;
+  fclose(C.crcs);
+  return ok;
+}
+
+// main
+int main(int argc, char* argv[])
+{
+  int c;
+  std::vector<const char*> inputs;
+  const char* output = NULL;
+  const char* indexPath = NULL;
+  tTimeBase base = eTimeCamera;
+  double toleranceMs = -1;
+
+  while ((c = getopt (argc, argv, "i:o:x:ht:")) != -1)
+  {
+    switch(c)
+    {
+      case 'i':
+        inputs.push_back(optarg);
+        break;
+      case 'o':
+        output = optarg;
+        break;
+      case 'x':
+        indexPath = optarg;
+        break;
+      case 'h':
+        base = eTimeHost;
+        break;
+      case 't':
+        toleranceMs = atof(optarg);
+        break;
+    }
+  }
+
+  if(inputs.size()<2 || inputs.size()>MAX_RECORDINGS)
+  {
+    ShowUsage();
+    return 1;
+  }
+
+  unsigned int count = inputs.size();
+  tRecording recs[MAX_RECORDINGS];
+  for(unsigned int r=0;r<count;r++)
+    if(!RecordingOpen(recs[r],inputs[r],eAccessSequential))
+    {
+      printf("%s\n",recs[r].error);
+      for(unsigned int o=0;o<r;o++)
+        RecordingClose(recs[o]);
+      return 1;
+    }
+
+  // half a frame period keeps neighbouring frames apart
+  float rate = recs[0].header.frameRate;
+  uint64_t tolerance = toleranceMs>=0 ? (uint64_t)(toleranceMs*1e6) : rate>0 ? (uint64_t)(0.5e9/rate) : 0;
+
+  bool ok = true;
+  FILE* index = NULL;
+  if(indexPath)
+  {
+    index = fopen(indexPath,"w");
+    ok = index!=NULL;
+    if(index)
+    {
+      fprintf(index,"time_ns");
+      for(unsigned int r=0;r<count;r++)
+        fprintf(index,",frame%u",r);
+      fprintf(index,"\n");
+    }
+  }
+  tCombined combined;
+  memset(&combined,0,sizeof(combined));
+  if(ok && output)
+    ok = CombinedOpen(combined,output,recs,count);
+  if(!ok)
+  {
+    if(indexPath && !index)
+      printf("failed to create %s\n",indexPath);
+    if(index)
+      fclose(index);
+    for(unsigned int r=0;r<count;r++)
+      RecordingClose(recs[r]);
+    return 1;
+  }
+
+  // one pass over all recordings
+  tMerge merge;
+  MergeOpen(merge,recs,count,base,tolerance);
+  int64_t frames[MAX_RECORDINGS];
+  uint64_t time, tuples = 0, unmatched[MAX_RECORDINGS] = {0};
+  bool matched;
+  while(ok && MergeNext(merge,frames,time,matched))
+  {
+    if(matched)
+      tuples++;
+    else
+      for(unsigned int r=0;r<count;r++)
+        if(frames[r]>=0)
+          unmatched[r]++;
+
+    if(index)
+    {
+      fprintf(index,"%llu",(unsigned long long)time);
+      for(unsigned int r=0;r<count;r++)
+        fprintf(index,",%lld",(long long)frames[r]);
+      fprintf(index,"\n");
+    }
+    if(matched && output)
+      ok = CombinedAppend(combined,recs,count,frames);
+  }
+  MergeClose(merge);
+
+  // the combined recording carries the most frames any camera dropped
+  uint32_t dropped = 0;
+  for(unsigned int r=0;r<count;r++)
+    dropped = recs[r].framesDropped>dropped ? recs[r].framesDropped : dropped;
+  if(output)
+    ok = CombinedClose(combined,dropped) && ok;
+  if(index)
+    ok = (fclose(index)==0) && ok;
+
+  printf("%llu tuples matched within %.3f ms on the %s clock\n",(unsigned long long)tuples,
+         tolerance/1e6,base==eTimeCamera ? "camera" : "host");
+  for(unsigned int r=0;r<count;r++)
+    printf("  %s: %llu frames, %llu unmatched\n",inputs[r],(unsigned long long)recs[r].count,
+           (unsigned long long)unmatched[r]);
+  if(!ok)
+    printf("failed to write output\n");
+
+  for(unsigned int r=0;r<count;r++)
+    RecordingClose(recs[r]);
+  return ok ? 0 : 1;
+}
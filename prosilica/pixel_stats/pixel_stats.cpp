@@ -0,0 +1,398 @@
+/* Computes per-pixel mean, variance, minimum and maximum over a snap_image
+ * recording in one read pass, and writes them as .npy images.
+ *
+ * Each thread takes a contiguous range of frames. Within a range, frames are
+ * summed exactly in integers (32-bit sums, 64-bit sums of squares) over
+ * chunks of CHUNK_FRAMES, which cannot overflow for 16-bit pixels. Each
+ * chunk is then folded into a running mean and sum of squared deviations
+ * with the pairwise Welford update (Chan et al.), and the threads' results
+ * are merged the same way, so precision does not degrade with recording
+ * length. The inner loop visits GROUP_FRAMES frames per strip of pixels
+ * with the accumulators in registers (NEON or SSE2), so memory traffic is
+ * dominated by the frames themselves.
+ */
+
+// includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <vector>
+#include <recording.h>
+#include <workers.h>
+#include <npy.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define STATS_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define STATS_SSE2
+#endif
+
+#define GROUP_FRAMES 16   // frames accumulated per pass over a strip
+#define STRIP_PIXELS 4096 // pixels per strip (accumulators stay in cache)
+#define CHUNK_FRAMES 4096 // frames summed exactly before a Welford merge
+
+// statistics of one thread's frames
+typedef struct
+{
+  uint64_t              first;     // frame range
+  uint64_t              count;
+  std::vector<uint32_t> sum;       // exact sums of the current chunk
+  std::vector<uint64_t> sumSq;
+  std::vector<double>   mean;      // running mean and sum of squared deviations
+  std::vector<double>   m2;
+  std::vector<uint16_t> lo;
+  std::vector<uint16_t> hi;
+  uint64_t              n;         // frames folded into mean and m2
+} tPartial;
+
+// shared state
+typedef struct
+{
+  tRecording            Rec;
+  uint64_t              pixels;
+  uint32_t              sampleSize;
+  std::vector<tPartial> parts;
+} tStats;
+
+// usage
+void ShowUsage()
+{
+  printf("usage: pixel_stats -i recording [-o prefix] [-f first] [-n count] [-j threads]\n");
+  printf("-o\toutput prefix for _mean, _var, _min and _max .npy files (default: recording name)\n");
+  printf("-f\tfirst frame (default 0)\n");
+  printf("-n\tnumber of frames (default all)\n");
+  printf("-j\tthreads (default 2)\n");
+  printf(RECORDING_MAP_LIMIT);
+}
+
+// seconds since an arbitrary start
+double Now()
+{
+  struct timespec tp;
+  clock_gettime(CLOCK_MONOTONIC,&tp);
+  return tp.tv_sec + tp.tv_nsec/1e9;
+}
+
+// add Frames rows of n pixels to the sums and extremes
+void AccumulateStrip(const uint16_t* const* Rows,unsigned int Frames,size_t n,
+                     uint32_t* Sum,uint64_t* SumSq,uint16_t* Lo,uint16_t* Hi)
+{
+  size_t i = 0;
+#if defined(STATS_NEON)
+  for(;i+8<=n;i+=8)
+  {
+    uint16x8_t lo = vld1q_u16(Lo+i), hi = vld1q_u16(Hi+i);
+    uint32x4_t s0 = vld1q_u32(Sum+i), s1 = vld1q_u32(Sum+i+4);
+    uint64x2_t q0 = vld1q_u64(SumSq+i), q1 = vld1q_u64(SumSq+i+2);
+    uint64x2_t q2 = vld1q_u64(SumSq+i+4), q3 = vld1q_u64(SumSq+i+6);
+    for(unsigned int f=0;f<Frames;f++)
+    {
+      uint16x8_t v = vld1q_u16(Rows[f]+i);
+      lo = vminq_u16(lo,v);
+      hi = vmaxq_u16(hi,v);
+      uint32x4_t a = vmovl_u16(vget_low_u16(v)), b = vmovl_u16(vget_high_u16(v));
+      s0 = vaddq_u32(s0,a);
+      s1 = vaddq_u32(s1,b);
+      q0 = vmlal_u32(q0,vget_low_u32(a),vget_low_u32(a));
+      q1 = vmlal_u32(q1,vget_high_u32(a),vget_high_u32(a));
+      q2 = vmlal_u32(q2,vget_low_u32(b),vget_low_u32(b));
+      q3 = vmlal_u32(q3,vget_high_u32(b),vget_high_u32(b));
+    }
+    vst1q_u16(Lo+i,lo);
+    vst1q_u16(Hi+i,hi);
+    vst1q_u32(Sum+i,s0);
+    vst1q_u32(Sum+i+4,s1);
+    vst1q_u64(SumSq+i,q0);
+    vst1q_u64(SumSq+i+2,q1);
+    vst1q_u64(SumSq+i+4,q2);
+    vst1q_u64(SumSq+i+6,q3);
+  }
+#elif defined(STATS_SSE2)
+  // SSE2 has only signed 16-bit min/max, so compare with the sign bit flipped
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i bias = _mm_set1_epi16((short)0x8000);
+  for(;i+8<=n;i+=8)
+  {
+    __m128i lo = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(Lo+i)),bias);
+    __m128i hi = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(Hi+i)),bias);
+    __m128i s0 = _mm_loadu_si128((const __m128i*)(Sum+i)), s1 = _mm_loadu_si128((const __m128i*)(Sum+i+4));
+    __m128i q0 = _mm_loadu_si128((const __m128i*)(SumSq+i)), q1 = _mm_loadu_si128((const __m128i*)(SumSq+i+2));
+    __m128i q2 = _mm_loadu_si128((const __m128i*)(SumSq+i+4)), q3 = _mm_loadu_si128((const __m128i*)(SumSq+i+6));
+    for(unsigned int f=0;f<Frames;f++)
+    {
+      __m128i v = _mm_loadu_si128((const __m128i*)(Rows[f]+i));
+      __m128i vs = _mm_xor_si128(v,bias);
+      lo = _mm_min_epi16(lo,vs);
+      hi = _mm_max_epi16(hi,vs);
+      s0 = _mm_add_epi32(s0,_mm_unpacklo_epi16(v,zero));
+      s1 = _mm_add_epi32(s1,_mm_unpackhi_epi16(v,zero));
+
+      // full 32-bit squares from the low and high product halves
+      __m128i pl = _mm_mullo_epi16(v,v), ph = _mm_mulhi_epu16(v,v);
+      __m128i sq0 = _mm_unpacklo_epi16(pl,ph), sq1 = _mm_unpackhi_epi16(pl,ph);
+      q0 = _mm_add_epi64(q0,_mm_unpacklo_epi32(sq0,zero));
+      q1 = _mm_add_epi64(q1,_mm_unpackhi_epi32(sq0,zero));
+      q2 = _mm_add_epi64(q2,_mm_unpacklo_epi32(sq1,zero));
+      q3 = _mm_add_epi64(q3,_mm_unpackhi_epi32(sq1,zero));
+    }
+    _mm_storeu_si128((__m128i*)(Lo+i),_mm_xor_si128(lo,bias));
+    _mm_storeu_si128((__m128i*)(Hi+i),_mm_xor_si128(hi,bias));
+    _mm_storeu_si128((__m128i*)(Sum+i),s0);
+    _mm_storeu_si128((__m128i*)(Sum+i+4),s1);
+    _mm_storeu_si128((__m128i*)(SumSq+i),q0);
+    _mm_storeu_si128((__m128i*)(SumSq+i+2),q1);
+    _mm_storeu_si128((__m128i*)(SumSq+i+4),q2);
+    _mm_storeu_si128((__m128i*)(SumSq+i+6),q3);
+  }
+#endif
+  for(;i<n;i++)
+    for(unsigned int f=0;f<Frames;f++)
+    {
+      uint32_t v = Rows[f][i];
+      Lo[i] = v<Lo[i] ? v : Lo[i];
+      Hi[i] = v>Hi[i] ? v : Hi[i];
+      Sum[i] += v;
+      SumSq[i] += (uint64_t)v*v;
+    }
+}
+
+// fold set b (count Nb) into set a (count Na) with the pairwise update
+inline void MergeMoments(double& MeanA,double& M2A,uint64_t Na,double MeanB,double M2B,uint64_t Nb)
+{
+  double n = (double)(Na+Nb);
+  double delta = MeanB-MeanA;
+  MeanA += delta*Nb/n;
+  M2A += M2B + delta*delta*((double)Na*Nb/n);
+}
+
+// fold the exact sums of a chunk of Frames frames into the running moments
+void FoldChunk(tPartial& P,uint64_t Pixels,uint64_t Frames)
+{
+  for(uint64_t i=0;i<Pixels;i++)
+  {
+    double mean = (double)P.sum[i]/Frames;
+    double m2 = (double)P.sumSq[i] - (double)P.sum[i]*mean;
+    if(P.n==0)
+    {
+      P.mean[i] = mean;
+      P.m2[i] = m2;
+    }
+    else
+      MergeMoments(P.mean[i],P.m2[i],P.n,mean,m2,Frames);
+  }
+  P.n += Frames;
+  memset(&P.sum[0],0,Pixels*sizeof(uint32_t));
+  memset(&P.sumSq[0],0,Pixels*sizeof(uint64_t));
+}
+
+// accumulate the frames of part Index
+void StatsThread(void* Arg,unsigned int Index)
+{
+  tStats& S = *(tStats*)Arg;
+  tPartial& P = S.parts[Index];
+  uint64_t pixels = S.pixels;
+  const uint8_t* images[GROUP_FRAMES];
+  std::vector<uint16_t> wide(S.sampleSize==1 ? GROUP_FRAMES*STRIP_PIXELS : 0);
+
+  P.sum.assign(pixels,0);
+  P.sumSq.assign(pixels,0);
+  P.mean.assign(pixels,0);
+  P.m2.assign(pixels,0);
+  P.lo.assign(pixels,0xffff);
+  P.hi.assign(pixels,0);
+  P.n = 0;
+
+  uint64_t inChunk = 0;
+  for(uint64_t g=0;g<P.count;g+=GROUP_FRAMES)
+  {
+    unsigned int frames = P.count-g<GROUP_FRAMES ? P.count-g : GROUP_FRAMES;
+    RecordingPrefetch(S.Rec,P.first+g+GROUP_FRAMES,GROUP_FRAMES);
+
+    for(unsigned int f=0;f<frames;f++)
+      images[f] = (const uint8_t*)RecordingFrame(S.Rec,P.first+g+f).image;
+
+    for(uint64_t s=0;s<pixels;s+=STRIP_PIXELS)
+    {
+      size_t n = pixels-s<STRIP_PIXELS ? pixels-s : STRIP_PIXELS;
+      const uint16_t* strip[GROUP_FRAMES];
+
+      // 16-bit strips are used in place, 8-bit ones are widened first
+      for(unsigned int f=0;f<frames;f++)
+      {
+        if(S.sampleSize==2)
+          strip[f] = (const uint16_t*)images[f]+s;
+        else
+        {
+          uint16_t* w = &wide[f*STRIP_PIXELS];
+          for(size_t i=0;i<n;i++)
+            w[i] = images[f][s+i];
+          strip[f] = w;
+        }
+      }
+      AccumulateStrip(strip,frames,n,&P.sum[s],&P.sumSq[s],&P.lo[s],&P.hi[s]);
+    }
+
+    inChunk += frames;
+    if(inChunk>=CHUNK_FRAMES || g+frames==P.count)
+    {
+      FoldChunk(P,pixels,inChunk);
+      inChunk = 0;
+    }
+  }
+
+  std::vector<uint32_t>().swap(P.sum);
+  std::vector<uint64_t>().swap(P.sumSq);
+}
+
+// write one statistic image
+bool WriteImage(const char* Prefix,const char* Name,const char* Descr,const void* Data,
+                uint64_t ElementSize,uint32_t Width,uint32_t Height)
+{
+  char path[1100];
+  snprintf(path,sizeof(path),"%s_%s.npy",Prefix,Name);
+
+  tNpyFile Npy;
+  uint64_t shape[2] = {Height,Width};
+  bool ok = NpyOpen(Npy,path,Descr,shape,2,ElementSize) && NpyAppend(Npy,Data,Height);
+  ok = NpyClose(Npy) && ok;
+  if(!ok)
+    printf("failed to write %s\n",path);
+  return ok;
+}
+
+// main
+int main(int argc, char* argv[])
+{
+  int c;
+  const char* input = NULL;
+  const char* prefix = NULL;
+  uint64_t first = 0, count = 0;
+  unsigned int threads = 2;
+  char stem[1024];
+
+  while ((c = getopt (argc, argv, "i:o:f:n:j:")) != -1)
+  {
+    switch(c)
+    {
+      case 'i':
+        input = optarg;
+        break;
+      case 'o':
+        prefix = optarg;
+        break;
+      case 'f':
+        first = strtoull(optarg,NULL,10);
+        break;
+      case 'n':
+        count = strtoull(optarg,NULL,10);
+        break;
+      case 'j':
+        threads = atoi(optarg);
+        break;
+    }
+  }
+
+  if(!input)
+  {
+    ShowUsage();
+    return 1;
+  }
+  if(!prefix)
+  {
+    snprintf(stem,sizeof(stem),"%s",input);
+    char* ext = strrchr(stem,'.');
+    if(ext && !strchr(ext,'/'))
+      *ext = 0;
+    prefix = stem;
+  }
+
+  tStats S;
+  if(!RecordingOpen(S.Rec,input,eAccessSequential))
+  {
+    printf("%s\n",S.Rec.error);
+    return 1;
+  }
+
+  // per sensor pixel, so raw Bayer frames are handled like grey ones
+  const char* format = S.Rec.header.pixelFormat;
+  if(strcmp(format,"Mono8")==0 || strcmp(format,"Bayer8")==0)
+    S.sampleSize = 1;
+  else if(strcmp(format,"Mono16")==0 || strcmp(format,"Bayer16")==0)
+    S.sampleSize = 2;
+  else
+  {
+    printf("pixel format %s is not supported\n",format);
+    RecordingClose(S.Rec);
+    return 1;
+  }
+
+  if(first>=S.Rec.count)
+  {
+    printf("recording has only %llu frames\n",(unsigned long long)S.Rec.count);
+    RecordingClose(S.Rec);
+    return 1;
+  }
+  if(count==0 || count>S.Rec.count-first)
+    count = S.Rec.count-first;
+  if(threads==0)
+    threads = 1;
+  if(threads>count)
+    threads = count;
+
+  // contiguous frame ranges, one per thread
+  S.pixels = (uint64_t)S.Rec.header.width*S.Rec.header.height;
+  S.parts.resize(threads);
+  for(unsigned int t=0;t<threads;t++)
+  {
+    S.parts[t].first = first + count*t/threads;
+    S.parts[t].count = count*(t+1)/threads - count*t/threads;
+  }
+
+  double start = Now();
+  RunParallel(threads,StatsThread,&S);
+
+  // merge the threads' moments into part 0
+  tPartial& All = S.parts[0];
+  for(unsigned int t=1;t<threads;t++)
+  {
+    tPartial& P = S.parts[t];
+    for(uint64_t i=0;i<S.pixels;i++)
+    {
+      MergeMoments(All.mean[i],All.m2[i],All.n,P.mean[i],P.m2[i],P.n);
+      All.lo[i] = P.lo[i]<All.lo[i] ? P.lo[i] : All.lo[i];
+      All.hi[i] = P.hi[i]>All.hi[i] ? P.hi[i] : All.hi[i];
+    }
+    All.n += P.n;
+  }
+  double seconds = Now()-start;
+
+  // population variance, as numpy's var() with ddof=0
+  std::vector<float> mean(S.pixels), var(S.pixels);
+  for(uint64_t i=0;i<S.pixels;i++)
+  {
+    mean[i] = (float)All.mean[i];
+    var[i] = (float)(All.m2[i]>0 ? All.m2[i]/All.n : 0);
+  }
+
+  uint32_t w = S.Rec.header.width, h = S.Rec.header.height;
+  bool ok = WriteImage(prefix,"mean","'<f4'",&mean[0],4,w,h) &&
+            WriteImage(prefix,"var","'<f4'",&var[0],4,w,h);
+  if(S.sampleSize==1)
+  {
+    std::vector<uint8_t> lo(All.lo.begin(),All.lo.end()), hi(All.hi.begin(),All.hi.end());
+    ok = ok && WriteImage(prefix,"min","'|u1'",&lo[0],1,w,h) && WriteImage(prefix,"max","'|u1'",&hi[0],1,w,h);
+  }
+  else
+    ok = ok && WriteImage(prefix,"min","'<u2'",&All.lo[0],2,w,h) && WriteImage(prefix,"max","'<u2'",&All.hi[0],2,w,h);
+
+  double bytes = (double)count*S.Rec.imageSize;
+  printf("%llu frames in %.2f s, %.1f MB/s with %u threads\n",
+         (unsigned long long)count,seconds,bytes/1e6/seconds,threads);
+
+  RecordingClose(S.Rec);
+  return ok ? 0 : 1;
+}
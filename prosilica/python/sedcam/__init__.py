@@ -0,0 +1,97 @@
+# sedcam recordings as NumPy views
+#
+# Opening a recording maps the file; pixels and stamps are strided views into
+# that mapping, so opening is independent of file size and slicing never
+# copies.
+
+# imports
+import socket
+import numpy as np
+from ._recording import Recording, HEADER_SIZE, STAMP_SIZE
+
+__all__ = ['Recording', 'open_recording', 'pixels', 'stamps', 'ticks', 'frame_info', 'request_burst',
+           'STAMP_DTYPE', 'FRAME_INFO_DTYPE']
+
+# per-frame time block written by snap_image
+STAMP_DTYPE = np.dtype([('host_sec', '<u4'), ('host_nsec', '<u4'),
+                        ('ticks_lo', '<u4'), ('ticks_hi', '<u4')])
+
+# per-frame footer entry; exposure (us), gain (dB) and sync levels are set
+# where flags & 1 (camera chunk data). Older recordings have only crc.
+FRAME_INFO_DTYPE = np.dtype([('crc', '<u4'), ('flags', '<u4'), ('exposure', '<u4'), ('gain', '<u4'),
+                             ('sync_in', '<u2'), ('sync_out', '<u2'), ('acquisition_count', '<u4')])
+
+# sample types for pixel formats that map directly onto an array
+_PIXEL_DTYPES = {
+  'Mono8': (np.dtype('u1'), 1),
+  'Bayer8': (np.dtype('u1'), 1),
+  'Mono16': (np.dtype('<u2'), 1),
+  'Bayer16': (np.dtype('<u2'), 1),
+  'Rgb24': (np.dtype('u1'), 3),
+  'Bgr24': (np.dtype('u1'), 3),
+  'Rgb48': (np.dtype('<u2'), 3),
+  'Yuv444': (np.dtype('u1'), 3),
+  'Rgba32': (np.dtype('u1'), 4),
+  'Bgra32': (np.dtype('u1'), 4),
+}
+
+# open a recording
+def open_recording(path, hint='normal'):
+  return Recording(path, hint)
+
+# pixel view: (frames, height, width[, channels]); packed formats give raw bytes
+def pixels(rec):
+  offset = HEADER_SIZE + STAMP_SIZE
+  if rec.pixel_format not in _PIXEL_DTYPES:
+    if rec.count == 0:
+      return np.empty((0, rec.image_size), dtype=np.uint8)
+    return np.ndarray((rec.count, rec.image_size), dtype=np.uint8, buffer=rec,
+                      offset=offset, strides=(rec.record_size, 1))
+  dtype, channels = _PIXEL_DTYPES[rec.pixel_format]
+  shape = (rec.count, rec.height, rec.width)
+  strides = (rec.record_size, rec.width*channels*dtype.itemsize, channels*dtype.itemsize)
+  if channels > 1:
+    shape += (channels,)
+    strides += (dtype.itemsize,)
+  # no frames: the buffer ends before the first record, so nothing to view
+  if rec.count == 0:
+    return np.empty(shape, dtype=dtype)
+  return np.ndarray(shape, dtype=dtype, buffer=rec, offset=offset, strides=strides)
+
+# per-frame stamps: structured (frames,) view with STAMP_DTYPE fields
+def stamps(rec):
+  if rec.count == 0:
+    return np.empty((0,), dtype=STAMP_DTYPE)
+  return np.ndarray((rec.count,), dtype=STAMP_DTYPE, buffer=rec,
+                    offset=HEADER_SIZE, strides=(rec.record_size,))
+
+# 64-bit camera timestamps (computed, so this one is a copy)
+def ticks(rec):
+  s = stamps(rec)
+  return (s['ticks_hi'].astype(np.uint64) << np.uint64(32)) | s['ticks_lo']
+
+# per-frame footer entries: structured (frames,) view with the FRAME_INFO_DTYPE
+# fields the recording has; None if it has no footer
+def frame_info(rec):
+  if rec.info_offset == 0:
+    return None
+  fields = FRAME_INFO_DTYPE.fields
+  names = [n for n in FRAME_INFO_DTYPE.names if fields[n][1] + fields[n][0].itemsize <= rec.info_size]
+  dtype = np.dtype({'names': names, 'formats': [fields[n][0] for n in names],
+                    'offsets': [fields[n][1] for n in names], 'itemsize': rec.info_size})
+  return np.ndarray((rec.info_count,), dtype=dtype, buffer=rec, offset=rec.info_offset)
+
+# ask a snap_image -d daemon for a burst; returns its reply line
+# (e.g. 'ok 100/0 start_ms=0.4 first_frame_ms=2.1', frames/dropped per camera)
+def request_burst(socket_path, frames, rate, outfiles, timeout=None):
+  sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+  try:
+    sock.settimeout(timeout)
+    sock.connect(socket_path)
+    sock.sendall(('burst %d %g %s\n' % (frames, rate, ' '.join(outfiles))).encode())
+    reply = sock.makefile().readline().strip()
+  finally:
+    sock.close()
+  if not reply.startswith('ok'):
+    raise RuntimeError(reply or 'no reply from %s' % socket_path)
+  return reply
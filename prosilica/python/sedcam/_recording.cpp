@@ -0,0 +1,247 @@
+/* Python extension wrapping the mmap reader in common/recording.h.
+ *
+ * A Recording object keeps the file mapped and exports the whole mapping
+ * through the buffer protocol, so NumPy arrays built on top of it (see
+ * sedcam/__init__.py) are views into the page cache rather than copies.
+ */
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <recording.h>
+
+// python object
+typedef struct
+{
+  PyObject_HEAD
+  tRecording Rec;
+  bool       isOpen;
+  bool       closed;
+} tPyRecording;
+
+// Recording(path, hint="normal")
+static int Recording_init(tPyRecording* self,PyObject* args,PyObject* kwds)
+{
+  static const char* kwlist[] = {"path","hint",NULL};
+  PyObject* path = NULL;
+  const char* hint = "normal";
+  tAccessHint Hint = eAccessNormal;
+
+  if(!PyArg_ParseTupleAndKeywords(args,kwds,"O&|s",(char**)kwlist,PyUnicode_FSConverter,&path,&hint))
+    return -1;
+
+  if(strcmp(hint,"sequential")==0)
+    Hint = eAccessSequential;
+  else if(strcmp(hint,"random")==0)
+    Hint = eAccessRandom;
+  else if(strcmp(hint,"normal")!=0)
+  {
+    Py_DECREF(path);
+    PyErr_Format(PyExc_ValueError,"unknown access hint '%s'",hint);
+    return -1;
+  }
+
+  if(self->isOpen)
+  {
+    Py_DECREF(path);
+    PyErr_SetString(PyExc_RuntimeError,"recording is already open");
+    return -1;
+  }
+
+  bool ok;
+  Py_BEGIN_ALLOW_THREADS
+  ok = RecordingOpen(self->Rec,PyBytes_AS_STRING(path),Hint);
+  Py_END_ALLOW_THREADS
+  Py_DECREF(path);
+
+  if(!ok)
+  {
+    PyErr_SetString(PyExc_OSError,self->Rec.error);
+    return -1;
+  }
+  self->isOpen = true;
+  return 0;
+}
+
+static void Recording_dealloc(tPyRecording* self)
+{
+  if(self->isOpen)
+    RecordingClose(self->Rec);
+  Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+// check the recording is still usable
+static bool Recording_check(tPyRecording* self)
+{
+  if(!self->isOpen || self->closed)
+  {
+    PyErr_SetString(PyExc_ValueError,"recording is closed");
+    return false;
+  }
+  return true;
+}
+
+// buffer protocol: the whole file as read-only bytes
+static int Recording_getbuffer(tPyRecording* self,Py_buffer* view,int flags)
+{
+  if(!Recording_check(self))
+  {
+    view->obj = NULL;
+    return -1;
+  }
+  if(PyBuffer_FillInfo(view,(PyObject*)self,(void*)self->Rec.base,
+                       (Py_ssize_t)self->Rec.fileSize,1,flags)<0)
+    return -1;
+  return 0;
+}
+
+static PyBufferProcs Recording_as_buffer =
+{
+  (getbufferproc)Recording_getbuffer,
+  NULL
+};
+
+// close(): arrays keep a reference to the recording rather than to a buffer
+// view, so the file stays mapped until the last of them is gone and only new
+// views are refused here
+static PyObject* Recording_close(tPyRecording* self,PyObject* unused)
+{
+  self->closed = true;
+  Py_RETURN_NONE;
+}
+
+// advise(hint)
+static PyObject* Recording_advise(tPyRecording* self,PyObject* args)
+{
+  const char* hint;
+  if(!PyArg_ParseTuple(args,"s",&hint) || !Recording_check(self))
+    return NULL;
+
+  if(strcmp(hint,"normal")==0)
+    RecordingAdvise(self->Rec,eAccessNormal);
+  else if(strcmp(hint,"sequential")==0)
+    RecordingAdvise(self->Rec,eAccessSequential);
+  else if(strcmp(hint,"random")==0)
+    RecordingAdvise(self->Rec,eAccessRandom);
+  else
+  {
+    PyErr_Format(PyExc_ValueError,"unknown access hint '%s'",hint);
+    return NULL;
+  }
+  Py_RETURN_NONE;
+}
+
+// prefetch(first, count)
+static PyObject* Recording_prefetch(tPyRecording* self,PyObject* args)
+{
+  unsigned long long first, count;
+  if(!PyArg_ParseTuple(args,"KK",&first,&count) || !Recording_check(self))
+    return NULL;
+  RecordingPrefetch(self->Rec,first,count);
+  Py_RETURN_NONE;
+}
+
+// getters
+#define RECORDING_GETTER(name,expr) \
+  static PyObject* Recording_get_##name(tPyRecording* self,void* closure) \
+  { \
+    if(!Recording_check(self)) \
+      return NULL; \
+    return expr; \
+  }
+
+RECORDING_GETTER(width,PyLong_FromUnsignedLong(self->Rec.header.width))
+RECORDING_GETTER(height,PyLong_FromUnsignedLong(self->Rec.header.height))
+RECORDING_GETTER(frame_count,PyLong_FromUnsignedLong(self->Rec.header.frameCount))
+RECORDING_GETTER(frame_rate,PyFloat_FromDouble(self->Rec.header.frameRate))
+RECORDING_GETTER(time_stamp_frequency,PyLong_FromUnsignedLong(self->Rec.header.timeStampFrequency))
+RECORDING_GETTER(pixel_format,PyUnicode_FromString(self->Rec.header.pixelFormat))
+RECORDING_GETTER(count,PyLong_FromUnsignedLongLong(self->Rec.count))
+RECORDING_GETTER(complete,PyBool_FromLong(self->Rec.complete))
+RECORDING_GETTER(truncated,PyBool_FromLong(self->Rec.truncated))
+RECORDING_GETTER(frames_dropped,PyLong_FromUnsignedLong(self->Rec.framesDropped))
+RECORDING_GETTER(image_size,PyLong_FromUnsignedLong(self->Rec.imageSize))
+RECORDING_GETTER(record_size,PyLong_FromUnsignedLongLong(self->Rec.recordSize))
+RECORDING_GETTER(info_offset,PyLong_FromUnsignedLongLong(self->Rec.info ? self->Rec.info-self->Rec.base : 0))
+RECORDING_GETTER(info_size,PyLong_FromUnsignedLong(self->Rec.infoSize))
+RECORDING_GETTER(info_count,PyLong_FromUnsignedLongLong(self->Rec.infoCount))
+
+static PyObject* Recording_get_closed(tPyRecording* self,void* closure)
+{
+  return PyBool_FromLong(!self->isOpen || self->closed);
+}
+
+static PyGetSetDef Recording_getset[] =
+{
+  {(char*)"width",(getter)Recording_get_width,NULL,(char*)"frame width in pixels",NULL},
+  {(char*)"height",(getter)Recording_get_height,NULL,(char*)"frame height in pixels",NULL},
+  {(char*)"frame_count",(getter)Recording_get_frame_count,NULL,(char*)"frames requested (header)",NULL},
+  {(char*)"frame_rate",(getter)Recording_get_frame_rate,NULL,(char*)"frame rate (header)",NULL},
+  {(char*)"time_stamp_frequency",(getter)Recording_get_time_stamp_frequency,NULL,(char*)"camera ticks per second",NULL},
+  {(char*)"pixel_format",(getter)Recording_get_pixel_format,NULL,(char*)"camera PixelFormat",NULL},
+  {(char*)"count",(getter)Recording_get_count,NULL,(char*)"frames present in the file",NULL},
+  {(char*)"complete",(getter)Recording_get_complete,NULL,(char*)"dropped-frame trailer present",NULL},
+  {(char*)"truncated",(getter)Recording_get_truncated,NULL,(char*)"file ends inside a frame",NULL},
+  {(char*)"frames_dropped",(getter)Recording_get_frames_dropped,NULL,(char*)"dropped frames (trailer)",NULL},
+  {(char*)"image_size",(getter)Recording_get_image_size,NULL,(char*)"bytes per image",NULL},
+  {(char*)"record_size",(getter)Recording_get_record_size,NULL,(char*)"bytes per frame record",NULL},
+  {(char*)"info_offset",(getter)Recording_get_info_offset,NULL,(char*)"file offset of the footer entries (0 = no footer)",NULL},
+  {(char*)"info_size",(getter)Recording_get_info_size,NULL,(char*)"bytes per footer entry",NULL},
+  {(char*)"info_count",(getter)Recording_get_info_count,NULL,(char*)"footer entries",NULL},
+  {(char*)"closed",(getter)Recording_get_closed,NULL,(char*)"true once close() was called",NULL},
+  {NULL}
+};
+
+static PyMethodDef Recording_methods[] =
+{
+  {"close",(PyCFunction)Recording_close,METH_NOARGS,"refuse new views; the file is unmapped once existing ones are gone"},
+  {"advise",(PyCFunction)Recording_advise,METH_VARARGS,"set access hint: normal, sequential or random"},
+  {"prefetch",(PyCFunction)Recording_prefetch,METH_VARARGS,"start reading frames [first, first+count) in the background"},
+  {NULL}
+};
+
+static PyTypeObject RecordingType =
+{
+  PyVarObject_HEAD_INIT(NULL,0)
+  "sedcam._recording.Recording",
+};
+
+static PyModuleDef RecordingModule =
+{
+  PyModuleDef_HEAD_INIT,
+  "_recording",
+  "Memory-mapped access to snap_image recordings.",
+  -1,
+  NULL
+};
+
+PyMODINIT_FUNC PyInit__recording(void)
+{
+  RecordingType.tp_basicsize = sizeof(tPyRecording);
+  RecordingType.tp_flags = Py_TPFLAGS_DEFAULT;
+  RecordingType.tp_doc = "Recording(path, hint='normal')\n\nMemory-mapped snap_image recording.";
+  RecordingType.tp_new = PyType_GenericNew;
+  RecordingType.tp_init = (initproc)Recording_init;
+  RecordingType.tp_dealloc = (destructor)Recording_dealloc;
+  RecordingType.tp_as_buffer = &Recording_as_buffer;
+  RecordingType.tp_getset = Recording_getset;
+  RecordingType.tp_methods = Recording_methods;
+
+  if(PyType_Ready(&RecordingType)<0)
+    return NULL;
+
+  PyObject* m = PyModule_Create(&RecordingModule);
+  if(m==NULL)
+    return NULL;
+
+  PyModule_AddIntConstant(m,"HEADER_SIZE",RECORDING_HEADER_SIZE);
+  PyModule_AddIntConstant(m,"STAMP_SIZE",RECORDING_STAMP_SIZE);
+
+  Py_INCREF(&RecordingType);
+  if(PyModule_AddObject(m,"Recording",(PyObject*)&RecordingType)<0)
+  {
+    Py_DECREF(&RecordingType);
+    Py_DECREF(m);
+    return NULL;
+  }
+  return m;
+}
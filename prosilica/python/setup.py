@@ -0,0 +1,20 @@
+#!/usr/bin/env python
+
+# build with: pip install .
+from setuptools import setup, Extension
+
+setup(
+  name='sedcam',
+  version='0.1dev',
+  description='Zero-copy NumPy access to sedcam recordings',
+  packages=['sedcam'],
+  ext_modules=[
+    Extension('sedcam._recording',
+      sources=['sedcam/_recording.cpp'],
+      include_dirs=['../common'],
+      define_macros=[('_FILE_OFFSET_BITS', '64')],
+      extra_compile_args=['-std=gnu++11'],
+    ),
+  ],
+  install_requires=['numpy'],
+)
@@ -0,0 +1,206 @@
+/* Reads every chunk of a zarr store written by snap_image -f zarr and reports
+ * the decode throughput. Given the raw recording of the same capture it also
+ * times a plain sequential read of that file and can check the chunks
+ * against it pixel by pixel.
+ *
+ * Drop the page cache between runs (echo 3 > /proc/sys/vm/drop_caches) to
+ * compare disk rather than memory throughput.
+ */
+
+// includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <vector>
+#include <recording.h>
+#include <workers.h>
+#include <zarr.h>
+
+// read job for one spatial tile column (all time chunks of tile y,x)
+typedef struct
+{
+  const tZarrReader* Reader;
+  const tRecording*  Rec;      // NULL unless verifying
+  uint32_t           ty;
+  uint32_t           tx;
+  uint64_t           chunks;
+  uint64_t           bad;
+} tReadJob;
+
+// usage
+void ShowUsage()
+{
+  printf("usage: read_zarr -z store [-i recording] [-j threads] [-v]\n");
+  printf("-z\tzarr store written by snap_image -f zarr\n");
+  printf("-i\traw recording to time (and verify against with -v)\n");
+  printf("-j\tdecode threads (default 2)\n");
+  printf("-v\tcompare every chunk with the raw recording\n");
+  printf(RECORDING_MAP_LIMIT);
+}
+
+// seconds since an arbitrary start
+double Now()
+{
+  struct timespec tp;
+  clock_gettime(CLOCK_MONOTONIC,&tp);
+  return tp.tv_sec + tp.tv_nsec/1e9;
+}
+
+// compare a decoded chunk with the recording
+bool CheckChunk(const tReadJob& Job,uint64_t t,const uint8_t* Chunk)
+{
+  const tZarrReader& R = *Job.Reader;
+  uint32_t s = R.sampleSize;
+  uint32_t y0 = Job.ty*R.chunks[1], x0 = Job.tx*R.chunks[2];
+  uint64_t rows = R.shape[1]-y0 < R.chunks[1] ? R.shape[1]-y0 : R.chunks[1];
+  uint64_t cols = R.shape[2]-x0 < R.chunks[2] ? R.shape[2]-x0 : R.chunks[2];
+
+  for(uint64_t f=0;f<R.chunks[0] && t*R.chunks[0]+f<R.shape[0];f++)
+  {
+    uint64_t i = t*R.chunks[0]+f;
+    if(i>=Job.Rec->count)
+      return false;
+    const uint8_t* image = (const uint8_t*)RecordingFrame(*Job.Rec,i).image;
+    for(uint64_t y=0;y<rows;y++)
+      if(memcmp(Chunk + ((f*R.chunks[1] + y)*R.chunks[2])*s,
+                image + ((y0+y)*R.shape[2] + x0)*s,cols*s)!=0)
+        return false;
+  }
+  return true;
+}
+
+// decode all time chunks of one tile
+void ReadTile(void* Arg)
+{
+  tReadJob* Job = (tReadJob*)Arg;
+  const tZarrReader& R = *Job->Reader;
+  std::vector<uint8_t> chunk(ZarrChunkSize(R));
+  uint64_t timeChunks = (R.shape[0]+R.chunks[0]-1)/R.chunks[0];
+
+  for(uint64_t t=0;t<timeChunks;t++)
+  {
+    if(!ZarrReadChunk(R,t,Job->ty,Job->tx,&chunk[0]) ||
+       (Job->Rec && !CheckChunk(*Job,t,&chunk[0])))
+    {
+      printf("chunk %llu.%u.%u is bad\n",(unsigned long long)t,Job->ty,Job->tx);
+      Job->bad++;
+    }
+    Job->chunks++;
+  }
+}
+
+// time a sequential read of the raw file
+void TimeRaw(const char* Path)
+{
+  int fd = open(Path,O_RDONLY);
+  if(fd<0)
+  {
+    printf("failed to open %s\n",Path);
+    return;
+  }
+
+  std::vector<uint8_t> buffer(4<<20);
+  uint64_t total = 0;
+  ssize_t n;
+  double start = Now();
+  while((n = read(fd,&buffer[0],buffer.size()))>0)
+    total += n;
+  double seconds = Now()-start;
+  close(fd);
+
+  printf("raw: %.1f MB in %.2f s, %.1f MB/s\n",total/1e6,seconds,total/1e6/seconds);
+}
+
+// main
+int main(int argc, char* argv[])
+{
+  int c;
+  const char* store = NULL;
+  const char* raw = NULL;
+  unsigned int threads = 2;
+  bool verify = false;
+
+  while ((c = getopt (argc, argv, "z:i:j:v")) != -1)
+  {
+    switch(c)
+    {
+      case 'z':
+        store = optarg;
+        break;
+      case 'i':
+        raw = optarg;
+        break;
+      case 'j':
+        threads = atoi(optarg);
+        break;
+      case 'v':
+        verify = true;
+        break;
+    }
+  }
+
+  if(!store)
+  {
+    ShowUsage();
+    return 1;
+  }
+
+  tZarrReader Reader;
+  if(!ZarrReaderOpen(Reader,store))
+  {
+    printf("failed to read metadata of %s\n",store);
+    return 1;
+  }
+
+  tRecording Rec;
+  if(verify && (!raw || !RecordingOpen(Rec,raw,eAccessSequential)))
+  {
+    printf("verifying needs a readable raw recording (-i)\n");
+    return 1;
+  }
+
+  // raw read first, so the zarr pass does not profit from its page cache
+  if(raw)
+    TimeRaw(raw);
+
+  // one job per tile column, spread over the workers
+  uint32_t tilesY = (Reader.shape[1]+Reader.chunks[1]-1)/Reader.chunks[1];
+  uint32_t tilesX = (Reader.shape[2]+Reader.chunks[2]-1)/Reader.chunks[2];
+  std::vector<tReadJob> jobs(tilesY*tilesX);
+  tWorkQueue Queue;
+  WorkQueueStart(Queue,threads,jobs.size());
+
+  double start = Now();
+  for(uint32_t ty=0;ty<tilesY;ty++)
+    for(uint32_t tx=0;tx<tilesX;tx++)
+    {
+      tReadJob& Job = jobs[ty*tilesX+tx];
+      memset(&Job,0,sizeof(tReadJob));
+      Job.Reader = &Reader;
+      Job.Rec = verify ? &Rec : NULL;
+      Job.ty = ty;
+      Job.tx = tx;
+      WorkQueueSubmit(Queue,ReadTile,&Job);
+    }
+  WorkQueueStop(Queue);
+  double seconds = Now()-start;
+
+  uint64_t chunks = 0, bad = 0;
+  for(size_t i=0;i<jobs.size();i++)
+  {
+    chunks += jobs[i].chunks;
+    bad += jobs[i].bad;
+  }
+  double bytes = (double)Reader.shape[0]*Reader.shape[1]*Reader.shape[2]*Reader.sampleSize;
+  printf("zarr: %llu chunks, %.1f MB decoded in %.2f s, %.1f MB/s with %u threads\n",
+         (unsigned long long)chunks,bytes/1e6,seconds,bytes/1e6/seconds,threads);
+  if(verify)
+  {
+    printf("%llu bad chunks\n",(unsigned long long)bad);
+    RecordingClose(Rec);
+  }
+
+  return bad ? 1 : 0;
+}
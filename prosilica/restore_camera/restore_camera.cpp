@@ -0,0 +1,153 @@
+/* This utility restores a camera's attributes from a dump_camera snapshot
+ * (json or bin), writing only the attributes whose values differ, in
+ * dependency order, and reports how long the setup took.
+ */
+
+// includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <PvApi.h>
+#include <attr_snapshot.h>
+#include <attr_restore.h>
+
+// usage
+void ShowUsage()
+{
+  printf("usage: restore_camera [-n] [-a] snapshot [camera IP]\n");
+  printf("-n\tshow the writes without making them\n");
+  printf("-a\twrite every writable attribute, changed or not (to compare setup times)\n");
+  printf("without an IP address the camera with the snapshot's unique ID is used\n");
+}
+
+// sleep function
+void Sleep(unsigned int time)
+{
+  struct timespec t,r;
+
+  t.tv_sec    = time / 1000;
+  t.tv_nsec   = (time % 1000) * 1000000;
+
+  while(nanosleep(&t,&r)==-1)
+    t = r;
+}
+
+// a value for the listing
+std::string ShowValue(const tAttr& A,const std::string& Value)
+{
+  return A.type==ePvDatatypeString || A.type==ePvDatatypeEnum ? "\"" + Value + "\"" : Value;
+}
+
+// open the camera by address, or by unique ID once PvAPI has found it
+bool OpenCamera(const char* Address,unsigned long Uid,tPvHandle& Handle,tPvCameraInfoEx& Info)
+{
+  if(Address)
+  {
+    unsigned long ip = inet_addr(Address);
+    return ip!=INADDR_NONE && !PvCameraInfoByAddrEx(ip,&Info,NULL,sizeof(tPvCameraInfoEx)) &&
+           !PvCameraOpenByAddr(ip,ePvAccessMaster,&Handle);
+  }
+  for(int rounds=0;rounds<16 && PvCameraInfoEx(Uid,&Info,sizeof(tPvCameraInfoEx));rounds++)
+    Sleep(250);
+  return !PvCameraOpen(Uid,ePvAccessMaster,&Handle);
+}
+
+// main
+int main(int argc, char* argv[])
+{
+  int c;
+  bool dryRun = false;
+  bool all = false;
+  while ((c = getopt (argc, argv, "na")) != -1)
+  {
+    switch(c)
+    {
+      case 'n':
+        dryRun = true;
+        break;
+      case 'a':
+        all = true;
+        break;
+      default:
+        ShowUsage();
+        return 1;
+    }
+  }
+  if(argc-optind<1 || argc-optind>2)
+  {
+    ShowUsage();
+    return 1;
+  }
+
+  tAttrSnapshot target;
+  if(!AttrLoad(argv[optind],target))
+  {
+    printf("cannot read snapshot %s\n",argv[optind]);
+    return 1;
+  }
+
+  if(PvInitialize())
+  {
+    printf("Prosilica API failed to initialize.\n");
+    return 1;
+  }
+
+  int status = 1;
+  tPvHandle handle;
+  tPvCameraInfoEx info;
+  const char* address = argc-optind==2 ? argv[optind+1] : NULL;
+  if(OpenCamera(address,target.uid,handle,info))
+  {
+    printf("restoring %s onto %s (%s)\n",argv[optind],info.SerialNumber,info.CameraName);
+    if(target.model!=info.ModelName || target.firmware!=info.FirmwareVersion)
+      printf("\n*** Warning ***\nsnapshot is from a %s (firmware %s), this camera is a %s (firmware %s)\n\n",
+             target.model.c_str(),target.firmware.c_str(),info.ModelName,info.FirmwareVersion);
+
+    // one read pass, then only the differences, in dependency order
+    tAttrRestoreStats stats;
+    std::vector<tAttrChange> plan;
+    memset(&stats,0,sizeof(tAttrRestoreStats));
+    AttrPlan(handle,target,plan,stats,all);
+    for(size_t i=0;i<plan.size();i++)
+      printf("  %s: %s -> %s\n",plan[i].target.name.c_str(),
+             all ? "?" : ShowValue(plan[i].target,plan[i].current).c_str(),
+             ShowValue(plan[i].target,plan[i].target.value).c_str());
+    if(!all)
+      printf("read %lu attributes in %.1f ms, %lu differ\n",stats.reads,stats.readSeconds*1000,
+             (unsigned long)plan.size());
+
+    if(!dryRun)
+    {
+      bool ok = AttrApply(handle,plan,stats);
+      for(size_t i=0;i<plan.size();i++)
+        if(plan[i].err!=ePvErrSuccess)
+          printf("  %s: write failed (%u)\n",plan[i].target.name.c_str(),plan[i].err);
+
+      // a write may have moved attributes written or matched before it
+      std::vector<tAttrChange> missed;
+      if(stats.changed)
+        ok = AttrSettle(handle,target,missed,stats) && ok;
+      for(size_t i=0;i<missed.size();i++)
+        printf("  %s: is %s after the restore, not %s\n",missed[i].target.name.c_str(),
+               ShowValue(missed[i].target,missed[i].current).c_str(),
+               ShowValue(missed[i].target,missed[i].target.value).c_str());
+      printf("wrote %lu attribute(s) in %.1f ms (%lu calls), %lu failed, %lu differ afterwards\n",stats.changed,
+             stats.writeSeconds*1000,stats.writes,stats.failed,stats.unsettled);
+      printf("setup took %.1f ms\n",(stats.readSeconds+stats.writeSeconds)*1000);
+      status = ok ? 0 : 2;
+    }
+    else
+      status = 0;
+
+    PvCameraClose(handle);
+  }
+  else
+    printf("failed to open the camera (maybe not found?)\n");
+
+  // uninitialize camera api
+  PvUnInitialize();
+  return status;
+}
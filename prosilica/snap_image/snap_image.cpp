@@ -6,27 +6,73 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
 #include <time.h>
 #include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <arpa/inet.h>
 #include <pthread.h>
 #include <math.h>
 #include <PvApi.h>
+#include <npy.h>
+#include <zarr.h>
+#include <recording.h>
+#include <crc32c.h>
+#include <stream.h>
+#include <aligned_writer.h>
+#include <staging.h>
+#include <attr_snapshot.h>
+#include <attr_restore.h>
+#include <discovery.h>
+#include <session_config.h>
 #include <iostream>
 using namespace std;
 
 #define FRAMESCOUNT 1024 // total frame buffers
+#define DAEMON_WORDS 64   // most words in a daemon request
+
+// output formats
+typedef enum
+{
+  eOutputRaw = 0, // header, time block + image per frame, dropped count
+  eOutputNpy = 1, // (frames, height, width) .npy plus _stamps.npy and _info.npy sidecars
+  eOutputZarr = 2, // chunked, compressed zarr v2 directory store
+  eOutputStream = 3 // raw format sent over TCP to stream_collector
+} tOutputFormat;
 
 // camera structure
 typedef struct
 {
   int           id;
   unsigned long uid;
+  unsigned long address;       // from the discovery service (network order, 0 = open by uid)
   tPvHandle     Handle;
   tPvFrame      Frames[FRAMESCOUNT];
   pthread_t     ThHandle;
   char          *outfile;
+  char          outname[1024]; // this burst's output, when outfile is per burst
   FILE*         fhandle;
+  tAlignedWriter writer;       // raw output in erase-block writes (-w)
+  tStager       stager;        // RAM tier in front of the raw output (-b)
+  tNpyFile      npyPixels;
+  tNpyFile      npyStamps;
+  tNpyFile      npyInfo;       // per-frame camera values of the npy output
+  tZarrWriter   zarr;
+  tFrameInfo*   info;          // footer entries of the raw output
+  unsigned long ancillarySize; // chunk data per frame (0 = no chunk mode)
+  bool          chunkModeSet;  // chunk mode was off until startCapture
+  unsigned long infoCount;
+  unsigned long infoCapacity;
+  tStreamSender stream;
+  uint32_t      stamps[FRAMESCOUNT][4]; // time blocks of frames lent to the stream
   bool          acquisitionComplete;
+  volatile bool recording;           // frames go to the output (false between bursts)
+  volatile unsigned long framesReceived; // frames delivered in this burst
+  double        firstFrame;          // host time of its first frame
+  char          ip[128];
+  char          name[128];
+  unsigned long droppedBefore;       // StatFramesDropped when the burst began
   unsigned long  startSecond;
   unsigned long  startnSecond;
   unsigned long  endSecond;
@@ -49,11 +95,34 @@ typedef struct
   int		GainAutoMax;
   int		actualFramesAcquired;
   float         frameRate;
+  tOutputFormat outputFormat;
+  unsigned int  zarrChunk[3];   // frames, rows, columns per chunk
+  int           zarrLevel;      // zlib level (0 = uncompressed)
+  unsigned int  zarrWorkers;    // compression threads per camera
+  const char*   streamAddress;  // host:port of the collector
+  unsigned int  streamInFlight; // frames the stream may hold at once
+  const char*   daemonSocket;   // UNIX socket bursts are requested on (-d)
+  const char*   discoverySocket; // camera_discovery service to look cameras up in (-l)
+  bool          discovered;     // every camera was found there
+  double        scheduleInterval; // seconds between scheduled bursts (-t, 0 = one capture)
+  unsigned long scheduleBursts;   // bursts to run (0 = until stopped)
+  unsigned int  startMargin;    // ms from a burst request to the PTP start
+  unsigned long writeBlock;     // aligned writer block size (0 = stdio)
+  unsigned long writeSync;      // bytes between fdatasync calls
+  unsigned long stageBudget;    // RAM staging bytes per camera (0 = write directly)
+  double        stageRate;      // staging flush rate in bytes/s (0 = no limit)
+  const char*   configPath;     // session file (-c)
+  bool          configCameras;  // the cameras come from the session file
 } tSession;
 
 // global GSession
 tSession GSession;
 
+// the session file, and each camera's settings (checked before any camera is opened)
+tConfig GConfig;
+std::vector<tAttrSnapshot> GSettings;
+std::vector<tAttrSnapshot> GModels;  // cached descriptions (empty if none)
+
 // usage
 //void ShowUsage()
 //{
@@ -72,17 +141,40 @@ void Sleep(unsigned int time)
     t = r;
 }
 
-// wait for cameras
+// look every camera up in the discovery service; false if one is not known there
+bool lookupCameras()
+{
+  for(int i=0;i<GSession.Count;i++)
+  {
+    tDiscoveredCamera found;
+    char key[32];
+    snprintf(key,sizeof(key),"%lu",GSession.Cameras[i].uid);
+    if(!DiscoveryLookup(GSession.discoverySocket,key,found))
+      return false;
+    GSession.Cameras[i].address = inet_addr(found.ip);
+  }
+  return true;
+}
+
+// all cameras can be opened
+bool camerasFound()
+{
+  return GSession.discovered || PvCameraCount()>=(unsigned int)GSession.Count;
+}
+
+// wait for cameras (not at all if the discovery service knows them)
 bool WaitForCamera()
 {
   int waitCount = 0;
   printf("Waiting for %i camera(s) ...",GSession.Count);
-  while(PvCameraCount() < (unsigned int)GSession.Count && waitCount<16)
+  if(GSession.discoverySocket)
+    GSession.discovered = lookupCameras();
+  while(!camerasFound() && waitCount<16)
   {
     Sleep(250);
     waitCount++;
   }
-  if(PvCameraCount()>=(unsigned int)GSession.Count)
+  if(camerasFound())
   {
     printf(" and go.\n");
     return true;
@@ -91,6 +183,14 @@ bool WaitForCamera()
     return false;
 }
 
+// open a camera, by address if the discovery service gave one
+tPvErr openCamera(tCamera& Camera)
+{
+  if(Camera.address && !PvCameraOpenByAddr(Camera.address,ePvAccessMaster,&Camera.Handle))
+    return ePvErrSuccess;
+  return PvCameraOpen(Camera.uid,ePvAccessMaster,&Camera.Handle);
+}
+
 // end acquisition callback
 void CameraEventCB(void* Context,tPvHandle Handle,const tPvCameraEvent* EventList,unsigned long EventListLength)
 {
@@ -102,27 +202,143 @@ void CameraEventCB(void* Context,tPvHandle Handle,const tPvCameraEvent* EventLis
   Camera->acquisitionComplete = true;
 }
 
+// write raw format bytes to the output file (also the staging flusher's sink)
+bool FileWrite(void* Context,const void* Data,size_t Size)
+{
+  tCamera* Camera = (tCamera*)Context;
+  if(GSession.writeBlock)
+    return AlignedWrite(Camera->writer,Data,Size);
+  return fwrite(Data,1,Size,Camera->fhandle)==Size;
+}
+
+// write raw format bytes to the file, its staging tier or the stream
+void RawWrite(tCamera& Camera,const void* Data,size_t Size)
+{
+  if(GSession.outputFormat==eOutputStream)
+    StreamSend(Camera.stream,Data,Size);
+  else if(GSession.stageBudget)
+    StageWrite(Camera.stager,Data,Size);
+  else
+    FileWrite(&Camera,Data,Size);
+}
+
+// checksum and chunk data of a frame record for the footer (grows only if the camera sends extra frames)
+void AddFrameInfo(tCamera* Camera,const uint32_t* stamp,tPvFrame* pFrame)
+{
+  if(Camera->infoCount==Camera->infoCapacity)
+  {
+    unsigned long capacity = Camera->infoCapacity ? 2*Camera->infoCapacity : 1024;
+    tFrameInfo* info = new tFrameInfo[capacity];
+    if(Camera->infoCount)
+      memcpy(info,Camera->info,Camera->infoCount*sizeof(tFrameInfo));
+    delete [] Camera->info;
+    Camera->info = info;
+    Camera->infoCapacity = capacity;
+  }
+  tFrameInfo& info = Camera->info[Camera->infoCount++];
+  memset(&info,0,sizeof(tFrameInfo));
+  info.crc = Crc32c(Crc32c(0,stamp,RECORDING_STAMP_SIZE),pFrame->ImageBuffer,pFrame->ImageBufferSize);
+  if(pFrame->AncillarySize)
+    FrameInfoAncillary(info,pFrame->AncillaryBuffer,pFrame->AncillarySize);
+}
+
+// a frame's camera values for the npy and zarr outputs (zero without chunk data)
+void FrameValues(tPvFrame* pFrame,tFrameInfo& info)
+{
+  memset(&info,0,sizeof(tFrameInfo));
+  if(pFrame->AncillarySize)
+    FrameInfoAncillary(info,pFrame->AncillaryBuffer,pFrame->AncillarySize);
+}
+
+// write a frame to the camera's output; true if the output keeps the
+// buffer and requeues it itself
+bool WriteFrame(tCamera* Camera,tPvFrame* pFrame)
+{
+  struct timespec tp;
+  clock_gettime(CLOCK_REALTIME, &tp);
+
+  // same time block as the raw format, as one row of the stamps array
+  uint32_t stamp[4];
+  stamp[0] = (uint32_t)tp.tv_sec;
+  stamp[1] = (uint32_t)tp.tv_nsec;
+  stamp[2] = (uint32_t)pFrame->TimestampLo;
+  stamp[3] = (uint32_t)pFrame->TimestampHi;
+
+  if(GSession.outputFormat==eOutputNpy)
+  {
+    if(Camera->npyPixels.written<Camera->npyPixels.shape[0])
+    {
+      // the footer entry from flags on, as one row of the info array
+      tFrameInfo info;
+      FrameValues(pFrame,info);
+      NpyAppend(Camera->npyStamps,stamp,1);
+      NpyAppend(Camera->npyInfo,&info.flags,1);
+      NpyAppend(Camera->npyPixels,pFrame->ImageBuffer,1);
+    }
+    return false;
+  }
+
+  if(GSession.outputFormat==eOutputZarr)
+  {
+    tFrameInfo info;
+    FrameValues(pFrame,info);
+    uint32_t values[ZARR_INFO_FIELDS] = {info.flags,info.exposure,info.gain,info.syncIn,info.syncOut,
+                                         info.acquisitionCount};
+    ZarrAppend(Camera->zarr,pFrame->ImageBuffer,stamp,values);
+    return false;
+  }
+
+  AddFrameInfo(Camera,stamp,pFrame);
+
+  // the stream sends straight from the frame buffer, so the time block has
+  // to stay put with it until the send completes
+  if(GSession.outputFormat==eOutputStream)
+  {
+    uint32_t* held = Camera->stamps[pFrame-Camera->Frames];
+    memcpy(held,stamp,sizeof(stamp));
+    return StreamSendFrame(Camera->stream,held,sizeof(stamp),pFrame->ImageBuffer,pFrame->ImageBufferSize,pFrame);
+  }
+
+  // write real time and camera timestamps to file
+  RawWrite(*Camera,stamp,sizeof(stamp));
+
+  // write out image buffer to file
+  RawWrite(*Camera,pFrame->ImageBuffer,pFrame->ImageBufferSize);
+  return false;
+}
+
+// write the per-frame footer after the dropped-frame count
+void WriteFooter(tCamera& Camera)
+{
+  tRecordingFooter tail = RecordingFooterTail(Camera.infoCount);
+  if(Camera.infoCount)
+    RawWrite(Camera,Camera.info,Camera.infoCount*sizeof(tFrameInfo));
+  RawWrite(Camera,&tail,RECORDING_FOOTER_SIZE);
+
+  delete [] Camera.info;
+  Camera.info = NULL;
+  Camera.infoCount = Camera.infoCapacity = 0;
+}
+
 // frame done callback
 void FrameDoneCB(tPvFrame* pFrame)
 {
+  tCamera* Camera = (tCamera*)pFrame->Context[1];
   if(pFrame->Status != ePvErrUnplugged && pFrame->Status != ePvErrCancelled)
   {
-    // write real time to file
-    struct timespec tp;
-    clock_gettime(CLOCK_REALTIME, &tp);
-    fwrite((unsigned long*)&tp.tv_sec,1,sizeof(unsigned long),(FILE*)pFrame->Context[1]);
-    //printf("Sec: %lu\n", (unsigned long)tp.tv_sec);
-    fwrite((unsigned long*)&tp.tv_nsec,1,sizeof(long),(FILE*)pFrame->Context[1]);
-    //printf("Nsec: %lu\n", (unsigned long)tp.tv_nsec);
-
-    // write camera timestamps to file
-    fwrite((unsigned long*)&pFrame->TimestampLo,1,sizeof(long),(FILE*)pFrame->Context[1]);
-    //printf("Lo: %lu\n", (unsigned long*)&pFrame->TimestampLo);
-    fwrite((unsigned long*)&pFrame->TimestampHi,1,sizeof(long),(FILE*)pFrame->Context[1]);
-    //printf("Hi: %lu\n", (unsigned long*)&pFrame->TimestampHi);
-
-    // write out image buffer to file
-    fwrite((void*)pFrame->ImageBuffer,pFrame->ImageBufferSize,sizeof(char),(FILE*)pFrame->Context[1]);
+    // write frame to the output (Context[1] is the camera), unless no burst is running
+    bool held = false;
+    if(Camera->recording)
+    {
+      if(Camera->framesReceived==0)
+      {
+        struct timespec tp;
+        clock_gettime(CLOCK_REALTIME, &tp);
+        Camera->firstFrame = tp.tv_sec + tp.tv_nsec/1e9;
+      }
+      held = WriteFrame(Camera,pFrame);
+      Camera->framesReceived++;
+    }
 
     // check frame rate (lastStamp is Context[2]
     //(unsigned int*)pFrame->Context[2] = (unsigned int*)&pFrame->TimestampLo;
@@ -132,14 +348,174 @@ void FrameDoneCB(tPvFrame* pFrame)
     //cout << *(unsigned int*)pFrame->Context[2] << endl;
     //cout << (unsigned int*)pFrame->Context[2] << endl;
 
-    // requeue frame
-    PvCaptureQueueFrame((tPvHandle)pFrame->Context[0],pFrame,FrameDoneCB);
+    // requeue frame (the stream requeues frames it holds once they are sent)
+    if(!held)
+      PvCaptureQueueFrame((tPvHandle)pFrame->Context[0],pFrame,FrameDoneCB);
 
     // increment acquired count
     GSession.actualFramesAcquired++;
   }
 }
 
+// stream release function: the socket is done with the frame buffer
+void RequeueFrame(void* Context)
+{
+  tPvFrame* pFrame = (tPvFrame*)Context;
+  PvCaptureQueueFrame((tPvHandle)pFrame->Context[0],pFrame,FrameDoneCB);
+}
+
+// a camera's settings: the defaults below, then the session file's values;
+// Given gets what the user set (options and the file), which is range checked
+void cameraSettings(tCamera& Camera,const tAttrSnapshot* Model,tAttrSnapshot& settings,tAttrSnapshot& Given)
+{
+  Given = tAttrSnapshot();
+  Given.uid = Camera.uid;
+  if(GSession.frameRate>0)
+    AttrTarget(Given,"FrameRate",ePvDatatypeFloat32,AttrText((double)GSession.frameRate,true));
+  if(GSession.AcquisitionFrameCount>0)
+    AttrTarget(Given,"AcquisitionFrameCount",ePvDatatypeUint32,AttrText((unsigned long)GSession.AcquisitionFrameCount));
+  if(GSession.ExposureValue>=0)
+    AttrTarget(Given,"ExposureValue",ePvDatatypeUint32,AttrText((unsigned long)GSession.ExposureValue));
+  if(GSession.ExposureAutoMax>=0)
+    AttrTarget(Given,"ExposureAutoMax",ePvDatatypeUint32,AttrText((unsigned long)GSession.ExposureAutoMax));
+  if(GSession.GainAutoMax>=0)
+    AttrTarget(Given,"GainAutoMax",ePvDatatypeUint32,AttrText((unsigned long)GSession.GainAutoMax));
+
+  settings = tAttrSnapshot();
+  settings.uid = Camera.uid;
+  //AttrTarget(settings,"SyncOut2Mode",ePvDatatypeEnum,"Exposing");
+  //AttrTarget(settings,"SyncOut2Invert",ePvDatatypeEnum,"Off");
+  AttrTarget(settings,"FrameStartTriggerMode",ePvDatatypeEnum,"FixedRate");
+  // a daemon gets the rate and frame count with each burst if not given here
+  bool perBurst = GSession.daemonSocket!=NULL;
+  if(!perBurst || GSession.frameRate>0)
+    AttrTarget(settings,"FrameRate",ePvDatatypeFloat32,AttrText((double)GSession.frameRate,true));
+  AttrTarget(settings,"AcquisitionMode",ePvDatatypeEnum,"MultiFrame");
+  //AttrTarget(settings,"AcquisitionFrameCount",ePvDatatypeUint32,"1000");
+  if(!perBurst || GSession.AcquisitionFrameCount>0)
+    AttrTarget(settings,"AcquisitionFrameCount",ePvDatatypeUint32,AttrText((unsigned long)GSession.AcquisitionFrameCount));
+  //AttrTarget(settings,"PixelFormat",ePvDatatypeEnum,"Mono8");
+  AttrTarget(settings,"PixelFormat",ePvDatatypeEnum,"Mono16");
+  //AttrTarget(settings,"PixelFormat",ePvDatatypeEnum,"Mono12Packed");
+  AttrTarget(settings,"Width",ePvDatatypeUint32,"1024");
+  AttrTarget(settings,"Height",ePvDatatypeUint32,"1024");
+  // exposure and gain limits only when given
+  if(GSession.ExposureValue>=0)
+    AttrTarget(settings,"ExposureValue",ePvDatatypeUint32,AttrText((unsigned long)GSession.ExposureValue));
+  //AttrTarget(settings,"ExposureMode",ePvDatatypeEnum,"Manual");
+  AttrTarget(settings,"ExposureMode",ePvDatatypeEnum,"Auto");
+  AttrTarget(settings,"ExposureAutoAlg",ePvDatatypeEnum,"Mean");
+  //AttrTarget(settings,"ExposureAutoAlg",ePvDatatypeEnum,"FitRange");
+  if(GSession.ExposureAutoMax>=0)
+    AttrTarget(settings,"ExposureAutoMax",ePvDatatypeUint32,AttrText((unsigned long)GSession.ExposureAutoMax));
+  AttrTarget(settings,"GainMode",ePvDatatypeEnum,"Auto");
+  if(GSession.GainAutoMax>=0)
+    AttrTarget(settings,"GainAutoMax",ePvDatatypeUint32,AttrText((unsigned long)GSession.GainAutoMax));
+  AttrTarget(settings,"PacketSize",ePvDatatypeUint32,"1500");
+  //AttrTarget(settings,"StreamBytesPerSecond",ePvDatatypeUint32,"124000000");
+  AttrTarget(settings,"StreamBytesPerSecond",ePvDatatypeUint32,"80000000");
+
+  if(GSession.configPath)
+  {
+    // without a cached description the types of what is set here are still known
+    tAttrSnapshot known = settings;
+    AttrTarget(known,"ExposureValue",ePvDatatypeUint32,"");
+    AttrTarget(known,"ExposureAutoMax",ePvDatatypeUint32,"");
+    AttrTarget(known,"GainAutoMax",ePvDatatypeUint32,"");
+    ConfigAttrs(GConfig,Camera.uid,Model ? Model : &known,settings);
+    ConfigAttrs(GConfig,Camera.uid,Model ? Model : &known,Given);
+  }
+}
+
+// the cached attribute description of a camera's model, found without opening the camera
+bool cameraModel(tCamera& Camera,tAttrSnapshot& Model)
+{
+  tPvCameraInfoEx info;
+  if(PvCameraInfoEx(Camera.uid,&info,sizeof(tPvCameraInfoEx)) &&
+     (!Camera.address || PvCameraInfoByAddrEx(Camera.address,&info,NULL,sizeof(tPvCameraInfoEx))))
+    return false;
+  return AttrLoad(AttrCachePath(ATTR_CACHE_DIR,info.ModelName,info.FirmwareVersion).c_str(),Model) &&
+         !Model.attrs.empty();
+}
+
+// do the cameras' frames fit the link and the disk of the session? Only a
+// budget the session file declares is enforced; without one, what would not
+// fit a CONFIG_LINK_MBIT link is only a warning
+bool budgetFits(const std::vector<tConfigRate>& Rates,std::vector<std::string>& Errors)
+{
+  const char* link = GSession.configPath ? ConfigValue(GConfig,"session","link_mbit") : NULL;
+  const char* disk = GSession.configPath ? ConfigValue(GConfig,"session","disk_mb") : NULL;
+  if(link || disk)
+    return ConfigFits(Rates,link ? atof(link) : CONFIG_LINK_MBIT,disk ? atof(disk) : 0,Errors);
+
+  std::vector<std::string> warnings;
+  if(!ConfigFits(Rates,CONFIG_LINK_MBIT,0,warnings))
+  {
+    printf("\n*** Warning ***\n");
+    for(size_t k=0;k<warnings.size();k++)
+      printf("%s\n",warnings[k].c_str());
+    printf("(no link_mbit or disk_mb in a session file, so capture goes ahead)\n\n");
+  }
+  return true;
+}
+
+// check every camera's settings, and what the frames need of the link and
+// the disk, before any camera is opened
+bool checkSettings()
+{
+  double start = AttrNow();
+  bool ok = true;
+  std::vector<tConfigRate> rates;
+  std::vector<std::string> errors;
+  GSettings.assign(GSession.Count,tAttrSnapshot());
+  GModels.assign(GSession.Count,tAttrSnapshot());
+  for(int i=0;i<GSession.Count;i++)
+  {
+    tCamera& Camera = GSession.Cameras[i];
+    tAttrSnapshot& model = GModels[i];
+    bool described = cameraModel(Camera,model);
+    if(!described)
+      printf("%u : no cached attribute description of camera %lu (run dump_camera on it once), ranges not checked\n",
+             Camera.id,Camera.uid);
+    tAttrSnapshot given;
+    cameraSettings(Camera,described ? &model : NULL,GSettings[i],given);
+
+    // only what the user set is checked; the defaults are left to the camera
+    errors.clear();
+    tConfigRate rate;
+    std::string error;
+    ConfigValidate(described ? &model : NULL,given,errors);
+    for(size_t k=0;k<given.attrs.size();k++)
+      ConfigPut(GSettings[i],given.attrs[k].name,given.attrs[k].type,given.attrs[k].value);
+    if(GSession.daemonSocket && !AttrFind(GSettings[i],"FrameRate"))
+      printf("%u : data rate checked with each burst\n",Camera.id);
+    else if(ConfigRate(GSettings[i],rate,error))
+    {
+      rates.push_back(rate);
+      printf("%u : %.1f frames/s of %llu bytes, %.1f MB/s to disk, %.0f Mbit/s on the link\n",Camera.id,rate.rate,
+             (unsigned long long)rate.imageBytes,rate.diskBytes/1048576.0,rate.wireBytes*8/1e6);
+    }
+    else
+      errors.push_back(error);
+    for(size_t k=0;k<errors.size();k++)
+      printf("%u : %s\n",Camera.id,errors[k].c_str());
+    ok = ok && errors.empty();
+  }
+
+  // the cameras share the link, and the recordings the disk
+  errors.clear();
+  budgetFits(rates,errors);
+  for(size_t k=0;k<errors.size();k++)
+    printf("%s\n",errors[k].c_str());
+  ok = ok && errors.empty();
+
+  if(ok)
+    printf("settings checked in %.1f ms\n",(AttrNow()-start)*1000);
+  else
+    printf("\n*** Warning ***\nsettings rejected in %.1f ms, no camera was opened\n\n",(AttrNow()-start)*1000);
+  return ok;
+}
+
 // setup camera 
 bool CameraSetup(tCamera& Camera)
 {
@@ -150,32 +526,87 @@ bool CameraSetup(tCamera& Camera)
   PvCameraEventCallbackRegister(Camera.Handle,CameraEventCB,&Camera);
   Camera.acquisitionComplete = 0;
 
-  // change some camera settings (these will come out. all these settings
-  // should be loaded from a file before this program is run.)
-  //PvAttrEnumSet(Camera.Handle,"SyncOut2Mode","Exposing");
-  //PvAttrEnumSet(Camera.Handle,"SyncOut2Invert","Off");
-  PvAttrEnumSet(Camera.Handle,"FrameStartTriggerMode","FixedRate");
-  PvAttrFloat32Set(Camera.Handle,"FrameRate",GSession.frameRate);
-  PvAttrEnumSet(Camera.Handle,"AcquisitionMode","MultiFrame");
-  //PvAttrUint32Set(Camera.Handle,"AcquisitionFrameCount",1000);
-  PvAttrUint32Set(Camera.Handle,"AcquisitionFrameCount",GSession.AcquisitionFrameCount);
-  //PvAttrEnumSet(Camera.Handle,"PixelFormat","Mono8");
-  PvAttrEnumSet(Camera.Handle,"PixelFormat","Mono16");
-  //PvAttrEnumSet(Camera.Handle,"PixelFormat","Mono12Packed");
-  PvAttrUint32Set(Camera.Handle,"Width",1024ul);
-  PvAttrUint32Set(Camera.Handle,"Height",1024ul);
-  PvAttrUint32Set(Camera.Handle,"ExposureValue",GSession.ExposureValue);
-  //PvAttrEnumSet(Camera.Handle,"ExposureMode","Manual");
-  PvAttrEnumSet(Camera.Handle,"ExposureMode","Auto");
-  PvAttrEnumSet(Camera.Handle,"ExposureAutoAlg","Mean");
-  //PvAttrEnumSet(Camera.Handle,"ExposureAutoAlg","FitRange");
-  PvAttrUint32Set(Camera.Handle,"ExposureAutoMax", GSession.ExposureAutoMax);
-  PvAttrEnumSet(Camera.Handle,"GainMode","Auto");
-  PvAttrUint32Set(Camera.Handle,"GainAutoMax", GSession.GainAutoMax);
-  PvAttrUint32Set(Camera.Handle,"PacketSize",1500ul);
-  //PvAttrUint32Set(Camera.Handle,"StreamBytesPerSecond",124000000ul);
-  PvAttrUint32Set(Camera.Handle,"StreamBytesPerSecond",80000000ul);
+  // the checked settings; only values that differ from the camera's are
+  // written, in dependency order
+  const tAttrSnapshot& settings = GSettings[Camera.id-1];
+  tAttrRestoreStats stats;
+  std::vector<tAttrChange> missed;
+  AttrRestore(Camera.Handle,settings,stats,missed);
+  if(stats.failed)
+    printf("\n*** Warning ***\n%u : %lu camera setting(s) could not be written\n\n",Camera.id,stats.failed);
+  if(!missed.empty())
+  {
+    printf("\n*** Warning ***\n%u : %lu camera setting(s) did not take:\n",Camera.id,(unsigned long)missed.size());
+    for(size_t i=0;i<missed.size();i++)
+      printf("  %s is %s, not %s\n",missed[i].target.name.c_str(),missed[i].current.c_str(),
+             missed[i].target.value.c_str());
+    printf("\n");
+  }
+  printf("%u : setup changed %lu of %lu settings in %.1f ms (%lu reads, %lu writes)\n",Camera.id,stats.changed,
+         (unsigned long)settings.attrs.size(),(stats.readSeconds+stats.writeSeconds)*1000,stats.reads,stats.writes);
+
+  return true;
+}
+
+// create the .npy pixel, stamp and info files for a camera
+bool WriteNpyHeaders(tCamera& Camera,unsigned long width,unsigned long height,
+                     unsigned long frameCount,const char* pixelFormat)
+{
+  const char* descr;
+  uint64_t sampleSize;
+
+  if(strcmp(pixelFormat,"Mono16")==0)
+  {
+    descr = "'<u2'";
+    sampleSize = 2;
+  }
+  else if(strcmp(pixelFormat,"Mono8")==0)
+  {
+    descr = "'|u1'";
+    sampleSize = 1;
+  }
+  else
+  {
+    printf("%u : npy output does not support %s\n",Camera.id,pixelFormat);
+    return false;
+  }
 
+  // stamps and camera values go next to the pixels as <name>_stamps.npy
+  // and <name>_info.npy
+  char stampsName[1024], infoName[1024];
+  snprintf(stampsName,sizeof(stampsName),"%s",Camera.outfile);
+  char* ext = strrchr(stampsName,'.');
+  if(ext && strcmp(ext,".npy")==0)
+    *ext = 0;
+  snprintf(infoName,sizeof(infoName),"%s",stampsName);
+  strncat(stampsName,"_stamps.npy",sizeof(stampsName)-strlen(stampsName)-1);
+  strncat(infoName,"_info.npy",sizeof(infoName)-strlen(infoName)-1);
+
+  uint64_t pixelShape[3] = {frameCount,height,width};
+  uint64_t stampShape[1] = {frameCount};
+  if(!NpyOpen(Camera.npyPixels,Camera.outfile,descr,pixelShape,3,sampleSize))
+  {
+    printf("%u : failed to create %s\n",Camera.id,Camera.outfile);
+    return false;
+  }
+  if(!NpyOpen(Camera.npyStamps,stampsName,
+              "[('host_sec', '<u4'), ('host_nsec', '<u4'), ('ticks_lo', '<u4'), ('ticks_hi', '<u4')]",
+              stampShape,1,16))
+  {
+    printf("%u : failed to create %s\n",Camera.id,stampsName);
+    NpyClose(Camera.npyPixels);
+    return false;
+  }
+  if(!NpyOpen(Camera.npyInfo,infoName,
+              "[('flags', '<u4'), ('exposure', '<u4'), ('gain', '<u4'), ('sync_in', '<u2'), ('sync_out', '<u2'), "
+              "('acquisition_count', '<u4')]",
+              stampShape,1,20))
+  {
+    printf("%u : failed to create %s\n",Camera.id,infoName);
+    NpyClose(Camera.npyPixels);
+    NpyClose(Camera.npyStamps);
+    return false;
+  }
   return true;
 }
 
@@ -199,13 +630,50 @@ bool WriteHeader(tCamera& Camera)
   PvAttrUint32Get(Camera.Handle,"AcquisitionFrameCount",&frameCount);
   PvAttrEnumGet(Camera.Handle,"PixelFormat",pixelFormat,16,NULL);
 
-  // write attributes to file
-  fwrite((void*)&width,1,sizeof(long),(FILE*)Camera.fhandle); // 4 bytes
-  fwrite((void*)&height,1,sizeof(long),(FILE*)Camera.fhandle); // 4 bytes
-  fwrite((void*)&timeStampFrequency,1,sizeof(long),(FILE*)Camera.fhandle); // 4 bytes
-  fwrite((void*)&frameRate,1,sizeof(float),(FILE*)Camera.fhandle); // 4 bytes
-  fwrite((void*)&frameCount,1,sizeof(long),(FILE*)Camera.fhandle); // 4 bytes
-  fwrite((void*)&pixelFormat,1,16,(FILE*)Camera.fhandle); // 16 bytes
+  // npy output keeps the attributes in the array shape and type instead
+  if(GSession.outputFormat==eOutputNpy)
+    return WriteNpyHeaders(Camera,width,height,frameCount,pixelFormat);
+
+  // the zarr store keeps them in its array metadata and attributes
+  if(GSession.outputFormat==eOutputZarr)
+  {
+    if(!ZarrOpen(Camera.zarr,Camera.outfile,width,height,pixelFormat,
+                 GSession.zarrChunk[0],GSession.zarrChunk[1],GSession.zarrChunk[2],
+                 GSession.zarrLevel,GSession.zarrWorkers))
+    {
+      printf("%u : failed to create zarr store %s for %s\n",Camera.id,Camera.outfile,pixelFormat);
+      return false;
+    }
+    Camera.zarr.frameRate = frameRate;
+    Camera.zarr.timeStampFrequency = timeStampFrequency;
+    return true;
+  }
+
+  // footer entry per frame, collected as frames are written
+  Camera.info = new tFrameInfo[frameCount ? frameCount : 1];
+  Camera.infoCount = 0;
+  Camera.infoCapacity = frameCount ? frameCount : 1;
+
+  // write attributes to file (or stream), 36 bytes in all
+  tRecordingHeader header;
+  header.width = width;
+  header.height = height;
+  header.timeStampFrequency = timeStampFrequency;
+  header.frameRate = frameRate;
+  header.frameCount = frameCount;
+  memcpy(header.pixelFormat,pixelFormat,16);
+  RawWrite(Camera,&header,RECORDING_HEADER_SIZE);
+
+  // claim the whole recording on the card before the first frame arrives
+  if(GSession.writeBlock)
+  {
+    unsigned long frameSize = 0;
+    PvAttrUint32Get(Camera.Handle,"TotalBytesPerFrame",&frameSize);
+    uint64_t total = RECORDING_HEADER_SIZE + (uint64_t)frameCount*(RECORDING_STAMP_SIZE+frameSize) +
+                     RECORDING_TRAILER_SIZE + (uint64_t)frameCount*sizeof(tFrameInfo) + RECORDING_FOOTER_SIZE;
+    if(!AlignedReserve(Camera.writer,total))
+      printf("%u : %s\n",Camera.id,Camera.writer.error);
+  }
 
   return true;
 }
@@ -220,6 +688,14 @@ unsigned long CheckData(tCamera& Camera)
   return framesDropped;
 }
 
+// switch chunk mode off again if startCapture switched it on
+void restoreChunkMode(tCamera& Camera)
+{
+  if(Camera.chunkModeSet)
+    PvAttrBooleanSet(Camera.Handle,"ChunkModeActive",false);
+  Camera.chunkModeSet = false;
+}
+
 // unsetup camera
 void CameraUnsetup(tCamera& Camera)
 {
@@ -227,13 +703,19 @@ void CameraUnsetup(tCamera& Camera)
   PvAttrUint32Set(Camera.Handle,"EventsEnable1",0);
   PvCameraEventCallbackUnRegister(Camera.Handle,CameraEventCB);
 
-  // clear queue and close camera
+  // clear queue, put chunk mode back and close camera
   PvCaptureQueueClear(Camera.Handle);
+  restoreChunkMode(Camera);
   PvCameraClose(Camera.Handle);
 
   // delete allocated buffers
   for(int i=0;i<FRAMESCOUNT;i++)
+  {
     delete [] (char*)Camera.Frames[i].ImageBuffer;
+    delete [] (char*)Camera.Frames[i].AncillaryBuffer;
+    Camera.Frames[i].AncillaryBuffer = NULL;
+    Camera.Frames[i].AncillaryBufferSize = 0;
+  }
 
   Camera.Handle = NULL;
 }
@@ -241,6 +723,21 @@ void CameraUnsetup(tCamera& Camera)
 // set up capture
 bool startCapture(tCamera& Camera)
 {
+  // exposure, gain and sync levels come with every frame as chunk data
+  // (firmware 1.42 and later), so nothing is polled while recording
+  // (and the camera is left the way it was found, see restoreChunkMode)
+  tPvBoolean before = false;
+  PvAttrBooleanGet(Camera.Handle,"ChunkModeActive",&before);
+  Camera.ancillarySize = 0;
+  Camera.chunkModeSet = false;
+  if(PvAttrBooleanSet(Camera.Handle,"ChunkModeActive",true)==ePvErrSuccess)
+  {
+    Camera.chunkModeSet = !before;
+    PvAttrUint32Get(Camera.Handle,"NonImagePayloadSize",&Camera.ancillarySize);
+  }
+  if(Camera.ancillarySize)
+    printf("%u : chunk mode on, %lu bytes of ancillary data per frame\n",Camera.id,Camera.ancillarySize);
+
   // allocate the buffer for each frame and define the file handle
   unsigned long FrameSize = 0;
   PvAttrUint32Get(Camera.Handle,"TotalBytesPerFrame",&FrameSize);
@@ -249,8 +746,10 @@ bool startCapture(tCamera& Camera)
   {
     Camera.Frames[i].ImageBuffer = new char[FrameSize];
     Camera.Frames[i].ImageBufferSize = FrameSize;
+    Camera.Frames[i].AncillaryBuffer = Camera.ancillarySize ? new char[Camera.ancillarySize] : NULL;
+    Camera.Frames[i].AncillaryBufferSize = Camera.ancillarySize;
     Camera.Frames[i].Context[0] = Camera.Handle;
-    Camera.Frames[i].Context[1] = Camera.fhandle;
+    Camera.Frames[i].Context[1] = &Camera;
     //Camera.Frames[i].Context[2] = &Camera.lastStamp;
     //Camera.Frames[i].Context[3] = &Camera.stampInterval;
   }
@@ -288,8 +787,8 @@ bool startAcquisition(tCamera& Camera)
 {
   // set PTP start time based on GSession start time
   PvAttrUint32Set(Camera.Handle,"PtpTriggerTimeHi",GSession.startStampHi);
-  PvAttrUint32Set(Camera.Handle,"PtpTriggerTimeLo",0);
-  
+  PvAttrUint32Set(Camera.Handle,"PtpTriggerTimeLo",GSession.startStampLo);
+
   // set start time
   struct timespec tp;
   clock_gettime(CLOCK_REALTIME, &tp);
@@ -297,6 +796,8 @@ bool startAcquisition(tCamera& Camera)
   Camera.startnSecond = tp.tv_nsec;
 
   // start aquisition
+  Camera.framesReceived = 0;
+  Camera.recording = true;
   PvCommandRun(Camera.Handle,"AcquisitionStart");
 
   return true;
@@ -314,8 +815,13 @@ void checkFile(tCamera& Camera,char* Name)
 {
   // get file size
   unsigned long long fileSize;
-  fseek(Camera.fhandle, 0L, SEEK_END);
-  fileSize = ftell(Camera.fhandle);
+  if(Camera.fhandle)
+  {
+    fseek(Camera.fhandle, 0L, SEEK_END);
+    fileSize = ftell(Camera.fhandle);
+  }
+  else
+    fileSize = Camera.writer.size;
   //printf("file size: %llu from %s\n",fileSize, Name);
   
   // get attributes
@@ -328,14 +834,15 @@ void checkFile(tCamera& Camera,char* Name)
   PvAttrUint32Get(Camera.Handle,"AcquisitionFrameCount",&frameCount);
   PvAttrEnumGet(Camera.Handle,"PixelFormat",pixelFormat,16,NULL);
   
-  // calculate expected size
+  // calculate expected size (with the footer, one entry per frame)
   unsigned long long expectedSize = 0;
+  unsigned long long footerSize = (unsigned long long)frameCount * sizeof(tFrameInfo) + RECORDING_FOOTER_SIZE;
   if(strcmp(pixelFormat,"Mono8")==0)
-    expectedSize = 8ull * (unsigned long long)width * (unsigned long long)height * (unsigned long long)frameCount / 8ull + (unsigned long long)frameCount * 16ull + 40ull;
+    expectedSize = 8ull * (unsigned long long)width * (unsigned long long)height * (unsigned long long)frameCount / 8ull + (unsigned long long)frameCount * 16ull + 40ull + footerSize;
   if(strcmp(pixelFormat,"Mono12Packed")==0)
-    expectedSize = 12ull * (unsigned long long)width * (unsigned long long)height * (unsigned long long)frameCount / 8ull + (unsigned long long)frameCount * 16ull + 40ull;
+    expectedSize = 12ull * (unsigned long long)width * (unsigned long long)height * (unsigned long long)frameCount / 8ull + (unsigned long long)frameCount * 16ull + 40ull + footerSize;
   if(strcmp(pixelFormat,"Mono16")==0)
-    expectedSize = 16ull * (unsigned long long)width * (unsigned long long)height * (unsigned long long)frameCount / 8ull + (unsigned long long)frameCount * 16ull + 40ull;
+    expectedSize = 16ull * (unsigned long long)width * (unsigned long long)height * (unsigned long long)frameCount / 8ull + (unsigned long long)frameCount * 16ull + 40ull + footerSize;
 
   // compare sizes
   if(expectedSize==fileSize)
@@ -348,6 +855,51 @@ void checkFile(tCamera& Camera,char* Name)
   
 }
 
+// flush the staging tier and print how far behind the file it ran
+void stageReport(tCamera& Camera)
+{
+  tStager& S = Camera.stager;
+  bool ok = StageClose(S);
+  printf("Staged up to %.1f of %.1f MB; data stayed in RAM up to %.2f s (mean %.2f s).\n",S.maxUsed/1048576.0,
+         S.budget/1048576.0,S.maxAge,S.aged ? S.ageSum/S.aged : 0.0);
+  if(S.waits)
+    printf("\n*** Warning ***\nStaging was full %llu times, holding frames for up to %.1f ms (%.2f s in all).\n\n",
+           (unsigned long long)S.waits,S.maxWaitSeconds*1000,S.waitSeconds);
+  if(!ok)
+    printf("\n*** Warning ***\nFailed to write staged data to %s.\n\n",Camera.outfile);
+}
+
+// finish the aligned file and print the longest stalls it caused
+void writerReport(tCamera& Camera)
+{
+  tAlignedWriter& W = Camera.writer;
+  bool ok = AlignedClose(W);
+  printf("%llu blocks of %lu KB written%s, longest write %.1f ms (mean %.1f ms).\n",
+         (unsigned long long)W.writes,(unsigned long)(W.blockSize>>10),W.direct ? " direct" : "",
+         W.maxWriteSeconds*1000,W.writes ? W.writeSeconds*1000/W.writes : 0.0);
+  printf("%llu syncs, longest %.1f ms (%.2f s in all).\n",(unsigned long long)W.syncs,W.maxSyncSeconds*1000,
+         W.syncSeconds);
+  if(!ok)
+    printf("\n*** Warning ***\nWriting %s failed: %s\n\n",Camera.outfile,W.error);
+}
+
+// finish the stream and print its accounting
+void streamReport(tCamera& Camera)
+{
+  tStreamSender& S = Camera.stream;
+  bool ok = StreamClose(S);
+  printf("%llu frames (%.1f MB) streamed to %s, %s.\n",(unsigned long long)S.frames,S.bytes/1e6,
+         GSession.streamAddress,S.zerocopy ? "zero-copy" : "copied");
+  printf("Up to %u frames in flight; %llu waits for the link (%.2f s), %.2f s blocked sending.\n",
+         S.maxPending,(unsigned long long)S.waits,S.waitSeconds,S.sendSeconds);
+  if(S.copied)
+    printf("%llu zero-copy sends were copied by the kernel.\n",(unsigned long long)S.copied);
+  if(S.stranded)
+    printf("%u frame buffers are still lent to the socket and were not requeued.\n",S.stranded);
+  if(!ok)
+    printf("\n*** Warning ***\nStream to %s failed: %s\n\n",GSession.streamAddress,S.error);
+}
+
 // calculate rate
 void calculateRate(tCamera& Camera)
 {
@@ -370,6 +922,141 @@ void calculateRate(tCamera& Camera)
     printf("\n*** Warning ***\nFrame rate was approximately %.1f%% lower than expected.\n\n",rateError*(-1));
 }
 
+// what a burst reports back
+typedef struct
+{
+  double started;       // host time of the last AcquisitionStart
+  double firstFrame;    // host time of the first frame (0 if none came)
+  char   summary[512];  // frames/dropped per camera, or what went wrong
+} tBurstResult;
+
+// read the camera's address and name
+bool cameraNames(tCamera& Camera)
+{
+  return !PvAttrStringGet(Camera.Handle,"DeviceIPAddress",Camera.ip,sizeof(Camera.ip),NULL) &&
+         !PvAttrStringGet(Camera.Handle,"CameraName",Camera.name,sizeof(Camera.name),NULL);
+}
+
+// open the camera's output for Camera.outfile (npy files are created with the header)
+bool openOutput(tCamera& Camera)
+{
+  bool outputOpen = true;
+  if(GSession.outputFormat==eOutputRaw && GSession.writeBlock)
+  {
+    if(!AlignedOpen(Camera.writer,Camera.outfile,GSession.writeBlock,GSession.writeSync))
+    {
+      printf("%u : %s\n",Camera.id,Camera.writer.error);
+      AlignedClose(Camera.writer);
+      outputOpen = false;
+    }
+  }
+  else if(GSession.outputFormat==eOutputRaw)
+  {
+    Camera.fhandle = fopen(Camera.outfile,"wb");
+    if(!Camera.fhandle)
+    {
+      printf("%u : failed to create %s\n",Camera.id,Camera.outfile);
+      outputOpen = false;
+    }
+  }
+
+  // frames land in RAM first and a background thread moves them to the file
+  if(outputOpen && GSession.outputFormat==eOutputRaw && GSession.stageBudget &&
+     !StageOpen(Camera.stager,GSession.stageBudget,GSession.stageRate,FileWrite,&Camera))
+  {
+    printf("%u : cannot set aside %lu MB for staging\n",Camera.id,GSession.stageBudget>>20);
+    if(GSession.writeBlock)
+      AlignedClose(Camera.writer);
+    else
+      fclose(Camera.fhandle);
+    Camera.fhandle = NULL;
+    outputOpen = false;
+  }
+
+  // or connect to the collector, which writes the file under the same name
+  if(GSession.outputFormat==eOutputStream &&
+     !StreamConnect(Camera.stream,GSession.streamAddress,Camera.outfile,GSession.streamInFlight,RequeueFrame))
+  {
+    printf("%u : %s\n",Camera.id,Camera.stream.error);
+    StreamClose(Camera.stream);
+    outputOpen = false;
+  }
+  return outputOpen;
+}
+
+// wait for the acquisition end event and then for frames still on their
+// way (at most 4 s); returns the frames dropped since DroppedBefore
+unsigned long waitForFrames(tCamera& Camera,unsigned long DroppedBefore)
+{
+  // wait until acquisition complete callbacks fire
+  while(!Camera.acquisitionComplete)
+    Sleep(10);
+
+  unsigned long framesDropped = CheckData(Camera)-DroppedBefore;
+  for(int waited=0;waited<4000 &&
+      Camera.framesReceived+framesDropped<(unsigned long)GSession.AcquisitionFrameCount;waited+=20)
+  {
+    Sleep(20);
+    framesDropped = CheckData(Camera)-DroppedBefore;
+  }
+  Camera.recording = false;
+  return framesDropped;
+}
+
+// finish the output of a capture and check it
+void finishOutput(tCamera& Camera,unsigned long framesDropped)
+{
+  // print dropped frames
+  printf("%lu frames dropped from %s.\n",framesDropped,Camera.name);
+
+  if(GSession.outputFormat==eOutputNpy)
+  {
+    // fix up the array headers with the frames actually written
+    printf("%llu frames written to %s.\n",(unsigned long long)Camera.npyPixels.written,Camera.outfile);
+    bool ok = NpyClose(Camera.npyPixels);
+    ok = NpyClose(Camera.npyStamps) && ok;
+    ok = NpyClose(Camera.npyInfo) && ok;
+    if(!ok)
+      printf("\n*** Warning ***\nFailed to finish npy files for %s.\n\n",Camera.outfile);
+  }
+  else if(GSession.outputFormat==eOutputZarr)
+  {
+    // flush the last chunks and write the consolidated metadata
+    bool ok = ZarrClose(Camera.zarr);
+    printf("%llu frames written to %s (compressed to %.1f%%).\n",
+           (unsigned long long)Camera.zarr.frames,Camera.outfile,
+           Camera.zarr.bytesIn ? 100.0*Camera.zarr.bytesOut/Camera.zarr.bytesIn : 0.0);
+    if(!ok)
+      printf("\n*** Warning ***\nFailed to finish zarr store %s.\n\n",Camera.outfile);
+  }
+  else
+  {
+    // write dropped frames to file
+    uint32_t dropped = framesDropped;
+    RawWrite(Camera,&dropped,RECORDING_TRAILER_SIZE);
+
+    // then the per-frame checksums
+    WriteFooter(Camera);
+
+    // check file size, or report how the stream kept up
+    if(GSession.outputFormat==eOutputStream)
+      streamReport(Camera);
+    else
+    {
+      if(GSession.stageBudget)
+        stageReport(Camera);
+      if(GSession.writeBlock)
+        writerReport(Camera);
+      checkFile(Camera,Camera.name);
+    }
+  }
+
+  // close output file
+  if(Camera.fhandle)
+    fclose(Camera.fhandle);
+  Camera.fhandle = NULL;
+}
+
 // thread function
 void *ThreadFunc(void *pContext)
 {
@@ -379,19 +1066,15 @@ void *ThreadFunc(void *pContext)
   //Camera->lastStamp = 1;
   //Camera->stampInterval = 2;
 
-  if(!PvCameraOpen(Camera->uid,ePvAccessMaster,&(Camera->Handle)))
+  if(!openCamera(*Camera))
   {
-    char IP[128];
-    char Name[128];
-
-    if(!PvAttrStringGet(Camera->Handle,"DeviceIPAddress",IP,128,NULL) &&
-        !PvAttrStringGet(Camera->Handle,"CameraName",Name,128,NULL))
+    if(cameraNames(*Camera))
     {
 
-      printf("%u : camera %s (%s) successfully opened\n",Camera->id,IP,Name);
+      printf("%u : camera %s (%s) successfully opened\n",Camera->id,Camera->ip,Camera->name);
 
       // open an output file for this thread
-      Camera->fhandle = fopen(Camera->outfile,"wb");
+      bool outputOpen = openOutput(*Camera);
 
       // set start time (only the first camera does this)
       if(Camera->id==1)
@@ -402,7 +1085,7 @@ void *ThreadFunc(void *pContext)
         Sleep(100);
 
       // setup camera
-      if(CameraSetup(*Camera))
+      if(outputOpen && CameraSetup(*Camera))
       {
         // write header information here (through header write function)
         if(WriteHeader(*Camera))
@@ -412,27 +1095,15 @@ void *ThreadFunc(void *pContext)
           {
             if(startAcquisition(*Camera))
             {
-              // wait until acquisition complete callbacks fire
-              while(!Camera->acquisitionComplete)
-                Sleep(250);
-
-	      // sleep just a bit
-	      Sleep(4000);
+              // wait for the acquisition and the last frames
+              unsigned long framesDropped = waitForFrames(*Camera,0);
 
-              // print dropped frames and write to file
-              unsigned long framesDropped = CheckData(*Camera);
-              printf("%lu frames dropped from %s.\n",framesDropped, Name);
-              fwrite((void*)&framesDropped,1,sizeof(unsigned long),(FILE*)Camera->fhandle);
-
-              // check file size
-              checkFile(*Camera, Name);
+              // write the trailer and check the output
+              finishOutput(*Camera,framesDropped);
 
 	      // calculate approximate frame rate
 	      calculateRate(*Camera);
 
-              // close output file
-              fclose(Camera->fhandle);
-
               // finish up
               CameraStop(*Camera);
               CameraUnsetup(*Camera);
@@ -444,7 +1115,7 @@ void *ThreadFunc(void *pContext)
     else
       printf("%u : camera opened but something went wrong\n",Camera->id);
 
-    printf("%u : camera %s (%s) successfully closed\n",Camera->id,IP,Name);
+    printf("%u : camera %s (%s) successfully closed\n",Camera->id,Camera->ip,Camera->name);
   }
   else
     printf("%u : camera failed to open\n",Camera->id);
@@ -452,6 +1123,464 @@ void *ThreadFunc(void *pContext)
   return 0;
 } 
 
+// daemon: open, set up and start capture on a camera, so bursts only have to start acquisition
+bool armCamera(tCamera& Camera)
+{
+  if(openCamera(Camera))
+  {
+    printf("%u : camera failed to open\n",Camera.id);
+    Camera.Handle = NULL;
+    return false;
+  }
+  if(!cameraNames(Camera) || !CameraSetup(Camera) || !startCapture(Camera))
+  {
+    printf("%u : camera opened but something went wrong\n",Camera.id);
+    restoreChunkMode(Camera);
+    PvCameraClose(Camera.Handle);
+    Camera.Handle = NULL;
+    return false;
+  }
+  printf("%u : camera %s (%s) armed\n",Camera.id,Camera.ip,Camera.name);
+  return true;
+}
+
+// daemon: choose a PTP start time MarginMs ahead on the first camera's clock
+void setBurstStart(tCamera& Camera,unsigned int MarginMs)
+{
+  unsigned long hi = 0, lo = 0, frequency = 0;
+  PvCommandRun(Camera.Handle,"TimeStampValueLatch");
+  PvAttrUint32Get(Camera.Handle,"TimeStampValueHi",&hi);
+  PvAttrUint32Get(Camera.Handle,"TimeStampValueLo",&lo);
+  PvAttrUint32Get(Camera.Handle,"TimeStampFrequency",&frequency);
+
+  uint64_t start = ((uint64_t)hi<<32 | lo) + (uint64_t)frequency*MarginMs/1000;
+  GSession.startStampHi = (unsigned long)(start>>32);
+  GSession.startStampLo = (unsigned long)(start & 0xffffffff);
+  GSession.startStampSet = 1;
+}
+
+// daemon: check a burst's frame count and rate against each camera's model,
+// and what its frames need of the link and the disk; false with the reason
+bool checkBurst(unsigned long Frames,float Rate,std::string& Error)
+{
+  std::vector<tConfigRate> rates;
+  std::vector<std::string> errors;
+  for(int i=0;i<GSession.Count && errors.empty();i++)
+  {
+    tAttrSnapshot burst;
+    burst.uid = GSession.Cameras[i].uid;
+    AttrTarget(burst,"FrameRate",ePvDatatypeFloat32,AttrText((double)Rate,true));
+    AttrTarget(burst,"AcquisitionFrameCount",ePvDatatypeUint32,AttrText(Frames));
+    ConfigValidate(GModels[i].attrs.empty() ? NULL : &GModels[i],burst,errors);
+
+    // the size and packets come from the checked settings
+    tAttrSnapshot settings = GSettings[i];
+    ConfigPut(settings,"FrameRate",ePvDatatypeFloat32,AttrText((double)Rate,true));
+    tConfigRate rate;
+    std::string error;
+    if(ConfigRate(settings,rate,error))
+      rates.push_back(rate);
+    else
+      errors.push_back(error);
+    for(size_t k=0;k<errors.size();k++)
+      errors[k] = "camera " + AttrText((unsigned long)(i+1)) + ": " + errors[k];
+  }
+  if(errors.empty())
+    budgetFits(rates,errors);
+  if(errors.empty())
+    return true;
+  Error = errors[0];
+  return false;
+}
+
+// run one burst of Frames at Rate on every armed camera, one output per camera
+bool runBurst(unsigned long Frames,float Rate,char** Outfiles,tBurstResult& Result)
+{
+  int count = GSession.Count;
+
+  // nothing is opened for a burst the cameras or the budget cannot take
+  std::string error;
+  if(!checkBurst(Frames,Rate,error))
+  {
+    snprintf(Result.summary,sizeof(Result.summary),"%s",error.c_str());
+    return false;
+  }
+
+  // per-burst settings and outputs
+  GSession.AcquisitionFrameCount = Frames;
+  GSession.frameRate = Rate;
+  GSession.actualFramesAcquired = 0;
+  int ready;
+  bool opened = false;
+  for(ready=0;ready<count;ready++)
+  {
+    // the name may live in a request buffer; keep a copy for the whole burst
+    tCamera& Camera = GSession.Cameras[ready];
+    snprintf(Camera.outname,sizeof(Camera.outname),"%s",Outfiles[ready]);
+    Camera.outfile = Camera.outname;
+    Camera.acquisitionComplete = false;
+    PvAttrFloat32Set(Camera.Handle,"FrameRate",Rate);
+    PvAttrUint32Set(Camera.Handle,"AcquisitionFrameCount",Frames);
+    Camera.droppedBefore = CheckData(Camera);
+    opened = openOutput(Camera);
+    if(!opened || !WriteHeader(Camera))
+      break;
+  }
+  if(ready<count)
+  {
+    // give up on the burst; outputs already begun end as empty recordings,
+    // including a raw or streamed one whose header failed (npy and zarr
+    // outputs are already closed when their header fails)
+    for(int i=0;i<ready;i++)
+      finishOutput(GSession.Cameras[i],0);
+    if(opened && GSession.outputFormat!=eOutputNpy && GSession.outputFormat!=eOutputZarr)
+      finishOutput(GSession.Cameras[ready],0);
+    snprintf(Result.summary,sizeof(Result.summary),"cannot create output for camera %d",ready+1);
+    return false;
+  }
+
+  // common start on the PTP clock, a few ms from now
+  setBurstStart(GSession.Cameras[0],GSession.startMargin);
+  for(int i=0;i<count;i++)
+    startAcquisition(GSession.Cameras[i]);
+  Result.started = GSession.Cameras[count-1].startSecond + GSession.Cameras[count-1].startnSecond/1e9;
+
+  // wait for every camera, then finish the outputs
+  int length = 0;
+  Result.summary[0] = 0;
+  Result.firstFrame = 0;
+  for(int i=0;i<count;i++)
+  {
+    tCamera& Camera = GSession.Cameras[i];
+    unsigned long framesDropped = waitForFrames(Camera,Camera.droppedBefore);
+    finishOutput(Camera,framesDropped);
+    calculateRate(Camera);
+    if(Camera.framesReceived && (Result.firstFrame==0 || Camera.firstFrame<Result.firstFrame))
+      Result.firstFrame = Camera.firstFrame;
+    if(length<(int)sizeof(Result.summary))
+      length += snprintf(Result.summary+length,sizeof(Result.summary)-length,"%s%lu/%lu",i ? " " : "",
+                         Camera.framesReceived,framesDropped);
+  }
+  return true;
+}
+
+volatile sig_atomic_t stopRequested = 0;
+
+// stop the daemon or the schedule between bursts
+void StopHandler(int Signal)
+{
+  stopRequested = 1;
+}
+
+// arm every camera for bursts; returns how many were armed before any failure
+int armCameras()
+{
+  int armed;
+  for(armed=0;armed<GSession.Count;armed++)
+    if(!armCamera(GSession.Cameras[armed]))
+      break;
+
+  // no SA_RESTART, so a signal ends a wait in accept or clock_nanosleep
+  struct sigaction action;
+  memset(&action,0,sizeof(action));
+  action.sa_handler = StopHandler;
+  sigaction(SIGINT,&action,NULL);
+  sigaction(SIGTERM,&action,NULL);
+  signal(SIGPIPE,SIG_IGN);
+  return armed;
+}
+
+// close the cameras armCameras opened
+void disarmCameras(int Armed)
+{
+  for(int i=0;i<Armed;i++)
+  {
+    CameraStop(GSession.Cameras[i]);
+    CameraUnsetup(GSession.Cameras[i]);
+    printf("%u : camera %s (%s) successfully closed\n",GSession.Cameras[i].id,GSession.Cameras[i].ip,
+           GSession.Cameras[i].name);
+  }
+}
+
+// daemon: arm the cameras once, then run bursts requested on a UNIX socket.
+// A request is one line, answered with one line:
+//   burst <frames> <fps> <outfile> [<outfile> ...]  one output per camera, in -u order
+//   status                                          ready <cameras>
+//   quit                                            stop the daemon
+void runDaemon()
+{
+  int armed = armCameras();
+
+  // listen (a stale socket from an earlier run is replaced)
+  int listener = -1;
+  struct sockaddr_un address;
+  memset(&address,0,sizeof(address));
+  address.sun_family = AF_UNIX;
+  strncpy(address.sun_path,GSession.daemonSocket,sizeof(address.sun_path)-1);
+  if(armed==GSession.Count)
+  {
+    unlink(GSession.daemonSocket);
+    listener = socket(AF_UNIX,SOCK_STREAM,0);
+    if(listener<0 || bind(listener,(struct sockaddr*)&address,sizeof(address))!=0 || listen(listener,8)!=0)
+    {
+      printf("cannot listen on %s: %s\n",GSession.daemonSocket,strerror(errno));
+      if(listener>=0)
+        close(listener);
+      listener = -1;
+    }
+  }
+
+  if(listener>=0)
+    printf("%i camera(s) armed, waiting for bursts on %s\n",GSession.Count,GSession.daemonSocket);
+  while(listener>=0 && !stopRequested)
+  {
+    int client = accept(listener,NULL,NULL);
+    if(client<0)
+      continue;
+
+    // a client that never finishes its line must not hold up the next burst
+    struct timeval timeout = {5,0};
+    setsockopt(client,SOL_SOCKET,SO_RCVTIMEO,&timeout,sizeof(timeout));
+
+    // one request line
+    char request[4096];
+    size_t got = 0;
+    ssize_t n;
+    while(got<sizeof(request)-1 && (n=read(client,request+got,sizeof(request)-1-got))>0)
+    {
+      got += n;
+      if(memchr(request,'\n',got))
+        break;
+    }
+    request[got] = 0;
+    struct timespec tp;
+    clock_gettime(CLOCK_REALTIME, &tp);
+    double requested = tp.tv_sec + tp.tv_nsec/1e9;
+
+    char reply[1024];
+    char* words[DAEMON_WORDS];
+    int count = 0;
+    for(char* w=strtok(request," \t\r\n");w && count<DAEMON_WORDS;w=strtok(NULL," \t\r\n"))
+      words[count++] = w;
+    if(count==1 && strcmp(words[0],"status")==0)
+      snprintf(reply,sizeof(reply),"ready %i\n",GSession.Count);
+    else if(count==1 && strcmp(words[0],"quit")==0)
+    {
+      snprintf(reply,sizeof(reply),"ok\n");
+      stopRequested = 1;
+    }
+    else if(count>=3 && strcmp(words[0],"burst")==0)
+    {
+      long frames = atol(words[1]);
+      float rate = atof(words[2]);
+      if(frames<=0 || rate<=0)
+        snprintf(reply,sizeof(reply),"error bad frame count or rate\n");
+      else if(count-3!=GSession.Count)
+        snprintf(reply,sizeof(reply),"error %i output files needed\n",GSession.Count);
+      else
+      {
+        // latencies from the request: to the last AcquisitionStart and to the first frame
+        printf("burst of %ld frames at %.1f fps\n",frames,rate);
+        tBurstResult result;
+        if(runBurst(frames,rate,words+3,result))
+          snprintf(reply,sizeof(reply),"ok %s start_ms=%.1f first_frame_ms=%.1f\n",result.summary,
+                   (result.started-requested)*1000,result.firstFrame>0 ? (result.firstFrame-requested)*1000 : -1.0);
+        else
+          snprintf(reply,sizeof(reply),"error %s\n",result.summary);
+      }
+    }
+    else
+      snprintf(reply,sizeof(reply),"error unknown request\n");
+
+    if(write(client,reply,strlen(reply))<0)
+      printf("could not answer a request: %s\n",strerror(errno));
+    close(client);
+  }
+
+  if(listener>=0)
+  {
+    close(listener);
+    unlink(GSession.daemonSocket);
+  }
+  disarmCameras(armed);
+}
+
+// output name for a scheduled burst: Pattern through strftime (UTC of the
+// scheduled time) if it has a %, otherwise Pattern with _<burst> before the extension
+void burstName(char* Name,size_t Size,const char* Pattern,unsigned long Burst,time_t Scheduled)
+{
+  if(strchr(Pattern,'%'))
+  {
+    struct tm t;
+    gmtime_r(&Scheduled,&t);
+    if(strftime(Name,Size,Pattern,&t)>0)
+      return;
+  }
+  const char* slash = strrchr(Pattern,'/');
+  const char* dot = strrchr(Pattern,'.');
+  int stem = dot && (!slash || dot>slash) ? dot-Pattern : strlen(Pattern);
+  snprintf(Name,Size,"%.*s_%04lu%s",stem,Pattern,Burst,Pattern+stem);
+}
+
+// schedule: a burst of -n frames at -r fps every scheduleInterval seconds,
+// on absolute deadlines aligned to the wall clock (like cron, without its
+// jitter or a new process per burst); reports how late each burst started
+void runSchedule()
+{
+  int count = GSession.Count;
+  int armed = armCameras();
+  if(armed<count)
+  {
+    disarmCameras(armed);
+    return;
+  }
+
+  // the -o names are patterns; runBurst points the cameras at this burst's names
+  const char** patterns = new const char*[count];
+  char (*names)[1024] = new char[count][1024];
+  char** outfiles = new char*[count];
+  for(int i=0;i<count;i++)
+  {
+    patterns[i] = GSession.Cameras[i].outfile;
+    outfiles[i] = names[i];
+  }
+
+  // first deadline: the next multiple of the interval
+  double interval = GSession.scheduleInterval;
+  struct timespec tp;
+  clock_gettime(CLOCK_REALTIME,&tp);
+  double first = (floor((tp.tv_sec + tp.tv_nsec/1e9)/interval)+1)*interval;
+  printf("%i camera(s) armed, %lu frames at %.1f fps every %.1f s from %.3f\n",count,
+         (unsigned long)GSession.AcquisitionFrameCount,GSession.frameRate,interval,first);
+
+  unsigned long bursts = 0, missed = 0, failed = 0;
+  double startSum = 0, startMax = 0, frameSum = 0, frameSquares = 0, frameMin = 0, frameMax = 0;
+  unsigned long framed = 0;
+  for(unsigned long k=0;!stopRequested && (GSession.scheduleBursts==0 || bursts+missed<GSession.scheduleBursts);k++)
+  {
+    // deadlines that passed while the last burst ran are skipped, not run late
+    double deadline = first + k*interval;
+    clock_gettime(CLOCK_REALTIME,&tp);
+    if(tp.tv_sec + tp.tv_nsec/1e9 > deadline+interval/2)
+    {
+      missed++;
+      printf("\n*** Warning ***\nBurst %lu skipped: the previous burst ran past its slot.\n\n",k);
+      continue;
+    }
+    struct timespec wake;
+    wake.tv_sec = (time_t)deadline;
+    wake.tv_nsec = (long)((deadline-wake.tv_sec)*1e9);
+    if(clock_nanosleep(CLOCK_REALTIME,TIMER_ABSTIME,&wake,NULL)!=0)
+      continue; // interrupted: stopRequested is checked above
+
+    for(int i=0;i<count;i++)
+      burstName(names[i],sizeof(names[i]),patterns[i],k,(time_t)deadline);
+    tBurstResult result;
+    bursts++;
+    if(!runBurst(GSession.AcquisitionFrameCount,GSession.frameRate,outfiles,result))
+    {
+      failed++;
+      printf("\n*** Warning ***\nBurst %lu failed: %s\n\n",k,result.summary);
+      continue;
+    }
+
+    // lateness against the schedule
+    double start = result.started-deadline;
+    startSum += start;
+    startMax = start>startMax ? start : startMax;
+    printf("burst %lu: %s, started %.1f ms",k,result.summary,start*1000);
+    if(result.firstFrame>0)
+    {
+      double frame = result.firstFrame-deadline;
+      frameSum += frame;
+      frameSquares += frame*frame;
+      frameMin = framed==0 || frame<frameMin ? frame : frameMin;
+      frameMax = framed==0 || frame>frameMax ? frame : frameMax;
+      framed++;
+      printf(", first frame %.1f ms",frame*1000);
+    }
+    printf(" after its deadline\n");
+  }
+
+  // latency and jitter over the run
+  unsigned long run = bursts-failed;
+  printf("%lu bursts run, %lu failed, %lu skipped.\n",run,failed,missed);
+  if(run)
+    printf("Start latency: mean %.1f ms, max %.1f ms.\n",startSum/run*1000,startMax*1000);
+  if(framed)
+  {
+    double mean = frameSum/framed;
+    double variance = frameSquares/framed-mean*mean;
+    printf("First frame latency: mean %.1f ms, jitter %.2f ms (sd), %.1f to %.1f ms.\n",mean*1000,
+           variance>0 ? sqrt(variance)*1000 : 0.0,frameMin*1000,frameMax*1000);
+  }
+  disarmCameras(armed);
+  delete [] patterns;
+  delete [] names;
+  delete [] outfiles;
+}
+
+// read the session file (-c); its cameras are used when none are given with -u
+bool loadConfig()
+{
+  std::string error;
+  if(!ConfigLoad(GSession.configPath,GConfig,error))
+  {
+    printf("%s\n",error.c_str());
+    return false;
+  }
+  if(GSession.Count==0)
+  {
+    std::vector<unsigned long> uids;
+    ConfigCameras(GConfig,uids);
+    GSession.Count = uids.size();
+    GSession.configCameras = true;
+  }
+  return true;
+}
+
+// session file values, before the command line overrides them
+void configDefaults()
+{
+  const char* value;
+  if((value = ConfigValue(GConfig,"session","frames")))
+    GSession.AcquisitionFrameCount = atol(value);
+  if((value = ConfigValue(GConfig,"session","rate")))
+    GSession.frameRate = atof(value);
+  if((value = ConfigValue(GConfig,"session","exposure")))
+    GSession.ExposureValue = atol(value);
+  if((value = ConfigValue(GConfig,"session","exposure_auto_max")))
+    GSession.ExposureAutoMax = atol(value);
+  if((value = ConfigValue(GConfig,"session","gain_auto_max")))
+    GSession.GainAutoMax = atol(value);
+
+  if(GSession.configCameras)
+  {
+    std::vector<unsigned long> uids;
+    ConfigCameras(GConfig,uids);
+    for(size_t i=0;i<uids.size();i++)
+    {
+      GSession.Count++;
+      GSession.Cameras[GSession.Count-1].uid = uids[i];
+      GSession.Cameras[GSession.Count-1].id = GSession.Count;
+    }
+  }
+}
+
+// cameras given no -o take their output file from the session file
+void configOutfiles()
+{
+  for(int i=0;i<GSession.Count;i++)
+  {
+    const char* outfile = ConfigValue(GConfig,ConfigSection(GSession.Cameras[i].uid),"outfile");
+    if(!GSession.Cameras[i].outfile && outfile)
+    {
+      GSession.Cameras[i].outfile = (char*)outfile;
+      GSession.outfileCount++;
+    }
+  }
+}
+
 // main
 int main(int argc, char* argv[])
 {
@@ -467,29 +1596,61 @@ int main(int argc, char* argv[])
 
       // count the number of cameras specified so that GSession.Cameras can be created
       GSession.Count = 0;
-      while ((c = getopt (argc, argv, "u:o:n:e:r:m:g:")) != -1)
+      while ((c = getopt (argc, argv, "u:o:n:e:r:m:g:f:z:s:w:b:d:t:l:c:")) != -1)
       {
         switch(c)
         {
           case 'u':
             {
               GSession.Count++;
+              break;
+            }
+          case 'c':
+            {
+              // session file: settings and per-camera attributes, checked before any camera is opened
+              GSession.configPath = optarg;
+              break;
             }
         }
       }
 
-      if(GSession.Count>0)
+      if(GSession.configPath && !loadConfig())
+        printf("Session file not used, nothing done.\n");
+      else if(GSession.Count>0)
       {
 
         // initilaize GSession.Cameras
         GSession.Cameras = new tCamera[GSession.Count];
         memset(GSession.Cameras,0,sizeof(tCamera) * GSession.Count);
 
+        // zarr defaults
+        GSession.zarrChunk[0] = 8;
+        GSession.zarrChunk[1] = 256;
+        GSession.zarrChunk[2] = 256;
+        GSession.zarrLevel = 1;
+        GSession.zarrWorkers = 2;
+
+        // stream defaults
+        GSession.streamInFlight = 64;
+
+        // daemon bursts start this far ahead, so every camera has its trigger time
+        GSession.startMargin = 50;
+
+        // aligned writer defaults (used with -w)
+        GSession.writeSync = ALIGNED_SYNC_BYTES;
+
+        // exposure and gain limits not given are left as the camera has them
+        GSession.ExposureValue = -1;
+        GSession.ExposureAutoMax = -1;
+        GSession.GainAutoMax = -1;
+
         // loop through options again (for real this time)
         GSession.Count = 0;
         GSession.outfileCount = 0;
+        if(GSession.configPath)
+          configDefaults();
         optind = 0;
-        while ((c = getopt (argc, argv, "u:o:n:e:r:m:g:")) != -1)
+        while ((c = getopt (argc, argv, "u:o:n:e:r:m:g:f:z:s:w:b:d:t:l:c:")) != -1)
         {
           switch(c)
           {
@@ -538,11 +1699,113 @@ int main(int argc, char* argv[])
                   GSession.GainAutoMax = atol(optarg);
                 break;
               } 
+            case 'f':
+              {
+                if(optarg && strcmp(optarg,"npy")==0)
+                  GSession.outputFormat = eOutputNpy;
+                else if(optarg && strcmp(optarg,"zarr")==0)
+                  GSession.outputFormat = eOutputZarr;
+                else if(optarg && strcmp(optarg,"raw")!=0)
+                  printf("Unknown output format %s, writing raw.\n",optarg);
+                break;
+              }
+            case 'z':
+              {
+                // zarr chunking: frames,rows,columns[,level[,workers]]
+                if(optarg)
+                  sscanf(optarg,"%u,%u,%u,%d,%u",&GSession.zarrChunk[0],&GSession.zarrChunk[1],
+                         &GSession.zarrChunk[2],&GSession.zarrLevel,&GSession.zarrWorkers);
+                break;
+              }
+            case 's':
+              {
+                // stream to a collector: host:port[,frames in flight]
+                if(optarg)
+                {
+                  char* comma = strchr(optarg,',');
+                  if(comma)
+                  {
+                    *comma = 0;
+                    GSession.streamInFlight = atoi(comma+1);
+                  }
+                  GSession.streamAddress = optarg;
+                  GSession.outputFormat = eOutputStream;
+                }
+                break;
+              }
+            case 'w':
+              {
+                // raw output in aligned direct writes: block MB[,MB between syncs]
+                if(optarg)
+                {
+                  unsigned int blockMB = 0, syncMB = 0;
+                  int n = sscanf(optarg,"%u,%u",&blockMB,&syncMB);
+                  GSession.writeBlock = (unsigned long)blockMB<<20;
+                  if(n==2)
+                    GSession.writeSync = (unsigned long)syncMB<<20;
+                }
+                break;
+              }
+            case 'd':
+              {
+                // keep the cameras armed and take bursts on a UNIX socket: path[,start margin ms]
+                if(optarg)
+                {
+                  char* comma = strchr(optarg,',');
+                  if(comma)
+                  {
+                    *comma = 0;
+                    GSession.startMargin = atoi(comma+1);
+                  }
+                  GSession.daemonSocket = optarg;
+                }
+                break;
+              }
+            case 'l':
+              {
+                // look cameras up in a camera_discovery service instead of waiting for PvAPI
+                if(optarg)
+                  GSession.discoverySocket = optarg;
+                break;
+              }
+            case 't':
+              {
+                // repeat the capture on a schedule: seconds between bursts[,bursts]
+                if(optarg)
+                  sscanf(optarg,"%lf,%lu",&GSession.scheduleInterval,&GSession.scheduleBursts);
+                break;
+              }
+            case 'b':
+              {
+                // stage raw output in RAM: MB per camera[,MB/s to the file]
+                if(optarg)
+                {
+                  unsigned int budgetMB = 0;
+                  float rateMB = 0;
+                  sscanf(optarg,"%u,%f",&budgetMB,&rateMB);
+                  GSession.stageBudget = (unsigned long)budgetMB<<20;
+                  GSession.stageRate = rateMB*1048576.0;
+                }
+                break;
+              }
           }
         }
 
+        if(GSession.configPath)
+          configOutfiles();
+
+        // a daemon gets its output files with each burst
+        if(GSession.daemonSocket)
+        {
+          if(!WaitForCamera())
+            printf(" all cameras not found.\n");
+          else if(checkSettings())
+            runDaemon();
+          delete [] GSession.Cameras;
+        }
+
         // check to see of number of cameras equals number of output files
-        if(GSession.Count == GSession.outfileCount)
+        else if(GSession.Count == GSession.outfileCount)
         {
           // initialize startStamps
           GSession.startStampHi = 0;
@@ -552,8 +1815,17 @@ int main(int argc, char* argv[])
           // initialize actual frame count
 	  GSession.actualFramesAcquired = 0;
 
-          // wait for cameras
-          if(WaitForCamera())
+          // wait for cameras, then check the settings before opening any
+          bool found = WaitForCamera();
+          if(found && !checkSettings())
+            delete [] GSession.Cameras;
+          else if(found && GSession.scheduleInterval>0)
+          {
+            // cameras stay armed from burst to burst
+            runSchedule();
+            delete [] GSession.Cameras;
+          }
+          else if(camerasFound())
           {
             // loop over cameras and spawn threads
             for(int i=0;i<GSession.Count;i++)
@@ -577,7 +1849,7 @@ int main(int argc, char* argv[])
           printf("Number of output files must match the number of cameras specified.\n");
       }
       else
-        printf("At least one camera UID must be specified using -u\n");
+        printf("At least one camera UID must be specified using -u (or a session file, -c)\n");
     }
     else
       printf("Prosilica API failed to initialize.\n");
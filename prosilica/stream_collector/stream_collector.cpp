@@ -0,0 +1,334 @@
+/* Receives recordings streamed by snap_image -s and writes them to disk.
+ *
+ * One epoll loop serves every connection. A connection first sends a
+ * tStreamHello with the file name, then the recording itself, which is
+ * moved from the socket through a pipe into the file with splice, so the
+ * data never passes through user space. Where splice is refused the data is
+ * copied through a buffer instead. A stream ends when its sender closes.
+ */
+
+// includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <vector>
+#include <stream.h>
+
+#define MAX_EVENTS   64
+#define SPLICE_BYTES (1<<20) // moved per wakeup and pipe size asked for
+
+// one incoming stream
+typedef struct
+{
+  int      fd;
+  int      file;
+  int      pipe[2];
+  bool     splice;   // false once splice was refused
+  uint8_t  hello[STREAM_HELLO_SIZE+STREAM_NAME_MAX];
+  uint32_t helloGot;
+  uint32_t helloNeed;
+  char     name[STREAM_NAME_MAX+1];
+  char     peer[64];
+  uint64_t bytes;
+  double   start;
+} tConnection;
+
+// collector state
+typedef struct
+{
+  int          epoll;
+  int          listener;
+  const char*  directory;
+  unsigned int open;      // connections open
+  unsigned int finished;  // streams closed so far
+  unsigned int failed;
+  std::vector<uint8_t>* buffer; // for copying when splice is refused
+} tCollector;
+
+volatile sig_atomic_t stopRequested = 0;
+
+// usage
+void ShowUsage()
+{
+  printf("usage: stream_collector -p port [-d directory] [-a address] [-n streams]\n");
+  printf("-d\tdirectory the recordings are written to (default .)\n");
+  printf("-a\taddress to listen on (default all)\n");
+  printf("-n\texit after this many streams have ended (default: run until interrupted)\n");
+}
+
+// stop on ctrl-c
+void StopHandler(int Signal)
+{
+  stopRequested = 1;
+}
+
+// finish a stream and report it
+void CloseConnection(tCollector& C,tConnection* Conn,bool Ok)
+{
+  epoll_ctl(C.epoll,EPOLL_CTL_DEL,Conn->fd,NULL);
+  close(Conn->fd);
+  if(Conn->pipe[0]>=0)
+  {
+    close(Conn->pipe[0]);
+    close(Conn->pipe[1]);
+  }
+  if(Conn->file>=0)
+    Ok = (close(Conn->file)==0) && Ok;
+
+  double seconds = StreamNow()-Conn->start;
+  if(Ok)
+    printf("%s: %llu bytes from %s in %.1f s (%.1f MB/s)\n",Conn->name[0] ? Conn->name : "(no name)",
+           (unsigned long long)Conn->bytes,Conn->peer,seconds,seconds>0 ? Conn->bytes/1e6/seconds : 0.0);
+  else
+  {
+    printf("\n*** Warning ***\nStream %s from %s failed after %llu bytes.\n\n",
+           Conn->name[0] ? Conn->name : "(no name)",Conn->peer,(unsigned long long)Conn->bytes);
+    C.failed++;
+  }
+  C.open--;
+  C.finished++;
+  delete Conn;
+}
+
+// accept a new stream
+void Accept(tCollector& C)
+{
+  struct sockaddr_storage address;
+  socklen_t length = sizeof(address);
+  int fd = accept(C.listener,(struct sockaddr*)&address,&length);
+  if(fd<0)
+    return;
+  fcntl(fd,F_SETFL,fcntl(fd,F_GETFL) | O_NONBLOCK);
+
+  tConnection* Conn = new tConnection;
+  memset(Conn,0,sizeof(tConnection));
+  Conn->fd = fd;
+  Conn->file = -1;
+  Conn->pipe[0] = Conn->pipe[1] = -1;
+  Conn->splice = true;
+  Conn->helloNeed = STREAM_HELLO_SIZE;
+  Conn->start = StreamNow();
+  char host[INET6_ADDRSTRLEN] = "?";
+  if(address.ss_family==AF_INET)
+  {
+    struct sockaddr_in* a = (struct sockaddr_in*)&address;
+    inet_ntop(AF_INET,&a->sin_addr,host,sizeof(host));
+    snprintf(Conn->peer,sizeof(Conn->peer),"%s:%u",host,ntohs(a->sin_port));
+  }
+  else
+    snprintf(Conn->peer,sizeof(Conn->peer),"%s",host);
+
+  struct epoll_event event;
+  event.events = EPOLLIN;
+  event.data.ptr = Conn;
+  epoll_ctl(C.epoll,EPOLL_CTL_ADD,fd,&event);
+  C.open++;
+}
+
+// read the hello and open the output file; false if the stream must be dropped
+bool ReadHello(tCollector& C,tConnection* Conn,bool& Closed)
+{
+  ssize_t n = recv(Conn->fd,Conn->hello+Conn->helloGot,Conn->helloNeed-Conn->helloGot,0);
+  Closed = n==0;
+  if(n<=0)
+    return n<0 && (errno==EAGAIN || errno==EINTR);
+  Conn->helloGot += n;
+  if(Conn->helloGot<Conn->helloNeed)
+    return true;
+
+  tStreamHello hello;
+  memcpy(&hello,Conn->hello,STREAM_HELLO_SIZE);
+  if(memcmp(hello.magic,STREAM_MAGIC,sizeof(STREAM_MAGIC))!=0 || hello.nameLength==0 ||
+     hello.nameLength>STREAM_NAME_MAX)
+    return false;
+  if(Conn->helloNeed==STREAM_HELLO_SIZE)
+  {
+    Conn->helloNeed += hello.nameLength;
+    return true;
+  }
+
+  // only a plain name inside the directory
+  memcpy(Conn->name,Conn->hello+STREAM_HELLO_SIZE,hello.nameLength);
+  Conn->name[hello.nameLength] = 0;
+  if(strchr(Conn->name,'/') || strcmp(Conn->name,".")==0 || strcmp(Conn->name,"..")==0 ||
+     strlen(Conn->name)!=hello.nameLength)
+    return false;
+
+  char path[4096];
+  snprintf(path,sizeof(path),"%s/%s",C.directory,Conn->name);
+  Conn->file = open(path,O_WRONLY|O_CREAT|O_TRUNC,0644);
+  if(Conn->file<0)
+  {
+    printf("failed to create %s\n",path);
+    return false;
+  }
+  if(pipe(Conn->pipe)!=0)
+  {
+    Conn->pipe[0] = Conn->pipe[1] = -1;
+    Conn->splice = false;
+  }
+#ifdef F_SETPIPE_SZ
+  else
+    fcntl(Conn->pipe[1],F_SETPIPE_SZ,SPLICE_BYTES);
+#endif
+  Conn->start = StreamNow();
+  printf("%s: receiving from %s\n",Conn->name,Conn->peer);
+  return true;
+}
+
+// move what has arrived into the file; false on error
+bool ReadData(tCollector& C,tConnection* Conn,bool& Closed)
+{
+  Closed = false;
+  if(Conn->splice)
+  {
+    ssize_t n = splice(Conn->fd,NULL,Conn->pipe[1],NULL,SPLICE_BYTES,SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+    if(n==0)
+    {
+      Closed = true;
+      return true;
+    }
+    if(n<0 && (errno==EAGAIN || errno==EINTR))
+      return true;
+    if(n<0 && errno==EINVAL)
+      Conn->splice = false; // not for this socket or file system: copy instead
+    else if(n<0)
+      return false;
+    else
+    {
+      Conn->bytes += n;
+      while(n>0)
+      {
+        ssize_t m = splice(Conn->pipe[0],NULL,Conn->file,NULL,n,SPLICE_F_MOVE);
+        if(m<=0)
+          return false;
+        n -= m;
+      }
+      return true;
+    }
+  }
+
+  std::vector<uint8_t>& buffer = *C.buffer;
+  ssize_t n = recv(Conn->fd,&buffer[0],buffer.size(),0);
+  if(n==0)
+  {
+    Closed = true;
+    return true;
+  }
+  if(n<0)
+    return errno==EAGAIN || errno==EINTR;
+  Conn->bytes += n;
+  for(ssize_t done=0;done<n;)
+  {
+    ssize_t m = write(Conn->file,&buffer[done],n-done);
+    if(m<=0)
+      return false;
+    done += m;
+  }
+  return true;
+}
+
+// main
+int main(int argc, char* argv[])
+{
+  int c;
+  int port = 0;
+  const char* address = NULL;
+  unsigned int streams = 0;
+  tCollector C;
+
+  memset(&C,0,sizeof(C));
+  C.directory = ".";
+  while ((c = getopt (argc, argv, "p:d:a:n:")) != -1)
+  {
+    switch(c)
+    {
+      case 'p':
+        port = atoi(optarg);
+        break;
+      case 'd':
+        C.directory = optarg;
+        break;
+      case 'a':
+        address = optarg;
+        break;
+      case 'n':
+        streams = atoi(optarg);
+        break;
+    }
+  }
+
+  if(port<=0 || port>65535)
+  {
+    ShowUsage();
+    return 1;
+  }
+
+  // listen
+  struct sockaddr_in listenAddress;
+  memset(&listenAddress,0,sizeof(listenAddress));
+  listenAddress.sin_family = AF_INET;
+  listenAddress.sin_port = htons(port);
+  listenAddress.sin_addr.s_addr = htonl(INADDR_ANY);
+  if(address && inet_pton(AF_INET,address,&listenAddress.sin_addr)!=1)
+  {
+    printf("bad listen address %s\n",address);
+    return 1;
+  }
+  int one = 1;
+  C.listener = socket(AF_INET,SOCK_STREAM,0);
+  setsockopt(C.listener,SOL_SOCKET,SO_REUSEADDR,&one,sizeof(one));
+  if(C.listener<0 || bind(C.listener,(struct sockaddr*)&listenAddress,sizeof(listenAddress))!=0 ||
+     listen(C.listener,16)!=0)
+  {
+    printf("cannot listen on port %d: %s\n",port,strerror(errno));
+    return 1;
+  }
+
+  C.epoll = epoll_create1(0);
+  struct epoll_event event;
+  event.events = EPOLLIN;
+  event.data.ptr = NULL;
+  epoll_ctl(C.epoll,EPOLL_CTL_ADD,C.listener,&event);
+  C.buffer = new std::vector<uint8_t>(SPLICE_BYTES);
+
+  signal(SIGINT,StopHandler);
+  signal(SIGTERM,StopHandler);
+  printf("collecting on port %d into %s\n",port,C.directory);
+
+  // one event loop for all streams
+  struct epoll_event events[MAX_EVENTS];
+  while(!stopRequested && (streams==0 || C.finished<streams))
+  {
+    int n = epoll_wait(C.epoll,events,MAX_EVENTS,1000);
+    for(int e=0;e<n;e++)
+    {
+      tConnection* Conn = (tConnection*)events[e].data.ptr;
+      if(!Conn)
+      {
+        Accept(C);
+        continue;
+      }
+
+      bool closed = false;
+      bool ok = Conn->helloGot<Conn->helloNeed || Conn->file<0 ? ReadHello(C,Conn,closed) : ReadData(C,Conn,closed);
+      if(!ok || closed)
+        CloseConnection(C,Conn,ok && Conn->file>=0);
+    }
+  }
+
+  if(C.open)
+    printf("\n*** Warning ***\n%u streams were still open when stopped.\n\n",C.open);
+  close(C.epoll);
+  close(C.listener);
+  delete C.buffer;
+  return C.failed ? 1 : 0;
+}
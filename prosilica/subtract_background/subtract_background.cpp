@@ -0,0 +1,309 @@
+/* Streaming temporal median background for snap_image recordings.
+ *
+ * The background of frame i is the per-pixel median of the frames in a
+ * window centred on it. Every pixel keeps its window values sorted; moving
+ * to the next frame replaces the value of the frame leaving the window with
+ * that of the frame entering it and shifts it into place, so an update costs
+ * a binary search and a short move, and the median is read off the middle.
+ * Outgoing values are read back from the mapped recording rather than kept.
+ *
+ * The image is split into bands of rows, one per thread. Each thread runs
+ * the whole recording for its band and writes its part of every output
+ * frame with pwrite, so threads never wait for each other. The output is a
+ * recording of the same geometry holding either the background-subtracted
+ * frames or (-m) the background model itself.
+ */
+
+// includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <vector>
+#include <recording.h>
+#include <workers.h>
+
+// shared state
+typedef struct
+{
+  tRecording   Rec;
+  int          fd;
+  uint32_t     window;      // frames in a full window (odd)
+  uint32_t     sampleSize;  // 1 or 2 bytes
+  uint32_t     maxValue;
+  bool         model;       // write the background instead of the difference
+  int32_t      offset;      // added to differences before clipping
+  unsigned int threads;
+  volatile uint32_t failed;  // set by any band thread, atomically
+} tFilter;
+
+// usage
+void ShowUsage()
+{
+  printf("usage: subtract_background -i recording -o output [-w window] [-m] [-b offset] [-j threads]\n");
+  printf("-w\tframes in the median window, centred on each frame (default 25)\n");
+  printf("-m\twrite the background model instead of subtracted frames\n");
+  printf("-b\tvalue added to differences before clipping at 0 (default 0)\n");
+  printf("-j\tthreads, each filtering a band of rows (default 2)\n");
+  printf(RECORDING_MAP_LIMIT);
+}
+
+// seconds since an arbitrary start
+double Now()
+{
+  struct timespec tp;
+  clock_gettime(CLOCK_MONOTONIC,&tp);
+  return tp.tv_sec + tp.tv_nsec/1e9;
+}
+
+// image of frame i in the mapping
+inline const uint8_t* Image(const tFilter& F,uint64_t i)
+{
+  return F.Rec.base + RECORDING_HEADER_SIZE + i*F.Rec.recordSize + RECORDING_STAMP_SIZE;
+}
+
+// pixel p of an image
+inline uint16_t Sample(const tFilter& F,const uint8_t* Image,uint64_t p)
+{
+  if(F.sampleSize==1)
+    return Image[p];
+  uint16_t v;
+  memcpy(&v,Image+2*p,2);
+  return v;
+}
+
+// insert V into the sorted values W[0..n)
+inline void SortedInsert(uint16_t* W,uint32_t n,uint16_t V)
+{
+  uint32_t i = n;
+  while(i>0 && W[i-1]>V)
+  {
+    W[i] = W[i-1];
+    i--;
+  }
+  W[i] = V;
+}
+
+// replace Old by New in the sorted values W[0..n)
+inline void SortedReplace(uint16_t* W,uint32_t n,uint16_t Old,uint16_t New)
+{
+  // binary search for Old
+  uint32_t lo = 0, hi = n;
+  while(lo<hi)
+  {
+    uint32_t mid = (lo+hi)/2;
+    if(W[mid]<Old)
+      lo = mid+1;
+    else
+      hi = mid;
+  }
+
+  // move New up or down into place
+  uint32_t i = lo;
+  while(i+1<n && W[i+1]<New)
+  {
+    W[i] = W[i+1];
+    i++;
+  }
+  while(i>0 && W[i-1]>New)
+  {
+    W[i] = W[i-1];
+    i--;
+  }
+  W[i] = New;
+}
+
+// remove Old from the sorted values W[0..n)
+inline void SortedRemove(uint16_t* W,uint32_t n,uint16_t Old)
+{
+  uint32_t i = 0;
+  while(W[i]!=Old)
+    i++;
+  memmove(W+i,W+i+1,(n-i-1)*sizeof(uint16_t));
+}
+
+// filter the rows of band Index through the whole recording
+void FilterBand(void* Arg,unsigned int Index)
+{
+  tFilter& F = *(tFilter*)Arg;
+  uint32_t width = F.Rec.header.width, height = F.Rec.header.height;
+  uint32_t y0 = (uint64_t)height*Index/F.threads, y1 = (uint64_t)height*(Index+1)/F.threads;
+  uint64_t p0 = (uint64_t)y0*width, pixels = (uint64_t)(y1-y0)*width;
+  uint64_t count = F.Rec.count;
+  uint32_t half = F.window/2;
+  if(pixels==0)
+    return;
+
+  // sorted window per pixel, and how many values it holds
+  std::vector<uint16_t> windows(pixels*F.window);
+  std::vector<uint8_t> out(pixels*F.sampleSize);
+  uint32_t n = 0;
+
+  // frames 0..half-1 enter before the first output
+  for(uint64_t j=0;j<half && j<count;j++,n++)
+  {
+    const uint8_t* image = Image(F,j);
+    for(uint64_t p=0;p<pixels;p++)
+      SortedInsert(&windows[p*F.window],n,Sample(F,image,p0+p));
+  }
+
+  for(uint64_t i=0;i<count && !__sync_fetch_and_or(&F.failed,0);i++)
+  {
+    // frame i+half enters; frame i-half-1 leaves once the window is full
+    uint64_t in = i+half;
+    bool entering = in<count;
+    bool leaving = i>half;
+    const uint8_t* newer = entering ? Image(F,in) : NULL;
+    const uint8_t* older = leaving ? Image(F,i-half-1) : NULL;
+    for(uint64_t p=0;p<pixels;p++)
+    {
+      uint16_t* w = &windows[p*F.window];
+      if(entering && leaving)
+        SortedReplace(w,n,Sample(F,older,p0+p),Sample(F,newer,p0+p));
+      else if(entering)
+        SortedInsert(w,n,Sample(F,newer,p0+p));
+      else if(leaving)
+        SortedRemove(w,n,Sample(F,older,p0+p));
+    }
+    if(entering && !leaving)
+      n++;
+    if(leaving && !entering)
+      n--;
+
+    // median (the lower one for an even count near the ends)
+    const uint8_t* image = Image(F,i);
+    for(uint64_t p=0;p<pixels;p++)
+    {
+      int32_t v = windows[p*F.window + (n-1)/2];
+      if(!F.model)
+      {
+        v = Sample(F,image,p0+p) - v + F.offset;
+        v = v<0 ? 0 : v>(int32_t)F.maxValue ? F.maxValue : v;
+      }
+      if(F.sampleSize==1)
+        out[p] = v;
+      else
+      {
+        uint16_t s = v;
+        memcpy(&out[2*p],&s,2);
+      }
+    }
+
+    // this band of output frame i (band 0 also writes the time block)
+    off_t record = RECORDING_HEADER_SIZE + (off_t)i*F.Rec.recordSize;
+    off_t offset = record + RECORDING_STAMP_SIZE + (off_t)p0*F.sampleSize;
+    if(pwrite(F.fd,&out[0],out.size(),offset)!=(ssize_t)out.size())
+      __sync_fetch_and_or(&F.failed,1);
+    if(Index==0 && pwrite(F.fd,image-RECORDING_STAMP_SIZE,RECORDING_STAMP_SIZE,record)!=RECORDING_STAMP_SIZE)
+      __sync_fetch_and_or(&F.failed,1);
+  }
+}
+
+// main
+int main(int argc, char* argv[])
+{
+  int c;
+  const char* input = NULL;
+  const char* output = NULL;
+  tFilter F;
+
+  F.window = 25;
+  F.model = false;
+  F.offset = 0;
+  F.threads = 2;
+
+  while ((c = getopt (argc, argv, "i:o:w:mb:j:")) != -1)
+  {
+    switch(c)
+    {
+      case 'i':
+        input = optarg;
+        break;
+      case 'o':
+        output = optarg;
+        break;
+      case 'w':
+        F.window = atoi(optarg);
+        break;
+      case 'm':
+        F.model = true;
+        break;
+      case 'b':
+        F.offset = atoi(optarg);
+        break;
+      case 'j':
+        F.threads = atoi(optarg);
+        break;
+    }
+  }
+
+  if(!input || !output)
+  {
+    ShowUsage();
+    return 1;
+  }
+  if(F.window<1 || F.window>1023)
+  {
+    printf("window must be 1-1023 frames\n");
+    return 1;
+  }
+  F.window |= 1;
+  if(F.threads==0)
+    F.threads = 1;
+
+  if(!RecordingOpen(F.Rec,input,eAccessSequential))
+  {
+    printf("%s\n",F.Rec.error);
+    return 1;
+  }
+
+  // per sensor pixel, so raw Bayer frames are filtered like grey ones
+  const char* format = F.Rec.header.pixelFormat;
+  if(strcmp(format,"Mono8")==0 || strcmp(format,"Bayer8")==0)
+    F.sampleSize = 1;
+  else if(strcmp(format,"Mono16")==0 || strcmp(format,"Bayer16")==0)
+    F.sampleSize = 2;
+  else
+  {
+    printf("pixel format %s is not supported\n",format);
+    RecordingClose(F.Rec);
+    return 1;
+  }
+  F.maxValue = F.sampleSize==1 ? 0xff : 0xffff;
+
+  // every band needs a row; band 0 writes the time blocks
+  if(F.threads>F.Rec.header.height)
+    F.threads = F.Rec.header.height ? F.Rec.header.height : 1;
+
+  // same header and trailer as the input, frames filled in by the bands
+  F.fd = open(output,O_WRONLY|O_CREAT|O_TRUNC,0644);
+  uint64_t size = RECORDING_HEADER_SIZE + F.Rec.count*F.Rec.recordSize;
+  uint32_t dropped = F.Rec.framesDropped;
+  if(F.fd<0 || posix_fallocate(F.fd,0,size)!=0 ||
+     pwrite(F.fd,&F.Rec.header,RECORDING_HEADER_SIZE,0)!=RECORDING_HEADER_SIZE)
+  {
+    printf("failed to create %s\n",output);
+    if(F.fd>=0)
+      close(F.fd);
+    RecordingClose(F.Rec);
+    return 1;
+  }
+
+  F.failed = 0;
+  double start = Now();
+  RunParallel(F.threads,FilterBand,&F);
+  double seconds = Now()-start;
+
+  bool ok = !F.failed && pwrite(F.fd,&dropped,RECORDING_TRAILER_SIZE,size)==RECORDING_TRAILER_SIZE;
+  ok = (close(F.fd)==0) && ok;
+  if(ok)
+    printf("%llu frames in %.2f s (%.1f frames/s), window %u, %s written to %s\n",
+           (unsigned long long)F.Rec.count,seconds,F.Rec.count/seconds,F.window,
+           F.model ? "background" : "subtracted frames",output);
+  else
+    printf("failed to write %s\n",output);
+
+  RecordingClose(F.Rec);
+  return ok ? 0 : 1;
+}
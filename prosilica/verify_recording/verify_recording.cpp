@@ -0,0 +1,191 @@
+/* Checks every frame of snap_image recordings against the CRC32C stored in
+ * the footer and lists the frames that no longer match.
+ *
+ * Threads take batches of frames from a shared counter, so the file is read
+ * front to back as a whole even though batches are checked in parallel, and
+ * each thread asks the kernel for the batch after its own before it starts
+ * so the disk is kept busy while checksums are computed. The CRC itself runs
+ * on the ARMv8 or SSE4.2 instructions where the build targets them.
+ */
+
+// includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <vector>
+#include <algorithm>
+#include <recording.h>
+#include <crc32c.h>
+#include <workers.h>
+
+#define BATCH_BYTES (8ull<<20) // frames handed out at a time, at least one
+
+// shared state for one recording
+typedef struct
+{
+  tRecording   Rec;
+  uint64_t     checked;      // frames that have a footer entry
+  uint64_t     batch;        // frames per batch
+  uint64_t     next;         // next batch to hand out
+  unsigned int threads;
+  std::vector<std::vector<uint64_t> > damaged; // per thread
+} tVerify;
+
+// usage
+void ShowUsage()
+{
+  printf("usage: verify_recording -i recording [-i recording ...] [-j threads]\n");
+  printf("-j\tthreads computing checksums (default 2)\n");
+  printf("exit status is 0 if all frames match, 2 if any are damaged, 1 on other errors\n");
+  printf(RECORDING_MAP_LIMIT);
+}
+
+// seconds since an arbitrary start
+double Now()
+{
+  struct timespec tp;
+  clock_gettime(CLOCK_MONOTONIC,&tp);
+  return tp.tv_sec + tp.tv_nsec/1e9;
+}
+
+// check batches until none are left
+void VerifyBatches(void* Arg,unsigned int Index)
+{
+  tVerify& V = *(tVerify*)Arg;
+  std::vector<uint64_t>& damaged = V.damaged[Index];
+
+  while(true)
+  {
+    uint64_t b = __sync_fetch_and_add(&V.next,1);
+    uint64_t first = b*V.batch;
+    if(first>=V.checked)
+      break;
+    uint64_t last = std::min(first+V.batch,V.checked);
+
+    // start reading ahead of the batch the next thread will take
+    RecordingPrefetch(V.Rec,first,2*V.batch);
+
+    for(uint64_t i=first;i<last;i++)
+    {
+      tFrameInfo info;
+      RecordingFrameInfo(V.Rec,i,info);
+      const uint8_t* record = V.Rec.base + RECORDING_HEADER_SIZE + i*V.Rec.recordSize;
+      if(Crc32c(0,record,V.Rec.recordSize)!=info.crc)
+        damaged.push_back(i);
+    }
+  }
+}
+
+// print damaged frames as runs, with the host time of the first of each
+void PrintDamaged(const tVerify& V,const std::vector<uint64_t>& Damaged)
+{
+  for(size_t i=0;i<Damaged.size();)
+  {
+    size_t j = i;
+    while(j+1<Damaged.size() && Damaged[j+1]==Damaged[j]+1)
+      j++;
+
+    // the stamp itself may be damaged, so it is only a hint
+    tFrameStamp stamp = RecordingStamp(V.Rec,Damaged[i]);
+    if(i==j)
+      printf("  frame %llu damaged (host time %u.%09u)\n",(unsigned long long)Damaged[i],
+             stamp.hostSecond,stamp.hostnSecond);
+    else
+      printf("  frames %llu-%llu damaged (host time %u.%09u)\n",(unsigned long long)Damaged[i],
+             (unsigned long long)Damaged[j],stamp.hostSecond,stamp.hostnSecond);
+    i = j+1;
+  }
+}
+
+// verify one recording; returns the exit status for it
+int VerifyRecording(const char* Path,unsigned int Threads)
+{
+  tVerify V;
+
+  if(!RecordingOpen(V.Rec,Path,eAccessSequential))
+  {
+    printf("%s: %s\n",Path,V.Rec.error);
+    return 1;
+  }
+  if(!V.Rec.info)
+  {
+    printf("%s: no checksums (%s)\n",Path,
+           V.Rec.complete ? "written before checksums were added" : "capture did not finish");
+    RecordingClose(V.Rec);
+    return 1;
+  }
+
+  V.checked = std::min(V.Rec.count,V.Rec.infoCount);
+  V.batch = std::max<uint64_t>(1,BATCH_BYTES/V.Rec.recordSize);
+  V.next = 0;
+  V.threads = Threads;
+  V.damaged.resize(Threads);
+
+  double start = Now();
+  RunParallel(Threads,VerifyBatches,&V);
+  double seconds = Now()-start;
+
+  std::vector<uint64_t> damaged;
+  for(unsigned int t=0;t<Threads;t++)
+    damaged.insert(damaged.end(),V.damaged[t].begin(),V.damaged[t].end());
+  std::sort(damaged.begin(),damaged.end());
+
+  double megabytes = V.checked*V.Rec.recordSize/1e6;
+  printf("%s: %llu frames checked in %.2f s (%.1f MB/s), %llu damaged\n",Path,
+         (unsigned long long)V.checked,seconds,seconds>0 ? megabytes/seconds : 0.0,
+         (unsigned long long)damaged.size());
+  PrintDamaged(V,damaged);
+
+  // entries and frames should pair up one to one
+  int status = damaged.empty() ? 0 : 2;
+  if(V.Rec.count>V.Rec.infoCount)
+  {
+    printf("  %llu frames have no checksum\n",(unsigned long long)(V.Rec.count-V.Rec.infoCount));
+    status = 2;
+  }
+  if(V.Rec.infoCount>V.Rec.count)
+  {
+    printf("  %llu frames are missing\n",(unsigned long long)(V.Rec.infoCount-V.Rec.count));
+    status = 2;
+  }
+
+  RecordingClose(V.Rec);
+  return status;
+}
+
+// main
+int main(int argc, char* argv[])
+{
+  int c;
+  std::vector<const char*> inputs;
+  unsigned int threads = 2;
+
+  while ((c = getopt (argc, argv, "i:j:")) != -1)
+  {
+    switch(c)
+    {
+      case 'i':
+        inputs.push_back(optarg);
+        break;
+      case 'j':
+        threads = atoi(optarg);
+        break;
+    }
+  }
+
+  if(inputs.empty())
+  {
+    ShowUsage();
+    return 1;
+  }
+  if(threads==0)
+    threads = 1;
+
+  // worst status over all recordings
+  int status = 0;
+  for(size_t i=0;i<inputs.size();i++)
+    status = std::max(status,VerifyRecording(inputs[i],threads));
+  return status;
+}